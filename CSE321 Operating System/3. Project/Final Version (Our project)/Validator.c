@@ -1,51 +1,28 @@
 // validator_public.c — minimal MiniVSFS checks
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread Validator.c bitmap.c crc32.c dir_index.c fsck.c image.c inode_map.c compress.c lz.c dedup.c sha256.c journal.c bcache.c ioq.c -o validator
+// Usage: ./validator [--full [--threads N]] out.img
 #define _FILE_OFFSET_BITS 64
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
-#define BS 4096u
-#define INODE_SIZE 128u
-#define ROOT_INO 1u
+#include "crc32.h"
+#include "dedup.h"
+#include "dir_index.h"
+#include "fsck.h"
+#include "image.h"
+#include "inode_map.h"
+#include "journal.h"
+#include "minivsfs.h"
 
 // ---- CRC32 ----
-static uint32_t T[256];
-static void crc32_init(void){
-  for (uint32_t i=0;i<256;i++){ uint32_t c=i; for(int j=0;j<8;j++) c = (c&1)?(0xEDB88320u^(c>>1)):(c>>1); T[i]=c; }
-}
-static uint32_t crc32(const void* buf, size_t n){
-  const uint8_t* p = (const uint8_t*)buf; uint32_t c=0xFFFFFFFFu;
-  for(size_t i=0;i<n;i++) c = T[(c^p[i])&0xFF] ^ (c>>8);
-  return c ^ 0xFFFFFFFFu;
-}
+// crc32_init()/crc32() come from the shared engine in crc32.c
 
 // ---- On-disk structs ----
-#pragma pack(push,1)
-typedef struct {
-  uint32_t magic, version, block_size;
-  uint64_t total_blocks, inode_count;
-  uint64_t ibm_start, ibm_blocks;
-  uint64_t dbm_start, dbm_blocks;
-  uint64_t itbl_start, itbl_blocks;
-  uint64_t data_start, data_blocks;
-  uint64_t root_inode, mtime_epoch;
-  uint32_t flags, checksum;
-} superblock_t;
-
-typedef struct {
-  uint16_t mode, links; uint32_t uid, gid;
-  uint64_t size_bytes, atime, mtime, ctime;
-  uint32_t direct[12]; uint32_t indirect1;
-  uint32_t r0, r1, proj_id, uid16_gid16;
-  uint64_t xattr_ptr, inode_crc;
-} inode_t;
-
-typedef struct {
-  uint32_t ino; uint8_t type; char name[58]; uint8_t checksum;
-} dirent64_t;
-#pragma pack(pop)
+// superblock_t, inode_t and dirent64_t come from minivsfs.h
 
 static void die(const char* msg){ fprintf(stderr,"[FAIL] %s\n", msg); }
 static void ok(const char* msg){  fprintf(stdout,"[ OK ] %s\n", msg); }
@@ -54,14 +31,54 @@ static uint8_t dirent_checksum(const dirent64_t* de){
   const uint8_t* p=(const uint8_t*)de; uint8_t x=0; for(int i=0;i<63;i++) x^=p[i]; return x;
 }
 
+// a data block pointer is good if it is inside the data region and its bitmap bit is set
+static int block_ok(const superblock_t* sb, const uint8_t* dbm, uint32_t blk){
+  if(blk < sb->data_region_start || blk >= sb->data_region_start + sb->data_region_blocks) return 0;
+  uint64_t rel = blk - sb->data_region_start;
+  return (dbm[rel>>3] >> (rel & 7)) & 1;
+}
+
+// resolve a file's direct, indirect1 and indirect2 pointers (or its extents) and check every block;
+// returns the number of bad pointers, or -1 if the map could not be read
+static int64_t check_file_map(const image_t* img, const superblock_t* sb, const uint8_t* dbm, const inode_t* ino){
+  // an inline file has no blocks: its data is in the inode
+  if(ino->flags & INODE_FL_INLINE) return ino->size_bytes > 0 && ino->size_bytes <= INLINE_MAX ? 0 : -1;
+  uint64_t n = map_file_blocks(ino->size_bytes);
+  uint64_t m = map_is_extents(ino) ? 0 : map_meta_blocks(n); // extent-mapped inodes have no pointer blocks
+  if(m == UINT64_MAX) return -1;
+  // pointer blocks must be valid before map_read follows them
+  if(m >= 1 && !block_ok(sb, dbm, ino->indirect1)) return -1;
+  if(m >= 2 && !block_ok(sb, dbm, ino->indirect2)) return -1;
+  uint32_t* data = malloc((n ? n : 1) * sizeof(uint32_t));
+  uint32_t* meta = malloc((m ? m : 1) * sizeof(uint32_t));
+  int64_t bad = -1;
+  if(data && meta && map_read(img, ino, n, data, meta) == (int64_t)m){
+    bad = 0;
+    for(uint64_t i=0;i<m;i++) if(!block_ok(sb, dbm, meta[i])) bad++;
+    // holes (0 pointers, extents starting at 0) are fine in an inode flagged sparse
+    for(uint64_t i=0;i<n;i++) if(!(data[i]==0 && (ino->flags & INODE_FL_SPARSE)) && !block_ok(sb, dbm, data[i])) bad++;
+  }
+  free(data); free(meta);
+  return bad;
+}
+
 int main(int argc, char** argv){
-  if(argc!=2){ fprintf(stderr,"Usage: %s out.img\n", argv[0]); return 2; }
-  FILE* f=fopen(argv[1],"rb"); if(!f) die("open image");
+  // --full: check every inode, entry and block too (fsck.c); --threads N: workers for it (default: one per CPU)
+  int full=0, threads=0; const char* path=NULL;
+  for(int i=1;i<argc;i++){
+    if(strcmp(argv[i],"--full")==0) full=1;
+    else if(strcmp(argv[i],"--threads")==0 && i+1<argc) threads=atoi(argv[++i]);
+    else if(!path) path=argv[i];
+    else path=NULL, i=argc;
+  }
+  if(!path){ fprintf(stderr,"Usage: %s [--full [--threads N]] out.img\n", argv[0]); return 2; }
+  // the image is mapped read-only once; every structure below is a view into it
+  image_t img; if(image_open(&img, path, 0)!=0){ die("open image"); return 1; }
 
   crc32_init();
 
   // read superblock
-  uint8_t sbraw[BS]; if(fread(sbraw,1,BS,f)!=BS) die("read superblock");
+  uint8_t sbraw[BS]; memcpy(sbraw, image_block(&img, 0), BS);
   superblock_t sb; memcpy(&sb, sbraw, sizeof sb);
 
   // basic fields
@@ -79,17 +96,33 @@ int main(int argc, char** argv){
 
   // region sanity
   uint64_t tb = sb.total_blocks;
-  if(!(sb.ibm_start==1)) die("ibm start");
-  if(sb.itbl_start >= tb || sb.data_start >= tb) die("region bounds");
-  if(sb.ibm_start + sb.ibm_blocks > sb.dbm_start) die("region overlap 1");
-  if(sb.dbm_start + sb.dbm_blocks > sb.itbl_start) die("region overlap 2");
-  if(sb.itbl_start + sb.itbl_blocks > sb.data_start) die("region overlap 3");
-  if(sb.data_start + sb.data_blocks > tb) die("data region overflow");
+  if(!(sb.inode_bitmap_start==1)) die("ibm start");
+  if(sb.inode_table_start >= tb || sb.data_region_start >= tb) die("region bounds");
+  if(sb.inode_bitmap_start + sb.inode_bitmap_blocks > sb.data_bitmap_start) die("region overlap 1");
+  if(sb.data_bitmap_start + sb.data_bitmap_blocks > sb.inode_table_start) die("region overlap 2");
+  if(sb.inode_table_start + sb.inode_table_blocks > sb.data_region_start) die("region overlap 3");
+  if(sb.data_region_start + sb.data_region_blocks > tb) die("data region overflow");
+  if(sb.total_blocks > img.nblocks) die("image shorter than total_blocks");
   ok("region layout");
+  if(image_check_layout(&img)!=0){ die("layout does not fit the image"); image_close(&img); return 1; }
+
+  // optional metadata journal, between the inode table and the data region
+  if(sb.flags & SB_FL_JOURNAL){
+    const superblock_ext_t* ext = SB_EXT(sbraw);
+    int64_t pending = journal_pending(&img);
+    printf("[INFO] journal: blocks %llu..%llu\n", (unsigned long long)ext->journal_start,
+      (unsigned long long)(ext->journal_start + ext->journal_blocks - 1));
+    if(pending < 0) die("journal header");
+    else {
+      // committed but maybe not written home yet: the next mkfs_adder run replays them
+      if(pending > 0) printf("[INFO] journal: %lld committed transaction(s) pending replay\n", (long long)pending);
+      ok("journal header");
+    }
+  }
 
   // read inode #1 (root)
-  if(fseek(f, (__off_t)(sb.itbl_start*BS + (ROOT_INO-1)*INODE_SIZE), SEEK_SET)!=0) die("seek itbl");
-  inode_t root; if(fread(&root,1,sizeof root,f)!=sizeof root) die("read root inode");
+  inode_t root; memset(&root,0,sizeof root);
+  if(image_inode(&img, ROOT_INO)) root = *image_inode(&img, ROOT_INO); else die("read root inode");
 
   // inode CRC
   uint8_t tmp[INODE_SIZE]; memcpy(tmp,&root,INODE_SIZE); memset(&tmp[120],0,8);
@@ -105,42 +138,158 @@ int main(int argc, char** argv){
 
   // read root dir block
   uint32_t rblk = root.direct[0];
-  if(rblk < sb.data_start || rblk >= sb.total_blocks) die("root block out of range");
-  if(fseek(f, (__off_t)rblk*BS, SEEK_SET)!=0) die("seek root block");
+  if(rblk < sb.data_region_start || rblk >= sb.total_blocks){ die("root block out of range"); image_close(&img); return 1; }
   uint32_t entries = root.size_bytes / sizeof(dirent64_t);
-  dirent64_t de[entries]; if(fread(de,1,sizeof de,f)!=sizeof de) die("read dir entries");
+  if(entries > DIRENTS_PER_BLOCK) entries = DIRENTS_PER_BLOCK;
+  if(entries < 2){ die("read dir entries"); image_close(&img); return 1; }
+  const dirent64_t* de = image_dirents(&img, rblk);
 
   // check "." entry
-  if(de[0].ino != ROOT_INO || de[0].type != 2 || strcmp(de[0].name,".")!=0) die("bad '.'");
+  if(de[0].inode_no != ROOT_INO || de[0].type != 2 || strcmp(de[0].name,".")!=0) die("bad '.'");
   if(de[0].checksum != dirent_checksum(&de[0])) die("bad '.' checksum");
 
   // check ".." entry
-  if(de[1].ino != ROOT_INO || de[1].type != 2 || strcmp(de[1].name,"..")!=0) die("bad '..'");
+  if(de[1].inode_no != ROOT_INO || de[1].type != 2 || strcmp(de[1].name,"..")!=0) die("bad '..'");
   if(de[1].checksum != dirent_checksum(&de[1])) die("bad '..' checksum");
   ok("root directory has '.' and '..'");
   
-  // check other entries
-  for(int i = 2; i < entries; i++) {
-    printf("[INFO] entry found. name: %s\n", de[i].name);
+  // check other entries (packed up to DIRENTS_PER_BLOCK per block; inode_no 0 = free slot)
+  for(int d = 0; d < DIRECT_MAX; d++) {
+    const dirent64_t* blk = root.direct[d] ? image_dirents(&img, root.direct[d]) : NULL;
+    for(size_t i = (d == 0 ? 2 : 0); blk && i < DIRENTS_PER_BLOCK; i++) {
+      if(blk[i].inode_no == 0) continue;
+      if(blk[i].checksum != dirent_checksum(&blk[i])) die("bad entry checksum");
+      printf("[INFO] entry found. name: %s\n", blk[i].name);
+    }
   }
 
   // spot-check bitmaps reflect allocations:
   // - inode bitmap bit 0 (inode #1) should be set
-  if(fseek(f, (__off_t)sb.ibm_start*BS, SEEK_SET)!=0) die("seek ibm");
-  uint8_t ib[1]; if(fread(ib,1,1,f)!=1) die("read ibm byte");
+  const uint8_t* ib = image_inode_bitmap(&img);
   if( (ib[0] & 0x01) == 0 ) die("inode #1 bit not set");
   ok("inode bitmap marks inode #1");
 
   // - data bitmap bit for root_data_rel should be set
-  uint64_t root_rel = (uint64_t)rblk - sb.data_start;
-  if(fseek(f, (__off_t)sb.dbm_start*BS + (root_rel>>3), SEEK_SET)!=0) die("seek dbm");
-  uint8_t db; if(fread(&db,1,1,f)!=1) die("read dbm byte");
+  uint64_t root_rel = (uint64_t)rblk - sb.data_region_start;
+  const uint8_t* dbm = image_data_bitmap(&img);
+  uint8_t db = dbm[root_rel>>3];
   if( (db & (1u << (root_rel & 7))) == 0 ) die("root data block not marked allocated");
   ok("data bitmap marks root data block");
 
+  // every regular file in the tree: block map (direct + indirect) in range and allocated.
+  // directories are walked from the root, each one once (seen[]), whatever its entries say
+  int bad_files = 0;
+  uint64_t ndirs = 0, nfiles = 0, top = 0;
+  uint32_t* stack = malloc((sb.inode_count + 1) * sizeof(uint32_t));
+  uint8_t* seen = calloc(sb.inode_count + 1, 1);
+  if(!stack || !seen){ die("out of memory for the directory walk"); bad_files++; }
+  else { stack[top++] = ROOT_INO; seen[ROOT_INO] = 1; }
+  while(top > 0){
+    const inode_t* dir = image_inode(&img, stack[--top]);
+    ndirs++;
+    for(int d=0; dir && d<DIRECT_MAX; d++){
+      if(dir->direct[d]==0) continue;
+      const dirent64_t* blk = image_dirents(&img, dir->direct[d]);
+      if(!blk){ die("read dir block"); bad_files++; continue; }
+      for(size_t i=0;i<DIRENTS_PER_BLOCK;i++){
+        if(blk[i].inode_no==0 || blk[i].inode_no > sb.inode_count) continue;
+        if(blk[i].type==2){
+          if(!seen[blk[i].inode_no]){ seen[blk[i].inode_no] = 1; stack[top++] = blk[i].inode_no; }
+          continue;
+        }
+        if(blk[i].type!=1) continue;
+        nfiles++;
+        const inode_t* ino = image_inode(&img, blk[i].inode_no);
+        if(!ino){ die("read file inode"); bad_files++; continue; }
+        int64_t bad = check_file_map(&img, &sb, dbm, ino);
+        if(bad != 0){
+          fprintf(stderr,"[FAIL] '%.58s': %s\n", blk[i].name, bad < 0 ? "unreadable block map" : "block pointer out of range or not allocated");
+          bad_files++;
+        }
+      }
+    }
+  }
+  free(stack); free(seen);
+  if(ndirs > 1) printf("[INFO] tree: %llu directories, %llu files\n", (unsigned long long)ndirs, (unsigned long long)nfiles);
+  if(bad_files==0) ok("file block maps (direct + indirect, or inline) in range and allocated");
+
+  // optional hashed index of the root directory: its blocks allocated, every entry reachable through it
+  if(root.flags & INODE_FL_DIR_INDEX){
+    const dir_index_block_t* idx = (const dir_index_block_t*)image_block(&img, root.indirect2);
+    int idx_ok = idx && idx->magic==DIR_INDEX_MAGIC && idx->nblocks>0;
+    for(uint32_t b=0; idx_ok && b<idx->nblocks; b++) if(!block_ok(&sb, dbm, root.indirect2+b)) idx_ok=0;
+    if(!idx_ok) die("root index blocks out of range or not allocated");
+    else if(dir_index_check(&img, &root)!=0) die("root index does not match directory entries");
+    else ok("root directory index matches entries");
+  }
+
+  // optional dedup table of shared data blocks: its blocks allocated, header and crc good
+  if(sb.flags & SB_FL_DEDUP){
+    const superblock_ext_t* ext = SB_EXT(sbraw);
+    const dedup_entry_t* dd; uint64_t dd_count;
+    int dd_ok = dedup_table(&img, &dd, &dd_count)==0;
+    for(uint64_t b=0; dd_ok && b<ext->dedup_blocks; b++) if(!block_ok(&sb, dbm, ext->dedup_start+b)) dd_ok=0;
+    if(!dd_ok) die("dedup table damaged or not allocated");
+    else {
+      uint64_t refs=0; for(uint64_t k=0;k<dd_count;k++) refs+=dd[k].refs;
+      printf("[INFO] dedup table: %llu blocks, %llu references\n", (unsigned long long)dd_count, (unsigned long long)refs);
+      ok("dedup table");
+    }
+  }
+
+  // optional block groups: descriptor crc good, the table and every inode slice allocated
+  if(sb.flags & SB_FL_GROUPS){
+    const superblock_ext_t* ext = SB_EXT(sbraw);
+    const group_desc_t* gd = image_groups(&img);
+    int gd_ok = gd && crc32(gd, ext->group_count*sizeof(group_desc_t))==ext->groups_crc;
+    uint64_t with_inodes=0;
+    for(uint64_t b=0; gd_ok && b<ext->groups_blocks; b++) if(!block_ok(&sb, dbm, ext->groups_start+b)) gd_ok=0;
+    for(uint64_t g=0; gd_ok && g<ext->group_count; g++){
+      if(gd[g].inode_table==0) continue;
+      with_inodes++;
+      for(uint64_t b=0; gd_ok && b<ext->inodes_per_group/INODES_PER_BLOCK; b++) if(!block_ok(&sb, dbm, gd[g].inode_table+b)) gd_ok=0;
+    }
+    if(!gd_ok) die("group descriptors damaged or not allocated");
+    else {
+      printf("[INFO] block groups: %llu, %llu inodes in each of %llu\n", (unsigned long long)ext->group_count,
+        (unsigned long long)ext->inodes_per_group, (unsigned long long)with_inodes);
+      ok("group descriptor table");
+    }
+  }
+
+  if(full){
+    struct timespec t0,t1; clock_gettime(CLOCK_MONOTONIC,&t0);
+    fsck_report_t r; int64_t problems = fsck_run(&img, threads, &r);
+    clock_gettime(CLOCK_MONOTONIC,&t1);
+    double dt = (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9;
+    if(problems < 0){ die("full check could not run"); image_close(&img); return 1; }
+    printf("[INFO] full check: %llu inodes (%llu in use: %llu files, %llu inline, %llu dirs), %llu blocks referenced, %llu holes\n",
+      (unsigned long long)r.inodes_scanned,(unsigned long long)r.inodes_used,(unsigned long long)r.files,
+      (unsigned long long)r.inline_files,(unsigned long long)r.dirs,(unsigned long long)r.blocks_claimed,(unsigned long long)r.holes);
+    if(r.shared_refs) printf("[INFO] full check: %llu references to %llu shared blocks\n",
+      (unsigned long long)r.shared_refs,(unsigned long long)r.shared_blocks);
+    if(sb.flags & SB_FL_GROUPS) printf("[INFO] full check: %llu of %llu blocks outside their inode's group\n",
+      (unsigned long long)r.far_blocks,(unsigned long long)r.blocks_claimed);
+    printf("[INFO] full check: %.3f s, %.0f inodes/s, %.1f MB/s of metadata\n",
+      dt, dt>0 ? r.inodes_scanned/dt : 0.0, dt>0 ? r.meta_bytes/dt/1e6 : 0.0);
+    if(problems){
+      fprintf(stderr,"[FAIL] full check: %lld problems: crc %llu, mode %llu, block map %llu, double alloc %llu, "
+        "used-but-free %llu, leaked %llu, dirent %llu, index %llu, dangling %llu, orphan %llu, links %llu, stray %llu, dedup %llu, groups %llu, unreachable %llu\n",
+        (long long)problems,(unsigned long long)r.bad_inode_crc,(unsigned long long)r.bad_mode,(unsigned long long)r.bad_block_map,
+        (unsigned long long)r.double_alloc,(unsigned long long)r.used_but_free,(unsigned long long)r.leaked,
+        (unsigned long long)r.bad_dirent,(unsigned long long)r.bad_dir_index,(unsigned long long)r.dangling_dirent,
+        (unsigned long long)r.orphan_inode,(unsigned long long)r.link_mismatch,(unsigned long long)r.stray_inode,
+        (unsigned long long)r.bad_dedup,(unsigned long long)r.bad_groups,(unsigned long long)r.unreachable);
+      image_close(&img);
+      return 1;
+    }
+    ok("full check: inodes, entries, block maps and bitmaps consistent");
+  }
+
   puts("[PASS] Basic MiniVSFS checks OK.");
 
   // read second inode
 
+  image_close(&img);
   return 0;
 }
@@ -0,0 +1,220 @@
+// bcache.c — LRU block buffer cache with coalesced write-back
+#define _GNU_SOURCE
+#include "bcache.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "minivsfs.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static size_t bucket(const bcache_t* c, uint64_t block) {
+    return (size_t)((block * 0x9E3779B97F4A7C15ULL) >> 32) & (c->buckets - 1);
+}
+
+static bcache_entry_t* lookup(const bcache_t* c, uint64_t block) {
+    for (bcache_entry_t* e = c->table[bucket(c, block)]; e != NULL; e = e->hnext) {
+        if (e->block == block) return e;
+    }
+    return NULL;
+}
+
+static void hash_remove(bcache_t* c, bcache_entry_t* e) {
+    bcache_entry_t** p = &c->table[bucket(c, e->block)];
+    while (*p != e) p = &(*p)->hnext;
+    *p = e->hnext;
+}
+
+static void lru_unlink(bcache_t* c, bcache_entry_t* e) {
+    if (e->prev) e->prev->next = e->next;
+    else c->head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else c->tail = e->prev;
+}
+
+static void lru_push_front(bcache_t* c, bcache_entry_t* e) {
+    e->prev = NULL;
+    e->next = c->head;
+    if (c->head) c->head->prev = e;
+    c->head = e;
+    if (c->tail == NULL) c->tail = e;
+}
+
+int bcache_init(bcache_t* c, int fd, size_t capacity) {
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->capacity = capacity ? capacity : BCACHE_DEFAULT_BLOCKS;
+    c->buckets = 16;
+    while (c->buckets < c->capacity * 2) c->buckets <<= 1;
+    c->entries = calloc(c->capacity, sizeof(bcache_entry_t));
+    c->pool = malloc(c->capacity * BS);
+    c->table = calloc(c->buckets, sizeof(bcache_entry_t*));
+    if (c->entries == NULL || c->pool == NULL || c->table == NULL) {
+        bcache_free(c);
+        return -1;
+    }
+    for (size_t i = 0; i < c->capacity; i++) c->entries[i].data = c->pool + i * BS;
+    return 0;
+}
+
+void bcache_free(bcache_t* c) {
+    free(c->entries);
+    free(c->pool);
+    free(c->table);
+    c->entries = NULL;
+    c->pool = NULL;
+    c->table = NULL;
+    c->used = 0;
+    c->head = c->tail = NULL;
+}
+
+static int cmp_entry(const void* a, const void* b) {
+    uint64_t x = (*(bcache_entry_t* const*)a)->block, y = (*(bcache_entry_t* const*)b)->block;
+    return (x > y) - (x < y);
+}
+
+static int write_run(bcache_t* c, bcache_entry_t** run, size_t n, struct iovec* iov) {
+    for (size_t i = 0; i < n; i++) {
+        iov[i].iov_base = run[i]->data;
+        iov[i].iov_len = BS;
+    }
+    c->stats.write_calls++;
+    c->stats.blocks_written += n;
+    if (c->io != NULL) return ioq_writev(c->io, iov, (int)n, run[0]->block * BS, 0);
+    ssize_t w = pwritev(c->fd, iov, (int)n, (off_t)(run[0]->block * BS));
+    if (w < 0) return -1;
+    // short write: the rest one block at a time
+    for (size_t i = (size_t)w / BS; i < n; i++) {
+        if (pwrite(c->fd, run[i]->data, BS, (off_t)(run[i]->block * BS)) != (ssize_t)BS) return -1;
+    }
+    return 0;
+}
+
+int bcache_flush(bcache_t* c) {
+    if (c->dirty == 0) return 0;
+    bcache_entry_t** list = malloc(c->dirty * sizeof(bcache_entry_t*));
+    // one iovec per block: the queued runs point into it until the wait
+    struct iovec* iov = malloc(c->dirty * sizeof(struct iovec));
+    if (list == NULL || iov == NULL) {
+        free(list);
+        free(iov);
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < c->used; i++) if (c->entries[i].dirty) list[n++] = &c->entries[i];
+    qsort(list, n, sizeof(list[0]), cmp_entry);
+
+    int rc = 0;
+    for (size_t i = 0; i < n && rc == 0;) {
+        size_t e = i + 1;
+        while (e < n && e - i < IOV_MAX && list[e]->block == list[e - 1]->block + 1) e++;
+        rc = write_run(c, list + i, e - i, iov + i);
+        i = e;
+    }
+    if (c->io != NULL && ioq_wait(c->io) != 0) rc = -1;
+    if (rc == 0) {
+        for (size_t i = 0; i < n; i++) list[i]->dirty = 0;
+        c->dirty = 0;
+    }
+    free(list);
+    free(iov);
+    return rc;
+}
+
+// Buffer for block (not in the cache yet): a free one, or the least recently used
+static bcache_entry_t* take(bcache_t* c, uint64_t block) {
+    bcache_entry_t* e;
+    if (c->used < c->capacity) {
+        e = &c->entries[c->used++];
+    } else {
+        e = c->tail;
+        // a dirty victim: write all dirty blocks now, in as few calls as possible
+        if (e->dirty && bcache_flush(c) != 0) return NULL;
+        hash_remove(c, e);
+        lru_unlink(c, e);
+    }
+    e->block = block;
+    e->dirty = 0;
+    size_t b = bucket(c, block);
+    e->hnext = c->table[b];
+    c->table[b] = e;
+    lru_push_front(c, e);
+    return e;
+}
+
+static void drop(bcache_t* c, bcache_entry_t* e) {
+    hash_remove(c, e);
+    lru_unlink(c, e);
+    if (e->dirty) c->dirty--;
+    // keep entries[0..used) packed: the last one in use moves into e's place
+    bcache_entry_t* last = &c->entries[--c->used];
+    if (last != e) {
+        uint8_t* data = e->data;
+        *e = *last;
+        e->data = last->data;
+        last->data = data;
+        bcache_entry_t** p = &c->table[bucket(c, e->block)];
+        while (*p != last) p = &(*p)->hnext;
+        *p = e;
+        if (e->prev) e->prev->next = e;
+        else c->head = e;
+        if (e->next) e->next->prev = e;
+        else c->tail = e;
+    }
+}
+
+const uint8_t* bcache_read(bcache_t* c, uint64_t block) {
+    bcache_entry_t* e = lookup(c, block);
+    if (e != NULL) {
+        c->stats.hits++;
+        lru_unlink(c, e);
+        lru_push_front(c, e);
+        return e->data;
+    }
+    c->stats.misses++;
+    e = take(c, block);
+    if (e == NULL) return NULL;
+    if (pread(c->fd, e->data, BS, (off_t)(block * BS)) != (ssize_t)BS) {
+        drop(c, e);
+        return NULL;
+    }
+    return e->data;
+}
+
+int bcache_write(bcache_t* c, uint64_t block, const void* data) {
+    c->stats.writes++;
+    bcache_entry_t* e = lookup(c, block);
+    if (e != NULL) {
+        lru_unlink(c, e);
+        lru_push_front(c, e);
+    } else if ((e = take(c, block)) == NULL) {
+        return -1;
+    }
+    if (e->dirty) c->stats.writes_saved++;
+    else c->dirty++;
+    e->dirty = 1;
+    memcpy(e->data, data, BS);
+    return 0;
+}
+
+void bcache_forget(bcache_t* c, uint64_t first, uint64_t count) {
+    if (count > c->used) {
+        // long range: walk the cache instead of the range
+        for (size_t i = 0; i < c->used;) {
+            bcache_entry_t* e = &c->entries[i];
+            if (e->block >= first && e->block - first < count) drop(c, e); // entries[i] is now another one
+            else i++;
+        }
+        return;
+    }
+    for (uint64_t b = first; b < first + count; b++) {
+        bcache_entry_t* e = lookup(c, b);
+        if (e != NULL) drop(c, e);
+    }
+}
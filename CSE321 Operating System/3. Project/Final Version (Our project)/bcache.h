@@ -0,0 +1,78 @@
+// bcache.h — LRU block buffer cache with write-back over an image file
+//
+// The tools reach the image through the mapping (image.h). This cache is for the
+// places that go through the file descriptor instead, i.e. the journal: it reads
+// back the committed copy of the bitmaps and of every block it may log at each
+// commit, and writes the committed blocks home at each checkpoint and replay.
+//
+// Blocks are cached in a fixed pool of `capacity` buffers, found through a hash
+// table and evicted least recently used first. A write only copies the block
+// into its buffer and marks it dirty; a second write before the flush replaces
+// the first (a write saved). bcache_flush() sorts the dirty blocks by block
+// number and writes each run of adjacent blocks with one pwritev(), or, given a
+// queue (ioq.h), queues all the runs and waits for them together.
+//
+// Every write to the file that bypasses the cache must bcache_forget() the
+// blocks, or later reads return the old contents.
+#ifndef MINIVSFS_BCACHE_H
+#define MINIVSFS_BCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ioq.h"
+
+#define BCACHE_DEFAULT_BLOCKS 1024   // 4 MiB
+
+typedef struct bcache_entry {
+    uint64_t block;
+    struct bcache_entry* hnext;             // hash chain
+    struct bcache_entry *prev, *next;       // LRU list, most recent first
+    int dirty;
+    uint8_t* data;
+} bcache_entry_t;
+
+typedef struct {
+    uint64_t hits, misses;
+    uint64_t writes;          // bcache_write() calls
+    uint64_t writes_saved;    // writes to a block that was already dirty
+    uint64_t write_calls;     // requests: one per run of adjacent blocks
+    uint64_t blocks_written;  // by flushes
+} bcache_stats_t;
+
+typedef struct {
+    int fd;
+    size_t capacity, used;
+    bcache_entry_t* entries;  // the pool: entries[0..used) are in use
+    uint8_t* pool;            // capacity blocks of data
+    bcache_entry_t** table;   // hash buckets
+    size_t buckets;           // power of two
+    bcache_entry_t *head, *tail;
+    size_t dirty;
+    ioq_t* io;                // NULL: synchronous writes
+    bcache_stats_t stats;
+} bcache_t;
+
+// capacity 0 means BCACHE_DEFAULT_BLOCKS. 0 on success. The owner may set io
+// afterwards; the queue must write to the same fd.
+int bcache_init(bcache_t* c, int fd, size_t capacity);
+
+// Drop every buffer (dirty ones are not written: flush first).
+void bcache_free(bcache_t* c);
+
+// The file's block, read on a miss. Valid until the next bcache_read/write.
+// NULL on a read error.
+const uint8_t* bcache_read(bcache_t* c, uint64_t block);
+
+// Replace the block with data; it reaches the file at the next flush (or when
+// the cache needs its buffer). 0 on success.
+int bcache_write(bcache_t* c, uint64_t block, const void* data);
+
+// Forget [first, first+count): the file was written there directly.
+void bcache_forget(bcache_t* c, uint64_t first, uint64_t count);
+
+// Write every dirty block, adjacent ones merged into one request. With a
+// queue, whatever else was queued on it is waited for too. 0 on success.
+int bcache_flush(bcache_t* c);
+
+#endif
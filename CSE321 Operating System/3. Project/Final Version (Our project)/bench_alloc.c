@@ -0,0 +1,179 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_alloc.c bitmap.c -o bench_alloc
+// Usage: ./bench_alloc [GiB] [seed]
+//        (defaults 16 and 42)
+//
+// Allocation cost on a nearly full data region of a GiB image (4 KiB blocks),
+// with the bitmap searched word by word and with its free-space summary
+// (bitmap_summarize). Two copies of the bitmap get the same requests and
+// must hand out the same bits.
+// Layouts, 99% full:
+//   scattered  free space in holes of 1..1024 blocks all over the region
+//   tail       free space in holes of 1..1024 blocks in the last 1% only
+// Per layout, each operation done and undone (so the layout stays put):
+//   single     bitmap_alloc() from hint 0, as the first add after opening
+//   churn      bitmap_alloc() after freeing a random used block
+//   run 8/256  bitmap_find_run() best fit, then set and cleared
+//   largest    bitmap_largest_run(), after one block set and cleared
+// Then the summary's build time and memory: what opening an image costs.
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitmap.h"
+
+#define OPS 2000
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+// All used, then holes cleared in [from, nbits) until 1% of the bits are free
+static void make_layout(bitmap_t* bm, uint64_t from) {
+    memset(bm->bytes, 0xFF, (bm->nwords * 8));
+    uint64_t want = bm->nbits / 100, span = bm->nbits - from, freed = 0;
+    while (freed < want) {
+        uint64_t len = 1 + next_rand() % (UINT64_C(1) << (next_rand() % 11));
+        uint64_t at = from + next_rand() % span;
+        if (at + len > bm->nbits) len = bm->nbits - at;
+        for (uint64_t k = at; k < at + len; k++) {
+            if (bitmap_test(bm, k)) {
+                bitmap_clear(bm, k);
+                freed++;
+            }
+        }
+    }
+    bm->hint = 0;
+}
+
+// Random used bit
+static uint64_t used_bit(const bitmap_t* bm) {
+    for (;;) {
+        uint64_t b = next_rand() % bm->nbits;
+        if (bitmap_test(bm, b)) return b;
+    }
+}
+
+enum { OP_SINGLE, OP_CHURN, OP_RUN8, OP_RUN256, OP_LARGEST, OP_COUNT };
+static const char* op_names[] = { "single", "churn", "run 8", "run 256", "largest" };
+
+// One operation on bm, undone again; returns the bit it found (or -1)
+static int64_t run_op(bitmap_t* bm, int op, uint64_t victim) {
+    int64_t bit = -1;
+    uint64_t s = 0, n;
+    switch (op) {
+    case OP_SINGLE:
+        bm->hint = 0;
+        bit = bitmap_alloc(bm);
+        if (bit >= 0) bitmap_clear(bm, (uint64_t)bit);
+        break;
+    case OP_CHURN:
+        bitmap_clear(bm, victim);
+        bit = bitmap_alloc(bm);
+        if (bit >= 0 && (uint64_t)bit != victim) {
+            // put the layout back: the victim used, the bit found free
+            bitmap_clear(bm, (uint64_t)bit);
+            bitmap_set(bm, victim);
+        }
+        break;
+    case OP_RUN8:
+    case OP_RUN256:
+        n = op == OP_RUN8 ? 8 : 256;
+        bit = bitmap_find_run(bm, n);
+        if (bit >= 0) {
+            bitmap_set_range(bm, (uint64_t)bit, n);
+            bitmap_clear_range(bm, (uint64_t)bit, n);
+        }
+        break;
+    case OP_LARGEST:
+        bitmap_set(bm, victim);   // a change, so the summary has something to redo
+        bitmap_clear(bm, victim);
+        bitmap_set(bm, victim);
+        bit = bitmap_largest_run(bm, &s) ? (int64_t)s : -1;
+        break;
+    }
+    return bit;
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t gib = argc > 1 ? strtoull(argv[1], NULL, 10) : 16;
+    rng = argc > 2 ? strtoull(argv[2], NULL, 10) : 42;
+    if (gib == 0 || rng == 0) {
+        printf("Error: GiB and seed must be positive\n");
+        return 1;
+    }
+    uint64_t nbits = gib << 18;
+    size_t bytes = (size_t)((nbits + 32767) / 32768 * 4096);   // whole bitmap blocks
+    uint8_t *a = malloc(bytes), *b = malloc(bytes);
+    uint64_t* victims = malloc(OPS * sizeof(uint64_t));
+    int64_t* found = malloc(2 * OPS * sizeof(int64_t));
+    if (a == NULL || b == NULL || victims == NULL || found == NULL) {
+        printf("Error: out of memory\n");
+        return 1;
+    }
+    printf("%llu GiB image: %llu data blocks, 99%% used\n", (unsigned long long)gib, (unsigned long long)nbits);
+    printf("%-10s %-8s %13s %13s %9s\n", "layout", "op", "plain ns/op", "summary ns/op", "speedup");
+
+    static const char* layouts[] = { "scattered", "tail" };
+    double build = 0;
+    for (int l = 0; l < 2; l++) {
+        bitmap_t plain, fast;
+        bitmap_init(&plain, a, nbits);
+        make_layout(&plain, l == 0 ? 0 : nbits - nbits / 100);
+        memcpy(b, a, bytes);
+        bitmap_init(&fast, b, nbits);
+        double t0 = now_sec();
+        if (bitmap_summarize(&fast) != 0) {
+            printf("Error: out of memory\n");
+            return 1;
+        }
+        build = now_sec() - t0;
+        for (int op = 0; op < OP_COUNT; op++) {
+            for (int i = 0; i < OPS; i++) victims[i] = used_bit(&plain);
+            // one pass each, so neither runs in the other's cache footprint
+            t0 = now_sec();
+            for (int i = 0; i < OPS; i++) found[i] = run_op(&plain, op, victims[i]);
+            double tp = now_sec() - t0;
+            t0 = now_sec();
+            for (int i = 0; i < OPS; i++) found[OPS + i] = run_op(&fast, op, victims[i]);
+            double tf = now_sec() - t0;
+            for (int i = 0; i < OPS; i++) {
+                if (found[i] != found[OPS + i]) {
+                    printf("Error: %s %s: plain found %lld, summary %lld\n", layouts[l], op_names[op],
+                           (long long)found[i], (long long)found[OPS + i]);
+                    return 1;
+                }
+            }
+            printf("%-10s %-8s %13.0f %13.0f %8.1fx\n", layouts[l], op_names[op], tp / OPS * 1e9, tf / OPS * 1e9,
+                   tf > 0 ? tp / tf : 0.0);
+        }
+        if (memcmp(a, b, bytes) != 0 || bitmap_count_free(&fast) != bitmap_count_free(&plain)) {
+            printf("Error: %s: the bitmaps differ after the run\n", layouts[l]);
+            return 1;
+        }
+        bitmap_release(&fast);
+    }
+    // word, chunk, group counts and the chunk shapes
+    uint64_t nwords = (nbits + 63) / 64, nchunks = (nwords + 511) / 512;
+    uint64_t sum_bytes = nwords + nchunks * (4 * 4 + 1) + (nchunks / BITMAP_GROUP_CHUNKS + 1) * 8;
+    printf("\nsummary: built in %.2f ms, %.1f KiB (%.2f bytes per 64 blocks)\n", build * 1e3, sum_bytes / 1024.0,
+           (double)sum_bytes / nwords);
+    free(a);
+    free(b);
+    free(victims);
+    free(found);
+    return 0;
+}
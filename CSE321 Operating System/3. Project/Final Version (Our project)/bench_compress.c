@@ -0,0 +1,176 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_compress.c compress.c lz.c image.c -o bench_compress
+// Usage: ./bench_compress [MiB per payload] [seed]
+//        (defaults 32 and 42)
+//
+// Packs generated payloads cluster by cluster exactly as mkfs_adder --compress
+// does (compress_cluster()), and reports for each: the ratio of the LZ data
+// alone and of the blocks really stored (clusters are rounded up to whole
+// blocks), compress and decompress MB/s, and random 4 KiB reads (each one
+// decodes the cluster that holds it) against memcpy from raw blocks.
+// Payloads: JSON log lines, plain text, a 50/50 mix of text and random
+// bytes, and random bytes (incompressible: stored raw, no decode at all).
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compress.h"
+#include "lz.h"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng;
+static volatile uint64_t sink;   // keeps the reads from being optimized away
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static const char *words[] = {
+    "request", "handled", "cache", "miss", "user", "session", "timeout", "retry", "the", "a", "of",
+    "block", "image", "journal", "commit", "file", "added", "error", "while", "reading", "and", "to",
+};
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+static size_t put_text(char *p, size_t room) {
+    size_t n = 0;
+    int len = 8 + (int)(next_rand() % 12);
+    for (int w = 0; w < len; w++) n += (size_t)snprintf(p + n, room - n, w ? " %s" : "%s", words[next_rand() % NWORDS]);
+    n += (size_t)snprintf(p + n, room - n, ".\n");
+    return n;
+}
+
+static size_t put_json(char *p, size_t room, uint64_t *ts) {
+    static const char *levels[] = { "INFO", "WARN", "DEBUG", "ERROR" };
+    *ts += next_rand() % 4;
+    return (size_t)snprintf(p, room,
+        "{\"ts\": %llu, \"level\": \"%s\", \"svc\": \"api-%u\", \"msg\": \"request handled\", \"path\": \"/v1/items/%u\", \"ms\": %u.%02u}\n",
+        (unsigned long long)*ts, levels[next_rand() % 4], (unsigned)(next_rand() % 9 + 1),
+        (unsigned)(next_rand() % 5000 + 1), (unsigned)(next_rand() % 100), (unsigned)(next_rand() % 100));
+}
+
+static void fill(uint8_t *buf, size_t size, int kind) {
+    char line[512];
+    uint64_t ts = 1700000000;
+    for (size_t at = 0; at < size;) {
+        size_t n;
+        if (kind == 0) {
+            n = put_json(line, sizeof(line), &ts);
+        } else if (kind == 1 || (kind == 2 && (at / COMPRESS_CLUSTER_BYTES) % 2 == 0)) {
+            n = put_text(line, sizeof(line));
+        } else {
+            for (n = 0; n + 8 <= sizeof(line); n += 8) {
+                uint64_t r = next_rand();
+                memcpy(line + n, &r, 8);
+            }
+        }
+        if (n > size - at) n = size - at;
+        memcpy(buf + at, line, n);
+        at += n;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t mib = argc > 1 ? strtoull(argv[1], NULL, 10) : 32;
+    rng = argc > 2 ? strtoull(argv[2], NULL, 10) : 42;
+    if (mib == 0 || rng == 0) {
+        printf("Error: MiB per payload and seed must be positive\n");
+        return 1;
+    }
+    static const char *kinds[] = { "json-log", "text", "mixed", "random" };
+    size_t size = (size_t)mib << 20;
+    size_t nclusters = size / COMPRESS_CLUSTER_BYTES;
+    uint8_t *src = malloc(size), *packed = malloc(size), *out = malloc(size);
+    uint32_t *stored = malloc(nclusters * sizeof(uint32_t));
+    if (src == NULL || packed == NULL || out == NULL || stored == NULL) {
+        printf("Error: out of memory\n");
+        return 1;
+    }
+
+    printf("%zu MiB per payload, clusters of %d blocks\n", (size_t)mib, COMPRESS_CLUSTER_BLOCKS);
+    printf("%-9s %8s %8s %7s %11s %11s %12s %12s\n", "payload", "LZ", "stored", "raw", "comp MB/s", "dec MB/s",
+           "4K read us", "memcpy us");
+    for (int kind = 0; kind < 4; kind++) {
+        fill(src, size, kind);
+
+        // pack: cluster c goes to packed + c * COMPRESS_CLUSTER_BYTES, stored[c] blocks of it
+        compress_stats_t st = {0};
+        uint64_t lz_bytes = 0;
+        double t0 = now_sec();
+        for (size_t c = 0; c < nclusters; c++) {
+            uint8_t *dst = packed + c * COMPRESS_CLUSTER_BYTES;
+            stored[c] = compress_cluster(src + c * COMPRESS_CLUSTER_BYTES, COMPRESS_CLUSTER_BYTES, dst, &st);
+            compress_hdr_t hdr;
+            memcpy(&hdr, dst, sizeof(hdr));
+            lz_bytes += stored[c] < COMPRESS_CLUSTER_BLOCKS ? hdr.bytes : COMPRESS_CLUSTER_BYTES;
+        }
+        double tc = now_sec() - t0;
+
+        // decode everything, then check it
+        t0 = now_sec();
+        for (size_t c = 0; c < nclusters; c++) {
+            const uint8_t *p = packed + c * COMPRESS_CLUSTER_BYTES;
+            uint8_t *o = out + c * COMPRESS_CLUSTER_BYTES;
+            if (stored[c] == COMPRESS_CLUSTER_BLOCKS) {
+                memcpy(o, p, COMPRESS_CLUSTER_BYTES);
+                continue;
+            }
+            compress_hdr_t hdr;
+            memcpy(&hdr, p, sizeof(hdr));
+            if (lz_decompress(p + sizeof(hdr), hdr.bytes, o, COMPRESS_CLUSTER_BYTES) != (int64_t)COMPRESS_CLUSTER_BYTES) {
+                printf("Error: cluster %zu of %s does not decode\n", c, kinds[kind]);
+                return 1;
+            }
+        }
+        double td = now_sec() - t0;
+        if (memcmp(src, out, size) != 0) {
+            printf("Error: %s does not round-trip\n", kinds[kind]);
+            return 1;
+        }
+
+        // random 4 KiB reads: the cluster holding the block is decoded whole
+        const int reads = 20000;
+        uint8_t cluster[COMPRESS_CLUSTER_BYTES], block[BS];
+        t0 = now_sec();
+        for (int r = 0; r < reads; r++) {
+            size_t b = next_rand() % (size / BS), c = b / COMPRESS_CLUSTER_BLOCKS;
+            const uint8_t *p = packed + c * COMPRESS_CLUSTER_BYTES;
+            if (stored[c] == COMPRESS_CLUSTER_BLOCKS) {
+                memcpy(block, p + (b % COMPRESS_CLUSTER_BLOCKS) * BS, BS);
+            } else {
+                compress_hdr_t hdr;
+                memcpy(&hdr, p, sizeof(hdr));
+                lz_decompress(p + sizeof(hdr), hdr.bytes, cluster, sizeof(cluster));
+                memcpy(block, cluster + (b % COMPRESS_CLUSTER_BLOCKS) * BS, BS);
+            }
+            sink += block[r % BS];
+        }
+        double tr = now_sec() - t0;
+        t0 = now_sec();
+        for (int r = 0; r < reads; r++) {
+            size_t b = next_rand() % (size / BS);
+            memcpy(block, src + b * BS, BS);
+            sink += block[r % BS];
+        }
+        double tm = now_sec() - t0;
+
+        printf("%-9s %7.2fx %7.2fx %7llu %11.0f %11.0f %12.2f %12.2f\n", kinds[kind],
+               (double)size / lz_bytes, (double)size / ((double)st.blocks_out * BS),
+               (unsigned long long)st.raw_clusters, size / 1e6 / tc, size / 1e6 / td,
+               tr / reads * 1e6, tm / reads * 1e6);
+    }
+    free(src);
+    free(packed);
+    free(out);
+    free(stored);
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_crc32.c crc32.c -o bench_crc32
+// Usage: ./bench_crc32 [megabytes-per-run]
+//
+// Checks every CRC32 kernel against the original byte-at-a-time loop and
+// reports GB/s for the buffer sizes the tools actually checksum:
+// 120 bytes (inode), 4092 bytes (superblock) and larger streaming buffers.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32.h"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    size_t mb_per_run = 256;
+    if (argc > 1) mb_per_run = strtoull(argv[1], NULL, 10);
+    if (mb_per_run == 0) mb_per_run = 1;
+
+    crc32_init();
+    crc32_variant_t best = crc32_selected();
+
+    const size_t sizes[] = { 120, 4092, 65536, 1u << 20 };
+    const size_t max_size = 1u << 20;
+    uint8_t* buf = malloc(max_size + 16);
+    if (buf == NULL) {
+        printf("Error allocating benchmark buffer\n");
+        return 1;
+    }
+
+    // fixed pattern so runs are comparable
+    uint32_t x = 0x12345678u;
+    for (size_t i = 0; i < max_size + 16; i++) {
+        x = x * 1103515245u + 12345u;
+        buf[i] = (uint8_t)(x >> 16);
+    }
+
+    // correctness: every kernel, every length 0..300 and every alignment 0..15
+    crc32_select(CRC32_BYTEWISE);
+    for (int v = 0; v < CRC32_VARIANT_COUNT; v++) {
+        if (!crc32_variant_supported((crc32_variant_t)v)) continue;
+        for (size_t off = 0; off < 16; off++) {
+            for (size_t n = 0; n <= 300; n++) {
+                crc32_select(CRC32_BYTEWISE);
+                uint32_t want = crc32(buf + off, n);
+                crc32_select((crc32_variant_t)v);
+                uint32_t got = crc32(buf + off, n);
+                if (got != want) {
+                    printf("MISMATCH %s off=%zu n=%zu: %08x != %08x\n",
+                           crc32_variant_name((crc32_variant_t)v), off, n, got, want);
+                    free(buf);
+                    return 1;
+                }
+            }
+        }
+    }
+    printf("All kernels match the bytewise reference\n");
+    printf("Auto-selected kernel: %s\n\n", crc32_variant_name(best));
+
+    printf("%-10s", "size");
+    for (int v = 0; v < CRC32_VARIANT_COUNT; v++) printf("%12s", crc32_variant_name((crc32_variant_t)v));
+    printf("   (GB/s)\n");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        size_t iters = (mb_per_run << 20) / n;
+        if (iters == 0) iters = 1;
+
+        printf("%-10zu", n);
+        for (int v = 0; v < CRC32_VARIANT_COUNT; v++) {
+            if (crc32_select((crc32_variant_t)v) != 0) {
+                printf("%12s", "n/a");
+                continue;
+            }
+            volatile uint32_t sink = 0;
+            double t0 = now_sec();
+            for (size_t i = 0; i < iters; i++) sink ^= crc32(buf, n);
+            double dt = now_sec() - t0;
+            (void)sink;
+            printf("%12.2f", (double)n * iters / dt / 1e9);
+        }
+        printf("\n");
+    }
+
+    free(buf);
+    return 0;
+}
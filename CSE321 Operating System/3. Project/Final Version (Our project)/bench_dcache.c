@@ -0,0 +1,145 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread bench_dcache.c volume.c sparse.c writer.c crc32.c bitmap.c dcache.c dir_index.c image.c inode_map.c compress.c lz.c dedup.c sha256.c journal.c bcache.c ioq.c -o bench_dcache
+// Usage: ./bench_dcache [path-to-mkfs_builder] [scratch-image]
+//        (defaults ./mkfs_builder and /tmp/bench_dcache.img)
+//
+// Builds two trees in a fresh image through the volume API and times it:
+//   deep  DEEP_LEVELS nested directories, DEEP_FILES files in each
+//   wide  WIDE_DIRS directories under the root, WIDE_FILES files in each
+// (mkdir/s: volume_mkdir() of each directory, in order; add/s: the files
+// into them; each with its commit in the time). Then resolves random file
+// paths of each tree with path_resolve(): without the dentry cache (every
+// component a directory lookup), with a cold cache and with a warm one, in ns
+// per path, with the cache's hits and misses over the cold and warm passes.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dcache.h"
+#include "volume.h"
+
+#define DEEP_LEVELS 48
+#define DEEP_FILES 16
+#define WIDE_DIRS 128
+#define WIDE_FILES 256
+#define LOOKUPS 200000
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Directory part of file i of a tree: "d00/d01/.../dNN" for deep, "wNNN" for wide
+static void dir_path(char* out, size_t cap, int deep, uint32_t i) {
+    if (!deep) {
+        snprintf(out, cap, "w%03u", i / WIDE_FILES);
+        return;
+    }
+    size_t len = 0;
+    for (uint32_t d = 0; d <= i / DEEP_FILES && len < cap; d++) {
+        len += (size_t)snprintf(out + len, cap - len, d ? "/d%02u" : "d%02u", d);
+    }
+}
+
+static void file_path(char* out, size_t cap, int deep, uint32_t i) {
+    char dir[512];
+    dir_path(dir, sizeof(dir), deep, i);
+    snprintf(out, cap, "%s/file_%06u.log", dir, i);
+}
+
+// Creates the directories of a tree, then adds its files (small ones, inline).
+// Prints the rates; 0 or -1.
+static int build_tree(volume_t* v, int deep, uint32_t n) {
+    char path[600], data[32];
+    uint32_t per_dir = deep ? DEEP_FILES : WIDE_FILES;
+    uint64_t dirs0 = v->dirs_made;
+    double t0 = now_sec();
+    for (uint32_t i = 0; i < n; i += per_dir) {
+        dir_path(path, sizeof(path), deep, i);
+        if (volume_mkdir(v, path) < 0) return -1;
+    }
+    if (volume_commit(v) != 0) return -1;
+    double t_dirs = now_sec() - t0;
+    uint64_t dirs = v->dirs_made - dirs0;
+
+    t0 = now_sec();
+    for (uint32_t i = 0; i < n; i++) {
+        file_path(path, sizeof(path), deep, i);
+        int len = snprintf(data, sizeof(data), "%u\n", i);
+        FILE* fp = fmemopen(data, (size_t)len, "r");
+        if (fp == NULL || volume_add(v, path, fp, (uint64_t)len, 1) < 0) {
+            printf("Error adding %s\n", path);
+            if (fp) fclose(fp);
+            return -1;
+        }
+        fclose(fp);
+    }
+    if (volume_commit(v) != 0) return -1;
+    double t = now_sec() - t0;
+    printf("%-5s  %6llu dirs %7u files  %8.0f mkdir/s %8.0f add/s\n",
+           deep ? "deep" : "wide", (unsigned long long)dirs, n, dirs / t_dirs, n / t);
+    return 0;
+}
+
+// ns per path over LOOKUPS random files of the tree; *found counts the resolved ones
+static double time_resolve(dcache_t* dc, const image_t* img, int deep, uint32_t n, uint64_t* found) {
+    char path[600];
+    uint32_t x = 12345;
+    *found = 0;
+    double t0 = now_sec();
+    for (uint32_t k = 0; k < LOOKUPS; k++) {
+        x = x * 1103515245u + 12345u;
+        file_path(path, sizeof(path), deep, (x >> 8) % n);
+        uint8_t type;
+        if (path_resolve(dc, img, path, &type) >= 0 && type == 1) (*found)++;
+    }
+    return (now_sec() - t0) / LOOKUPS * 1e9;
+}
+
+static int resolve_tree(const image_t* img, int deep, uint32_t n) {
+    uint64_t found_none, found_cold, found_warm;
+    dcache_t dc;
+    memset(&dc, 0, sizeof(dc));
+    double none = time_resolve(NULL, img, deep, n, &found_none);
+    double cold = time_resolve(&dc, img, deep, n, &found_cold);
+    double warm = time_resolve(&dc, img, deep, n, &found_warm);
+    if (found_none != LOOKUPS || found_cold != LOOKUPS || found_warm != LOOKUPS) {
+        printf("Error: paths not resolved (%llu, %llu, %llu of %u)\n", (unsigned long long)found_none,
+               (unsigned long long)found_cold, (unsigned long long)found_warm, LOOKUPS);
+        dcache_free(&dc);
+        return -1;
+    }
+    printf("%-5s  %8.0fns %8.0fns %8.0fns  %10llu %8llu  %6.1f KiB\n", deep ? "deep" : "wide", none, cold, warm,
+           (unsigned long long)dc.hits, (unsigned long long)dc.misses, dcache_memory(&dc) / 1024.0);
+    dcache_free(&dc);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* builder = argc > 1 ? argv[1] : "./mkfs_builder";
+    const char* path = argc > 2 ? argv[2] : "/tmp/bench_dcache.img";
+    const uint32_t deep_n = DEEP_LEVELS * DEEP_FILES, wide_n = WIDE_DIRS * WIDE_FILES;
+
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "%s --image %s --size-kib 65536 --inodes %u > /dev/null", builder, path,
+             deep_n + wide_n + DEEP_LEVELS + WIDE_DIRS + 1024);
+    if (system(cmd) != 0) {
+        printf("Error running %s\n", builder);
+        return 1;
+    }
+    volume_t v;
+    if (volume_open(&v, path, 0) < 0) return 1;
+    if (build_tree(&v, 1, deep_n) != 0 || build_tree(&v, 0, wide_n) != 0) {
+        volume_close(&v);
+        return 1;
+    }
+
+    printf("\n%-5s  %10s %10s %10s  %10s %8s  %s\n", "tree", "no cache", "cold", "warm", "hits", "misses", "cache");
+    int rc = resolve_tree(&v.img, 1, deep_n) != 0 || resolve_tree(&v.img, 0, wide_n) != 0;
+    volume_close(&v);
+    remove(path);
+    return rc;
+}
@@ -0,0 +1,177 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_dedup.c dedup.c sha256.c crc32.c bitmap.c image.c -o bench_dedup
+// Usage: ./bench_dedup [MiB per file] [seed]
+//        (defaults 16 and 42)
+//
+// Runs generated file sets through the dedup index block by block as
+// mkfs_adder --dedup does (hash, lookup, byte compare on a hit, insert on a
+// miss) and reports for each: blocks, blocks stored, the dedup ratio,
+// hashing MB/s, ns per block for the rest (lookup, compare or copy, insert)
+// and the index's memory per stored block.
+// Sets: 8 variants of one image with 2% of their blocks changed, 8
+// snapshots of a growing log (each one the previous one plus more lines),
+// and 8 files of random bytes (nothing to share: the cost of looking).
+// Then the index alone at 1M and 4M stored blocks: inserts/s, lookups/s and
+// memory per block.
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dedup.h"
+#include "sha256.h"
+
+#define FILES 8
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void fill_random(uint8_t *p, size_t n) {
+    for (size_t i = 0; i + 8 <= n; i += 8) {
+        uint64_t r = next_rand();
+        memcpy(p + i, &r, 8);
+    }
+}
+
+// File f of a set, size bytes
+static void make_file(uint8_t *buf, size_t size, int set, int f, const uint8_t *base) {
+    if (set == 0) {
+        // the image with 2% of its blocks rewritten
+        memcpy(buf, base, size);
+        for (size_t b = 0; b < size / BS; b++) {
+            if (next_rand() % 50 == 0) fill_random(buf + b * BS, BS);
+        }
+    } else if (set == 1) {
+        // log snapshot f: the first (f + 1) / FILES of the final log
+        size_t len = size / FILES * (size_t)(f + 1);
+        memcpy(buf, base, len);
+        memset(buf + len, 0, size - len);
+    } else {
+        fill_random(buf, size);
+    }
+}
+
+static void fill_log(uint8_t *p, size_t size) {
+    uint64_t ts = 1700000000;
+    for (size_t at = 0; at < size;) {
+        char line[160];
+        ts += next_rand() % 3;
+        int n = snprintf(line, sizeof(line), "%llu INFO api-%u GET /v1/items/%u 200 %u.%02ums\n",
+                         (unsigned long long)ts, (unsigned)(next_rand() % 9), (unsigned)(next_rand() % 5000),
+                         (unsigned)(next_rand() % 100), (unsigned)(next_rand() % 100));
+        if ((size_t)n > size - at) n = (int)(size - at);
+        memcpy(p + at, line, (size_t)n);
+        at += (size_t)n;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t mib = argc > 1 ? strtoull(argv[1], NULL, 10) : 16;
+    rng = argc > 2 ? strtoull(argv[2], NULL, 10) : 42;
+    if (mib == 0 || rng == 0) {
+        printf("Error: MiB per file and seed must be positive\n");
+        return 1;
+    }
+    size_t size = (size_t)mib << 20, nblocks = size / BS;
+    uint8_t *base = malloc(size), *buf = malloc(size);
+    // the blocks "stored", as the image would hold them: what a hit is compared with
+    uint8_t *store = malloc(size * FILES);
+    if (base == NULL || buf == NULL || store == NULL) {
+        printf("Error: out of memory\n");
+        return 1;
+    }
+    memset(store, 0, size * FILES);   // fault it in now, not in the timed loop
+
+    static const char *sets[] = { "variants", "log-snaps", "unique" };
+    printf("%d files of %zu MiB per set, hashing: %s\n", FILES, (size_t)mib, sha256_kernel());
+    printf("%-10s %9s %9s %7s %10s %11s %13s\n", "set", "blocks", "stored", "ratio", "hash MB/s", "rest ns/b", "bytes/stored");
+    for (int set = 0; set < 3; set++) {
+        if (set == 0) fill_random(base, size);
+        if (set == 1) fill_log(base, size);
+        dedup_t d;
+        memset(&d, 0, sizeof(d));
+        uint64_t stored = 0, total = 0;
+        double th = 0, ti = 0;
+        for (int f = 0; f < FILES; f++) {
+            make_file(buf, size, set, f, base);
+            for (size_t b = 0; b < nblocks; b++) {
+                const uint8_t *blk = buf + b * BS;
+                uint8_t hash[DEDUP_HASH_BYTES];
+                double t0 = now_sec();
+                dedup_hash(blk, hash);
+                double t1 = now_sec();
+                dedup_entry_t *e = dedup_find(&d, hash);
+                if (e != NULL && memcmp(store + (size_t)(e->block - 1) * BS, blk, BS) == 0) {
+                    e->refs++;
+                } else {
+                    memcpy(store + stored * BS, blk, BS);
+                    stored++;
+                    if (e == NULL && dedup_insert(&d, hash, (uint32_t)stored) == NULL) {
+                        printf("Error: out of memory\n");
+                        return 1;
+                    }
+                }
+                ti += now_sec() - t1;
+                th += t1 - t0;
+                total++;
+            }
+        }
+        printf("%-10s %9llu %9llu %6.2fx %10.0f %11.0f %13.1f\n", sets[set], (unsigned long long)total,
+               (unsigned long long)stored, (double)total / stored, total * (double)BS / 1e6 / th, ti / total * 1e9,
+               (double)dedup_memory(&d) / stored);
+        dedup_free(&d);
+    }
+
+    // the index alone, with synthetic hashes
+    printf("\n%-10s %12s %12s %13s\n", "entries", "inserts/s", "lookups/s", "bytes/entry");
+    for (uint64_t n = 1u << 20; n <= 4u << 20; n *= 4) {
+        dedup_t d;
+        memset(&d, 0, sizeof(d));
+        uint8_t hash[DEDUP_HASH_BYTES];
+        uint64_t seed = rng;
+        double t0 = now_sec();
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t a = next_rand(), b = next_rand();
+            memcpy(hash, &a, 8);
+            memcpy(hash + 8, &b, 8);
+            if (dedup_insert(&d, hash, (uint32_t)(i + 1)) == NULL) {
+                printf("Error: out of memory\n");
+                return 1;
+            }
+        }
+        double ins = now_sec() - t0;
+        rng = seed;
+        uint64_t found = 0;
+        t0 = now_sec();
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t a = next_rand(), b = next_rand();
+            memcpy(hash, &a, 8);
+            memcpy(hash + 8, &b, 8);
+            found += dedup_find(&d, hash) != NULL;
+        }
+        double look = now_sec() - t0;
+        if (found != n) {
+            printf("Error: %llu of %llu entries found\n", (unsigned long long)found, (unsigned long long)n);
+            return 1;
+        }
+        printf("%-10llu %12.0f %12.0f %13.1f\n", (unsigned long long)n, n / ins, n / look, (double)dedup_memory(&d) / n);
+        dedup_free(&d);
+    }
+    free(base);
+    free(buf);
+    free(store);
+    return 0;
+}
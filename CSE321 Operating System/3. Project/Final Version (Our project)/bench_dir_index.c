@@ -0,0 +1,113 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_dir_index.c bitmap.c dir_index.c image.c -o bench_dir_index
+// Usage: ./bench_dir_index [scratch-image]   (default /tmp/bench_dir_index.img)
+//
+// Name lookup in a directory with the hashed index against the plain scan
+// of its dirent blocks, for hits and misses, at several directory sizes up
+// to the largest directory MiniVSFS holds (DIRECT_MAX blocks of entries).
+// Also reports the blocks each lookup touches on average.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitmap.h"
+#include "dir_index.h"
+#include "image.h"
+#include "minivsfs.h"
+
+#define DATA_BLOCKS 256
+#define LOOKUPS 200000
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void entry_name(char* out, size_t cap, uint32_t i, int hit) {
+    snprintf(out, cap, "%s_%06u.log", hit ? "file" : "none", i);
+}
+
+// ns per lookup over LOOKUPS names; 0 names found means the check failed for hits
+static double time_lookups(const image_t* img, const inode_t* dir, uint32_t n, int hit, uint64_t* found) {
+    char name[64];
+    uint32_t x = 12345;
+    *found = 0;
+    double t0 = now_sec();
+    for (uint32_t k = 0; k < LOOKUPS; k++) {
+        x = x * 1103515245u + 12345u;
+        entry_name(name, sizeof(name), (x >> 8) % n, hit);
+        if (dir_lookup(img, dir, name) != NULL) (*found)++;
+    }
+    return (now_sec() - t0) / LOOKUPS * 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : "/tmp/bench_dir_index.img";
+
+    // scratch image: superblock, one data bitmap block, then the data region
+    image_t img;
+    if (image_create(&img, path, (uint64_t)(2 + DATA_BLOCKS) * BS) != 0) {
+        printf("Error creating %s\n", path);
+        return 1;
+    }
+    superblock_t* sb = img.sb;
+    sb->magic = MINIVSFS_MAGIC;
+    sb->block_size = BS;
+    sb->total_blocks = 2 + DATA_BLOCKS;
+    sb->data_bitmap_start = 1;
+    sb->data_bitmap_blocks = 1;
+    sb->data_region_start = 2;
+    sb->data_region_blocks = DATA_BLOCKS;
+    bitmap_t dbm;
+    bitmap_init(&dbm, image_data_bitmap(&img), DATA_BLOCKS);
+
+    // dirent blocks are the first DIRECT_MAX data blocks
+    inode_t dir;
+    memset(&dir, 0, sizeof(dir));
+    dir.mode = 0x4000;
+    bitmap_set_range(&dbm, 0, DIRECT_MAX);
+
+    printf("%8s  %10s %10s %10s %10s  %s\n", "entries", "scan hit", "index hit", "scan miss", "index miss", "blocks/lookup scan vs index (hit)");
+    const uint32_t sizes[] = { 64, 128, 256, 512, DIRECT_MAX * DIRENTS_PER_BLOCK };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); si++) {
+        uint32_t n = sizes[si];
+        dir_index_drop(&img, &dbm, &dir);
+        for (int i = 0; i < DIRECT_MAX; i++) {
+            dir.direct[i] = (uint32_t)(sb->data_region_start + i);
+            memset(image_block(&img, dir.direct[i]), 0, BS);
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            dirent64_t* de = &image_dirents(&img, dir.direct[i / DIRENTS_PER_BLOCK])[i % DIRENTS_PER_BLOCK];
+            de->inode_no = i + 2;
+            de->type = 1;
+            entry_name(de->name, sizeof(de->name), i, 1);
+        }
+
+        uint64_t found_scan, found_idx, miss_scan, miss_idx;
+        double scan_hit = time_lookups(&img, &dir, n, 1, &found_scan);
+        double scan_miss = time_lookups(&img, &dir, n, 0, &miss_scan);
+        if (dir_index_build(&img, &dbm, &dir, 1) != 0) {
+            printf("Error building the index\n");
+            return 1;
+        }
+        double idx_hit = time_lookups(&img, &dir, n, 1, &found_idx);
+        double idx_miss = time_lookups(&img, &dir, n, 0, &miss_idx);
+        if (found_scan != LOOKUPS || found_idx != LOOKUPS || miss_scan != 0 || miss_idx != 0) {
+            printf("Error: lookups disagree (scan %llu, index %llu)\n",
+                   (unsigned long long)found_scan, (unsigned long long)found_idx);
+            return 1;
+        }
+
+        // a hit scans half the used dirent blocks on average; the index reads one index block and one dirent block
+        double used_blocks = (double)((n + DIRENTS_PER_BLOCK - 1) / DIRENTS_PER_BLOCK);
+        printf("%8u  %8.0fns %8.0fns %8.0fns %8.0fns  %.1f vs 2\n",
+               n, scan_hit, idx_hit, scan_miss, idx_miss, (used_blocks + 1) / 2);
+    }
+
+    image_close(&img);
+    remove(path);
+    return 0;
+}
@@ -0,0 +1,230 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_frag.c bitmap.c image.c inode_map.c compress.c lz.c -o bench_frag
+// Usage: ./bench_frag [seed]        (aging simulation, both allocators)
+//        ./bench_frag img [img ...] (report on real images)
+//
+// Fragmentation report. A file's fragments are its maximal runs of
+// physically adjacent data blocks: 1 means it can be read with one I/O.
+//
+// Without image arguments a 1 GiB data region is aged in memory: files of
+// random sizes are created until it is 90% full, random files are deleted
+// down to 60%, and that repeats. It is done twice with the same seed, once
+// allocating bit by bit (bitmap_alloc_n, as mkfs_adder --no-extents does)
+// and once with best-fit extents (bitmap_alloc_extents, mkfs_adder's default,
+// falling back to bit by bit when a file would need more than EXTENT_MAX
+// extents). The live files and the free space are then reported.
+//
+// With image arguments the same numbers are printed for every regular file
+// in the root directory, e.g. for images built with and without --no-extents.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitmap.h"
+#include "image.h"
+#include "inode_map.h"
+#include "minivsfs.h"
+
+#define SIM_BLOCKS (1u << 18)  // 1 GiB of 4 KiB blocks
+#define SIM_ROUNDS 20
+#define SIM_MAX_FILES 65536
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state;
+
+static uint64_t rng(void) {
+    // xorshift64*, deterministic for a given seed
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// File sizes: mostly small, a long tail up to 16 MiB
+static uint64_t random_file_blocks(void) {
+    uint64_t shift = rng() % 13;  // up to 4096 blocks
+    return 1 + rng() % (UINT64_C(1) << shift);
+}
+
+typedef struct {
+    uint64_t files;
+    uint64_t fragments;   // sum over files
+    uint64_t fragmented;  // files with more than one fragment
+    uint64_t worst;
+} frag_stats_t;
+
+static void add_file_stats(frag_stats_t* st, uint64_t fragments) {
+    st->files++;
+    st->fragments += fragments;
+    if (fragments > 1) st->fragmented++;
+    if (fragments > st->worst) st->worst = fragments;
+}
+
+static void print_stats(const char* label, const frag_stats_t* st, const bitmap_t* bm) {
+    uint64_t runs = 0, largest = 0, s, len;
+    for (uint64_t at = 0; bitmap_next_run(bm, at, &s, &len); at = s + len) {
+        runs++;
+        if (len > largest) largest = len;
+    }
+    printf("%-22s files %6llu  fragments/file %6.2f  fragmented %5.1f%%  worst %5llu  "
+           "free %7llu blocks in %6llu runs (largest %llu)\n",
+           label, (unsigned long long)st->files,
+           st->files ? (double)st->fragments / st->files : 0.0,
+           st->files ? 100.0 * st->fragmented / st->files : 0.0,
+           (unsigned long long)st->worst,
+           (unsigned long long)bitmap_count_free(bm), (unsigned long long)runs,
+           (unsigned long long)largest);
+}
+
+// ---- simulation ----
+
+typedef struct {
+    uint64_t nbits;
+    uint64_t* bits;   // every block of the file, in file order
+} sim_file_t;
+
+static uint64_t count_fragments(const uint64_t* bits, uint64_t n) {
+    uint64_t f = n ? 1 : 0;
+    for (uint64_t i = 1; i < n; i++) if (bits[i] != bits[i - 1] + 1) f++;
+    return f;
+}
+
+static int sim_alloc(bitmap_t* bm, uint64_t n, uint64_t* out, int use_extents) {
+    if (use_extents) {
+        uint64_t start[EXTENT_MAX], len[EXTENT_MAX];
+        int count = bitmap_alloc_extents(bm, n, start, len, EXTENT_MAX);
+        if (count > 0) {
+            uint64_t k = 0;
+            for (int e = 0; e < count; e++) {
+                for (uint64_t b = 0; b < len[e]; b++) out[k++] = start[e] + b;
+            }
+            return 0;
+        }
+    }
+    return bitmap_alloc_n(bm, n, out);
+}
+
+static int simulate(uint64_t seed, int use_extents) {
+    uint8_t* bytes = calloc(SIM_BLOCKS / 8, 1);
+    sim_file_t* files = calloc(SIM_MAX_FILES, sizeof(sim_file_t));
+    if (bytes == NULL || files == NULL) {
+        printf("Error allocating simulation state\n");
+        free(bytes);
+        free(files);
+        return -1;
+    }
+    bitmap_t bm;
+    bitmap_init(&bm, bytes, SIM_BLOCKS);
+    rng_state = seed ? seed : 1;
+
+    uint64_t live = 0, used = 0, allocs = 0;
+    double t_alloc = 0;
+    for (int round = 0; round < SIM_ROUNDS; round++) {
+        // fill to 90%
+        while (used < SIM_BLOCKS / 10 * 9 && live < SIM_MAX_FILES) {
+            uint64_t n = random_file_blocks();
+            uint64_t* bits = malloc(n * sizeof(uint64_t));
+            if (bits == NULL) break;
+            double t0 = now_sec();
+            int rc = sim_alloc(&bm, n, bits, use_extents);
+            t_alloc += now_sec() - t0;
+            if (rc != 0) {
+                free(bits);
+                break;
+            }
+            files[live].nbits = n;
+            files[live].bits = bits;
+            live++;
+            used += n;
+            allocs++;
+        }
+        // delete random files down to 60%
+        while (used > SIM_BLOCKS / 10 * 6 && live > 0) {
+            uint64_t v = rng() % live;
+            for (uint64_t i = 0; i < files[v].nbits; i++) bitmap_clear(&bm, files[v].bits[i]);
+            used -= files[v].nbits;
+            free(files[v].bits);
+            files[v] = files[--live];
+        }
+    }
+
+    frag_stats_t st = {0};
+    for (uint64_t i = 0; i < live; i++) add_file_stats(&st, count_fragments(files[i].bits, files[i].nbits));
+    print_stats(use_extents ? "best-fit extents" : "bit by bit", &st, &bm);
+    printf("%-22s %llu allocations, %.1f us each\n", "",
+           (unsigned long long)allocs, allocs ? t_alloc / allocs * 1e6 : 0.0);
+
+    for (uint64_t i = 0; i < live; i++) free(files[i].bits);
+    free(files);
+    free(bytes);
+    return 0;
+}
+
+// ---- real images ----
+
+static int report_image(const char* path) {
+    image_t img;
+    if (image_open(&img, path, 0) != 0 || image_check_layout(&img) != 0) {
+        printf("Error: %s is not a MiniVSFS image\n", path);
+        return -1;
+    }
+    const inode_t* root = image_inode(&img, ROOT_INO);
+    frag_stats_t st = {0};
+    uint64_t extent_files = 0;
+    for (int d = 0; root && d < DIRECT_MAX; d++) {
+        if (root->direct[d] == 0) continue;
+        const dirent64_t* de = image_dirents(&img, root->direct[d]);
+        for (size_t j = 0; de && j < DIRENTS_PER_BLOCK; j++) {
+            if (de[j].inode_no == 0 || de[j].type != 1) continue;
+            const inode_t* ino = image_inode(&img, de[j].inode_no);
+            if (ino == NULL) continue;
+            uint64_t n = map_inode_blocks(ino);
+            uint32_t* blocks = malloc((n ? n : 1) * sizeof(uint32_t));
+            if (blocks == NULL || map_read(&img, ino, n, blocks, NULL) < 0) {
+                printf("Error reading block map of '%s'\n", de[j].name);
+                free(blocks);
+                continue;
+            }
+            // holes (0) are not fragments: only the data blocks, in file order
+            uint64_t f = 0, prev = 0;
+            for (uint64_t i = 0; i < n; i++) {
+                if (blocks[i] == 0) continue;
+                if (blocks[i] != prev + 1) f++;
+                prev = blocks[i];
+            }
+            add_file_stats(&st, f);
+            if (map_is_extents(ino)) extent_files++;
+            free(blocks);
+        }
+    }
+    bitmap_t bm;
+    bitmap_init(&bm, image_data_bitmap(&img), img.sb->data_region_blocks);
+    print_stats(path, &st, &bm);
+    printf("%-22s %llu of %llu files extent-mapped\n", "",
+           (unsigned long long)extent_files, (unsigned long long)st.files);
+    image_close(&img);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // a numeric first argument is a seed, anything else is an image
+    char* end = NULL;
+    if (argc > 1 && (strtoull(argv[1], &end, 10), *end != '\0')) {
+        int rc = 0;
+        for (int i = 1; i < argc; i++) if (report_image(argv[i]) != 0) rc = 1;
+        return rc;
+    }
+
+    uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 10) : 42;
+    printf("aging %u blocks, %d rounds of fill to 90%% / delete to 60%%, seed %llu\n",
+           SIM_BLOCKS, SIM_ROUNDS, (unsigned long long)seed);
+    if (simulate(seed, 0) != 0 || simulate(seed, 1) != 0) return 1;
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_ingest.c -o bench_ingest
+// Usage: ./bench_ingest [path-to-mkfs_builder] [path-to-mkfs_adder] [scratch-dir]
+//        (defaults ./mkfs_builder, ./mkfs_adder and /tmp)
+//
+// Adds one large file to a fresh image with each mkfs_adder --writer mode
+// (map: fread into the mapping; sync: chunked reads and pwritev; pipelined:
+// the same with a reader thread) and reports the ingest rate in MB/s, with and
+// without a journal. The source is written once and read back before the runs,
+// so every mode starts with it in the page cache. Times include the commit
+// (fdatasync or msync), i.e. the data is on disk when the clock stops.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs argv[0] with stdout discarded. Returns its peak RSS in KiB, or -1 if it failed.
+static long run(char *const argv[]) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    return ru.ru_maxrss;
+}
+
+// size bytes of xorshift noise (incompressible, not all-zero)
+static int make_source(const char *path, uint64_t size) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) return -1;
+    uint64_t buf[8192], x = 0x9E3779B97F4A7C15ULL;
+    for (uint64_t done = 0; done < size;) {
+        for (size_t i = 0; i < 8192; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            buf[i] = x;
+        }
+        size_t n = size - done < sizeof(buf) ? (size_t)(size - done) : sizeof(buf);
+        if (fwrite(buf, 1, n, f) != n) {
+            fclose(f);
+            return -1;
+        }
+        done += n;
+    }
+    if (fclose(f) != 0) return -1;
+    // read it back once: every run starts with the source cached
+    char cmd[4200];
+    snprintf(cmd, sizeof(cmd), "cat '%s' > /dev/null", path);
+    return system(cmd) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    char *builder = argc > 1 ? argv[1] : "./mkfs_builder";
+    char *adder = argc > 2 ? argv[2] : "./mkfs_adder";
+    const char *dir = argc > 3 ? argv[3] : "/tmp";
+
+    const uint64_t sizes_mib[] = { 16, 64, 256 };
+    const char *modes[] = { "map", "sync", "pipelined" };
+    const char *journals[] = { "0", "1024" };
+
+    char image[4096], source[4096];
+    snprintf(image, sizeof(image), "%s/bench_ingest.img", dir);
+    snprintf(source, sizeof(source), "%s/bench_ingest.src", dir);
+
+    printf("%8s %8s %10s %10s %10s %10s\n", "file", "journal", "writer", "time", "MB/s", "peak RSS");
+    for (size_t s = 0; s < sizeof(sizes_mib) / sizeof(sizes_mib[0]); s++) {
+        uint64_t bytes = sizes_mib[s] << 20;
+        if (make_source(source, bytes) != 0) {
+            printf("Error writing the source file %s\n", source);
+            return 1;
+        }
+        // twice the file, plus room for the metadata and the journal
+        char size_arg[32];
+        snprintf(size_arg, sizeof(size_arg), "%llu", (unsigned long long)(2 * (bytes >> 10) + 16384));
+
+        for (size_t j = 0; j < sizeof(journals) / sizeof(journals[0]); j++) {
+            for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+                char *build[] = { builder, "--image", image, "--size-kib", size_arg, "--inodes", "128",
+                                  "--journal-blocks", (char *)journals[j], NULL };
+                if (run(build) < 0) {
+                    printf("Error: %s failed\n", builder);
+                    return 1;
+                }
+                char *add[] = { adder, "--input", image, "--in-place", "--file", source,
+                                "--writer", (char *)modes[m], NULL };
+                double t0 = now_sec();
+                long rss = run(add);
+                double t = now_sec() - t0;
+                if (rss < 0) {
+                    printf("Error: %s failed (--writer %s)\n", adder, modes[m]);
+                    return 1;
+                }
+                printf("%6llu M %8s %10s %8.3f s %10.1f %7ld MiB\n", (unsigned long long)sizes_mib[s],
+                       journals[j][0] == '0' ? "no" : "yes", modes[m], t, bytes / 1e6 / t, rss / 1024);
+                fflush(stdout);
+            }
+        }
+    }
+    unlink(image);
+    unlink(source);
+    return 0;
+}
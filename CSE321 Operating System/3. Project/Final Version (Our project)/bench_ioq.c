@@ -0,0 +1,132 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_ioq.c ioq.c -o bench_ioq
+// Usage: ./bench_ioq [scratch-dir] [MiB per run]
+//        (defaults /tmp and 64)
+//
+// Writes MiB of scattered 4 KiB and 64 KiB blocks (every slot of a file four
+// times that size written at most once, in a shuffled order) through an ioq
+// at queue depths 1 to 64, and through the synchronous pwritev() fallback
+// (MINIVSFS_IO=sync), then one fdatasync. Reports MB/s, IOPS and the
+// io_uring_enter() calls, for buffered writes and, where the file system
+// supports it, O_DIRECT ones (the case where the depth really matters).
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ioq.h"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// slots 0..n in a fixed pseudo-random order
+static uint64_t *shuffled(uint64_t n) {
+    uint64_t *v = malloc(n * sizeof(uint64_t));
+    if (v == NULL) return NULL;
+    for (uint64_t i = 0; i < n; i++) v[i] = i;
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (uint64_t i = n - 1; i > 0; i--) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        uint64_t k = x % (i + 1), t = v[i];
+        v[i] = v[k];
+        v[k] = t;
+    }
+    return v;
+}
+
+// One run: writes of `size` bytes to the slots in order, at depth (0 = synchronous).
+// Returns the seconds taken, or -1.
+static double run(int fd, const void *buf, size_t size, const uint64_t *slots, uint64_t n, unsigned depth, ioq_stats_t *stats) {
+    if (depth == 0) setenv("MINIVSFS_IO", "sync", 1);
+    else unsetenv("MINIVSFS_IO");
+    ioq_t q;
+    ioq_init(&q, fd, depth);
+    if (depth > 0 && !ioq_async(&q)) {
+        ioq_free(&q);
+        return -1;
+    }
+    double t0 = now_sec();
+    int rc = 0;
+    for (uint64_t i = 0; i < n && rc == 0; i++) rc = ioq_write(&q, buf, size, slots[i] * size, 0);
+    if (rc == 0) rc = ioq_sync(&q, IOQ_DRAIN);
+    if (ioq_wait(&q) != 0) rc = -1;
+    double t = now_sec() - t0;
+    *stats = q.stats;
+    ioq_free(&q);
+    return rc == 0 ? t : -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    uint64_t mib = argc > 2 ? strtoull(argv[2], NULL, 10) : 64;
+    if (mib == 0) {
+        printf("Error: MiB per run must be positive\n");
+        return 1;
+    }
+    const size_t sizes[] = { 4096, 65536 };
+    const unsigned depths[] = { 0, 1, 4, 16, 64 };
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/bench_ioq.dat", dir);
+    void *buf;
+    if (posix_memalign(&buf, 4096, 65536) != 0) {
+        printf("Error: out of memory\n");
+        return 1;
+    }
+    memset(buf, 0xA5, 65536);
+
+    printf("%8s %6s %8s %10s %10s %10s %10s\n", "mode", "write", "depth", "time", "MB/s", "IOPS", "enters");
+    for (int direct = 0; direct < 2; direct++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            uint64_t n = (mib << 20) / sizes[s];
+            uint64_t *slots = shuffled(4 * n);
+            if (slots == NULL) {
+                printf("Error: out of memory\n");
+                return 1;
+            }
+            for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+                // a fresh, fully allocated file each run: no run pays for another's allocation
+                unlink(path);
+                int fd = open(path, O_RDWR | O_CREAT | (direct ? O_DIRECT : 0), 0644);
+                if (fd < 0) {
+                    if (direct) printf("%8s (O_DIRECT not supported in %s)\n", "direct", dir);
+                    else printf("Error: cannot create %s\n", path);
+                    break;
+                }
+                if (posix_fallocate(fd, 0, (off_t)(4 * n * sizes[s])) != 0) {
+                    printf("Error: cannot allocate %s\n", path);
+                    close(fd);
+                    unlink(path);
+                    return 1;
+                }
+                fdatasync(fd);
+                ioq_stats_t st;
+                double t = run(fd, buf, sizes[s], slots, n, depths[d], &st);
+                close(fd);
+                if (t < 0) {
+                    printf("%8s %5zuK %8u %10s\n", direct ? "direct" : "buffered", sizes[s] >> 10, depths[d],
+                           depths[d] ? "(no io_uring)" : "(failed)");
+                    continue;
+                }
+                char depth[16];
+                if (depths[d]) snprintf(depth, sizeof(depth), "%u", depths[d]);
+                else snprintf(depth, sizeof(depth), "pwritev");
+                printf("%8s %5zuK %8s %8.3f s %10.1f %10.0f %10llu\n", direct ? "direct" : "buffered", sizes[s] >> 10, depth,
+                       t, n * sizes[s] / 1e6 / t, n / t, (unsigned long long)st.enters);
+                fflush(stdout);
+            }
+            free(slots);
+        }
+    }
+    unlink(path);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_mkfs.c -o bench_mkfs
+// Usage: ./bench_mkfs [path-to-mkfs_builder] [scratch-image]
+//        (defaults ./mkfs_builder and /tmp/bench_mkfs.img)
+//
+// Runs mkfs_builder for image sizes from 180 KiB to 64 GiB (one inode per
+// 64 KiB, at least 128) and reports wall time, peak RSS of the builder and
+// the disk space the image really takes. With a sparse format all three
+// should stay flat while the image grows.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    const char* builder = argc > 1 ? argv[1] : "./mkfs_builder";
+    const char* image = argc > 2 ? argv[2] : "/tmp/bench_mkfs.img";
+
+    const uint64_t sizes_kib[] = {
+        180, 4096, 64ull << 10, 1ull << 20, 16ull << 20, 64ull << 20,
+    };
+
+    printf("%12s %10s %10s %12s %12s\n", "size", "inodes", "time", "peak RSS", "on disk");
+    for (size_t i = 0; i < sizeof(sizes_kib) / sizeof(sizes_kib[0]); i++) {
+        uint64_t kib = sizes_kib[i];
+        uint64_t inodes = kib / 64 < 128 ? 128 : kib / 64;
+        char size_arg[32], inode_arg[32];
+        snprintf(size_arg, sizeof(size_arg), "%llu", (unsigned long long)kib);
+        snprintf(inode_arg, sizeof(inode_arg), "%llu", (unsigned long long)inodes);
+
+        double t0 = now_sec();
+        pid_t pid = fork();
+        if (pid < 0) {
+            printf("Error in fork\n");
+            return 1;
+        }
+        if (pid == 0) {
+            // the builder's own output is not part of the report
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+            execl(builder, builder, "--image", image, "--size-kib", size_arg, "--inodes", inode_arg, (char*)NULL);
+            _exit(127);
+        }
+        int status;
+        struct rusage ru;
+        if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("Error: %s failed for %s KiB\n", builder, size_arg);
+            return 1;
+        }
+        double dt = now_sec() - t0;
+
+        struct stat st;
+        if (stat(image, &st) != 0) {
+            printf("Error: no image at %s\n", image);
+            return 1;
+        }
+        printf("%9llu KiB %10llu %8.1fms %9ld KiB %8lld KiB\n",
+               (unsigned long long)kib, (unsigned long long)inodes, dt * 1e3,
+               ru.ru_maxrss, (long long)st.st_blocks / 2);
+        remove(image);
+    }
+    return 0;
+}
@@ -0,0 +1,477 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra bench_suite.c -lm -o bench_suite
+// Usage: ./bench_suite [--seed <n>] [--files <n>] [--profile tiny|mixed|large] [--names flat|nested]
+//                      [--runs <n>] [--samples <n>] [--dir <scratch>] [--bin <tool-dir>] [--json <file>]
+//        (defaults: seed 1, 1000 files, mixed, nested, 5 runs, 100 samples, /dev/shm or else /tmp,
+//         the tools in ., <scratch>/bench_suite.json)
+//
+// Reproducible end-to-end benchmark of the MiniVSFS tools. A workload is
+// generated from the seed alone: file sizes drawn from the profile's
+// distribution, file contents, and names following the pattern (flat: all in
+// the root directory; nested: NESTED_FILES per directory). Then it times, each
+// tool run as its own process with its output discarded:
+//   format    mkfs_builder --seed, runs times
+//   single    mkfs_adder of one file, samples times into the same image
+//   batch     mkfs_adder of the whole workload (--manifest) into a fresh image, runs times
+//   validate  validator --full of the batch image, runs times
+//   read      mkfs_reader of samples files of the batch image
+// and reports per operation (an image formatted or validated, a file added or
+// read): ops/s, MB/s, p50 and p99 latency of one tool run, and the syscalls
+// of one tool run. Syscalls are counted under ptrace in one more run that is
+// not timed (threads included); where ptrace is not allowed they are null.
+//
+// Everything (workload, images) lives under the scratch directory, which is
+// removed at the end: put it on tmpfs (the default) or a local disk with
+// --dir. Results are printed as a table and written as JSON for regression
+// tracking; the workload digest in it tells whether two runs saw the same data.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define NESTED_FILES 256
+#define ROOT_MAX_FILES 766 // 12 dirent blocks of 64 entries, less "." and ".."
+#define NO_SYSCALLS UINT64_MAX
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ---------------------------------------------------------------- workload
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// A size class of a profile: weight percent, sizes log-uniform in [min, max]
+typedef struct {
+    int weight;
+    uint64_t min, max;
+} size_class_t;
+
+typedef struct {
+    const char *name;
+    size_class_t classes[4];
+} profile_t;
+
+static const profile_t profiles[] = {
+    { "tiny",  { { 100, 1, 64 } } },                         // all inline
+    { "mixed", { { 40, 1, 64 }, { 35, 1024, 16384 }, { 20, 16384, 262144 }, { 5, 262144, 4194304 } } },
+    { "large", { { 100, 1048576, 8388608 } } },
+};
+
+static uint64_t draw_size(const profile_t *p, uint64_t *rng) {
+    int pick = (int)(splitmix64(rng) % 100);
+    const size_class_t *c = &p->classes[0];
+    for (int i = 0; i < 4 && p->classes[i].weight > 0; i++) {
+        c = &p->classes[i];
+        if (pick < c->weight) break;
+        pick -= c->weight;
+    }
+    // log-uniform: as many small files as big ones per doubling of the size
+    double u = (double)(splitmix64(rng) >> 11) / (double)(1ULL << 53);
+    double lo = (double)c->min, hi = (double)c->max;
+    uint64_t size = (uint64_t)(lo * pow(hi / lo, u));
+    return size < c->min ? c->min : size > c->max ? c->max : size;
+}
+
+typedef struct {
+    char name[64];      // relative to the work directory, also the image path
+    uint64_t size;
+} wfile_t;
+
+typedef struct {
+    wfile_t *files;
+    uint32_t count;
+    uint64_t bytes;
+    uint32_t dirs;
+    uint64_t digest;    // FNV-1a of every name and byte
+} workload_t;
+
+static void fnv(uint64_t *h, const void *p, size_t n) {
+    const uint8_t *b = p;
+    for (size_t i = 0; i < n; i++) *h = (*h ^ b[i]) * 0x100000001B3ULL;
+}
+
+// Writes the files under work/ (cwd-relative names). 0 or -1.
+static int make_workload(workload_t *w, const char *work, const profile_t *p, int nested, uint32_t count, uint64_t seed) {
+    uint64_t rng = seed;
+    char path[PATH_MAX + 80];
+    static uint64_t buf[8192];
+    w->files = calloc(count, sizeof(wfile_t));
+    if (w->files == NULL) return -1;
+    w->count = count;
+    w->bytes = 0;
+    w->dirs = nested ? (count + NESTED_FILES - 1) / NESTED_FILES : 0;
+    w->digest = 0xCBF29CE484222325ULL;
+    for (uint32_t d = 0; d < w->dirs; d++) {
+        snprintf(path, sizeof(path), "%s/d%04u", work, d);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        wfile_t *f = &w->files[i];
+        if (nested) snprintf(f->name, sizeof(f->name), "d%04u/f%06u.dat", i / NESTED_FILES, i);
+        else snprintf(f->name, sizeof(f->name), "f%06u.dat", i);
+        f->size = draw_size(p, &rng);
+        w->bytes += f->size;
+        fnv(&w->digest, f->name, strlen(f->name));
+
+        snprintf(path, sizeof(path), "%s/%s", work, f->name);
+        FILE *out = fopen(path, "wb");
+        if (out == NULL) return -1;
+        for (uint64_t done = 0; done < f->size;) {
+            size_t n = f->size - done < sizeof(buf) ? (size_t)(f->size - done) : sizeof(buf);
+            for (size_t k = 0; k < (n + 7) / 8; k++) buf[k] = splitmix64(&rng);
+            fnv(&w->digest, buf, n);
+            if (fwrite(buf, 1, n, out) != n) {
+                fclose(out);
+                return -1;
+            }
+            done += n;
+        }
+        if (fclose(out) != 0) return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------- tool runs
+
+// Runs argv (argv[0] an absolute path) in directory cwd, output discarded.
+// Returns the wall time in seconds, or -1 if it could not run or failed.
+// With syscalls it runs under ptrace and *syscalls gets the syscalls of all
+// its threads (NO_SYSCALLS if tracing is not allowed here).
+static double run(char *const argv[], const char *cwd, uint64_t *syscalls) {
+    double t0 = now_sec();
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        if (chdir(cwd) != 0) _exit(127);
+        if (syscalls) ptrace(PTRACE_TRACEME, 0, NULL, NULL);   // if refused, runs untraced
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    if (syscalls == NULL) {
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+        return now_sec() - t0;
+    }
+
+    // traced: the child stops at its exec; every syscall then stops each
+    // thread twice (entry and exit), told apart from signals by TRACESYSGOOD
+    *syscalls = NO_SYSCALLS;
+    if (waitpid(pid, &status, 0) < 0) return -1;
+    if (!WIFSTOPPED(status)) return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? now_sec() - t0 : -1;
+    ptrace(PTRACE_SETOPTIONS, pid, NULL,
+           (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_EXITKILL));
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+    uint64_t stops = 0;
+    int rc = -1;
+    for (;;) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0) break;   // ECHILD: every thread is gone
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == pid) rc = WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+            continue;
+        }
+        int sig = WSTOPSIG(status), deliver = 0;
+        if (sig == (SIGTRAP | 0x80)) stops++;
+        else if (status >> 16 == 0 && sig != SIGTRAP && sig != SIGSTOP) deliver = sig;  // a real signal
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void *)(long)deliver);
+    }
+    *syscalls = (stops + 1) / 2;   // exit_group stops only on entry
+    return rc == 0 ? now_sec() - t0 : -1;
+}
+
+// ---------------------------------------------------------------- results
+
+typedef struct {
+    const char *op;
+    uint64_t ops;          // images formatted or validated, files added or read
+    uint64_t runs;         // tool runs timed
+    uint64_t bytes;        // file data the ops moved (format: image size)
+    double seconds;        // all timed runs
+    double *lat;           // seconds of each run
+    uint64_t syscalls;     // of one run, or NO_SYSCALLS
+} result_t;
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of the sorted run times, in ms
+static double percentile_ms(const result_t *r, int p) {
+    if (r->runs == 0) return 0;
+    uint64_t rank = (r->runs * p + 99) / 100;
+    return r->lat[rank ? rank - 1 : 0] * 1e3;
+}
+
+static int timed(result_t *r, char *const argv[], const char *cwd) {
+    double t = run(argv, cwd, NULL);
+    if (t < 0) {
+        printf("Error: %s failed (%s)\n", argv[0], r->op);
+        return -1;
+    }
+    r->lat[r->runs++] = t;
+    r->seconds += t;
+    return 0;
+}
+
+static void report(result_t *res, int n, FILE *json) {
+    printf("%-9s %7s %12s %10s %10s %10s %10s\n", "op", "ops", "ops/s", "MB/s", "p50 ms", "p99 ms", "syscalls");
+    for (int i = 0; i < n; i++) {
+        result_t *r = &res[i];
+        qsort(r->lat, r->runs, sizeof(double), cmp_double);
+        double ops_s = r->seconds > 0 ? r->ops / r->seconds : 0, mb_s = r->seconds > 0 ? r->bytes / r->seconds / 1e6 : 0;
+        char sc[32] = "n/a";
+        if (r->syscalls != NO_SYSCALLS) snprintf(sc, sizeof(sc), "%llu", (unsigned long long)r->syscalls);
+        printf("%-9s %7llu %12.1f %10.1f %10.3f %10.3f %10s\n", r->op, (unsigned long long)r->ops, ops_s, mb_s,
+               percentile_ms(r, 50), percentile_ms(r, 99), sc);
+        if (r->syscalls == NO_SYSCALLS) snprintf(sc, sizeof(sc), "null");
+        fprintf(json,
+                "    \"%s\": {\"ops\": %llu, \"runs\": %llu, \"bytes\": %llu, \"seconds\": %.6f, \"ops_per_s\": %.3f, "
+                "\"mb_per_s\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"syscalls_per_run\": %s}%s\n",
+                r->op, (unsigned long long)r->ops, (unsigned long long)r->runs, (unsigned long long)r->bytes,
+                r->seconds, ops_s, mb_s, percentile_ms(r, 50), percentile_ms(r, 99), sc, i + 1 < n ? "," : "");
+    }
+}
+
+// ---------------------------------------------------------------- main
+
+int main(int argc, char *argv[]) {
+    uint64_t seed = 1;
+    uint32_t nfiles = 1000, runs = 5, samples = 100;
+    const profile_t *profile = &profiles[1];
+    int nested = 1;
+    const char *scratch_root = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+    const char *bin_dir = ".", *json_path = NULL;
+
+    static const struct option long_options[] = {
+        {"seed", required_argument, NULL, 'r'},
+        {"files", required_argument, NULL, 'f'},
+        {"profile", required_argument, NULL, 'p'},
+        {"names", required_argument, NULL, 'n'},
+        {"runs", required_argument, NULL, 'R'},
+        {"samples", required_argument, NULL, 's'},
+        {"dir", required_argument, NULL, 'd'},
+        {"bin", required_argument, NULL, 'b'},
+        {"json", required_argument, NULL, 'j'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "r:f:p:n:R:s:d:b:j:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'r': seed = strtoull(optarg, NULL, 10); break;
+        case 'f': nfiles = (uint32_t)strtoul(optarg, NULL, 10); break;
+        case 'p':
+            profile = NULL;
+            for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+                if (strcmp(optarg, profiles[i].name) == 0) profile = &profiles[i];
+            }
+            if (profile == NULL) {
+                printf("Unknown profile %s: tiny, mixed or large\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            if (strcmp(optarg, "flat") != 0 && strcmp(optarg, "nested") != 0) {
+                printf("Unknown name pattern %s: flat or nested\n", optarg);
+                return 1;
+            }
+            nested = strcmp(optarg, "nested") == 0;
+            break;
+        case 'R': runs = (uint32_t)strtoul(optarg, NULL, 10); break;
+        case 's': samples = (uint32_t)strtoul(optarg, NULL, 10); break;
+        case 'd': scratch_root = optarg; break;
+        case 'b': bin_dir = optarg; break;
+        case 'j': json_path = optarg; break;
+        default:
+            printf("Usage: %s [--seed <n>] [--files <n>] [--profile tiny|mixed|large] [--names flat|nested] "
+                   "[--runs <n>] [--samples <n>] [--dir <scratch>] [--bin <tool-dir>] [--json <file>]\n", argv[0]);
+            return 1;
+        }
+    }
+    // a seed of 0 would leave mkfs_builder on the clock
+    if (seed == 0 || nfiles < 2 || runs == 0 || samples == 0) {
+        printf("Invalid arguments: seed, runs and samples at least 1, files at least 2\n");
+        return 1;
+    }
+    if (!nested && nfiles > ROOT_MAX_FILES) {
+        printf("Invalid files: at most %d with --names flat (one directory)\n", ROOT_MAX_FILES);
+        return 1;
+    }
+    if (samples >= nfiles) samples = nfiles - 1;   // the single adds leave one file for the traced run
+
+    // tools by absolute path: they run with the work directory as cwd
+    char bin[PATH_MAX], builder[PATH_MAX + 16], adder[PATH_MAX + 16], reader[PATH_MAX + 16], validator[PATH_MAX + 16];
+    if (realpath(bin_dir, bin) == NULL) {
+        printf("Error: no tool directory %s\n", bin_dir);
+        return 1;
+    }
+    snprintf(builder, sizeof(builder), "%s/mkfs_builder", bin);
+    snprintf(adder, sizeof(adder), "%s/mkfs_adder", bin);
+    snprintf(reader, sizeof(reader), "%s/mkfs_reader", bin);
+    snprintf(validator, sizeof(validator), "%s/validator", bin);
+    const char *tools[] = { builder, adder, reader, validator };
+    for (int i = 0; i < 4; i++) {
+        if (access(tools[i], X_OK) != 0) {
+            printf("Error: %s is missing (build the tools first, or --bin)\n", tools[i]);
+            return 1;
+        }
+    }
+
+    char scratch[PATH_MAX], work[PATH_MAX + 8], image[PATH_MAX + 16], manifest[PATH_MAX + 16], json_default[PATH_MAX + 32];
+    snprintf(scratch, sizeof(scratch), "%s/bench_suite.%d", scratch_root, (int)getpid());
+    snprintf(work, sizeof(work), "%s/work", scratch);
+    snprintf(image, sizeof(image), "%s/fs.img", scratch);
+    snprintf(manifest, sizeof(manifest), "%s/manifest", scratch);
+    snprintf(json_default, sizeof(json_default), "%s/bench_suite.json", scratch_root);
+    if (json_path == NULL) json_path = json_default;
+    if (mkdir(scratch, 0755) != 0 || mkdir(work, 0755) != 0) {
+        printf("Error creating %s\n", scratch);
+        return 1;
+    }
+
+    workload_t w;
+    printf("Generating %u files (%s, %s, seed %llu) in %s\n", nfiles, profile->name, nested ? "nested" : "flat",
+           (unsigned long long)seed, work);
+    if (make_workload(&w, work, profile, nested, nfiles, seed) != 0) {
+        printf("Error writing the workload in %s\n", work);
+        return 1;
+    }
+    FILE *mf = fopen(manifest, "w");
+    if (mf == NULL) return 1;
+    for (uint32_t i = 0; i < w.count; i++) fprintf(mf, "%s\n", w.files[i].name);
+    fclose(mf);
+
+    // image: the data, an indirect block per 1024 blocks and per file, room for
+    // the journal and the directories, plus a quarter
+    uint64_t blocks = 0;
+    for (uint32_t i = 0; i < w.count; i++) blocks += (w.files[i].size + 4095) / 4096 + w.files[i].size / (4096 * 1024) + 2;
+    uint64_t size_kib = ((blocks + w.dirs * 2 + 2048) * 5 / 4) * 4;
+    char size_arg[32], inodes_arg[32], seed_arg[32];
+    snprintf(size_arg, sizeof(size_arg), "%llu", (unsigned long long)size_kib);
+    snprintf(inodes_arg, sizeof(inodes_arg), "%u", w.count + w.dirs + 128);
+    snprintf(seed_arg, sizeof(seed_arg), "%llu", (unsigned long long)seed);
+    printf("Workload: %.1f MiB in %u files, %u directories, digest %016llx; image %llu KiB\n\n", w.bytes / 1048576.0,
+           w.count, w.dirs, (unsigned long long)w.digest, (unsigned long long)size_kib);
+
+    char *format_argv[] = { builder, "--image", image, "--size-kib", size_arg, "--inodes", inodes_arg, "--seed", seed_arg, NULL };
+    char *batch_argv[] = { adder, "--input", image, "--in-place", "--manifest", manifest, NULL };
+    char *validate_argv[] = { validator, "--full", image, NULL };
+    char name_arg[64];
+    char *single_argv[] = { adder, "--input", image, "--in-place", "--file", name_arg, NULL };
+    char *read_argv[] = { reader, "--input", image, "--file", name_arg, "--output", "/dev/null", NULL };
+
+    uint64_t max_runs = runs > samples ? runs : samples;
+    result_t res[5] = {
+        { .op = "format" }, { .op = "single" }, { .op = "batch" }, { .op = "validate" }, { .op = "read" },
+    };
+    for (int i = 0; i < 5; i++) {
+        res[i].lat = calloc(max_runs, sizeof(double));
+        if (res[i].lat == NULL) return 1;
+    }
+    int ok = 1;
+    uint64_t pick = seed;
+
+    // format
+    for (uint32_t i = 0; ok && i < runs; i++) {
+        ok = timed(&res[0], format_argv, work) == 0;
+        res[0].ops++;
+        res[0].bytes += size_kib * 1024;
+    }
+    ok = ok && run(format_argv, work, &res[0].syscalls) >= 0;
+
+    // single adds: samples files one run each, then one traced
+    for (uint32_t i = 0; ok && i <= samples; i++) {
+        snprintf(name_arg, sizeof(name_arg), "%s", w.files[i].name);
+        if (i == samples) {
+            ok = run(single_argv, work, &res[1].syscalls) >= 0;
+            break;
+        }
+        ok = timed(&res[1], single_argv, work) == 0;
+        res[1].ops++;
+        res[1].bytes += w.files[i].size;
+    }
+
+    // batch adds, each into a fresh image (the format is not timed); the last
+    // one traced, its image kept for validate and read
+    for (uint32_t i = 0; ok && i <= runs; i++) {
+        ok = run(format_argv, work, NULL) >= 0;
+        if (ok && i == runs) ok = run(batch_argv, work, &res[2].syscalls) >= 0;
+        else if (ok) {
+            ok = timed(&res[2], batch_argv, work) == 0;
+            res[2].ops += w.count;
+            res[2].bytes += w.bytes;
+        }
+    }
+
+    // validate
+    for (uint32_t i = 0; ok && i < runs; i++) {
+        ok = timed(&res[3], validate_argv, work) == 0;
+        res[3].ops++;
+        res[3].bytes += w.bytes;
+    }
+    ok = ok && run(validate_argv, work, &res[3].syscalls) >= 0;
+
+    // reads of seeded random files
+    for (uint32_t i = 0; ok && i <= samples; i++) {
+        const wfile_t *f = &w.files[splitmix64(&pick) % w.count];
+        snprintf(name_arg, sizeof(name_arg), "%s", f->name);
+        if (i == samples) {
+            ok = run(read_argv, work, &res[4].syscalls) >= 0;
+            break;
+        }
+        ok = timed(&res[4], read_argv, work) == 0;
+        res[4].ops++;
+        res[4].bytes += f->size;
+    }
+
+    if (ok) {
+        FILE *json = fopen(json_path, "w");
+        if (json == NULL) {
+            printf("Error opening %s\n", json_path);
+            ok = 0;
+        } else {
+            fprintf(json, "{\n  \"seed\": %llu,\n  \"profile\": \"%s\",\n  \"names\": \"%s\",\n  \"files\": %u,\n"
+                          "  \"bytes\": %llu,\n  \"directories\": %u,\n  \"digest\": \"%016llx\",\n  \"image_kib\": %llu,\n"
+                          "  \"runs\": %u,\n  \"samples\": %u,\n  \"scratch\": \"%s\",\n  \"results\": {\n",
+                    (unsigned long long)seed, profile->name, nested ? "nested" : "flat", w.count,
+                    (unsigned long long)w.bytes, w.dirs, (unsigned long long)w.digest, (unsigned long long)size_kib,
+                    runs, samples, scratch_root);
+            report(res, 5, json);
+            fprintf(json, "  }\n}\n");
+            if (fclose(json) != 0) ok = 0;
+            else printf("\nResults written to %s\n", json_path);
+        }
+    }
+
+    char cmd[PATH_MAX + 32];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", scratch);
+    if (system(cmd) != 0) printf("Error removing %s\n", scratch);
+    for (int i = 0; i < 5; i++) free(res[i].lat);
+    free(w.files);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,486 @@
+// bitmap.c — word-at-a-time free-bit search over on-disk bitmap blocks, with an optional free-space summary
+#include "bitmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_WORDS (BITMAP_CHUNK_BITS / 64)
+
+struct bitmap_sum {
+    uint8_t* word_free;    // clear bits per word, 0..64
+    uint32_t* chunk_free;  // per chunk of CHUNK_WORDS words
+    uint64_t* group_free;  // per BITMAP_GROUP_CHUNKS chunks
+    uint64_t free;
+    // shape of each chunk, valid unless stale
+    uint32_t* prefix;      // clear bits at its start
+    uint32_t* suffix;      // clear bits at its end
+    uint32_t* longest;     // longest run of clear bits in it (or the part of one that is)
+    uint8_t* stale;
+    uint64_t nchunks, ngroups;
+};
+
+// Bits past nbits in the last word read as allocated so they are never found
+static uint64_t tail_mask(const bitmap_t* bm) {
+    unsigned used = (unsigned)(bm->nbits & 63);
+    return used ? ~((UINT64_C(1) << used) - 1) : 0;
+}
+
+// Word w with bit k = object w*64+k, independent of host byte order
+static uint64_t load_word(const bitmap_t* bm, uint64_t w) {
+    const uint8_t* p = bm->bytes + w * 8;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+    memcpy(&v, p, 8);
+#else
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+#endif
+    if (w == bm->nwords - 1) v |= tail_mask(bm);
+    return v;
+}
+
+void bitmap_init(bitmap_t* bm, uint8_t* bytes, uint64_t nbits) {
+    bm->bytes = bytes;
+    bm->nbits = nbits;
+    bm->nwords = (nbits + 63) / 64;
+    bm->hint = 0;
+    bm->sum = NULL;
+    bm->lo = 0;
+    bm->hi = nbits;
+}
+
+void bitmap_window(bitmap_t* bm, uint64_t lo, uint64_t hi) {
+    bm->hi = hi < bm->nbits ? hi : bm->nbits;
+    bm->lo = lo < bm->hi ? lo : bm->hi;
+}
+
+// Words that hold the window
+static uint64_t hi_word(const bitmap_t* bm) {
+    return (bm->hi + 63) / 64;
+}
+
+// ---- summary upkeep ----
+
+// Bits in chunk c (the last one may be short)
+static uint64_t chunk_bits(const bitmap_t* bm, uint64_t c) {
+    uint64_t lo = c * BITMAP_CHUNK_BITS;
+    return bm->nbits - lo < BITMAP_CHUNK_BITS ? bm->nbits - lo : BITMAP_CHUNK_BITS;
+}
+
+// The clear bits of word w went up by delta (negative: down)
+static void sum_add(struct bitmap_sum* s, uint64_t w, int64_t delta) {
+    uint64_t c = w / CHUNK_WORDS;
+    s->word_free[w] = (uint8_t)(s->word_free[w] + delta);
+    s->chunk_free[c] = (uint32_t)(s->chunk_free[c] + delta);
+    s->group_free[c / BITMAP_GROUP_CHUNKS] += (uint64_t)delta;
+    s->free += (uint64_t)delta;
+    s->stale[c] = 1;
+}
+
+// Bits [first, end) were written as whole bytes: recount their words
+static void sum_recount(bitmap_t* bm, uint64_t first, uint64_t end) {
+    if (bm->sum == NULL || first >= end) return;
+    for (uint64_t w = first / 64; w <= (end - 1) / 64; w++) {
+        int64_t now = 64 - __builtin_popcountll(load_word(bm, w));
+        if (now != bm->sum->word_free[w]) sum_add(bm->sum, w, now - bm->sum->word_free[w]);
+    }
+}
+
+void bitmap_release(bitmap_t* bm) {
+    struct bitmap_sum* s = bm->sum;
+    if (s == NULL) return;
+    free(s->word_free);
+    free(s->chunk_free);
+    free(s->group_free);
+    free(s->prefix);
+    free(s->suffix);
+    free(s->longest);
+    free(s->stale);
+    free(s);
+    bm->sum = NULL;
+}
+
+int bitmap_summarize(bitmap_t* bm) {
+    bitmap_release(bm);
+    struct bitmap_sum* s = calloc(1, sizeof(*s));
+    if (s == NULL) return -1;
+    bm->sum = s;
+    s->nchunks = (bm->nwords + CHUNK_WORDS - 1) / CHUNK_WORDS;
+    s->ngroups = (s->nchunks + BITMAP_GROUP_CHUNKS - 1) / BITMAP_GROUP_CHUNKS;
+    s->word_free = malloc(bm->nwords ? bm->nwords : 1);
+    s->chunk_free = calloc(s->nchunks + 1, sizeof(uint32_t));
+    s->group_free = calloc(s->ngroups + 1, sizeof(uint64_t));
+    s->prefix = calloc(s->nchunks + 1, sizeof(uint32_t));
+    s->suffix = calloc(s->nchunks + 1, sizeof(uint32_t));
+    s->longest = calloc(s->nchunks + 1, sizeof(uint32_t));
+    s->stale = malloc(s->nchunks + 1);
+    if (s->word_free == NULL || s->chunk_free == NULL || s->group_free == NULL || s->prefix == NULL ||
+        s->suffix == NULL || s->longest == NULL || s->stale == NULL) {
+        bitmap_release(bm);
+        return -1;
+    }
+    for (uint64_t w = 0; w < bm->nwords; w++) {
+        uint32_t f = 64 - (uint32_t)__builtin_popcountll(load_word(bm, w));
+        s->word_free[w] = (uint8_t)f;
+        s->chunk_free[w / CHUNK_WORDS] += f;
+        s->free += f;
+    }
+    for (uint64_t c = 0; c < s->nchunks; c++) s->group_free[c / BITMAP_GROUP_CHUNKS] += s->chunk_free[c];
+    memset(s->stale, 1, s->nchunks + 1);
+    return 0;
+}
+
+int bitmap_test(const bitmap_t* bm, uint64_t bit) {
+    return (bm->bytes[bit >> 3] >> (bit & 7)) & 1;
+}
+
+void bitmap_set(bitmap_t* bm, uint64_t bit) {
+    if (bm->sum != NULL && !bitmap_test(bm, bit)) sum_add(bm->sum, bit / 64, -1);
+    bm->bytes[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+}
+
+void bitmap_clear(bitmap_t* bm, uint64_t bit) {
+    if (bm->sum != NULL && bitmap_test(bm, bit)) sum_add(bm->sum, bit / 64, 1);
+    bm->bytes[bit >> 3] &= (uint8_t)~(1u << (bit & 7));
+    // keep the hint at the lowest known hole so it gets reused first
+    if (bit < bm->hint) bm->hint = bit;
+}
+
+// Scan words [from_word, to_word) for a clear bit at or after `from`
+static int64_t scan(const bitmap_t* bm, uint64_t from, uint64_t to_word) {
+    for (uint64_t w = from / 64; w < to_word; w++) {
+        uint64_t v = load_word(bm, w);
+        if (w == from / 64) v |= (UINT64_C(1) << (from & 63)) - 1; // ignore bits before `from`
+        if (v != UINT64_MAX) {
+            return (int64_t)(w * 64 + (uint64_t)__builtin_ctzll(~v));
+        }
+    }
+    return -1;
+}
+
+// A bit scan() found, -1 unless it is inside the window
+static int64_t in_window(const bitmap_t* bm, int64_t bit) {
+    return bit >= 0 && (uint64_t)bit < bm->hi ? bit : -1;
+}
+
+// scan() to the end of the window through the summary: the word of `from`,
+// the rest of its chunk by word counts, then the next chunk with a clear bit,
+// passing over whole groups without one
+static int64_t sum_scan(const bitmap_t* bm, uint64_t from) {
+    const struct bitmap_sum* s = bm->sum;
+    if (from >= bm->hi) return -1;
+    uint64_t hw = hi_word(bm), hc = (hw + CHUNK_WORDS - 1) / CHUNK_WORDS;
+    uint64_t w = from / 64, c = w / CHUNK_WORDS;
+    uint64_t v = load_word(bm, w) | ((UINT64_C(1) << (from & 63)) - 1);
+    if (v != UINT64_MAX) return in_window(bm, (int64_t)(w * 64 + (uint64_t)__builtin_ctzll(~v)));
+    w++;
+    for (;;) {
+        uint64_t end = (c + 1) * CHUNK_WORDS < hw ? (c + 1) * CHUNK_WORDS : hw;
+        if (s->chunk_free[c] > 0) {
+            // the counts of 8 words at a time, then the word
+            for (; w < end; w++) {
+                uint64_t eight;
+                if ((w & 7) == 0 && w + 8 <= end && (memcpy(&eight, s->word_free + w, 8), eight == 0)) {
+                    w += 7;
+                    continue;
+                }
+                if (s->word_free[w] > 0) {
+                    return in_window(bm, (int64_t)(w * 64 + (uint64_t)__builtin_ctzll(~load_word(bm, w))));
+                }
+            }
+        }
+        c++;
+        while (c < hc && s->chunk_free[c] == 0) {
+            if (c % BITMAP_GROUP_CHUNKS == 0 && s->group_free[c / BITMAP_GROUP_CHUNKS] == 0) c += BITMAP_GROUP_CHUNKS;
+            else c++;
+        }
+        if (c >= hc) return -1;
+        w = c * CHUNK_WORDS;
+    }
+}
+
+int64_t bitmap_find_free(const bitmap_t* bm) {
+    if (bm->lo >= bm->hi) return -1;
+    uint64_t start = bm->hint >= bm->lo && bm->hint < bm->hi ? bm->hint : bm->lo;
+    if (bm->sum != NULL) {
+        if (bm->sum->free == 0) return -1;
+        int64_t bit = sum_scan(bm, start);
+        return bit < 0 ? sum_scan(bm, bm->lo) : bit;
+    }
+    int64_t bit = in_window(bm, scan(bm, start, hi_word(bm)));
+    if (bit < 0 && start > bm->lo) bit = scan(bm, bm->lo, start / 64 + 1); // wrap around once
+    return bit;
+}
+
+int64_t bitmap_alloc(bitmap_t* bm) {
+    int64_t bit = bitmap_find_free(bm);
+    if (bit < 0) return -1;
+    bitmap_set(bm, (uint64_t)bit);
+    bm->hint = (uint64_t)bit + 1;
+    return bit;
+}
+
+int bitmap_alloc_n(bitmap_t* bm, uint64_t n, uint64_t* out) {
+    uint64_t saved_hint = bm->hint;
+    if (bm->sum != NULL && bm->sum->free < n) return -1;
+    for (uint64_t i = 0; i < n; i++) {
+        int64_t bit = bitmap_alloc(bm);
+        if (bit < 0) {
+            // roll back so a failed request leaves the bitmap untouched
+            for (uint64_t j = 0; j < i; j++) bitmap_clear(bm, out[j]);
+            bm->hint = saved_hint;
+            return -1;
+        }
+        out[i] = (uint64_t)bit;
+    }
+    return 0;
+}
+
+uint64_t bitmap_count_free(const bitmap_t* bm) {
+    if (bm->sum != NULL) return bm->sum->free;
+    uint64_t used = 0;
+    for (uint64_t w = 0; w < bm->nwords; w++) used += (uint64_t)__builtin_popcountll(load_word(bm, w));
+    return bm->nwords * 64 - used;
+}
+
+uint64_t bitmap_count_free_in(const bitmap_t* bm, uint64_t lo, uint64_t hi) {
+    uint64_t n = 0;
+    if (hi > bm->nbits) hi = bm->nbits;
+    while (lo < hi) {
+        uint64_t c = lo / BITMAP_CHUNK_BITS;
+        if (bm->sum != NULL && lo % BITMAP_CHUNK_BITS == 0 && hi - lo >= chunk_bits(bm, c)) {
+            n += bm->sum->chunk_free[c];
+            lo += chunk_bits(bm, c);
+        } else if (lo % 64 == 0 && hi - lo >= 64) {
+            n += bm->sum != NULL ? bm->sum->word_free[lo / 64] : 64 - (uint64_t)__builtin_popcountll(load_word(bm, lo / 64));
+            lo += 64;
+        } else {
+            n += !bitmap_test(bm, lo++);   // the ends of the range
+        }
+    }
+    return n;
+}
+
+void bitmap_set_range(bitmap_t* bm, uint64_t first, uint64_t n) {
+    uint64_t end = first + n;
+    while (first < end && (first & 7)) bitmap_set(bm, first++);
+    if (end - first >= 8) {
+        // whole bytes in the middle
+        uint64_t bytes = (end - first) >> 3;
+        memset(bm->bytes + (first >> 3), 0xFF, bytes);
+        sum_recount(bm, first, first + bytes * 8);
+        first += bytes * 8;
+    }
+    while (first < end) bitmap_set(bm, first++);
+}
+
+void bitmap_clear_range(bitmap_t* bm, uint64_t first, uint64_t n) {
+    uint64_t end = first + n;
+    if (n == 0) return;
+    bitmap_clear(bm, first); // lowers the hint
+    first++;
+    while (first < end && (first & 7)) bitmap_clear(bm, first++);
+    if (end - first >= 8) {
+        uint64_t bytes = (end - first) >> 3;
+        memset(bm->bytes + (first >> 3), 0, bytes);
+        sum_recount(bm, first, first + bytes * 8);
+        first += bytes * 8;
+    }
+    while (first < end) bitmap_clear(bm, first++);
+}
+
+// First set bit at or after `from` in words before to_word (bits past nbits
+// read as set), so a run ends there; to_word * 64 if there is none. With a
+// summary, chunks with no set bit are passed over whole.
+static uint64_t scan_set(const bitmap_t* bm, uint64_t from, uint64_t to_word) {
+    for (uint64_t w = from / 64; w < to_word; w++) {
+        if (bm->sum != NULL && w % CHUNK_WORDS == 0 &&
+            bm->sum->chunk_free[w / CHUNK_WORDS] == chunk_bits(bm, w / CHUNK_WORDS)) {
+            w += CHUNK_WORDS - 1;
+            continue;
+        }
+        uint64_t v = load_word(bm, w);
+        if (w == from / 64) v &= ~((UINT64_C(1) << (from & 63)) - 1); // ignore bits before `from`
+        if (v != 0) return w * 64 + (uint64_t)__builtin_ctzll(v);
+    }
+    return to_word * 64;
+}
+
+int bitmap_next_run(const bitmap_t* bm, uint64_t from, uint64_t* start, uint64_t* len) {
+    if (from < bm->lo) from = bm->lo;
+    if (from >= bm->hi) return 0;
+    int64_t s = bm->sum != NULL ? sum_scan(bm, from) : in_window(bm, scan(bm, from, hi_word(bm)));
+    if (s < 0) return 0;
+    uint64_t e = scan_set(bm, (uint64_t)s, hi_word(bm));
+    if (e > bm->hi) e = bm->hi;
+    *start = (uint64_t)s;
+    *len = e - (uint64_t)s;
+    return 1;
+}
+
+// Next run at or after `from` that starts before `hi`, cut off at hi
+static int chunk_run(const bitmap_t* bm, uint64_t from, uint64_t hi, uint64_t* start, uint64_t* len) {
+    uint64_t to_word = (hi + 63) / 64;
+    int64_t s = from < hi ? scan(bm, from, to_word) : -1;
+    if (s < 0 || (uint64_t)s >= hi) return 0;
+    uint64_t e = scan_set(bm, (uint64_t)s, to_word);
+    *start = (uint64_t)s;
+    *len = (e < hi ? e : hi) - (uint64_t)s;
+    return 1;
+}
+
+// What a run search keeps: want 0 looks for the longest run, otherwise for
+// the best fit for want bits
+typedef struct {
+    uint64_t want;
+    uint64_t len;          // best so far: 0 / UINT64_MAX for none
+    uint64_t start;
+    uint64_t carry;        // the run reaching the start of the next chunk
+    uint64_t carry_start;
+} run_pick_t;
+
+// Weighs the run [at, at + len); 1 once nothing can beat what was picked
+static int pick(run_pick_t* p, uint64_t at, uint64_t len) {
+    if (p->want ? len >= p->want && len < p->len : len > p->len) {
+        p->len = len;
+        p->start = at;
+    }
+    return p->want != 0 && p->len == p->want;
+}
+
+// Chunk c, not all clear, with a stale shape: every run in it is weighed (the
+// first one joined to the carry), and its shape recorded on the way unless
+// the search ends in it. The run at its end becomes the carry. 1 when done.
+static int walk_chunk(const bitmap_t* bm, uint64_t c, run_pick_t* p) {
+    struct bitmap_sum* s = bm->sum;
+    uint64_t lo = c * BITMAP_CHUNK_BITS, hi = lo + chunk_bits(bm, c);
+    uint64_t pre = 0, suf = 0, longest = 0, at, len;
+    if (p->carry > 0 && bitmap_test(bm, lo) && pick(p, p->carry_start, p->carry)) return 1;
+    for (uint64_t from = lo; chunk_run(bm, from, hi, &at, &len); from = at + len) {
+        if (len > longest) longest = len;
+        if (at + len == hi) {
+            suf = len;
+        } else if (at == lo) {
+            pre = len;
+            if (p->carry == 0) p->carry_start = lo;
+            if (pick(p, p->carry_start, p->carry + len)) return 1;
+        } else if (pick(p, at, len)) {
+            return 1;
+        }
+    }
+    s->prefix[c] = (uint32_t)pre;
+    s->suffix[c] = (uint32_t)suf;
+    s->longest[c] = (uint32_t)longest;
+    s->stale[c] = 0;
+    p->carry = suf;
+    p->carry_start = hi - suf;
+    return 0;
+}
+
+// Run search through the summary, in address order like the plain loops: runs
+// that cross chunk edges are put together from suffixes, clear chunks and
+// prefixes, and only chunks whose longest run could win are looked into.
+// Stale chunks are walked whole, which brings their shape up to date.
+static void sum_find_run(const bitmap_t* bm, run_pick_t* p) {
+    const struct bitmap_sum* s = bm->sum;
+    uint64_t hc = (bm->hi + BITMAP_CHUNK_BITS - 1) / BITMAP_CHUNK_BITS;
+    for (uint64_t c = bm->lo / BITMAP_CHUNK_BITS; c < hc; c++) {
+        uint64_t lo = c * BITMAP_CHUNK_BITS, bits = chunk_bits(bm, c), hi = lo + bits;
+        if (s->chunk_free[c] == bits) {
+            if (p->carry == 0) p->carry_start = lo;
+            p->carry += bits;
+            continue;
+        }
+        if (s->stale[c]) {
+            if (walk_chunk(bm, c, p)) return;
+            continue;
+        }
+        if (p->carry + s->prefix[c] > 0) {
+            if (p->carry == 0) p->carry_start = lo;
+            if (pick(p, p->carry_start, p->carry + s->prefix[c])) return;
+        }
+        if (p->want ? s->longest[c] >= p->want : s->longest[c] > p->len) {
+            // the runs inside: after the prefix run, before the suffix run
+            uint64_t at, len;
+            for (uint64_t from = lo + s->prefix[c]; chunk_run(bm, from, hi, &at, &len) && at + len < hi; from = at + len) {
+                if (pick(p, at, len)) return;
+            }
+        }
+        p->carry = s->suffix[c];
+        p->carry_start = hi - p->carry;
+    }
+    if (p->carry > 0) pick(p, p->carry_start, p->carry);
+}
+
+// The summary can answer run searches: the window is whole chunks
+static int sum_runs(const bitmap_t* bm) {
+    return bm->sum != NULL && bm->lo % BITMAP_CHUNK_BITS == 0 &&
+           (bm->hi % BITMAP_CHUNK_BITS == 0 || bm->hi == bm->nbits);
+}
+
+int64_t bitmap_find_run(const bitmap_t* bm, uint64_t n) {
+    int64_t best = -1;
+    uint64_t best_len = UINT64_MAX;
+    uint64_t s, len;
+    if (n == 0) return -1;
+    if (sum_runs(bm)) {
+        run_pick_t p = { n, UINT64_MAX, 0, 0, 0 };
+        if (bm->sum->free >= n) sum_find_run(bm, &p);
+        return p.len != UINT64_MAX ? (int64_t)p.start : -1;
+    }
+    for (uint64_t at = bm->lo; bitmap_next_run(bm, at, &s, &len); at = s + len) {
+        if (len >= n && len < best_len) {
+            best = (int64_t)s;
+            best_len = len;
+            if (len == n) break;
+        }
+    }
+    return best;
+}
+
+uint64_t bitmap_largest_run(const bitmap_t* bm, uint64_t* start) {
+    if (sum_runs(bm)) {
+        run_pick_t p = { 0, 0, 0, 0, 0 };
+        sum_find_run(bm, &p);
+        if (p.len > 0) *start = p.start;
+        return p.len;
+    }
+    uint64_t best = 0, s, len;
+    for (uint64_t at = bm->lo; bitmap_next_run(bm, at, &s, &len); at = s + len) {
+        if (len > best) {
+            best = len;
+            *start = s;
+        }
+    }
+    return best;
+}
+
+int bitmap_alloc_extents(bitmap_t* bm, uint64_t n, uint64_t* start, uint64_t* len, int max_ext) {
+    int used = 0;
+    uint64_t left = n;
+    if (bm->sum != NULL && bm->sum->free < n) return -1;
+    while (left > 0) {
+        if (used == max_ext) break;
+        int64_t fit = bitmap_find_run(bm, left);
+        if (fit >= 0) {
+            start[used] = (uint64_t)fit;
+            len[used] = left;
+        } else {
+            uint64_t s = 0, l = bitmap_largest_run(bm, &s);
+            if (l == 0) break;
+            start[used] = s;
+            len[used] = l;
+        }
+        bitmap_set_range(bm, start[used], len[used]);
+        left -= len[used];
+        used++;
+    }
+    if (left > 0) {
+        // roll back so a failed request leaves the bitmap untouched
+        uint64_t saved_hint = bm->hint;
+        for (int i = 0; i < used; i++) bitmap_clear_range(bm, start[i], len[i]);
+        bm->hint = saved_hint;
+        return -1;
+    }
+    return used;
+}
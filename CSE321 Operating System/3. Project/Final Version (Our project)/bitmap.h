@@ -0,0 +1,102 @@
+// bitmap.h — bit-granular allocation bitmaps shared by the MiniVSFS tools
+//
+// On disk, object i (inode i+1, or data block data_region_start+i) is
+// bit (i & 7) of byte (i >> 3), which is what Validator checks. In memory
+// the same bytes are scanned 64 bits at a time: a word that is all ones is
+// skipped in one compare, otherwise count-trailing-zeros of its complement
+// gives the free bit directly.
+//
+// A bitmap kept open for many allocations (volume.h) can also carry a
+// free-space summary, built by bitmap_summarize(): the clear bits of every
+// word, of every chunk of BITMAP_CHUNK_BITS (one 4 KiB bitmap block) and of
+// every group of BITMAP_GROUP_CHUNKS chunks. Searches skip full groups,
+// then full chunks, then full words, instead of reading every word from the
+// hint on. For runs each chunk also has its shape: the clear bits at its
+// start and end and its longest run, so a run search only looks inside the
+// chunks that can hold what it wants and joins the others by their ends.
+// The counts are updated on every set and clear; a shape is recomputed the
+// next time a run search needs it. The summary lives in memory only: it is
+// rebuilt from the bitmap in one pass (a popcount per word) when an image is
+// opened. The bits found are the same with or without it.
+#ifndef MINIVSFS_BITMAP_H
+#define MINIVSFS_BITMAP_H
+
+#include <stdint.h>
+
+#define BITMAP_CHUNK_BITS 32768u  // 4096-byte bitmap block
+#define BITMAP_GROUP_CHUNKS 16u   // 512Ki bits, 2 GiB of data blocks
+
+struct bitmap_sum;
+
+typedef struct {
+    uint8_t* bytes;   // caller-owned bitmap blocks, exactly as stored on disk
+    uint64_t nbits;   // objects tracked; bits past this are never handed out
+    uint64_t nwords;  // ceil(nbits / 64)
+    uint64_t hint;    // next search starts here (just past the last allocation)
+    struct bitmap_sum* sum;  // free-space summary, NULL without one
+    uint64_t lo, hi;  // searches only find bits in [lo, hi) (bitmap_window)
+} bitmap_t;
+
+// Wrap a bitmap buffer of at least ceil(nbits/8) bytes. It must be readable
+// as whole 64-bit words, so callers pass whole blocks. No summary, no window.
+void bitmap_init(bitmap_t* bm, uint8_t* bytes, uint64_t nbits);
+
+// Restrict every search below to bits [lo, hi) (a block group, minivsfs.h);
+// bitmap_window(bm, 0, bm->nbits) lifts it. Bits outside the window can still
+// be set and cleared. Run searches use the summary when lo and hi are on chunk
+// edges (or hi is nbits), and look word by word otherwise.
+void bitmap_window(bitmap_t* bm, uint64_t lo, uint64_t hi);
+
+// Clear bits in [lo, hi), from the summary where there is one
+uint64_t bitmap_count_free_in(const bitmap_t* bm, uint64_t lo, uint64_t hi);
+
+// Build the free-space summary of bm from its bits; from then on every change
+// must go through the functions below. 0, or -1 (no memory: bm works without).
+int bitmap_summarize(bitmap_t* bm);
+
+// Free the summary, if any
+void bitmap_release(bitmap_t* bm);
+
+int bitmap_test(const bitmap_t* bm, uint64_t bit);
+void bitmap_set(bitmap_t* bm, uint64_t bit);
+void bitmap_clear(bitmap_t* bm, uint64_t bit);
+
+// First clear bit at or after the hint (wrapping once). Does not set it.
+// Returns -1 when the bitmap is full.
+int64_t bitmap_find_free(const bitmap_t* bm);
+
+// Find, set and return one free bit, or -1 when full.
+int64_t bitmap_alloc(bitmap_t* bm);
+
+// Allocate n bits (not necessarily adjacent) in one pass, writing them in
+// ascending search order to out[]. All or nothing: returns 0, or -1 with
+// the bitmap unchanged if fewer than n bits are free.
+int bitmap_alloc_n(bitmap_t* bm, uint64_t n, uint64_t* out);
+
+uint64_t bitmap_count_free(const bitmap_t* bm);   // O(1) with a summary
+
+// ---- contiguous runs ----
+// A run is a maximal stretch of clear bits. Runs are found word-at-a-time
+// too: all-ones words are skipped while looking for a run's start, and
+// all-zero words while looking for its end.
+
+void bitmap_set_range(bitmap_t* bm, uint64_t first, uint64_t n);
+void bitmap_clear_range(bitmap_t* bm, uint64_t first, uint64_t n);
+
+// Next run starting at or after `from`: 1 with *start/*len filled, 0 if none.
+int bitmap_next_run(const bitmap_t* bm, uint64_t from, uint64_t* start, uint64_t* len);
+
+// Best fit: start of the smallest run of at least n clear bits (the lowest
+// one on ties; an exact fit ends the search). -1 if no run is long enough.
+int64_t bitmap_find_run(const bitmap_t* bm, uint64_t n);
+
+// Allocate n bits as at most max_ext runs, writing them to start[]/len[].
+// One best-fit run when one is long enough; otherwise the largest runs are
+// taken until the rest fits best-fit into one. All or nothing: returns the
+// number of runs used, or -1 with the bitmap unchanged.
+int bitmap_alloc_extents(bitmap_t* bm, uint64_t n, uint64_t* start, uint64_t* len, int max_ext);
+
+// Longest run (the lowest one on ties): its length with *start, 0 when full
+uint64_t bitmap_largest_run(const bitmap_t* bm, uint64_t* start);
+
+#endif
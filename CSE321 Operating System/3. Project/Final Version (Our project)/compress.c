@@ -0,0 +1,101 @@
+// compress.c — packing file clusters with lz.c, and reading them back
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include "compress.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "lz.h"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint32_t compress_cluster(const uint8_t* src, size_t len, uint8_t* dst, compress_stats_t* stats) {
+    uint32_t nblocks = (uint32_t)((len + BS - 1) / BS);
+    double t0 = stats ? now_sec() : 0;
+    // worth it only if at least one block is saved: the LZ data gets that much room
+    size_t clen = 0;
+    if (nblocks > 1) clen = lz_compress(src, len, dst + sizeof(compress_hdr_t), (nblocks - 1) * BS - sizeof(compress_hdr_t));
+    uint32_t stored;
+    if (clen == 0) {
+        memcpy(dst, src, len);
+        memset(dst + len, 0, (size_t)nblocks * BS - len);
+        stored = nblocks;
+    } else {
+        compress_hdr_t hdr = { (uint32_t)clen };
+        memcpy(dst, &hdr, sizeof(hdr));
+        stored = (uint32_t)((sizeof(hdr) + clen + BS - 1) / BS);
+        memset(dst + sizeof(hdr) + clen, 0, (size_t)stored * BS - sizeof(hdr) - clen);
+    }
+    if (stats) {
+        stats->seconds += now_sec() - t0;
+        stats->clusters++;
+        stats->raw_clusters += stored == nblocks;
+        stats->bytes_in += len;
+        stats->bytes_packed += len;
+        stats->blocks_out += stored;
+    }
+    return stored;
+}
+
+int compress_read_cluster(const image_t* img, const uint32_t* ptrs, uint32_t nblocks, uint8_t* out) {
+    uint32_t stored = 0;
+    while (stored < nblocks && ptrs[stored] != 0) stored++;
+    for (uint32_t k = stored; k < nblocks; k++) {
+        if (ptrs[k] != 0) return -1; // nonzero entries come first
+    }
+    if (stored == 0) {
+        memset(out, 0, (size_t)nblocks * BS);
+        return 0;
+    }
+    if (stored == nblocks) {
+        for (uint32_t k = 0; k < nblocks; k++) {
+            const uint8_t* b = image_block(img, ptrs[k]);
+            if (b == NULL) return -1;
+            memcpy(out + (size_t)k * BS, b, BS);
+        }
+        return 0;
+    }
+
+    // the LZ data straight out of the mapping when its blocks are adjacent
+    // (they nearly always are), else gathered first
+    uint8_t gather[COMPRESS_CLUSTER_BYTES];
+    const uint8_t* src = NULL;
+    int adjacent = 1;
+    for (uint32_t k = 1; k < stored; k++) adjacent &= ptrs[k] == ptrs[k - 1] + 1;
+    if (adjacent) {
+        src = image_blocks(img, ptrs[0], stored);
+    } else {
+        for (uint32_t k = 0; k < stored; k++) {
+            const uint8_t* b = image_block(img, ptrs[k]);
+            if (b == NULL) return -1;
+            memcpy(gather + (size_t)k * BS, b, BS);
+        }
+        src = gather;
+    }
+    if (src == NULL) return -1;
+    compress_hdr_t hdr;
+    memcpy(&hdr, src, sizeof(hdr));
+    if (hdr.bytes == 0 || hdr.bytes > (size_t)stored * BS - sizeof(hdr)) return -1;
+    int64_t got = lz_decompress(src + sizeof(hdr), hdr.bytes, out, (size_t)nblocks * BS);
+    if (got < 0) return -1;
+    memset(out + got, 0, (size_t)nblocks * BS - (size_t)got);
+    return 0;
+}
+
+int compress_copy_out(const image_t* img, const inode_t* ino, const uint32_t* blocks, FILE* out) {
+    uint64_t n = (ino->size_bytes + BS - 1) / BS;
+    uint64_t remaining = ino->size_bytes;
+    uint8_t buf[COMPRESS_CLUSTER_BYTES];
+    for (uint64_t i = 0; i < n; i += COMPRESS_CLUSTER_BLOCKS) {
+        uint32_t nblocks = n - i < COMPRESS_CLUSTER_BLOCKS ? (uint32_t)(n - i) : COMPRESS_CLUSTER_BLOCKS;
+        if (compress_read_cluster(img, blocks + i, nblocks, buf) != 0) return -1;
+        size_t bytes = remaining < (uint64_t)nblocks * BS ? (size_t)remaining : (size_t)nblocks * BS;
+        if (fwrite(buf, 1, bytes, out) != bytes) return -1;
+        remaining -= bytes;
+    }
+    return 0;
+}
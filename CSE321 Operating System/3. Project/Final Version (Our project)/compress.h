@@ -0,0 +1,58 @@
+// compress.h — transparent per-file compression in independent clusters (mkfs_adder --compress)
+//
+// A compressed file (INODE_FL_COMPRESSED) is cut into clusters of
+// COMPRESS_CLUSTER_BLOCKS file blocks, the last one possibly shorter. Its
+// block map (direct/indirect pointers or extents) keeps one entry per file
+// block, and the entries of a cluster tell how it is stored:
+//   - all nonzero:        raw, the blocks hold the data as it is (it did not
+//                         shrink by at least one whole block);
+//   - k nonzero, then 0:  compressed into its first k blocks: a
+//                         compress_hdr_t, then the LZ block (lz.h), zero padded;
+//   - all 0:              a cluster of zeros, stored as holes.
+// Those 0 entries make every compressed file INODE_FL_SPARSE as well, which
+// is what fsck and the validator already accept. Each cluster decodes on its
+// own, so reading any block of the file costs one cluster of decompression at
+// most, and stored blocks stay 4 KiB aligned like every other data block.
+#ifndef MINIVSFS_COMPRESS_H
+#define MINIVSFS_COMPRESS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "image.h"
+#include "minivsfs.h"
+
+#define COMPRESS_CLUSTER_BYTES ((size_t)COMPRESS_CLUSTER_BLOCKS * BS)
+
+#pragma pack(push,1)
+typedef struct {
+    uint32_t bytes;   // LZ data right after the header
+} compress_hdr_t;
+#pragma pack(pop)
+
+typedef struct {
+    uint64_t files;
+    uint64_t clusters;        // all of them: compressed, raw and zero
+    uint64_t raw_clusters;    // did not shrink by a block
+    uint64_t zero_clusters;   // stored as holes
+    uint64_t bytes_in;        // file bytes
+    uint64_t bytes_packed;    // of those, through compress_cluster() (not zero clusters)
+    uint64_t blocks_out;      // data blocks stored
+    double seconds;           // spent compressing
+} compress_stats_t;
+
+// Pack one cluster, the len (1..COMPRESS_CLUSTER_BYTES) bytes at src, into dst
+// (COMPRESS_CLUSTER_BYTES of room). Returns how many of the cluster's blocks
+// are stored: fewer than it has when compressed, all of them when raw. The
+// blocks in dst are zero padded. Counted in *stats unless it is NULL.
+uint32_t compress_cluster(const uint8_t* src, size_t len, uint8_t* dst, compress_stats_t* stats);
+
+// Decode the cluster whose nblocks block map entries are ptrs[] into out
+// (nblocks * BS bytes). 0, or -1 if the cluster is damaged.
+int compress_read_cluster(const image_t* img, const uint32_t* ptrs, uint32_t nblocks, uint8_t* out);
+
+// Write the size_bytes of compressed file ino, whose block map is blocks[]
+// (map_read()), to out, decoding one cluster at a time. 0, or -1.
+int compress_copy_out(const image_t* img, const inode_t* ino, const uint32_t* blocks, FILE* out);
+
+#endif
@@ -0,0 +1,251 @@
+// crc32.c — table-sliced and carry-less-multiply CRC32 kernels
+#include "crc32.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CRC32_HAVE_PCLMUL 1
+#else
+#define CRC32_HAVE_PCLMUL 0
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CRC32_LITTLE_ENDIAN 1
+#else
+#define CRC32_LITTLE_ENDIAN 0
+#endif
+
+// CRC32_TAB[0] is the classic 256-entry table.
+// CRC32_TAB[k][i] is the crc of byte i followed by k zero bytes,
+// which lets the sliced kernels look up 8 or 16 bytes independently.
+static uint32_t CRC32_TAB[16][256];
+static int crc32_ready = 0;
+
+// All kernels work on the raw (pre-inverted) register value
+typedef uint32_t (*crc32_kernel_t)(uint32_t c, const uint8_t* p, size_t n);
+
+static uint32_t crc32_bytewise(uint32_t c, const uint8_t* p, size_t n) {
+    for (size_t i = 0; i < n; i++) c = CRC32_TAB[0][(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c;
+}
+
+static uint32_t load32(const uint8_t* p) {
+    uint32_t w;
+    memcpy(&w, p, 4); // unaligned-safe, compiles to a single load
+    return w;
+}
+
+static uint32_t crc32_slice8(uint32_t c, const uint8_t* p, size_t n) {
+    while (n >= 8) {
+        uint32_t lo = load32(p) ^ c;
+        uint32_t hi = load32(p + 4);
+        c = CRC32_TAB[7][lo & 0xFF] ^ CRC32_TAB[6][(lo >> 8) & 0xFF] ^
+            CRC32_TAB[5][(lo >> 16) & 0xFF] ^ CRC32_TAB[4][lo >> 24] ^
+            CRC32_TAB[3][hi & 0xFF] ^ CRC32_TAB[2][(hi >> 8) & 0xFF] ^
+            CRC32_TAB[1][(hi >> 16) & 0xFF] ^ CRC32_TAB[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    return crc32_bytewise(c, p, n);
+}
+
+static uint32_t crc32_slice16(uint32_t c, const uint8_t* p, size_t n) {
+    while (n >= 16) {
+        uint32_t w0 = load32(p) ^ c;
+        uint32_t w1 = load32(p + 4);
+        uint32_t w2 = load32(p + 8);
+        uint32_t w3 = load32(p + 12);
+        c = CRC32_TAB[15][w0 & 0xFF] ^ CRC32_TAB[14][(w0 >> 8) & 0xFF] ^
+            CRC32_TAB[13][(w0 >> 16) & 0xFF] ^ CRC32_TAB[12][w0 >> 24] ^
+            CRC32_TAB[11][w1 & 0xFF] ^ CRC32_TAB[10][(w1 >> 8) & 0xFF] ^
+            CRC32_TAB[9][(w1 >> 16) & 0xFF] ^ CRC32_TAB[8][w1 >> 24] ^
+            CRC32_TAB[7][w2 & 0xFF] ^ CRC32_TAB[6][(w2 >> 8) & 0xFF] ^
+            CRC32_TAB[5][(w2 >> 16) & 0xFF] ^ CRC32_TAB[4][w2 >> 24] ^
+            CRC32_TAB[3][w3 & 0xFF] ^ CRC32_TAB[2][(w3 >> 8) & 0xFF] ^
+            CRC32_TAB[1][(w3 >> 16) & 0xFF] ^ CRC32_TAB[0][w3 >> 24];
+        p += 16;
+        n -= 16;
+    }
+    return crc32_bytewise(c, p, n);
+}
+
+#if CRC32_HAVE_PCLMUL
+// Folding with PCLMULQDQ, after Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction". Constants are for the
+// bit-reflected 0x04C11DB7 polynomial. Needs n >= 64 and n % 16 == 0.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_fold(uint32_t c, const uint8_t* p, size_t n) {
+    static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+    static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+    static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+    static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)c));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+    p += 64;
+    n -= 64;
+
+    // four lanes of 128 bits folded in parallel
+    while (n >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        p += 64;
+        n -= 64;
+    }
+
+    // fold the four lanes into one
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // remaining 16-byte blocks
+    while (n >= 16) {
+        x2 = _mm_loadu_si128((const __m128i*)p);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        p += 16;
+        n -= 16;
+    }
+
+    // 128 -> 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i*)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t c, const uint8_t* p, size_t n) {
+    // inodes are 120 bytes; the fold only pays off from 64 bytes up
+    if (n >= 64) {
+        size_t bulk = n & ~(size_t)15;
+        c = crc32_pclmul_fold(c, p, bulk);
+        p += bulk;
+        n -= bulk;
+    }
+    return crc32_slice16(c, p, n);
+}
+#endif
+
+static const crc32_kernel_t CRC32_KERNELS[CRC32_VARIANT_COUNT] = {
+    [CRC32_BYTEWISE] = crc32_bytewise,
+    [CRC32_SLICE8] = crc32_slice8,
+    [CRC32_SLICE16] = crc32_slice16,
+#if CRC32_HAVE_PCLMUL
+    [CRC32_PCLMUL] = crc32_pclmul,
+#endif
+};
+
+static const char* const CRC32_NAMES[CRC32_VARIANT_COUNT] = {
+    "bytewise", "slice8", "slice16", "pclmul"
+};
+
+static crc32_variant_t crc32_current = CRC32_BYTEWISE;
+static crc32_kernel_t crc32_kernel = crc32_bytewise;
+
+int crc32_variant_supported(crc32_variant_t v) {
+    if (v < 0 || v >= CRC32_VARIANT_COUNT || CRC32_KERNELS[v] == NULL) return 0;
+    // the sliced kernels read words in host order, so they assume little endian
+    if ((v == CRC32_SLICE8 || v == CRC32_SLICE16) && !CRC32_LITTLE_ENDIAN) return 0;
+#if CRC32_HAVE_PCLMUL
+    if (v == CRC32_PCLMUL) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return 1;
+}
+
+int crc32_select(crc32_variant_t v) {
+    if (!crc32_variant_supported(v)) return -1;
+    crc32_current = v;
+    crc32_kernel = CRC32_KERNELS[v];
+    return 0;
+}
+
+crc32_variant_t crc32_selected(void) {
+    return crc32_current;
+}
+
+const char* crc32_variant_name(crc32_variant_t v) {
+    if (v < 0 || v >= CRC32_VARIANT_COUNT) return "unknown";
+    return CRC32_NAMES[v];
+}
+
+void crc32_init(void) {
+    if (!crc32_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; j++) c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            CRC32_TAB[0][i] = c;
+        }
+        for (int k = 1; k < 16; k++) {
+            for (int i = 0; i < 256; i++) {
+                uint32_t prev = CRC32_TAB[k - 1][i];
+                CRC32_TAB[k][i] = (prev >> 8) ^ CRC32_TAB[0][prev & 0xFF];
+            }
+        }
+        crc32_ready = 1;
+    }
+
+    // fastest supported kernel first, unless the environment forces one
+    const char* forced = getenv("MINIVSFS_CRC32");
+    if (forced != NULL) {
+        for (int v = 0; v < CRC32_VARIANT_COUNT; v++) {
+            if (strcmp(forced, CRC32_NAMES[v]) == 0 && crc32_select((crc32_variant_t)v) == 0) return;
+        }
+    }
+    for (int v = CRC32_VARIANT_COUNT - 1; v >= 0; v--) {
+        if (crc32_select((crc32_variant_t)v) == 0) return;
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t n) {
+    return crc32_kernel(crc ^ 0xFFFFFFFFu, (const uint8_t*)data, n) ^ 0xFFFFFFFFu;
+}
+
+uint32_t crc32(const void* data, size_t n) {
+    return crc32_update(0, data, n);
+}
@@ -0,0 +1,42 @@
+// crc32.h — shared CRC32 engine for mkfs_builder, mkfs_adder and Validator
+//
+// Same polynomial as the original byte-at-a-time loop (reflected 0xEDB88320,
+// init 0xFFFFFFFF, final xor 0xFFFFFFFF), so every checksum already written
+// to an image still verifies.
+//
+// crc32_init() builds the tables and picks the fastest kernel for this CPU:
+//   pclmul   : carry-less multiply folding (x86-64 with PCLMULQDQ + SSE4.1)
+//   slice16  : 16 bytes per step, 16 lookup tables
+//   slice8   : 8 bytes per step, 8 lookup tables
+//   bytewise : the original loop, kept as the reference
+// Set MINIVSFS_CRC32=<name> in the environment to force one of them.
+#ifndef MINIVSFS_CRC32_H
+#define MINIVSFS_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    CRC32_BYTEWISE = 0,
+    CRC32_SLICE8,
+    CRC32_SLICE16,
+    CRC32_PCLMUL,
+    CRC32_VARIANT_COUNT
+} crc32_variant_t;
+
+// Build tables and select a kernel. Safe to call more than once.
+void crc32_init(void);
+
+// One-shot checksum of n bytes, identical to the original crc32().
+uint32_t crc32(const void* data, size_t n);
+
+// Streaming form: start with crc = 0, feed chunks, the result is the crc.
+uint32_t crc32_update(uint32_t crc, const void* data, size_t n);
+
+// Kernel selection, used by bench_crc32 to compare variants.
+int crc32_variant_supported(crc32_variant_t v);
+int crc32_select(crc32_variant_t v);            // 0 on success, -1 if unsupported
+crc32_variant_t crc32_selected(void);
+const char* crc32_variant_name(crc32_variant_t v);
+
+#endif
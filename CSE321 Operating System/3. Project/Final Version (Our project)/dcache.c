@@ -0,0 +1,138 @@
+// dcache.c — path components, (parent, name) lookups and their in-memory cache
+#include "dcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dir_index.h"
+
+#define DCACHE_MIN_SLOTS 1024
+
+int path_next(const char **path, char *name) {
+    const char *p = *path;
+    for (;;) {
+        while (*p == '/') p++;
+        if (*p == '\0') {
+            *path = p;
+            return 0;
+        }
+        size_t len = strcspn(p, "/");
+        if (len > DCACHE_NAME_MAX) return -1;
+        if (len == 1 && p[0] == '.') {
+            p += len;
+            continue;
+        }
+        memcpy(name, p, len);
+        name[len] = '\0';
+        *path = p + len;
+        return 1;
+    }
+}
+
+// Home slot of (parent, hash): the parent is mixed in, so the same name in
+// many directories does not pile up in one probe run
+static uint64_t home_slot(const dcache_t *dc, uint32_t parent, uint64_t hash) {
+    return (hash ^ (parent * UINT64_C(0x9E3779B97F4A7C15))) & (dc->cap - 1);
+}
+
+static dcache_entry_t *find(const dcache_t *dc, uint32_t parent, uint64_t hash, const char *name) {
+    if (dc->cap == 0) return NULL;
+    for (uint64_t i = home_slot(dc, parent, hash); dc->slots[i].parent != 0; i = (i + 1) & (dc->cap - 1)) {
+        const dcache_entry_t *e = &dc->slots[i];
+        if (e->parent == parent && e->hash == hash && strcmp(e->name, name) == 0) {
+            return &dc->slots[i];
+        }
+    }
+    return NULL;
+}
+
+static void place(dcache_t *dc, const dcache_entry_t *e) {
+    uint64_t i = home_slot(dc, e->parent, e->hash);
+    while (dc->slots[i].parent != 0) i = (i + 1) & (dc->cap - 1);
+    dc->slots[i] = *e;
+}
+
+static int grow(dcache_t *dc) {
+    uint64_t cap = dc->cap ? dc->cap * 2 : DCACHE_MIN_SLOTS;
+    dcache_entry_t *old = dc->slots;
+    uint64_t old_cap = dc->cap;
+    dc->slots = calloc(cap, sizeof(dcache_entry_t));
+    if (dc->slots == NULL) {
+        dc->slots = old;
+        return -1;
+    }
+    dc->cap = cap;
+    for (uint64_t i = 0; i < old_cap; i++) {
+        if (old[i].parent != 0) place(dc, &old[i]);
+    }
+    free(old);
+    return 0;
+}
+
+void dcache_add(dcache_t *dc, uint32_t parent, const char *name, uint32_t ino, uint8_t type) {
+    size_t len = strlen(name);
+    if (dc == NULL || len > DCACHE_NAME_MAX) return;
+    uint64_t hash = dir_hash(name);
+    if (find(dc, parent, hash, name) != NULL) return;
+    if (dc->count >= DCACHE_MAX_ENTRIES) dcache_clear(dc);
+    if (dc->count + 1 > dc->cap / 4 * 3 && grow(dc) != 0) return;
+    dcache_entry_t e;
+    memset(&e, 0, sizeof(e));
+    e.hash = hash;
+    e.parent = parent;
+    e.ino = ino;
+    e.type = type;
+    memcpy(e.name, name, len + 1);
+    place(dc, &e);
+    dc->count++;
+}
+
+int64_t dcache_lookup(dcache_t *dc, const image_t *img, uint32_t dir, const char *name, uint8_t *type) {
+    if (dc != NULL) {
+        const dcache_entry_t *e = find(dc, dir, dir_hash(name), name);
+        if (e != NULL) {
+            dc->hits++;
+            if (type != NULL) *type = e->type;
+            return e->ino;
+        }
+        dc->misses++;
+    }
+    const inode_t *d = image_inode(img, dir);
+    if (d == NULL || (d->mode & 0xF000) != 0x4000) return -1;
+    const dirent64_t *de = dir_lookup(img, d, name);
+    if (de == NULL) return -1;
+    dcache_add(dc, dir, name, de->inode_no, de->type);
+    if (type != NULL) *type = de->type;
+    return de->inode_no;
+}
+
+int64_t path_resolve(dcache_t *dc, const image_t *img, const char *path, uint8_t *type) {
+    char name[DCACHE_NAME_MAX + 1];
+    int64_t ino = ROOT_INO;
+    uint8_t t = 2;
+    int r;
+    while ((r = path_next(&path, name)) == 1) {
+        if (t != 2) return -1;   // a file in the middle of the path
+        ino = dcache_lookup(dc, img, (uint32_t)ino, name, &t);
+        if (ino < 0) return -1;
+    }
+    if (r < 0) return -1;
+    if (type != NULL) *type = t;
+    return ino;
+}
+
+void dcache_clear(dcache_t *dc) {
+    if (dc->cap > 0) memset(dc->slots, 0, dc->cap * sizeof(dcache_entry_t));
+    dc->count = 0;
+}
+
+uint64_t dcache_memory(const dcache_t *dc) {
+    return dc->cap * sizeof(dcache_entry_t);
+}
+
+void dcache_free(dcache_t *dc) {
+    free(dc->slots);
+    dc->slots = NULL;
+    dc->cap = 0;
+    dc->count = 0;
+}
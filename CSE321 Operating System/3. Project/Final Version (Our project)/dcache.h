@@ -0,0 +1,76 @@
+// dcache.h — path resolution over the directory tree, with a dentry cache
+//
+// A path names an entry below the root directory: components separated by
+// '/', each at most DCACHE_NAME_MAX bytes (a dirent name). Repeated and
+// trailing slashes and "." components are skipped, so "/a//b/./c" is
+// "a/b/c"; ".." follows the directory's ".." entry.
+//
+// Each step of a resolution is one (directory inode, name) lookup. The
+// dentry cache keeps the answers in memory, in an open-addressing table
+// keyed by the directory's inode number and dir_hash() of the name, with
+// the name itself to tell apart names whose hashes collide. A lookup under
+// a prefix seen before reads no inode, index or dirent block at all; a miss
+// goes through dir_lookup() (the directory's hash index when it has one)
+// and caches what it found. Names that are not there are not cached, so a
+// tool that creates entries only has to dcache_add() them. Nothing here
+// removes entries from a directory; a tool that does must dcache_clear().
+//
+// The table grows up to DCACHE_MAX_ENTRIES and is then emptied and refilled
+// by the lookups that follow: memory stays bounded on any tree.
+#ifndef MINIVSFS_DCACHE_H
+#define MINIVSFS_DCACHE_H
+
+#include <stdint.h>
+
+#include "image.h"
+#include "minivsfs.h"
+
+#define DCACHE_NAME_MAX sizeof(((dirent64_t *)0)->name)
+#define DCACHE_MAX_ENTRIES (1u << 20)
+
+typedef struct {
+    uint64_t hash;                 // dir_hash(name)
+    uint32_t parent;               // directory inode; 0 = empty slot
+    uint32_t ino;
+    uint8_t type;                  // dirent type: 1 file, 2 directory
+    char name[DCACHE_NAME_MAX + 1]; // terminated
+} dcache_entry_t;
+
+// A zeroed dcache_t is an empty cache
+typedef struct {
+    dcache_entry_t* slots;
+    uint64_t cap;        // slots, a power of two (0: none yet)
+    uint64_t count;
+    uint64_t hits;       // lookups answered from memory
+    uint64_t misses;     // lookups that went to the directory
+} dcache_t;
+
+// Copies the next component of *path into name (DCACHE_NAME_MAX + 1 bytes,
+// terminated) and moves *path past it. 1, 0 when no component is left, or -1
+// if the component is longer than a dirent name.
+int path_next(const char** path, char* name);
+
+// Inode number of name in directory dir, its dirent type in *type (may be
+// NULL); -1 if dir is not a directory or has no such entry. dc may be NULL
+// (no cache).
+int64_t dcache_lookup(dcache_t* dc, const image_t* img, uint32_t dir, const char* name, uint8_t* type);
+
+// Record that directory parent now has name -> ino (a new entry).
+// Without memory for it, or for a name longer than a dirent name, the entry
+// is simply not cached.
+void dcache_add(dcache_t* dc, uint32_t parent, const char* name, uint32_t ino, uint8_t type);
+
+// Inode number of path ("" or "/" is the root), its type in *type (may be
+// NULL); -1 if some component is missing, too long, or not a directory.
+int64_t path_resolve(dcache_t* dc, const image_t* img, const char* path, uint8_t* type);
+
+// Forget every entry (the hit and miss counts stay)
+void dcache_clear(dcache_t* dc);
+
+// Bytes of memory the cache takes
+uint64_t dcache_memory(const dcache_t* dc);
+
+// Free the table
+void dcache_free(dcache_t* dc);
+
+#endif
@@ -0,0 +1,184 @@
+// dedup.c — dedup table of shared data blocks: hash index in memory, sorted table on disk
+#include "dedup.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "sha256.h"
+
+#define DEDUP_MIN_SLOTS 1024
+
+void dedup_hash(const uint8_t *block, uint8_t out[DEDUP_HASH_BYTES]) {
+    uint8_t full[SHA256_BYTES];
+    sha256(block, BS, full);
+    memcpy(out, full, DEDUP_HASH_BYTES);
+}
+
+// Home slot of a hash: its first 8 bytes are already uniformly spread
+static uint64_t home_slot(const dedup_t *d, const uint8_t *hash) {
+    uint64_t h;
+    memcpy(&h, hash, sizeof(h));
+    return h & (d->cap - 1);
+}
+
+// Puts e into the first empty slot from its home (linear probing); e is not in the index
+static dedup_entry_t *place(dedup_t *d, const dedup_entry_t *e) {
+    uint64_t i = home_slot(d, e->hash);
+    while (d->slots[i].block != 0) i = (i + 1) & (d->cap - 1);
+    d->slots[i] = *e;
+    return &d->slots[i];
+}
+
+static int grow(dedup_t *d, uint64_t cap) {
+    dedup_entry_t *old = d->slots;
+    uint64_t old_cap = d->cap;
+    d->slots = calloc(cap, sizeof(dedup_entry_t));
+    if (d->slots == NULL) {
+        d->slots = old;
+        return -1;
+    }
+    d->cap = cap;
+    for (uint64_t i = 0; i < old_cap; i++) {
+        if (old[i].block != 0) place(d, &old[i]);
+    }
+    free(old);
+    return 0;
+}
+
+int dedup_table(const image_t *img, const dedup_entry_t **entries, uint64_t *count) {
+    const superblock_t *sb = img->sb;
+    *entries = NULL;
+    *count = 0;
+    if (!(sb->flags & SB_FL_DEDUP)) return 0;
+    const superblock_ext_t *ext = SB_EXT(sb);
+    const uint8_t *p = image_blocks(img, ext->dedup_start, ext->dedup_blocks);
+    if (p == NULL) return -1;
+    dedup_hdr_t hdr;
+    memcpy(&hdr, p, sizeof(hdr));
+    uint64_t room = (ext->dedup_blocks * BS - sizeof(hdr)) / sizeof(dedup_entry_t);
+    if (hdr.magic != DEDUP_MAGIC || hdr.count > room) return -1;
+    const dedup_entry_t *e = (const dedup_entry_t *)(p + sizeof(hdr));
+    if (crc32(e, hdr.count * sizeof(dedup_entry_t)) != hdr.crc) return -1;
+    for (uint64_t i = 0; i < hdr.count; i++) {
+        if (e[i].block < sb->data_region_start || e[i].block >= sb->data_region_start + sb->data_region_blocks ||
+            e[i].refs == 0 || (i > 0 && e[i].block <= e[i - 1].block)) return -1;
+    }
+    *entries = e;
+    *count = hdr.count;
+    return 0;
+}
+
+int dedup_load(dedup_t *d, const image_t *img) {
+    const dedup_entry_t *e;
+    uint64_t count;
+    if (dedup_table(img, &e, &count) != 0) return -1;
+    uint64_t cap = DEDUP_MIN_SLOTS;
+    while (cap / 4 * 3 < count) cap *= 2;
+    free(d->slots);
+    d->slots = NULL;
+    d->cap = 0;
+    if (grow(d, cap) != 0) return -1;
+    for (uint64_t i = 0; i < count; i++) place(d, &e[i]);
+    d->count = count;
+    d->loaded = 1;
+    d->dirty = 0;
+    return 0;
+}
+
+dedup_entry_t *dedup_find(dedup_t *d, const uint8_t hash[DEDUP_HASH_BYTES]) {
+    if (d->cap == 0) return NULL;
+    for (uint64_t i = home_slot(d, hash); d->slots[i].block != 0; i = (i + 1) & (d->cap - 1)) {
+        if (memcmp(d->slots[i].hash, hash, DEDUP_HASH_BYTES) == 0) return &d->slots[i];
+    }
+    return NULL;
+}
+
+dedup_entry_t *dedup_insert(dedup_t *d, const uint8_t hash[DEDUP_HASH_BYTES], uint32_t block) {
+    if (d->count + 1 > d->cap / 4 * 3 && grow(d, d->cap ? d->cap * 2 : DEDUP_MIN_SLOTS) != 0) return NULL;
+    dedup_entry_t e;
+    memcpy(e.hash, hash, DEDUP_HASH_BYTES);
+    e.block = block;
+    e.refs = 1;
+    d->count++;
+    d->dirty = 1;
+    return place(d, &e);
+}
+
+void dedup_unref(dedup_t *d, const uint8_t hash[DEDUP_HASH_BYTES]) {
+    dedup_entry_t *e = dedup_find(d, hash);
+    if (e == NULL) return;
+    d->dirty = 1;
+    if (--e->refs > 0) return;
+
+    // backward-shift deletion: move up every later entry of the probe run
+    // that may sit in the emptied slot, so no lookup stops early at a gap
+    uint64_t mask = d->cap - 1, hole = (uint64_t)(e - d->slots);
+    d->slots[hole].block = 0;
+    d->count--;
+    for (uint64_t i = (hole + 1) & mask; d->slots[i].block != 0; i = (i + 1) & mask) {
+        uint64_t home = home_slot(d, d->slots[i].hash);
+        // movable unless its home lies cyclically in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            d->slots[hole] = d->slots[i];
+            d->slots[i].block = 0;
+            hole = i;
+        }
+    }
+}
+
+static int by_block(const void *a, const void *b) {
+    uint32_t x = ((const dedup_entry_t *)a)->block, y = ((const dedup_entry_t *)b)->block;
+    return x < y ? -1 : x > y;
+}
+
+int dedup_store(dedup_t *d, image_t *img, bitmap_t *dbm) {
+    superblock_t *sb = img->sb;
+    superblock_ext_t *ext = SB_EXT(sb);
+    uint64_t old_start = (sb->flags & SB_FL_DEDUP) ? ext->dedup_start : 0;
+    uint64_t old_blocks = (sb->flags & SB_FL_DEDUP) ? ext->dedup_blocks : 0;
+    uint64_t bytes = sizeof(dedup_hdr_t) + d->count * sizeof(dedup_entry_t);
+    uint64_t nblocks = d->count ? (bytes + BS - 1) / BS : 0;
+
+    if (nblocks > 0) {
+        // the new table goes to blocks that were free, the old one is still in use
+        int64_t bit = bitmap_find_run(dbm, nblocks);
+        uint8_t *p = bit < 0 ? NULL : image_blocks(img, sb->data_region_start + bit, nblocks);
+        if (p == NULL) {
+            printf("Error: no room for the dedup table (%" PRIu64 " blocks)\n", nblocks);
+            return -1;
+        }
+        bitmap_set_range(dbm, (uint64_t)bit, nblocks);
+        dedup_entry_t *e = (dedup_entry_t *)(p + sizeof(dedup_hdr_t));
+        uint64_t n = 0;
+        for (uint64_t i = 0; i < d->cap; i++) {
+            if (d->slots[i].block != 0) e[n++] = d->slots[i];
+        }
+        qsort(e, n, sizeof(*e), by_block);
+        memset(p + bytes, 0, nblocks * BS - bytes);
+        dedup_hdr_t hdr = { DEDUP_MAGIC, crc32(e, n * sizeof(*e)), n };
+        memcpy(p, &hdr, sizeof(hdr));
+        ext->dedup_start = sb->data_region_start + (uint64_t)bit;
+        ext->dedup_blocks = nblocks;
+        sb->flags |= SB_FL_DEDUP;
+    } else {
+        ext->dedup_start = 0;
+        ext->dedup_blocks = 0;
+        sb->flags &= ~SB_FL_DEDUP;
+    }
+    if (old_blocks > 0) bitmap_clear_range(dbm, old_start - sb->data_region_start, old_blocks);
+    d->dirty = 0;
+    return 0;
+}
+
+uint64_t dedup_memory(const dedup_t *d) {
+    return d->cap * sizeof(dedup_entry_t);
+}
+
+void dedup_free(dedup_t *d) {
+    free(d->slots);
+    d->slots = NULL;
+    d->loaded = 0;
+}
@@ -0,0 +1,97 @@
+// dedup.h — content-addressed sharing of data blocks between files (mkfs_adder --dedup)
+//
+// Files added with dedup store each distinct 4 KiB block once: a block whose
+// contents are already in the image is mapped to the block that holds them
+// instead of being written again. The image keeps those blocks in its dedup
+// table (SB_FL_DEDUP): per block, the first DEDUP_HASH_BYTES of the SHA-256
+// of its contents (sha256.h) and the number of block map entries, across all
+// files, that point at it. Blocks outside the table have one reference, as
+// always; a block in it may have any number.
+//
+// On disk the table is a run of dedup_blocks data blocks from dedup_start
+// (superblock_ext_t), allocated in the data bitmap like file data: a
+// dedup_hdr_t, then the entries sorted by block number, so a checker finds
+// the count of a block by binary search. Ingest loads it into an
+// open-addressing hash index (kept at most 3/4 full) and a commit that
+// changed it writes it whole to newly allocated blocks before freeing the
+// old ones, so the committed table is never overwritten in place.
+//
+// A block whose hash is found is compared byte for byte with the stored
+// one before it is shared: a collision of the truncated hash costs a copy,
+// never wrong data.
+#ifndef MINIVSFS_DEDUP_H
+#define MINIVSFS_DEDUP_H
+
+#include <stdint.h>
+
+#include "bitmap.h"
+#include "image.h"
+#include "minivsfs.h"
+
+#define DEDUP_MAGIC 0x5044564Du   // "MVDP"
+#define DEDUP_HASH_BYTES 16
+
+#pragma pack(push,1)
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;      // crc32 of the count entries
+    uint64_t count;
+} dedup_hdr_t;
+
+typedef struct {
+    uint8_t hash[DEDUP_HASH_BYTES];
+    uint32_t block;    // absolute block number; 0 = empty slot (in memory)
+    uint32_t refs;     // block map entries pointing at block
+} dedup_entry_t;
+#pragma pack(pop)
+_Static_assert(sizeof(dedup_entry_t) == 24, "dedup entry size mismatch");
+
+// A zeroed dedup_t is an empty index
+typedef struct {
+    dedup_entry_t* slots;
+    uint64_t cap;        // slots, a power of two (0: none yet)
+    uint64_t count;      // entries in use
+    int loaded;
+    int dirty;           // changed since the table was last stored
+    // what the adds looked up
+    uint64_t blocks;     // data blocks hashed (holes are not)
+    uint64_t shared;     // of those, mapped to a block already stored
+    uint64_t collisions; // hash found but contents different
+    double seconds;      // spent hashing
+} dedup_t;
+
+// Hash of one block's contents (BS bytes), as the table keys it
+void dedup_hash(const uint8_t* block, uint8_t out[DEDUP_HASH_BYTES]);
+
+// Load the table of img into d (an empty index when img has none).
+// 0, or -1 if the table is damaged or memory runs out.
+int dedup_load(dedup_t* d, const image_t* img);
+
+// The entry with this hash, or NULL
+dedup_entry_t* dedup_find(dedup_t* d, const uint8_t hash[DEDUP_HASH_BYTES]);
+
+// Add block with this hash (not in the index yet), one reference.
+// The entry, or NULL if memory runs out. Entry pointers last until the next insert.
+dedup_entry_t* dedup_insert(dedup_t* d, const uint8_t hash[DEDUP_HASH_BYTES], uint32_t block);
+
+// Drop one reference to the entry with this hash (a failed add); the entry
+// goes with its last one
+void dedup_unref(dedup_t* d, const uint8_t hash[DEDUP_HASH_BYTES]);
+
+// Write the index as the table of img: new blocks from dbm, then the old
+// table's blocks freed and superblock_ext_t updated (the caller finalizes the
+// superblock crc). An empty index removes the table. 0, or -1 (message printed).
+int dedup_store(dedup_t* d, image_t* img, bitmap_t* dbm);
+
+// Bytes of memory the index takes
+uint64_t dedup_memory(const dedup_t* d);
+
+// Free the index; the counters, count and dedup_memory() stay for reports
+void dedup_free(dedup_t* d);
+
+// For checkers: the table of img, in the mapping. 0 with *entries NULL and
+// *count 0 when img has none; -1 if it is damaged (magic, crc, size, or the
+// entries not sorted by block).
+int dedup_table(const image_t* img, const dedup_entry_t** entries, uint64_t* count);
+
+#endif
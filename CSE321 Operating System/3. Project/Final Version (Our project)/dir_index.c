@@ -0,0 +1,214 @@
+// dir_index.c — hashed directory index kept next to the linear dirent blocks
+#include "dir_index.h"
+
+#include <string.h>
+
+#define NAME_LEN sizeof(((dirent64_t*)0)->name)
+
+uint64_t dir_hash(const char* name) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < NAME_LEN && name[i] != '\0'; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Where a hash goes: which index block, first slot probed, tag
+static uint32_t hash_block(uint64_t h, uint32_t nblocks) { return (uint32_t)(h & (nblocks - 1)); }
+static uint32_t hash_slot(uint64_t h) { return (uint32_t)((h >> 16) % DIR_INDEX_SLOTS); }
+static uint16_t hash_tag(uint64_t h) { return (uint16_t)(h >> 48); }
+
+// dir's index blocks, or NULL when it has none (or they do not look like one)
+static dir_index_block_t* index_view(const image_t* img, const inode_t* dir) {
+    if (!(dir->flags & INODE_FL_DIR_INDEX)) return NULL;
+    dir_index_block_t* idx = (dir_index_block_t*)image_block(img, dir->indirect2);
+    if (idx == NULL || dir->indirect2 == 0 || idx->magic != DIR_INDEX_MAGIC) return NULL;
+    uint32_t nb = idx->nblocks;
+    if (nb == 0 || nb > DIR_INDEX_MAX_BLOCKS || (nb & (nb - 1)) != 0) return NULL;
+    if (image_blocks(img, dir->indirect2, nb) == NULL) return NULL;
+    return idx;
+}
+
+// The dirent a slot points at, if it is live
+static dirent64_t* slot_entry(const image_t* img, const dir_index_slot_t* s) {
+    if (s->block == 0 || s->block == DIR_INDEX_DELETED || s->slot >= DIRENTS_PER_BLOCK) return NULL;
+    dirent64_t* de = image_dirents(img, s->block);
+    if (de == NULL || de[s->slot].inode_no == 0) return NULL;
+    return &de[s->slot];
+}
+
+// Index slot holding name, or NULL
+static dir_index_slot_t* find_slot(const image_t* img, dir_index_block_t* idx, const char* name) {
+    uint64_t h = dir_hash(name);
+    dir_index_block_t* b = &idx[hash_block(h, idx->nblocks)];
+    uint32_t k = hash_slot(h);
+    for (uint32_t i = 0; i < DIR_INDEX_SLOTS; i++, k = (k + 1) % DIR_INDEX_SLOTS) {
+        dir_index_slot_t* s = &b->slots[k];
+        if (s->block == 0) return NULL; // end of the probe chain
+        if (s->tag != hash_tag(h)) continue;
+        dirent64_t* de = slot_entry(img, s);
+        if (de != NULL && strncmp(de->name, name, NAME_LEN) == 0) return s;
+    }
+    return NULL;
+}
+
+// Put (block, slot) for name into the index. -1 when its index block is full.
+static int place(dir_index_block_t* idx, const char* name, uint32_t block, uint32_t slot) {
+    uint64_t h = dir_hash(name);
+    dir_index_block_t* b = &idx[hash_block(h, idx->nblocks)];
+    uint32_t k = hash_slot(h);
+    uint32_t i = 0;
+    for (; i < DIR_INDEX_SLOTS; i++, k = (k + 1) % DIR_INDEX_SLOTS) {
+        dir_index_slot_t* s = &b->slots[k];
+        if (s->block == DIR_INDEX_DELETED) break; // reuse a tombstone, used is unchanged
+        if (s->block == 0) {
+            if (b->used >= DIR_INDEX_MAX_USED) return -1;
+            b->used++;
+            break;
+        }
+    }
+    if (i == DIR_INDEX_SLOTS) return -1;
+    b->slots[k].block = block;
+    b->slots[k].slot = (uint16_t)slot;
+    b->slots[k].tag = hash_tag(h);
+    return 0;
+}
+
+static dirent64_t* scan_dir(const image_t* img, const inode_t* dir, const char* name) {
+    for (int i = 0; i < DIRECT_MAX; i++) {
+        if (dir->direct[i] == 0) continue;
+        dirent64_t* de = image_dirents(img, dir->direct[i]);
+        if (de == NULL) continue;
+        for (size_t j = 0; j < DIRENTS_PER_BLOCK; j++) {
+            if (de[j].inode_no != 0 && strncmp(de[j].name, name, NAME_LEN) == 0) return &de[j];
+        }
+    }
+    return NULL;
+}
+
+dirent64_t* dir_lookup(const image_t* img, const inode_t* dir, const char* name) {
+    dir_index_block_t* idx = index_view(img, dir);
+    if (idx == NULL) return scan_dir(img, dir, name);
+    dir_index_slot_t* s = find_slot(img, idx, name);
+    return s ? slot_entry(img, s) : NULL;
+}
+
+void dir_index_drop(image_t* img, bitmap_t* dbm, inode_t* dir) {
+    dir_index_block_t* idx = index_view(img, dir);
+    if (idx != NULL && dir->indirect2 >= img->sb->data_region_start) {
+        bitmap_clear_range(dbm, dir->indirect2 - img->sb->data_region_start, idx->nblocks);
+    }
+    dir->flags &= ~INODE_FL_DIR_INDEX;
+    dir->indirect2 = 0;
+}
+
+// Format nb index blocks at idx and file every live dirent of dir; -1 if a block overflows
+static int fill(image_t* img, const inode_t* dir, dir_index_block_t* idx, uint32_t nb) {
+    memset(idx, 0, (size_t)nb * BS);
+    for (uint32_t b = 0; b < nb; b++) {
+        idx[b].magic = DIR_INDEX_MAGIC;
+        idx[b].nblocks = nb;
+    }
+    for (int i = 0; i < DIRECT_MAX; i++) {
+        if (dir->direct[i] == 0) continue;
+        dirent64_t* de = image_dirents(img, dir->direct[i]);
+        if (de == NULL) continue;
+        for (size_t j = 0; j < DIRENTS_PER_BLOCK; j++) {
+            if (de[j].inode_no == 0) continue;
+            if (place(idx, de[j].name, dir->direct[i], (uint32_t)j) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+int dir_index_build(image_t* img, bitmap_t* dbm, inode_t* dir, uint32_t nblocks) {
+    uint64_t live = 0;
+    for (int i = 0; i < DIRECT_MAX; i++) {
+        dirent64_t* de = dir->direct[i] ? image_dirents(img, dir->direct[i]) : NULL;
+        for (size_t j = 0; de && j < DIRENTS_PER_BLOCK; j++) if (de[j].inode_no != 0) live++;
+    }
+    uint32_t nb = 1;
+    while (nb < nblocks || (uint64_t)nb * DIR_INDEX_MAX_USED / 2 < live) nb <<= 1;
+
+    dir_index_drop(img, dbm, dir);
+    for (; nb <= DIR_INDEX_MAX_BLOCKS; nb <<= 1) {
+        uint64_t start, len;
+        if (bitmap_alloc_extents(dbm, nb, &start, &len, 1) != 1) return -1;
+        uint32_t first = (uint32_t)(img->sb->data_region_start + start);
+        dir_index_block_t* idx = (dir_index_block_t*)image_blocks(img, first, nb);
+        if (idx != NULL && fill(img, dir, idx, nb) == 0) {
+            dir->indirect2 = first;
+            dir->flags |= INODE_FL_DIR_INDEX;
+            return 0;
+        }
+        // unlucky hashes crowd one block: try again twice as large
+        bitmap_clear_range(dbm, start, nb);
+    }
+    return -1;
+}
+
+int dir_index_insert(image_t* img, bitmap_t* dbm, inode_t* dir, const char* name, uint32_t block, uint32_t slot) {
+    dir_index_block_t* idx = index_view(img, dir);
+    if (idx == NULL) {
+        dir_index_drop(img, dbm, dir);
+        return -1;
+    }
+    if (place(idx, name, block, slot) == 0) return 0;
+    // the dirent is already written, so the rebuild picks it up
+    if (dir_index_build(img, dbm, dir, idx->nblocks * 2) != 0) {
+        dir_index_drop(img, dbm, dir);
+        return -1;
+    }
+    return 0;
+}
+
+int dir_index_remove(image_t* img, inode_t* dir, const char* name) {
+    dir_index_block_t* idx = index_view(img, dir);
+    if (idx == NULL) return -1;
+    dir_index_slot_t* s = find_slot(img, idx, name);
+    if (s == NULL) return -1;
+    s->block = DIR_INDEX_DELETED;
+    return 0;
+}
+
+static int is_dir_block(const inode_t* dir, uint32_t block) {
+    for (int i = 0; i < DIRECT_MAX; i++) if (dir->direct[i] != 0 && dir->direct[i] == block) return 1;
+    return 0;
+}
+
+int64_t dir_index_check(const image_t* img, const inode_t* dir) {
+    dir_index_block_t* idx = index_view(img, dir);
+    if (idx == NULL) return -1;
+    int64_t bad = 0;
+
+    // every slot points at a live entry of this directory, filed under the right hash
+    for (uint32_t b = 0; b < idx->nblocks; b++) {
+        if (idx[b].magic != DIR_INDEX_MAGIC || idx[b].nblocks != idx->nblocks) {
+            bad++;
+            continue;
+        }
+        for (uint32_t k = 0; k < DIR_INDEX_SLOTS; k++) {
+            const dir_index_slot_t* s = &idx[b].slots[k];
+            if (s->block == 0 || s->block == DIR_INDEX_DELETED) continue;
+            dirent64_t* de = is_dir_block(dir, s->block) ? slot_entry(img, s) : NULL;
+            if (de == NULL) {
+                bad++;
+                continue;
+            }
+            uint64_t h = dir_hash(de->name);
+            if (hash_block(h, idx->nblocks) != b || hash_tag(h) != s->tag) bad++;
+        }
+    }
+
+    // every live entry is found through the index
+    for (int i = 0; i < DIRECT_MAX; i++) {
+        if (dir->direct[i] == 0) continue;
+        dirent64_t* de = image_dirents(img, dir->direct[i]);
+        for (size_t j = 0; de && j < DIRENTS_PER_BLOCK; j++) {
+            if (de[j].inode_no == 0) continue;
+            if (dir_lookup(img, dir, de[j].name) != &de[j]) bad++;
+        }
+    }
+    return bad;
+}
@@ -0,0 +1,74 @@
+// dir_index.h — on-disk hashed index of a directory's entries
+//
+// The dirent blocks stay the directory: any tool can still scan them
+// linearly, and an image without an index is just as valid. A directory
+// inode with INODE_FL_DIR_INDEX set also has indirect2 pointing at the first
+// of nblocks (a power of two) contiguous index blocks.
+//
+// A name's hash picks one index block and a start slot in it, and slots are
+// probed linearly inside that block. Each slot holds where the dirent is
+// (block, slot) plus 16 more bits of the hash as a tag, so a lookup reads one
+// index block and, on a tag match, one dirent block: O(1) block reads. When an
+// index block gets DIR_INDEX_MAX_USED slots in use, the index is rebuilt twice
+// as large from the dirent blocks.
+#ifndef MINIVSFS_DIR_INDEX_H
+#define MINIVSFS_DIR_INDEX_H
+
+#include <stdint.h>
+
+#include "bitmap.h"
+#include "image.h"
+#include "minivsfs.h"
+
+#define DIR_INDEX_MAGIC 0x5844564Du     // "MVDX"
+#define DIR_INDEX_SLOTS 510             // per block, after the 16-byte header
+#define DIR_INDEX_MAX_USED 448          // grow past ~7/8 full to keep probes short
+#define DIR_INDEX_MAX_BLOCKS 1024u
+#define DIR_INDEX_DELETED 0xFFFFFFFFu   // slot.block of a removed entry (probing goes past it)
+
+#pragma pack(push,1)
+typedef struct {
+    uint32_t block;   // absolute dirent block, 0 = empty slot
+    uint16_t slot;    // entry within that block
+    uint16_t tag;     // hash bits 48..63
+} dir_index_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t nblocks; // index blocks, same value in each of them
+    uint32_t used;    // slots of this block in use (tombstones included)
+    uint32_t reserved;
+    dir_index_slot_t slots[DIR_INDEX_SLOTS];
+} dir_index_block_t;
+#pragma pack(pop)
+_Static_assert(sizeof(dir_index_block_t) == BS, "index block size mismatch");
+
+// FNV-1a over the name as stored in a dirent (at most 58 bytes)
+uint64_t dir_hash(const char* name);
+
+// Find name in dir: through the index when dir has one, otherwise by scanning
+// its dirent blocks. Returns the entry (inside the mapping) or NULL.
+dirent64_t* dir_lookup(const image_t* img, const inode_t* dir, const char* name);
+
+// (Re)build dir's index from its dirent blocks with at least nblocks index
+// blocks (more if the entries need it), allocated as one contiguous run from
+// dbm. A previous index is freed. Returns 0, or -1 with dir left unindexed.
+int dir_index_build(image_t* img, bitmap_t* dbm, inode_t* dir, uint32_t nblocks);
+
+// Record that name now lives in entry `slot` of dirent block `block`
+// (the dirent must already be written). Grows the index when needed. If it
+// cannot, the index is dropped and -1 returned: the directory stays valid.
+int dir_index_insert(image_t* img, bitmap_t* dbm, inode_t* dir, const char* name, uint32_t block, uint32_t slot);
+
+// Forget name (call before its dirent is cleared). 0, or -1 if not indexed.
+int dir_index_remove(image_t* img, inode_t* dir, const char* name);
+
+// Drop dir's index and give its blocks back to dbm
+void dir_index_drop(image_t* img, bitmap_t* dbm, inode_t* dir);
+
+// Consistency check for Validator: every live dirent is found through the
+// index and every index slot points at a live dirent with its name.
+// Returns the number of problems, or -1 if the index blocks are unreadable.
+int64_t dir_index_check(const image_t* img, const inode_t* dir);
+
+#endif
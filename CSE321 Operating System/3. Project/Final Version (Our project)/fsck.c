@@ -0,0 +1,473 @@
+// fsck.c — parallel full-image consistency check
+#include "fsck.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "dedup.h"
+#include "dir_index.h"
+#include "inode_map.h"
+
+#define FSCK_CHUNK 1024      // inodes a worker takes at a time
+#define FSCK_PRINT_MAX 20    // problems printed one by one; the rest are only counted
+#define FSCK_MAX_THREADS 64
+
+typedef struct {
+    const image_t* img;
+    const uint8_t* ibm;
+    const uint8_t* dbm;
+    _Atomic uint64_t* claimed;  // bit i = data block data_region_start+i is referenced
+    _Atomic uint32_t* refs;     // refs[n] = directory entries naming inode n
+    uint8_t* reached;           // reached[n] = inode n is reachable from the root (after phase 1)
+    const dedup_entry_t* dd;    // the dedup table, sorted by block (dd_count entries)
+    uint64_t dd_count;
+    _Atomic uint32_t* dd_seen;  // dd_seen[k] = block map entries pointing at dd[k].block
+    uint64_t ipg;               // inodes per group, 0 without block groups
+    _Atomic uint64_t next;      // first inode of the next chunk to hand out
+    _Atomic uint64_t printed;
+    int phase;
+} fsck_ctx_t;
+
+typedef struct {
+    fsck_ctx_t* ctx;
+    fsck_report_t rep;
+    uint32_t* buf;       // block map of the inode being checked
+    uint64_t buf_cap;
+} worker_t;
+
+static void problem(fsck_ctx_t* ctx, const char* fmt, ...) {
+    if (atomic_fetch_add_explicit(&ctx->printed, 1, memory_order_relaxed) >= FSCK_PRINT_MAX) return;
+    char line[160];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "[FAIL] %s\n", line);
+}
+
+static int bit(const uint8_t* b, uint64_t i) {
+    return (b[i >> 3] >> (i & 7)) & 1;
+}
+
+// Index of blk in the dedup table, or -1
+static int64_t shared_index(const fsck_ctx_t* ctx, uint64_t blk) {
+    uint64_t lo = 0, hi = ctx->dd_count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (ctx->dd[mid].block < blk) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < ctx->dd_count && ctx->dd[lo].block == blk ? (int64_t)lo : -1;
+}
+
+// Record that inode ino references block blk
+static void claim(worker_t* w, uint64_t ino, uint64_t blk) {
+    const superblock_t* sb = w->ctx->img->sb;
+    if (blk < sb->data_region_start || blk >= sb->data_region_start + sb->data_region_blocks) {
+        w->rep.bad_block_map++;
+        problem(w->ctx, "inode %llu: block %llu outside the data region", (unsigned long long)ino, (unsigned long long)blk);
+        return;
+    }
+    uint64_t rel = blk - sb->data_region_start;
+    uint64_t mask = UINT64_C(1) << (rel & 63);
+    uint64_t old = atomic_fetch_or_explicit(&w->ctx->claimed[rel >> 6], mask, memory_order_relaxed);
+    int64_t k = shared_index(w->ctx, blk);
+    if (k >= 0) {
+        // a shared block: its claims are counted against the table after phase 1
+        atomic_fetch_add_explicit(&w->ctx->dd_seen[k], 1, memory_order_relaxed);
+        w->rep.shared_refs++;
+    } else if (old & mask) {
+        w->rep.double_alloc++;
+        problem(w->ctx, "inode %llu: block %llu is referenced more than once", (unsigned long long)ino, (unsigned long long)blk);
+    }
+    if (w->ctx->ipg && rel / GROUP_BLOCKS != (ino - 1) / w->ctx->ipg) w->rep.far_blocks++;
+    w->rep.blocks_claimed++;
+}
+
+static int reserve(worker_t* w, uint64_t n) {
+    if (n <= w->buf_cap) return 0;
+    uint32_t* p = realloc(w->buf, n * sizeof(uint32_t));
+    if (p == NULL) return -1;
+    w->buf = p;
+    w->buf_cap = n;
+    return 0;
+}
+
+static void check_file(worker_t* w, uint64_t i, const inode_t* ino) {
+    if (ino->flags & INODE_FL_INLINE) {
+        // the data is in the inode: nothing to claim, and no other way of mapping it
+        w->rep.inline_files++;
+        if (ino->size_bytes == 0 || ino->size_bytes > INLINE_MAX ||
+            (ino->flags & (INODE_FL_EXTENTS | INODE_FL_SPARSE | INODE_FL_COMPRESSED))) {
+            w->rep.bad_block_map++;
+            problem(w->ctx, "inode %llu: inline file of %llu bytes with flags 0x%x", (unsigned long long)i,
+                    (unsigned long long)ino->size_bytes, ino->flags);
+        }
+        return;
+    }
+    uint64_t n = map_file_blocks(ino->size_bytes);
+    uint64_t m = map_is_extents(ino) ? 0 : map_meta_blocks(n);
+    if (m == UINT64_MAX || reserve(w, n + m + 1) != 0 ||
+        map_read(w->ctx->img, ino, n, w->buf + m, w->buf) != (int64_t)m) {
+        w->rep.bad_block_map++;
+        problem(w->ctx, "inode %llu: unreadable block map", (unsigned long long)i);
+        return;
+    }
+    w->rep.meta_bytes += m * BS;
+    for (uint64_t k = 0; k < m; k++) claim(w, i, w->buf[k]);
+    // a 0 data pointer is a hole, but only in an inode that says it has holes
+    int sparse = (ino->flags & INODE_FL_SPARSE) != 0;
+    for (uint64_t k = m; k < n + m; k++) {
+        if (w->buf[k] == 0 && sparse) w->rep.holes++;
+        else claim(w, i, w->buf[k]);
+    }
+    // the blocks a compressed cluster stores come first, then its 0 entries (compress.h)
+    for (uint64_t c = 0; (ino->flags & INODE_FL_COMPRESSED) && c < n; c += COMPRESS_CLUSTER_BLOCKS) {
+        const uint32_t* p = w->buf + m + c;
+        uint64_t len = n - c < COMPRESS_CLUSTER_BLOCKS ? n - c : COMPRESS_CLUSTER_BLOCKS;
+        for (uint64_t k = 1; k < len; k++) {
+            if (p[k] != 0 && p[k - 1] == 0) {
+                w->rep.bad_block_map++;
+                problem(w->ctx, "inode %llu: compressed cluster at block %llu has a gap",
+                        (unsigned long long)i, (unsigned long long)c);
+                break;
+            }
+        }
+    }
+}
+
+static int is_dot(const char* name) {
+    return strncmp(name, ".", 2) == 0 || strncmp(name, "..", 3) == 0;
+}
+
+static void check_dir(worker_t* w, uint64_t i, const inode_t* ino) {
+    fsck_ctx_t* ctx = w->ctx;
+    const superblock_t* sb = ctx->img->sb;
+    // every directory opens with "." (itself) and ".." (its parent, itself for the root)
+    const dirent64_t* first = ino->direct[0] >= sb->data_region_start ? image_dirents(ctx->img, ino->direct[0]) : NULL;
+    if (first == NULL || first[0].inode_no != i || first[0].type != 2 || strncmp(first[0].name, ".", sizeof(first[0].name)) != 0 ||
+        first[1].inode_no == 0 || first[1].type != 2 || strncmp(first[1].name, "..", sizeof(first[1].name)) != 0 ||
+        (i == ROOT_INO && first[1].inode_no != ROOT_INO)) {
+        w->rep.bad_dirent++;
+        problem(ctx, "directory inode %llu: no '.' and '..' at the start", (unsigned long long)i);
+    }
+    uint64_t entries = 0;   // other than "." and ".."
+    for (int d = 0; d < DIRECT_MAX; d++) {
+        if (ino->direct[d] == 0) continue;
+        claim(w, i, ino->direct[d]);
+        if (ino->direct[d] < sb->data_region_start) continue;
+        const dirent64_t* de = image_dirents(ctx->img, ino->direct[d]);
+        if (de == NULL) continue;
+        w->rep.meta_bytes += BS;
+        for (size_t j = 0; j < DIRENTS_PER_BLOCK; j++) {
+            if (de[j].inode_no == 0) continue;
+            const uint8_t* p = (const uint8_t*)&de[j];
+            uint8_t x = 0;
+            for (int k = 0; k < 63; k++) x ^= p[k];
+            if (x != de[j].checksum || (de[j].type != 1 && de[j].type != 2) ||
+                de[j].name[0] == '\0' || de[j].inode_no > sb->inode_count) {
+                w->rep.bad_dirent++;
+                problem(ctx, "directory inode %llu: bad entry %zu in block %u",
+                        (unsigned long long)i, j, ino->direct[d]);
+                continue;
+            }
+            atomic_fetch_add_explicit(&ctx->refs[de[j].inode_no], 1, memory_order_relaxed);
+            if (!is_dot(de[j].name)) entries++;
+        }
+    }
+    // a directory links "." and ".." plus every entry added to it (make_dir(), the adds)
+    if (ino->links != 2 + entries) {
+        w->rep.link_mismatch++;
+        problem(ctx, "directory inode %llu: links %u but %llu entries", (unsigned long long)i, ino->links,
+                (unsigned long long)entries);
+    }
+    if (ino->flags & INODE_FL_DIR_INDEX) {
+        const dir_index_block_t* idx = (const dir_index_block_t*)image_block(ctx->img, ino->indirect2);
+        if (idx == NULL || idx->magic != DIR_INDEX_MAGIC || idx->nblocks == 0 || idx->nblocks > DIR_INDEX_MAX_BLOCKS) {
+            w->rep.bad_dir_index++;
+            problem(ctx, "directory inode %llu: unreadable hash index", (unsigned long long)i);
+            return;
+        }
+        for (uint32_t b = 0; b < idx->nblocks; b++) claim(w, i, (uint64_t)ino->indirect2 + b);
+        w->rep.meta_bytes += (uint64_t)idx->nblocks * BS;
+        if (dir_index_check(ctx->img, ino) != 0) {
+            w->rep.bad_dir_index++;
+            problem(ctx, "directory inode %llu: hash index does not match its entries", (unsigned long long)i);
+        }
+    }
+}
+
+// Phase 1: the inode itself and everything it references
+static void check_inode(worker_t* w, uint64_t i) {
+    fsck_ctx_t* ctx = w->ctx;
+    const inode_t* ino = image_inode(ctx->img, i);
+    w->rep.inodes_scanned++;
+    if (!bit(ctx->ibm, i - 1)) {
+        if (ino->mode != 0 || ino->links != 0) {
+            w->rep.stray_inode++;
+            problem(ctx, "inode %llu: not allocated but not zeroed", (unsigned long long)i);
+        }
+        return;
+    }
+    w->rep.inodes_used++;
+
+    uint8_t tmp[INODE_SIZE];
+    memcpy(tmp, ino, INODE_SIZE);
+    memset(&tmp[120], 0, 8);
+    if ((uint32_t)ino->inode_crc != crc32(tmp, 120)) {
+        w->rep.bad_inode_crc++;
+        problem(ctx, "inode %llu: crc mismatch", (unsigned long long)i);
+    }
+
+    switch (ino->mode & 0xF000) {
+    case 0x8000:
+        w->rep.files++;
+        check_file(w, i, ino);
+        break;
+    case 0x4000:
+        w->rep.dirs++;
+        check_dir(w, i, ino);
+        break;
+    default:
+        w->rep.bad_mode++;
+        problem(ctx, "inode %llu: mode 0x%x is neither file nor directory", (unsigned long long)i, ino->mode);
+    }
+}
+
+// Between the phases, one thread: breadth-first from the root over the
+// entries phase 1 found valid, marking what is reachable. Every directory
+// must be named once, by a directory its ".." names.
+static void mark_reachable(fsck_ctx_t* ctx, fsck_report_t* rep) {
+    const superblock_t* sb = ctx->img->sb;
+    uint32_t* queue = malloc((sb->inode_count + 1) * sizeof(uint32_t));
+    if (queue == NULL) {
+        memset(ctx->reached, 1, sb->inode_count + 1);   // no memory: do not report anything unreachable
+        return;
+    }
+    uint64_t head = 0, tail = 0;
+    queue[tail++] = ROOT_INO;
+    ctx->reached[ROOT_INO] = 1;
+    while (head < tail) {
+        uint32_t dir = queue[head++];
+        const inode_t* ino = image_inode(ctx->img, dir);
+        for (int d = 0; d < DIRECT_MAX; d++) {
+            if (ino->direct[d] < sb->data_region_start) continue;
+            const dirent64_t* de = image_dirents(ctx->img, ino->direct[d]);
+            for (size_t j = 0; de != NULL && j < DIRENTS_PER_BLOCK; j++) {
+                uint32_t child = de[j].inode_no;
+                if (child == 0 || child > sb->inode_count || is_dot(de[j].name)) continue;
+                if ((de[j].type != 2) != ((image_inode(ctx->img, child)->mode & 0xF000) != 0x4000)) {
+                    rep->bad_dirent++;
+                    problem(ctx, "directory inode %u: entry '%.58s' type %u does not match inode %u",
+                            dir, de[j].name, de[j].type, child);
+                }
+                if (de[j].type != 2) {
+                    ctx->reached[child] = 1;
+                    continue;
+                }
+                if (ctx->reached[child]) {
+                    rep->bad_dirent++;
+                    problem(ctx, "directory inode %u is named by more than one entry", child);
+                    continue;
+                }
+                ctx->reached[child] = 1;
+                const inode_t* sub = image_inode(ctx->img, child);
+                if ((sub->mode & 0xF000) != 0x4000) continue;
+                const dirent64_t* first = sub->direct[0] >= sb->data_region_start ? image_dirents(ctx->img, sub->direct[0]) : NULL;
+                if (first != NULL && first[1].inode_no != dir) {
+                    rep->bad_dirent++;
+                    problem(ctx, "directory inode %u: '..' names inode %u, not its parent %u", child, first[1].inode_no, dir);
+                }
+                queue[tail++] = child;
+            }
+        }
+    }
+    free(queue);
+}
+
+// Phase 2: allocation and link counts against the references counted in phase 1
+static void check_refs(worker_t* w, uint64_t i) {
+    fsck_ctx_t* ctx = w->ctx;
+    uint32_t r = atomic_load_explicit(&ctx->refs[i], memory_order_relaxed);
+    int used = bit(ctx->ibm, i - 1);
+    if (used && r == 0) {
+        w->rep.orphan_inode++;
+        problem(ctx, "inode %llu: allocated but no directory entry names it", (unsigned long long)i);
+    }
+    if (!used && r > 0) {
+        w->rep.dangling_dirent += r;
+        problem(ctx, "inode %llu: named by %u entries but not allocated", (unsigned long long)i, r);
+    }
+    if (used && r > 0 && !ctx->reached[i]) {
+        w->rep.unreachable++;
+        problem(ctx, "inode %llu: named by %u entries but not reachable from the root", (unsigned long long)i, r);
+    }
+    const inode_t* ino = image_inode(ctx->img, i);
+    if (used && (ino->mode & 0xF000) == 0x8000 && ino->links != r) {
+        w->rep.link_mismatch++;
+        problem(ctx, "inode %llu: links %u but %u entries", (unsigned long long)i, ino->links, r);
+    }
+}
+
+static void* worker(void* arg) {
+    worker_t* w = arg;
+    fsck_ctx_t* ctx = w->ctx;
+    uint64_t count = ctx->img->sb->inode_count;
+    for (;;) {
+        uint64_t first = atomic_fetch_add_explicit(&ctx->next, FSCK_CHUNK, memory_order_relaxed) + 1;
+        if (first > count) break;
+        uint64_t last = first + FSCK_CHUNK - 1 < count ? first + FSCK_CHUNK - 1 : count;
+        for (uint64_t i = first; i <= last; i++) {
+            if (ctx->phase == 1) check_inode(w, i);
+            else check_refs(w, i);
+        }
+    }
+    return NULL;
+}
+
+static void run_phase(fsck_ctx_t* ctx, worker_t* workers, int threads, int phase) {
+    pthread_t tid[FSCK_MAX_THREADS];
+    ctx->phase = phase;
+    atomic_store(&ctx->next, 0);
+    int started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&tid[started], NULL, worker, &workers[started]) != 0) break;
+    }
+    if (started == 0) worker(&workers[0]); // no threads: do it here
+    for (int t = 0; t < started; t++) pthread_join(tid[t], NULL);
+}
+
+static void add_report(fsck_report_t* a, const fsck_report_t* b) {
+    // every field is a uint64_t counter
+    uint64_t* pa = (uint64_t*)a;
+    const uint64_t* pb = (const uint64_t*)b;
+    for (size_t k = 0; k < sizeof(*a) / sizeof(uint64_t); k++) pa[k] += pb[k];
+}
+
+int64_t fsck_run(const image_t* img, int threads, fsck_report_t* report) {
+    const superblock_t* sb = img->sb;
+    memset(report, 0, sizeof(*report));
+    if (image_check_layout(img) != 0) return -1;
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    if (threads > FSCK_MAX_THREADS) threads = FSCK_MAX_THREADS;
+
+    fsck_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.img = img;
+    ctx.ibm = image_inode_bitmap(img);
+    ctx.dbm = image_data_bitmap(img);
+    uint64_t nwords = (sb->data_region_blocks + 63) / 64;
+    ctx.claimed = calloc(nwords ? nwords : 1, sizeof(uint64_t));
+    ctx.refs = calloc(sb->inode_count + 1, sizeof(uint32_t));
+    ctx.reached = calloc(sb->inode_count + 1, 1);
+    worker_t* workers = calloc(threads, sizeof(worker_t));
+    if (ctx.ibm == NULL || ctx.dbm == NULL || ctx.claimed == NULL || ctx.refs == NULL || ctx.reached == NULL || workers == NULL) {
+        free(ctx.claimed);
+        free(ctx.refs);
+        free(ctx.reached);
+        free(workers);
+        return -1;
+    }
+    for (int t = 0; t < threads; t++) workers[t].ctx = &ctx;
+
+    // the dedup table: its own blocks are claimed here, the ones it shares by the files
+    if (dedup_table(img, &ctx.dd, &ctx.dd_count) != 0) {
+        report->bad_dedup++;
+        problem(&ctx, "dedup table is damaged");
+    } else if (sb->flags & SB_FL_DEDUP) {
+        const superblock_ext_t* ext = SB_EXT(sb);
+        ctx.dd_seen = calloc(ctx.dd_count ? ctx.dd_count : 1, sizeof(uint32_t));
+        if (ctx.dd_seen == NULL) ctx.dd_count = 0;
+        for (uint64_t b = ext->dedup_start; b < ext->dedup_start + ext->dedup_blocks; b++) {
+            uint64_t rel = b - sb->data_region_start;
+            ctx.claimed[rel >> 6] |= UINT64_C(1) << (rel & 63);
+            if (shared_index(&ctx, b) >= 0) {
+                report->bad_dedup++;
+                problem(&ctx, "dedup table block %llu is listed as shared", (unsigned long long)b);
+            }
+        }
+        report->meta_bytes += ext->dedup_blocks * BS;
+    }
+
+    // block groups: the descriptor table and the inode slices are metadata in the data region
+    const group_desc_t* gd = image_groups(img);
+    if (gd != NULL) {
+        const superblock_ext_t* ext = SB_EXT(sb);
+        ctx.ipg = ext->inodes_per_group;
+        if (crc32(gd, ext->group_count * sizeof(group_desc_t)) != ext->groups_crc) {
+            report->bad_groups++;
+            problem(&ctx, "group descriptor table crc mismatch");
+        }
+        for (uint64_t g = 0; g <= ext->group_count; g++) {
+            // g == group_count: the table itself
+            uint64_t first = g < ext->group_count ? gd[g].inode_table : ext->groups_start;
+            uint64_t n = g < ext->group_count ? ext->inodes_per_group / INODES_PER_BLOCK : ext->groups_blocks;
+            if (first == 0) continue;
+            for (uint64_t rel = first - sb->data_region_start; rel < first - sb->data_region_start + n; rel++) {
+                ctx.claimed[rel >> 6] |= UINT64_C(1) << (rel & 63);
+            }
+        }
+        report->meta_bytes += ext->groups_blocks * BS;
+    }
+
+    run_phase(&ctx, workers, threads, 1);
+    mark_reachable(&ctx, report);
+    run_phase(&ctx, workers, threads, 2);
+
+    for (int t = 0; t < threads; t++) {
+        add_report(report, &workers[t].rep);
+        free(workers[t].buf);
+    }
+    free(workers);
+
+    // every shared block: claimed as often as the table says, still what its hash says
+    for (uint64_t k = 0; k < ctx.dd_count; k++) {
+        uint32_t seen = atomic_load_explicit(&ctx.dd_seen[k], memory_order_relaxed);
+        uint8_t hash[DEDUP_HASH_BYTES];
+        if (seen > 1) report->shared_blocks++;
+        if (seen != ctx.dd[k].refs) {
+            report->bad_dedup++;
+            problem(&ctx, "shared block %u: %u references, the dedup table counts %u", ctx.dd[k].block, seen, ctx.dd[k].refs);
+        }
+        dedup_hash(image_block(img, ctx.dd[k].block), hash);
+        if (memcmp(hash, ctx.dd[k].hash, DEDUP_HASH_BYTES) != 0) {
+            report->bad_dedup++;
+            problem(&ctx, "shared block %u does not match its hash", ctx.dd[k].block);
+        }
+    }
+    report->meta_bytes += ctx.dd_count * sizeof(dedup_entry_t);
+
+    // claimed blocks against the data bitmap, 64 blocks per step
+    for (uint64_t w = 0; w < nwords; w++) {
+        uint64_t d = 0;
+        for (int k = 0; k < 8; k++) d |= (uint64_t)ctx.dbm[w * 8 + k] << (8 * k);
+        uint64_t valid = UINT64_MAX;
+        if (w == nwords - 1 && (sb->data_region_blocks & 63)) valid = (UINT64_C(1) << (sb->data_region_blocks & 63)) - 1;
+        uint64_t c = atomic_load_explicit(&ctx.claimed[w], memory_order_relaxed);
+        d &= valid;
+        uint64_t free_but_used = c & ~d, leaked = d & ~c;
+        report->used_but_free += (uint64_t)__builtin_popcountll(free_but_used);
+        report->leaked += (uint64_t)__builtin_popcountll(leaked);
+        if (free_but_used) problem(&ctx, "data block %llu is referenced but marked free",
+                                   (unsigned long long)(sb->data_region_start + w * 64 + __builtin_ctzll(free_but_used)));
+        if (leaked) problem(&ctx, "data block %llu is marked used but referenced by nothing",
+                            (unsigned long long)(sb->data_region_start + w * 64 + __builtin_ctzll(leaked)));
+    }
+    report->meta_bytes += sb->inode_count * INODE_SIZE + (sb->inode_bitmap_blocks + sb->data_bitmap_blocks) * BS;
+
+    free(ctx.claimed);
+    free(ctx.refs);
+    free(ctx.reached);
+    free(ctx.dd_seen);
+    return (int64_t)(report->bad_inode_crc + report->bad_mode + report->bad_block_map + report->double_alloc +
+                     report->used_but_free + report->leaked + report->bad_dirent + report->bad_dir_index +
+                     report->dangling_dirent + report->orphan_inode + report->link_mismatch + report->stray_inode +
+                     report->bad_dedup + report->bad_groups + report->unreachable);
+}
@@ -0,0 +1,76 @@
+// fsck.h — full consistency check of a MiniVSFS image (Validator --full)
+//
+// Phase 1 splits the inode table across a thread pool. Every allocated
+// inode gets its CRC, mode and block map checked. Every block it
+// references (data, pointer, directory and index blocks) is range-checked
+// and claimed in a shared bitmap with an atomic OR, so a block claimed
+// twice is a double allocation. Directory inodes also check each dirent's
+// checksum and count one reference for the inode it names, and that they
+// open with "." and "..", so subdirectories (volume_mkdir) are checked like
+// the root.
+//
+// Directories must link 2 + their entries ("." and ".." plus one per entry
+// added to them). Between the phases one thread walks the tree breadth-first
+// from the root: every directory named once, by the directory its ".."
+// names, and each entry's type matching its inode. Phase 2 (same pool)
+// compares reference counts with the inode bitmap, the link counts of
+// regular files, and what the walk reached: inodes named only from a part of
+// the tree cut off from the root are unreachable. The claimed blocks are
+// then compared word by word with the data bitmap.
+//
+// Blocks in the dedup table (dedup.h) may be claimed any number of times:
+// their claims are counted instead, and must add up to the table's count
+// for the block; each one must still match its hash. The table's own blocks
+// are claimed before phase 1.
+//
+// With block groups (SB_FL_GROUPS) the descriptor table and the inode
+// slices are claimed before phase 1 too, the table's crc is checked, and
+// file blocks outside the group of their inode are counted: not a
+// problem, a measure of how well the adds kept files near their inodes.
+//
+// Threads never share a counter: each one fills its own fsck_report_t,
+// and the reports are summed after the join.
+#ifndef MINIVSFS_FSCK_H
+#define MINIVSFS_FSCK_H
+
+#include <stdint.h>
+
+#include "image.h"
+
+typedef struct {
+    // what was examined
+    uint64_t inodes_scanned;   // the whole inode table
+    uint64_t inodes_used;      // allocated in the inode bitmap
+    uint64_t files, dirs;
+    uint64_t blocks_claimed;   // blocks referenced by some inode
+    uint64_t holes;            // file blocks without a data block (INODE_FL_SPARSE)
+    uint64_t inline_files;     // files kept in their inode (INODE_FL_INLINE)
+    uint64_t shared_blocks;    // dedup table blocks referenced more than once
+    uint64_t shared_refs;      // block map entries pointing at dedup table blocks
+    uint64_t meta_bytes;       // inode table, bitmaps, pointer/directory/index blocks read
+    uint64_t far_blocks;       // with block groups: blocks claimed outside their inode's group
+
+    // problems
+    uint64_t bad_inode_crc;
+    uint64_t bad_mode;          // allocated inode that is neither a file nor a directory
+    uint64_t bad_block_map;     // unreadable map, or a pointer outside the data region
+    uint64_t double_alloc;      // block referenced more than once
+    uint64_t used_but_free;     // referenced block whose data bitmap bit is clear
+    uint64_t leaked;            // data bitmap bit set, block referenced by nothing
+    uint64_t bad_dirent;        // bad checksum, type, name or inode number
+    uint64_t bad_dir_index;
+    uint64_t dangling_dirent;   // names an inode that is not allocated
+    uint64_t orphan_inode;      // allocated, but no directory entry names it
+    uint64_t link_mismatch;     // file links != entries naming it; directory links != 2 + its entries
+    uint64_t stray_inode;       // not allocated, but not zeroed either
+    uint64_t bad_dedup;         // damaged dedup table, count != references, or contents != hash
+    uint64_t bad_groups;        // group descriptor table crc
+    uint64_t unreachable;       // named by some entry, but not reachable from the root (a cut-off cycle)
+} fsck_report_t;
+
+// Check img with `threads` workers (0 = one per online CPU). The first
+// problems found are also printed to stderr as they are found.
+// Returns the number of problems, or -1 if the check could not run.
+int64_t fsck_run(const image_t* img, int threads, fsck_report_t* report);
+
+#endif
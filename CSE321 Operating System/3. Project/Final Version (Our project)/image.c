@@ -0,0 +1,212 @@
+// image.c — mmap-backed image access
+#define _GNU_SOURCE
+#include "image.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int map_fd(image_t *img, int fd, int writable) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < BS) return -1;
+
+    int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+    int flags = writable == IMAGE_PRIVATE ? MAP_PRIVATE : MAP_SHARED;
+    void *base = mmap(NULL, st.st_size, prot, flags, fd, 0);
+    if (base == MAP_FAILED) return -1;
+
+    img->fd = fd;
+    img->writable = writable;
+    img->base = base;
+    img->size = st.st_size;
+    img->nblocks = img->size / BS;
+    img->sb = (superblock_t *)img->base;
+    return 0;
+}
+
+int image_open(image_t *img, const char *path, int mode) {
+    memset(img, 0, sizeof(*img));
+    int fd = open(path, mode != IMAGE_READ ? O_RDWR : O_RDONLY);
+    if (fd < 0) return -1;
+    if (map_fd(img, fd, mode) != 0) {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+int image_create(image_t *img, const char *path, uint64_t size) {
+    memset(img, 0, sizeof(*img));
+    //O_TRUNC : truncate the file (make it empty) if it already exists
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    // ftruncate extends with a hole: nothing is written until a block is touched
+    if (ftruncate(fd, size) != 0 || map_fd(img, fd, IMAGE_WRITE) != 0) {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+// first + count <= limit, without overflow
+static int range_ok(uint64_t first, uint64_t count, uint64_t limit) {
+    return first <= limit && count <= limit - first;
+}
+
+// The group descriptors describe the layout mkfs_builder --groups makes: groups
+// of GROUP_BLOCKS blocks in order, the groups with inodes first, each inode
+// slice inside its group, and inode_count the inodes of those slices
+static int check_groups(const image_t *img) {
+    const superblock_t *sb = img->sb;
+    const superblock_ext_t *ext = SB_EXT(sb);
+    const group_desc_t *gd = image_groups(img);
+    uint64_t ipg = ext->inodes_per_group, with_inodes = 0;
+    if (gd == NULL || ext->groups_start != sb->data_region_start || ipg == 0 || ipg % INODES_PER_BLOCK != 0 ||
+        ext->group_count != (sb->data_region_blocks + GROUP_BLOCKS - 1) / GROUP_BLOCKS) return -1;
+    for (uint64_t g = 0; g < ext->group_count; g++) {
+        uint64_t first = sb->data_region_start + g * GROUP_BLOCKS;
+        uint64_t blocks = sb->data_region_blocks - g * GROUP_BLOCKS;
+        if (blocks > GROUP_BLOCKS) blocks = GROUP_BLOCKS;
+        if (gd[g].first_block != first || gd[g].blocks != blocks) return -1;
+        if (gd[g].first_inode == 0) {
+            if (gd[g].inode_table != 0) return -1;
+            continue;
+        }
+        if (g != with_inodes || gd[g].first_inode != g * ipg + 1 ||
+            gd[g].inode_table < first || !range_ok(gd[g].inode_table, ipg / INODES_PER_BLOCK, first + blocks)) return -1;
+        with_inodes++;
+    }
+    return sb->inode_count == with_inodes * ipg ? 0 : -1;
+}
+
+int image_check_layout(const image_t *img) {
+    const superblock_t *sb = img->sb;
+    if (sb->magic != MINIVSFS_MAGIC || sb->block_size != BS) return -1;
+    if (sb->total_blocks > img->nblocks) return -1;
+    if (!range_ok(sb->inode_bitmap_start, sb->inode_bitmap_blocks, sb->total_blocks)) return -1;
+    if (!range_ok(sb->data_bitmap_start, sb->data_bitmap_blocks, sb->total_blocks)) return -1;
+    if (!range_ok(sb->inode_table_start, sb->inode_table_blocks, sb->total_blocks)) return -1;
+    if (!range_ok(sb->data_region_start, sb->data_region_blocks, sb->total_blocks)) return -1;
+    if (sb->flags & SB_FL_GROUPS) {
+        if (check_groups(img) != 0) return -1;
+    } else if (sb->inode_count > sb->inode_table_blocks * INODES_PER_BLOCK) {
+        return -1;
+    }
+    if (sb->inode_count > sb->inode_bitmap_blocks * BS * 8) return -1;
+    if (sb->data_region_blocks > sb->data_bitmap_blocks * BS * 8) return -1;
+    if (sb->flags & SB_FL_JOURNAL) {
+        const superblock_ext_t *ext = SB_EXT(sb);
+        // the journal sits between the inode table and the data region
+        if (ext->journal_blocks < 2 || ext->journal_start < sb->inode_table_start + sb->inode_table_blocks) return -1;
+        if (!range_ok(ext->journal_start, ext->journal_blocks, sb->data_region_start)) return -1;
+    }
+    if (sb->flags & SB_FL_DEDUP) {
+        // the dedup table is a run of ordinary data blocks
+        const superblock_ext_t *ext = SB_EXT(sb);
+        if (ext->dedup_blocks == 0 || ext->dedup_start < sb->data_region_start) return -1;
+        if (!range_ok(ext->dedup_start, ext->dedup_blocks, sb->data_region_start + sb->data_region_blocks)) return -1;
+    }
+    return 0;
+}
+
+// Page-aligned [addr, addr+len) covering blocks [first, first+count)
+static int page_span(const image_t *img, uint64_t first, uint64_t count, uint8_t **addr, size_t *len) {
+    if (!range_ok(first, count, img->nblocks) || count == 0) return -1;
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = first * BS;
+    uint64_t end = (first + count) * BS;
+    start -= start % page;
+    *addr = img->base + start;
+    *len = end - start;
+    return 0;
+}
+
+int image_flush(image_t *img) {
+    if (img->writable != IMAGE_WRITE) return 0;
+    return msync(img->base, img->size, MS_SYNC);
+}
+
+int image_flush_blocks(image_t *img, uint64_t first, uint64_t count) {
+    uint8_t *addr;
+    size_t len;
+    if (img->writable != IMAGE_WRITE) return 0;
+    if (page_span(img, first, count, &addr, &len) != 0) return -1;
+    return msync(addr, len, MS_SYNC);
+}
+
+void image_advise(const image_t *img, uint64_t first, uint64_t count, image_advice_t advice) {
+    static const int flags[] = {
+        [IMAGE_ADV_NORMAL] = MADV_NORMAL,
+        [IMAGE_ADV_SEQUENTIAL] = MADV_SEQUENTIAL,
+        [IMAGE_ADV_WILLNEED] = MADV_WILLNEED,
+        [IMAGE_ADV_DONTNEED] = MADV_DONTNEED,
+    };
+    uint8_t *addr;
+    size_t len;
+    if (page_span(img, first, count, &addr, &len) != 0) return;
+    madvise(addr, len, flags[advice]); // only a hint, failure is harmless
+}
+
+int image_close(image_t *img) {
+    int rc = 0;
+    if (img->base != NULL && munmap(img->base, img->size) != 0) rc = -1;
+    if (img->fd >= 0 && close(img->fd) != 0) rc = -1;
+    img->base = NULL;
+    img->sb = NULL;
+    img->fd = -1;
+    return rc;
+}
+
+uint8_t *image_block(const image_t *img, uint64_t block_no) {
+    return block_no < img->nblocks ? img->base + block_no * BS : NULL;
+}
+
+uint8_t *image_blocks(const image_t *img, uint64_t first, uint64_t count) {
+    return range_ok(first, count, img->nblocks) ? img->base + first * BS : NULL;
+}
+
+const group_desc_t *image_groups(const image_t *img) {
+    const superblock_t *sb = img->sb;
+    const superblock_ext_t *ext = SB_EXT(sb);
+    if (!(sb->flags & SB_FL_GROUPS) || ext->group_count > (uint64_t)ext->groups_blocks * BS / sizeof(group_desc_t)) {
+        return NULL;
+    }
+    return (const group_desc_t *)image_blocks(img, ext->groups_start, ext->groups_blocks);
+}
+
+uint64_t image_inode_block(const image_t *img, uint64_t inode_no) {
+    const superblock_t *sb = img->sb;
+    if (inode_no < 1 || inode_no > sb->inode_count) return 0;
+    uint64_t i = inode_no - 1, block;
+    if (sb->flags & SB_FL_GROUPS) {
+        // the slice of its group
+        const superblock_ext_t *ext = SB_EXT(sb);
+        const group_desc_t *gd = image_groups(img);
+        uint64_t g = ext->inodes_per_group ? i / ext->inodes_per_group : UINT64_MAX;
+        if (gd == NULL || g >= ext->group_count || gd[g].inode_table == 0) return 0;
+        block = gd[g].inode_table + i % ext->inodes_per_group / INODES_PER_BLOCK;
+    } else {
+        block = sb->inode_table_start + i / INODES_PER_BLOCK;
+    }
+    return block < img->nblocks ? block : 0;
+}
+
+inode_t *image_inode(const image_t *img, uint64_t inode_no) {
+    uint64_t block = image_inode_block(img, inode_no);
+    if (block == 0) return NULL;
+    return (inode_t *)(img->base + block * BS + (inode_no - 1) % INODES_PER_BLOCK * INODE_SIZE);
+}
+
+dirent64_t *image_dirents(const image_t *img, uint64_t block_no) {
+    return (dirent64_t *)image_block(img, block_no);
+}
+
+uint8_t *image_inode_bitmap(const image_t *img) {
+    return image_blocks(img, img->sb->inode_bitmap_start, img->sb->inode_bitmap_blocks);
+}
+
+uint8_t *image_data_bitmap(const image_t *img) {
+    return image_blocks(img, img->sb->data_bitmap_start, img->sb->data_bitmap_blocks);
+}
@@ -0,0 +1,73 @@
+// image.h — memory-mapped access to a MiniVSFS image, shared by all tools
+//
+// The whole image is mapped once (MAP_SHARED), and every on-disk structure
+// is used in place through a typed view: no seek, no per-access buffer, no
+// copy. Writes go to the page cache like any store to memory; image_flush()
+// makes them durable with msync().
+//
+// Every accessor checks its argument against the mapped size and returns
+// NULL when the structure would lie outside the file, so a corrupt
+// superblock or pointer can never read past the mapping.
+#ifndef MINIVSFS_IMAGE_H
+#define MINIVSFS_IMAGE_H
+
+#include <stdint.h>
+
+#include "minivsfs.h"
+
+typedef struct {
+    int fd;
+    int writable;        // IMAGE_READ / IMAGE_WRITE / IMAGE_PRIVATE
+    uint8_t *base;       // start of the mapping (block 0)
+    uint64_t size;       // bytes mapped
+    uint64_t nblocks;    // whole blocks mapped
+    superblock_t *sb;    // view of block 0
+} image_t;
+
+// Access pattern hints, passed to madvise()
+typedef enum {
+    IMAGE_ADV_NORMAL,
+    IMAGE_ADV_SEQUENTIAL,  // about to stream through these blocks once
+    IMAGE_ADV_WILLNEED,    // start reading these blocks in now
+    IMAGE_ADV_DONTNEED,    // done with these blocks for now
+} image_advice_t;
+
+// image_open() modes
+#define IMAGE_READ 0
+#define IMAGE_WRITE 1     // MAP_SHARED: stores reach the file through the page cache
+#define IMAGE_PRIVATE 2   // MAP_PRIVATE: stores stay in this process; the file only changes
+                          // through explicit pwrite() on img->fd (journal.c)
+
+// Map an existing image. Only checks that it is at least one block long;
+// callers that need a sane layout call image_check_layout().
+int image_open(image_t *img, const char *path, int mode);
+
+// Create (or truncate) path as a sparse file of size bytes and map it read-write.
+// Every block reads as zero until written.
+int image_create(image_t *img, const char *path, uint64_t size);
+
+// 0 if the superblock describes a layout that fits inside the mapping
+int image_check_layout(const image_t *img);
+
+// msync() the whole image, or just [first, first+count) blocks. 0 on success.
+// A no-op for IMAGE_READ and IMAGE_PRIVATE mappings.
+int image_flush(image_t *img);
+int image_flush_blocks(image_t *img, uint64_t first, uint64_t count);
+
+void image_advise(const image_t *img, uint64_t first, uint64_t count, image_advice_t advice);
+
+// Unmap and close. Does not msync: dirty pages are written back by the kernel
+// either way, call image_flush() first when durability matters.
+int image_close(image_t *img);
+
+// ---- typed views (NULL when out of range) ----
+uint8_t *image_block(const image_t *img, uint64_t block_no);
+uint8_t *image_blocks(const image_t *img, uint64_t first, uint64_t count);
+inode_t *image_inode(const image_t *img, uint64_t inode_no);        // 1-indexed
+uint64_t image_inode_block(const image_t *img, uint64_t inode_no);  // block holding it, 0 if out of range
+const group_desc_t *image_groups(const image_t *img);               // group_count descriptors (SB_FL_GROUPS)
+dirent64_t *image_dirents(const image_t *img, uint64_t block_no);   // DIRENTS_PER_BLOCK entries
+uint8_t *image_inode_bitmap(const image_t *img);                    // inode_bitmap_blocks blocks
+uint8_t *image_data_bitmap(const image_t *img);                     // data_bitmap_blocks blocks
+
+#endif
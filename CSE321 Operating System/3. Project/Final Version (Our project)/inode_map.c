@@ -0,0 +1,302 @@
+// inode_map.c — indirect block maps built and walked in place in the mapped image
+#include "inode_map.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+
+// Upper bound on leaf blocks prefetched by one madvise, and on the blocks
+// map_copy_out() writes with one fwrite (256 KiB)
+#define MAP_READ_RUN 64
+
+uint64_t map_file_blocks(uint64_t size_bytes) {
+    return (size_bytes + BS - 1) / BS;
+}
+
+uint64_t map_inode_blocks(const inode_t* ino) {
+    return (ino->flags & INODE_FL_INLINE) ? 0 : map_file_blocks(ino->size_bytes);
+}
+
+uint64_t map_meta_blocks(uint64_t nblocks) {
+    if (nblocks > MAP_MAX_BLOCKS) return UINT64_MAX;
+    if (nblocks <= DIRECT_MAX) return 0;
+    uint64_t rest = nblocks - DIRECT_MAX;
+    if (rest <= PTRS_PER_BLOCK) return 1;
+    rest -= PTRS_PER_BLOCK;
+    // indirect1 + indirect2 + one leaf per PTRS_PER_BLOCK blocks
+    return 2 + (rest + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
+}
+
+// Pointer block view; block 0 is the superblock, so it never holds pointers
+static uint32_t* ptr_block(const image_t* img, uint32_t block_no) {
+    if (block_no == 0) return NULL;
+    return (uint32_t*)image_block(img, block_no);
+}
+
+int map_write(image_t* img, inode_t* ino, const uint32_t* data, uint64_t n, const uint32_t* meta) {
+    uint64_t m = map_meta_blocks(n);
+    if (m == UINT64_MAX) return -1;
+    for (uint64_t j = 0; j < m; j++) {
+        if (ptr_block(img, meta[j]) == NULL) return -1;
+    }
+
+    memset(ino->direct, 0, sizeof(ino->direct));
+    ino->indirect1 = 0;
+    ino->indirect2 = 0;
+
+    uint64_t i = 0;
+    for (; i < n && i < DIRECT_MAX; i++) ino->direct[i] = data[i];
+    if (m == 0) return 0;
+
+    // every slot of a pointer block is written, unused ones as 0
+    ino->indirect1 = meta[0];
+    uint32_t* ind1 = ptr_block(img, meta[0]);
+    memset(ind1, 0, BS);
+    for (uint64_t k = 0; i < n && k < PTRS_PER_BLOCK; k++, i++) ind1[k] = data[i];
+
+    if (i < n) {
+        ino->indirect2 = meta[1];
+        uint32_t* top = ptr_block(img, meta[1]);
+        memset(top, 0, BS);
+        for (uint64_t j = 0; i < n; j++) {
+            top[j] = meta[2 + j];
+            uint32_t* leaf = ptr_block(img, meta[2 + j]);
+            memset(leaf, 0, BS);
+            for (uint64_t k = 0; i < n && k < PTRS_PER_BLOCK; k++, i++) leaf[k] = data[i];
+        }
+    }
+    return 0;
+}
+
+int64_t map_read(const image_t* img, const inode_t* ino, uint64_t n, uint32_t* data, uint32_t* meta) {
+    if (ino->flags & INODE_FL_INLINE) return n == 0 ? 0 : -1;
+    if (map_is_extents(ino)) {
+        // extents are expanded block by block; there are no pointer blocks
+        extent_t ext[EXTENT_MAX];
+        int count = map_extents(ino, n, ext);
+        if (count < 0) return -1;
+        uint64_t i = 0;
+        for (int e = 0; e < count; e++) {
+            for (uint32_t k = 0; k < ext[e].len; k++) data[i++] = ext[e].start ? ext[e].start + k : 0;
+        }
+        return 0;
+    }
+
+    uint64_t m = map_meta_blocks(n);
+    if (m == UINT64_MAX) return -1;
+
+    uint64_t i = 0;
+    for (; i < n && i < DIRECT_MAX; i++) data[i] = ino->direct[i];
+    if (m == 0) return 0;
+
+    // indirect1: the whole block is copied straight into data[]
+    const uint32_t* ind1 = ptr_block(img, ino->indirect1);
+    if (ind1 == NULL) return -1;
+    if (meta) meta[0] = ino->indirect1;
+    uint64_t take = n - i < PTRS_PER_BLOCK ? n - i : PTRS_PER_BLOCK;
+    memcpy(data + i, ind1, take * sizeof(uint32_t));
+    i += take;
+    if (i == n) return 1;
+
+    // indirect2: prefetch each run of adjacent leaves, then copy them out
+    const uint32_t* top = ptr_block(img, ino->indirect2);
+    if (top == NULL) return -1;
+    if (meta) meta[1] = ino->indirect2;
+    uint64_t leaves = m - 2;
+    for (uint64_t j = 0; j < leaves;) {
+        uint64_t e = j + 1;
+        while (e < leaves && e - j < MAP_READ_RUN && top[e] == top[e - 1] + 1) e++;
+        if (top[j] == 0 || image_blocks(img, top[j], e - j) == NULL) return -1;
+        image_advise(img, top[j], e - j, IMAGE_ADV_WILLNEED);
+        for (uint64_t r = j; r < e; r++) {
+            const uint32_t* leaf = ptr_block(img, top[r]);
+            if (leaf == NULL) return -1;
+            if (meta) meta[2 + r] = top[r];
+            take = n - i < PTRS_PER_BLOCK ? n - i : PTRS_PER_BLOCK;
+            memcpy(data + i, leaf, take * sizeof(uint32_t));
+            i += take;
+        }
+        j = e;
+    }
+    return (int64_t)m;
+}
+
+uint32_t map_block(const image_t* img, const inode_t* ino, uint64_t i) {
+    if (i < DIRECT_MAX) return ino->direct[i];
+    i -= DIRECT_MAX;
+    if (i < PTRS_PER_BLOCK) {
+        const uint32_t* ind1 = ptr_block(img, ino->indirect1);
+        return ind1 ? ind1[i] : 0;
+    }
+    i -= PTRS_PER_BLOCK;
+    if (i >= (uint64_t)PTRS_PER_BLOCK * PTRS_PER_BLOCK) return 0;
+    const uint32_t* top = ptr_block(img, ino->indirect2);
+    const uint32_t* leaf = top ? ptr_block(img, top[i / PTRS_PER_BLOCK]) : NULL;
+    return leaf ? leaf[i % PTRS_PER_BLOCK] : 0;
+}
+
+int map_append_meta(uint64_t i) {
+    if (i < DIRECT_MAX) return 0;
+    if (i == DIRECT_MAX) return 1;                     // indirect1
+    i -= DIRECT_MAX + PTRS_PER_BLOCK;
+    if (i == 0) return 2;                              // indirect2 and its first leaf
+    return i < (uint64_t)PTRS_PER_BLOCK * PTRS_PER_BLOCK && i % PTRS_PER_BLOCK == 0 ? 1 : 0;
+}
+
+int map_append(image_t* img, inode_t* ino, uint64_t i, uint32_t block, const uint32_t* meta) {
+    if (i >= MAP_MAX_BLOCKS) return -1;
+    int m = map_append_meta(i);
+    for (int k = 0; k < m; k++) {
+        uint32_t* p = ptr_block(img, meta[k]);
+        if (p == NULL) return -1;
+        memset(p, 0, BS);
+    }
+    if (i < DIRECT_MAX) {
+        ino->direct[i] = block;
+        return 0;
+    }
+    if (i == DIRECT_MAX) ino->indirect1 = meta[0];
+    i -= DIRECT_MAX;
+    if (i < PTRS_PER_BLOCK) {
+        uint32_t* ind1 = ptr_block(img, ino->indirect1);
+        if (ind1 == NULL) return -1;
+        ind1[i] = block;
+        return 0;
+    }
+    i -= PTRS_PER_BLOCK;
+    if (i == 0) ino->indirect2 = meta[0];
+    uint32_t* top = ptr_block(img, ino->indirect2);
+    if (top == NULL) return -1;
+    if (m > 0) top[i / PTRS_PER_BLOCK] = meta[m - 1];
+    uint32_t* leaf = ptr_block(img, top[i / PTRS_PER_BLOCK]);
+    if (leaf == NULL) return -1;
+    leaf[i % PTRS_PER_BLOCK] = block;
+    return 0;
+}
+
+int map_is_extents(const inode_t* ino) {
+    return (ino->flags & INODE_FL_EXTENTS) != 0;
+}
+
+int map_write_extents(inode_t* ino, const extent_t* ext, int count) {
+    if (count < 1 || count > EXTENT_MAX) return -1;
+    int holes = 0;
+    for (int e = 0; e < count; e++) {
+        if (ext[e].len == 0) return -1;
+        if (ext[e].start == 0) holes = 1;
+    }
+    memset(ino->direct, 0, sizeof(ino->direct));
+    memcpy(ino->direct, ext, count * sizeof(extent_t));
+    ino->indirect1 = 0;
+    ino->indirect2 = 0;
+    ino->flags |= INODE_FL_EXTENTS | (holes ? INODE_FL_SPARSE : 0);
+    return 0;
+}
+
+int map_extents(const inode_t* ino, uint64_t n, extent_t* ext) {
+    if (!map_is_extents(ino)) return -1;
+    memcpy(ext, ino->direct, EXTENT_MAX * sizeof(extent_t));
+    uint64_t left = n;
+    int count = 0;
+    for (; count < EXTENT_MAX && left > 0; count++) {
+        if (ext[count].len == 0) return -1;
+        if (ext[count].len > left) ext[count].len = (uint32_t)left;
+        left -= ext[count].len;
+    }
+    return left == 0 ? count : -1;
+}
+
+// The inline bytes: the 56 from direct[0] to the end of indirect2, then xattr_ptr
+#define INLINE_HEAD (sizeof(((inode_t*)0)->direct) + 2 * sizeof(uint32_t))
+_Static_assert(INLINE_HEAD + sizeof(((inode_t*)0)->xattr_ptr) == INLINE_MAX, "inline area size mismatch");
+
+int map_write_inline(inode_t* ino, const void* data, uint64_t size) {
+    if (size == 0 || size > INLINE_MAX) return -1;
+    uint8_t area[INLINE_MAX] = {0};
+    memcpy(area, data, size);
+    memcpy((uint8_t*)ino + offsetof(inode_t, direct), area, INLINE_HEAD);   // direct[], indirect1, indirect2 are adjacent
+    memcpy(&ino->xattr_ptr, area + INLINE_HEAD, INLINE_MAX - INLINE_HEAD);
+    ino->flags |= INODE_FL_INLINE;
+    return 0;
+}
+
+void map_read_inline(const inode_t* ino, uint8_t* out) {
+    memcpy(out, (const uint8_t*)ino + offsetof(inode_t, direct), INLINE_HEAD);
+    memcpy(out + INLINE_HEAD, &ino->xattr_ptr, INLINE_MAX - INLINE_HEAD);
+}
+
+// Writes count blocks of zeros (at most *remaining bytes) to out: a hole
+static int copy_zeros(uint64_t count, uint64_t* remaining, FILE* out) {
+    static const uint8_t zeros[MAP_READ_RUN * BS];
+    uint64_t bytes = count * BS;
+    if (bytes > *remaining) bytes = *remaining;
+    *remaining -= bytes;
+    for (uint64_t n; bytes > 0; bytes -= n) {
+        n = bytes < sizeof(zeros) ? bytes : sizeof(zeros);
+        if (fwrite(zeros, 1, n, out) != n) return -1;
+    }
+    return 0;
+}
+
+// Writes the count blocks starting at first (at most *remaining bytes) to out
+static int copy_out(const image_t* img, uint64_t first, uint64_t count, uint64_t* remaining, FILE* out) {
+    if (first == 0) return copy_zeros(count, remaining, out);
+    uint64_t bytes = count * BS;
+    if (bytes > *remaining) bytes = *remaining;
+    const uint8_t* data = image_blocks(img, first, count);
+    if (data == NULL) return -1;
+    image_advise(img, first, count, IMAGE_ADV_WILLNEED);
+    if (fwrite(data, 1, bytes, out) != bytes) return -1;
+    image_advise(img, first, count, IMAGE_ADV_DONTNEED);
+    *remaining -= bytes;
+    return 0;
+}
+
+int map_copy_out(const image_t* img, const inode_t* ino, FILE* out) {
+    if (ino->flags & INODE_FL_INLINE) {
+        uint8_t data[INLINE_MAX];
+        if (ino->size_bytes > INLINE_MAX) return -1;
+        map_read_inline(ino, data);
+        return fwrite(data, 1, ino->size_bytes, out) == ino->size_bytes ? 0 : -1;
+    }
+    // resolve the whole block map up front: every indirect block is used once, whole
+    uint64_t n = map_file_blocks(ino->size_bytes);
+    uint32_t* blocks = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (blocks == NULL || map_read(img, ino, n, blocks, NULL) < 0) {
+        free(blocks);
+        return -1;
+    }
+    if (ino->flags & INODE_FL_COMPRESSED) {
+        int rc = compress_copy_out(img, ino, blocks, out);
+        free(blocks);
+        return rc;
+    }
+
+    uint64_t remaining = ino->size_bytes;
+    extent_t ext[EXTENT_MAX];
+    int ext_count = map_extents(ino, n, ext);
+    for (uint64_t i = 0, e_idx = 0; i < n;) {
+        uint64_t first, count;
+        if (ext_count > 0) {
+            first = ext[e_idx].start;
+            count = ext[e_idx].len;
+            e_idx++;
+        } else {
+            // group physically adjacent blocks into one write (a run of holes into one hole)
+            uint64_t e = i + 1;
+            if (blocks[i] == 0) {
+                while (e < n && blocks[e] == 0) e++;
+            } else {
+                while (e < n && e - i < MAP_READ_RUN && blocks[e] == blocks[e - 1] + 1) e++;
+            }
+            first = blocks[i];
+            count = e - i;
+        }
+        if (copy_out(img, first, count, &remaining, out) != 0) break;
+        i += count;
+    }
+    free(blocks);
+    return remaining == 0 ? 0 : -1;
+}
@@ -0,0 +1,106 @@
+// inode_map.h — file block mapping through direct, single- and double-indirect pointers
+//
+// File block i lives in:
+//   i < 12                 : inode.direct[i]
+//   i < 12 + 1024          : slot i-12 of the inode.indirect1 block
+//   otherwise              : the inode.indirect2 block points to up to 1024
+//                            more indirect blocks, each mapping 1024 file blocks
+// With 4 KiB blocks that covers a little over 4 GiB per file.
+//
+// An inode with INODE_FL_EXTENTS set maps its blocks as up to EXTENT_MAX
+// contiguous extents kept in direct[] instead (see minivsfs.h), with no
+// pointer blocks at all. map_read() handles both forms.
+//
+// A sparse file (INODE_FL_SPARSE) may leave data pointers at 0, or have
+// extents with start 0: those file blocks are holes and read as zeros.
+// Pointer blocks are always present.
+//
+// An inline file (INODE_FL_INLINE, at most INLINE_MAX bytes) maps no blocks:
+// its bytes are stored in direct[], indirect1 and indirect2, then xattr_ptr.
+#ifndef MINIVSFS_INODE_MAP_H
+#define MINIVSFS_INODE_MAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "image.h"
+#include "minivsfs.h"
+
+#define MAP_MAX_BLOCKS ((uint64_t)DIRECT_MAX + PTRS_PER_BLOCK + (uint64_t)PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+
+// Data blocks needed to hold size_bytes
+uint64_t map_file_blocks(uint64_t size_bytes);
+
+// Data blocks ino maps: map_file_blocks() of its size, 0 for an inline file
+uint64_t map_inode_blocks(const inode_t* ino);
+
+// Pointer blocks needed to map nblocks file blocks (0 when direct[] is enough),
+// or UINT64_MAX when nblocks > MAP_MAX_BLOCKS.
+uint64_t map_meta_blocks(uint64_t nblocks);
+
+// Fill ino's direct/indirect pointers so file block i is data[i], using meta[]
+// (map_meta_blocks(n) freshly allocated blocks) as the pointer blocks:
+// meta[0] = indirect1, meta[1] = indirect2, meta[2..] = its leaf blocks.
+// Pointer blocks are filled in place in the mapped image.
+// Returns 0, or -1 if a pointer block lies outside the image.
+int map_write(image_t* img, inode_t* ino, const uint32_t* data, uint64_t n, const uint32_t* meta);
+
+// Resolve file blocks 0..n-1 of ino into data[]. Each indirect block is used
+// whole, and each run of adjacent leaf blocks under indirect2 is prefetched
+// with one madvise(WILLNEED) before it is walked. If meta is not NULL the
+// pointer blocks are listed there in map_write order. Holes come out as 0.
+// Returns the number of pointer blocks, or -1 on error (a needed pointer
+// block is 0 or outside the image).
+int64_t map_read(const image_t* img, const inode_t* ino, uint64_t n, uint32_t* data, uint32_t* meta);
+
+// Block i of a block-mapped file, looked up through its pointer blocks, or 0
+// (past the end of the map, or a missing pointer block).
+uint32_t map_block(const image_t* img, const inode_t* ino, uint64_t i);
+
+// ---- growing a block map (files of unknown length, filled in order) ----
+
+// Pointer blocks that must be added when a block-mapped file grows to file
+// block i: 1 at the first block under indirect1, 2 (indirect2 and a leaf) at
+// the first one under indirect2, 1 at the first block of each further leaf.
+int map_append_meta(uint64_t i);
+
+// Make `block` file block i of ino, which maps blocks 0..i-1 already.
+// meta[] holds map_append_meta(i) freshly allocated blocks (indirect2 first);
+// they are zeroed and linked in. Returns 0, or -1 if i is past MAP_MAX_BLOCKS
+// or a pointer block lies outside the image.
+int map_append(image_t* img, inode_t* ino, uint64_t i, uint32_t block, const uint32_t* meta);
+
+// ---- extent-mapped inodes ----
+
+int map_is_extents(const inode_t* ino);
+
+// Store count (1..EXTENT_MAX) extents in ino and set INODE_FL_EXTENTS, and
+// INODE_FL_SPARSE if one of them is a hole (start 0).
+// Returns 0, or -1 if count is out of range or an extent is empty.
+int map_write_extents(inode_t* ino, const extent_t* ext, int count);
+
+// Copy ino's extents (trimmed to the n blocks actually used) to ext[],
+// which has room for EXTENT_MAX. Returns the count, or -1 if ino is not
+// extent-mapped or its extents hold fewer than n blocks.
+int map_extents(const inode_t* ino, uint64_t n, extent_t* ext);
+
+// ---- inline files ----
+
+// Store the size (1..INLINE_MAX) bytes of data in ino and set INODE_FL_INLINE.
+// ino must not map anything yet. Returns 0, or -1 if size is out of range.
+int map_write_inline(inode_t* ino, const void* data, uint64_t size);
+
+// Copy the bytes of inline file ino to out (INLINE_MAX bytes of room)
+void map_read_inline(const inode_t* ino, uint8_t* out);
+
+// ---- file data ----
+
+// Write ino's size_bytes of data to out straight out of the mapping: one
+// fwrite per extent, or per run of up to MAP_READ_RUN adjacent blocks of a
+// block-mapped file. Each run is prefetched before the copy and dropped after
+// it, so a big file does not stay resident. Holes are written as zeros, and
+// a compressed file (INODE_FL_COMPRESSED) is decoded cluster by cluster (compress.h),
+// an inline one comes out of the inode. Returns 0, or -1.
+int map_copy_out(const image_t* img, const inode_t* ino, FILE* out);
+
+#endif
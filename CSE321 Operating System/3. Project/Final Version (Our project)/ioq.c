@@ -0,0 +1,271 @@
+// ioq.c — io_uring through the raw system calls (no liburing), with a synchronous fallback
+#define _GNU_SOURCE
+#include "ioq.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define IOQ_MAX_WRITE ((size_t)1 << 30)
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int ring_fd, unsigned submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, submit, min_complete, flags, NULL, 0);
+}
+
+void ioq_init(ioq_t *q, int fd, unsigned depth) {
+    memset(q, 0, sizeof(*q));
+    q->fd = fd;
+    q->ring_fd = -1;
+    q->depth = depth ? depth : IOQ_DEFAULT_DEPTH;
+    const char *mode = getenv("MINIVSFS_IO");
+    if (mode != NULL && strcmp(mode, "sync") == 0) return;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int ring = sys_setup(q->depth, &p);
+    if (ring < 0) return;
+    q->depth = p.sq_entries;
+
+    q->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    q->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (q->cq_ring_size > q->sq_ring_size) q->sq_ring_size = q->cq_ring_size;
+        q->cq_ring_size = q->sq_ring_size;
+    }
+    q->sq_ring = mmap(NULL, q->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    if (q->sq_ring == MAP_FAILED) goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        q->cq_ring = q->sq_ring;
+    } else {
+        q->cq_ring = mmap(NULL, q->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        if (q->cq_ring == MAP_FAILED) goto fail;
+    }
+    q->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    q->sqes = mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if (q->sqes == MAP_FAILED) goto fail;
+
+    uint8_t *sq = q->sq_ring, *cq = q->cq_ring;
+    q->sq_head = (unsigned *)(sq + p.sq_off.head);
+    q->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    q->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    q->sq_array = (unsigned *)(sq + p.sq_off.array);
+    q->cq_head = (unsigned *)(cq + p.cq_off.head);
+    q->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    q->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    q->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    q->slots = calloc(q->depth, sizeof(ioq_slot_t));
+    q->free_slots = malloc(q->depth * sizeof(unsigned));
+    if (q->slots == NULL || q->free_slots == NULL) goto fail;
+    for (unsigned i = 0; i < q->depth; i++) q->free_slots[i] = q->depth - 1 - i;
+    q->nfree = q->depth;
+    q->ring_fd = ring;
+    q->stats.uring = 1;
+    return;
+
+fail:
+    free(q->slots);
+    free(q->free_slots);
+    q->slots = NULL;
+    q->free_slots = NULL;
+    if (q->sqes != NULL && q->sqes != MAP_FAILED) munmap(q->sqes, q->sqes_size);
+    if (q->cq_ring != NULL && q->cq_ring != MAP_FAILED && q->cq_ring != q->sq_ring) munmap(q->cq_ring, q->cq_ring_size);
+    if (q->sq_ring != NULL && q->sq_ring != MAP_FAILED) munmap(q->sq_ring, q->sq_ring_size);
+    q->sqes = NULL;
+    q->sq_ring = q->cq_ring = NULL;
+    close(ring);
+}
+
+void ioq_free(ioq_t *q) {
+    if (q->ring_fd < 0) return;
+    ioq_wait(q);
+    munmap(q->sqes, q->sqes_size);
+    if (q->cq_ring != q->sq_ring) munmap(q->cq_ring, q->cq_ring_size);
+    munmap(q->sq_ring, q->sq_ring_size);
+    close(q->ring_fd);
+    free(q->slots);
+    free(q->free_slots);
+    q->slots = NULL;
+    q->free_slots = NULL;
+    q->ring_fd = -1;
+}
+
+int ioq_async(const ioq_t *q) {
+    return q->ring_fd >= 0;
+}
+
+// Takes every completion that is there; a write must have written all its bytes
+static void reap(ioq_t *q) {
+    unsigned head = *q->cq_head;
+    unsigned tail = __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &q->cqes[head & *q->cq_mask];
+        unsigned slot = (unsigned)cqe->user_data;
+        if (cqe->res < 0 || (uint64_t)cqe->res != q->slots[slot].expect) q->error = 1;
+        q->free_slots[q->nfree++] = slot;
+        q->inflight--;
+    }
+    __atomic_store_n(q->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Submits the queued requests and waits until at least min_complete are done
+static int enter(ioq_t *q, unsigned min_complete) {
+    unsigned submit = q->queued;
+    q->inflight += submit;
+    q->queued = 0;
+    if (q->inflight > q->stats.max_inflight) q->stats.max_inflight = q->inflight;
+    if (min_complete > q->inflight) min_complete = q->inflight;
+    unsigned left = q->inflight - min_complete;   // in flight when done
+    while (submit > 0 || q->inflight > left) {
+        unsigned wait = q->inflight - (q->inflight > left ? left : q->inflight);
+        int n = sys_enter(q->ring_fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (n < 0 && errno == EINTR) continue;
+        q->stats.enters++;
+        if (n < 0) {
+            // the requests not taken stay in the ring: drop them, nothing of theirs completes
+            unsigned tail = *q->sq_tail;
+            for (unsigned i = 0; i < submit; i++) {
+                unsigned idx = (tail - 1 - i) & *q->sq_mask;
+                q->free_slots[q->nfree++] = (unsigned)q->sqes[idx].user_data;
+            }
+            __atomic_store_n(q->sq_tail, tail - submit, __ATOMIC_RELEASE);
+            q->inflight -= submit;
+            q->error = 1;
+            return -1;
+        }
+        submit -= (unsigned)n < submit ? (unsigned)n : submit;
+        reap(q);
+    }
+    return 0;
+}
+
+// A free SQE and slot for a request that must return expect, after making
+// room (need: 2 for a link, so both ends of it go in one submission). A full
+// queue is submitted and drained to half its depth: waiting for one
+// completion at a time would cost an io_uring_enter() per request.
+static struct io_uring_sqe *get_sqe(ioq_t *q, unsigned need, uint64_t expect) {
+    if (q->queued + q->inflight + need > q->depth) {
+        unsigned keep = q->depth / 2 > need ? q->depth / 2 : need;
+        if (keep > q->depth) keep = q->depth;
+        if (enter(q, q->inflight + q->queued - (q->depth - keep)) != 0) return NULL;
+    }
+    unsigned tail = *q->sq_tail;
+    unsigned idx = tail & *q->sq_mask;
+    struct io_uring_sqe *sqe = &q->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    unsigned slot = q->free_slots[--q->nfree];
+    q->slots[slot].expect = expect;
+    sqe->user_data = slot;
+    q->sq_array[idx] = idx;
+    __atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    q->queued++;
+    q->stats.requests++;
+    return sqe;
+}
+
+static unsigned sqe_flags(unsigned flags) {
+    return (flags & IOQ_DRAIN ? IOSQE_IO_DRAIN : 0) | (flags & IOQ_LINK ? IOSQE_IO_LINK : 0);
+}
+
+static int write_sync(int fd, const struct iovec *iov, int cnt, uint64_t off) {
+    ssize_t n;
+    do n = pwritev(fd, iov, cnt, (off_t)off);
+    while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    // after a short write, the rest piece by piece
+    size_t skip = (size_t)n;
+    for (int i = 0; i < cnt; i++) {
+        const uint8_t *p = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        uint64_t at = off;
+        off += len;
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        p += skip;
+        at += skip;
+        len -= skip;
+        skip = 0;
+        while (len > 0) {
+            ssize_t k = pwrite(fd, p, len, (off_t)at);
+            if (k <= 0) return -1;
+            p += k;
+            at += k;
+            len -= k;
+        }
+    }
+    return 0;
+}
+
+int ioq_writev(ioq_t *q, const struct iovec *iov, int cnt, uint64_t off, unsigned flags) {
+    uint64_t bytes = 0;
+    for (int i = 0; i < cnt; i++) bytes += iov[i].iov_len;
+    if (q->ring_fd < 0) {
+        q->stats.requests++;
+        if (write_sync(q->fd, iov, cnt, off) == 0) return 0;
+        q->error = 1;
+        return -1;
+    }
+    struct io_uring_sqe *sqe = get_sqe(q, flags & IOQ_LINK ? 2 : 1, bytes);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->flags = sqe_flags(flags);
+    sqe->fd = q->fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = (unsigned)cnt;
+    sqe->off = off;
+    return 0;
+}
+
+int ioq_write(ioq_t *q, const void *buf, size_t len, uint64_t off, unsigned flags) {
+    const uint8_t *p = buf;
+    do {
+        // one request writes at most MAX_RW_COUNT (2 GiB - 4 KiB): bigger ones in pieces
+        size_t n = len > IOQ_MAX_WRITE ? IOQ_MAX_WRITE : len;
+        unsigned f = n < len ? flags & IOQ_DRAIN : flags;
+        struct iovec iov = { (void *)p, n };
+        if (ioq_writev(q, &iov, 1, off, f) != 0) return -1;
+        if (q->ring_fd >= 0) {
+            // the request just queued points at the slot's own copy of the iovec
+            struct io_uring_sqe *sqe = &q->sqes[(*q->sq_tail - 1) & *q->sq_mask];
+            ioq_slot_t *slot = &q->slots[sqe->user_data];
+            slot->one = iov;
+            sqe->addr = (uint64_t)(uintptr_t)&slot->one;
+        }
+        p += n;
+        off += n;
+        len -= n;
+    } while (len > 0);
+    return 0;
+}
+
+int ioq_sync(ioq_t *q, unsigned flags) {
+    if (q->ring_fd < 0) {
+        q->stats.requests++;
+        if (fdatasync(q->fd) == 0) return 0;
+        q->error = 1;
+        return -1;
+    }
+    struct io_uring_sqe *sqe = get_sqe(q, flags & IOQ_LINK ? 2 : 1, 0);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->flags = sqe_flags(flags);
+    sqe->fd = q->fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    return 0;
+}
+
+int ioq_wait(ioq_t *q) {
+    if (q->ring_fd >= 0 && (q->queued > 0 || q->inflight > 0)) enter(q, q->queued + q->inflight);
+    int rc = q->error ? -1 : 0;
+    q->error = 0;
+    return rc;
+}
@@ -0,0 +1,91 @@
+// ioq.h — batched writes to one file: io_uring, or pwritev() where it is missing
+//
+// The journal, the block cache and the data writer each have several
+// independent writes ready at once (runs of blocks at different offsets).
+// Issued one pwritev() at a time, one request is in flight at a time. An ioq
+// queues them instead: ioq_writev() adds a write, ioq_sync() an fdatasync(),
+// and ioq_wait() submits everything queued with one io_uring_enter() and
+// reaps the completions in batches. Up to `depth` requests are in flight; a
+// full queue is submitted early.
+//
+// Ordering, where it matters, is explicit:
+//   IOQ_DRAIN  the request starts only after every request queued before it
+//              has completed (IOSQE_IO_DRAIN), e.g. the commit's fdatasync
+//              after the log records and in-place data;
+//   IOQ_LINK   the next request starts only after this one has completed
+//              (IOSQE_IO_LINK), e.g. fdatasync, then the journal header.
+//
+// Buffers and iovec arrays must stay valid until ioq_wait() returns (ioq_write()
+// keeps its one iovec itself).
+//
+// Without io_uring (old kernel, seccomp, kernel.io_uring_disabled) or with
+// MINIVSFS_IO=sync in the environment the same calls run synchronously, in
+// queue order, which satisfies both flags.
+#ifndef MINIVSFS_IOQ_H
+#define MINIVSFS_IOQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define IOQ_DEFAULT_DEPTH 64
+
+#define IOQ_DRAIN 0x1u
+#define IOQ_LINK 0x2u
+
+typedef struct {
+    int uring;           // the queue used io_uring (kept after ioq_free(), for reports)
+    uint64_t requests;   // writes and syncs
+    uint64_t enters;     // io_uring_enter() calls (0 when synchronous)
+    uint64_t max_inflight;
+} ioq_stats_t;
+
+// One request in flight: its iovec for ioq_write(), and the result it must have
+typedef struct {
+    struct iovec one;
+    uint64_t expect;
+} ioq_slot_t;
+
+typedef struct {
+    int fd;                  // the file written
+    int ring_fd;             // -1: synchronous
+    unsigned depth;
+    // submission ring
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    // completion ring
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    ioq_slot_t *slots;       // depth of them; user_data is the index
+    unsigned *free_slots, nfree;
+    unsigned queued;         // filled, not submitted yet
+    unsigned inflight;       // submitted, not reaped yet
+    int error;               // a request failed since the last ioq_wait()
+    ioq_stats_t stats;
+} ioq_t;
+
+// Set up a queue of `depth` (0 = IOQ_DEFAULT_DEPTH) requests on fd. Falls back
+// to synchronous I/O by itself; never fails.
+void ioq_init(ioq_t *q, int fd, unsigned depth);
+void ioq_free(ioq_t *q);
+
+// 1 when requests really go through io_uring
+int ioq_async(const ioq_t *q);
+
+// Queue a write of iov[0..cnt) at byte offset off. 0, or -1 (synchronous mode:
+// the write failed; with io_uring: it could not be queued).
+int ioq_writev(ioq_t *q, const struct iovec *iov, int cnt, uint64_t off, unsigned flags);
+
+// ioq_writev() of one buffer
+int ioq_write(ioq_t *q, const void *buf, size_t len, uint64_t off, unsigned flags);
+
+// Queue an fdatasync() of the file. 0 or -1, as ioq_writev().
+int ioq_sync(ioq_t *q, unsigned flags);
+
+// Submit what is queued and wait for every request in flight. Returns 0, or
+// -1 if any request since the last ioq_wait() failed or wrote short.
+int ioq_wait(ioq_t *q);
+
+#endif
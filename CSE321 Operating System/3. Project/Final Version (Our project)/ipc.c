@@ -0,0 +1,73 @@
+// ipc.c — SEQPACKET messages with an optional file descriptor
+#define _GNU_SOURCE
+#include "ipc.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+const char* ipc_op_name(uint32_t op) {
+    static const char* names[IPC_OP_COUNT] = {
+        [IPC_HELLO] = "hello", [IPC_ADD] = "add", [IPC_READ] = "read", [IPC_LIST] = "list",
+        [IPC_STAT] = "stat", [IPC_VALIDATE] = "validate", [IPC_STATS] = "stats",
+    };
+    return op > 0 && op < IPC_OP_COUNT ? names[op] : "?";
+}
+
+int ipc_send(int sock, const void* msg, size_t len, int fd) {
+    struct iovec iov = { .iov_base = (void*)msg, .iov_len = len };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(&ctl, 0, sizeof(ctl));
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = sizeof(ctl.buf);
+        struct cmsghdr* c = CMSG_FIRSTHDR(&mh);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+    ssize_t n;
+    do n = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    return n == (ssize_t)len ? 0 : -1;
+}
+
+ssize_t ipc_recv(int sock, void* msg, size_t cap, int* fd, int flags) {
+    struct iovec iov = { .iov_base = msg, .iov_len = cap };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    *fd = -1;
+    ssize_t n;
+    do n = recvmsg(sock, &mh, flags | MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&mh); c != NULL; c = CMSG_NXTHDR(&mh, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) memcpy(fd, CMSG_DATA(c), sizeof(int));
+    }
+    // a truncated message is a protocol error; do not leak the descriptor
+    if (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return n;
+}
@@ -0,0 +1,71 @@
+// ipc.h — request/response protocol between mkfs_server and mkfs_client
+//
+// One AF_UNIX SOCK_SEQPACKET connection per client: every request and every
+// response is one message, so message boundaries need no framing of our own,
+// and a message can carry one file descriptor (SCM_RIGHTS). File data never
+// goes through the socket: an add passes the open file to read from, a read
+// or list passes the file to write to, and the server does the copy.
+//
+// A client may send many requests before reading any response (pipelining);
+// responses come back in request order, each tagged with its request id.
+#ifndef MINIVSFS_IPC_H
+#define MINIVSFS_IPC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define IPC_MAGIC 0x5356564Du   // "MVVS"
+#define IPC_NAME_MAX 4096       // file name, or image path for IPC_HELLO
+#define IPC_TEXT_MAX 8192
+
+typedef enum {
+    IPC_HELLO = 1,   // name: image path the client means; fails if the server serves another
+    IPC_ADD,         // fd: regular file to add as name, a path (directories created as needed)
+    IPC_READ,        // fd: where to write file name
+    IPC_LIST,        // fd: where to write "name<TAB>inode<TAB>size" lines of directory name ("": the root)
+    IPC_STAT,        // text: image summary
+    IPC_VALIDATE,    // value: problems found by a full check, text: summary
+    IPC_STATS,       // text: per-request latency percentiles
+    IPC_OP_COUNT
+} ipc_op_t;
+
+#define IPC_NO_EXTENTS 0x1u   // IPC_ADD: block map only (mkfs_adder --no-extents)
+#define IPC_NO_HOLES 0x2u     // IPC_ADD: all-zero blocks get data blocks too (mkfs_adder --no-holes)
+#define IPC_COMPRESS 0x4u     // IPC_ADD: store the file compressed (mkfs_adder --compress)
+#define IPC_DEDUP 0x8u        // IPC_ADD: share blocks already in the image (mkfs_adder --dedup)
+#define IPC_NO_INLINE 0x10u   // IPC_ADD: a tiny file gets a data block too (mkfs_adder --no-inline)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;
+    uint64_t id;
+    uint32_t flags;
+    uint32_t name_len;        // bytes of name, without a terminator
+    char name[IPC_NAME_MAX];  // only name_len bytes are sent
+} ipc_request_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;
+    uint64_t id;
+    int32_t status;           // 0, or -1 with the reason in text
+    uint32_t text_len;
+    uint64_t value;           // ADD: inode, READ: bytes, LIST: entries, VALIDATE: problems
+    char text[IPC_TEXT_MAX];  // only text_len bytes are sent
+} ipc_response_t;
+
+#define IPC_REQUEST_HEADER offsetof(ipc_request_t, name)
+#define IPC_RESPONSE_HEADER offsetof(ipc_response_t, text)
+
+const char* ipc_op_name(uint32_t op);
+
+// Send one message of len bytes, with fd attached unless it is -1. 0 or -1.
+int ipc_send(int sock, const void* msg, size_t len, int fd);
+
+// Receive one message into msg (cap bytes). *fd is the attached descriptor or -1.
+// Returns the message length, 0 when the peer closed, or -1 (errno set;
+// EAGAIN with MSG_DONTWAIT in flags when nothing is waiting).
+ssize_t ipc_recv(int sock, void* msg, size_t cap, int* fd, int flags);
+
+#endif
@@ -0,0 +1,456 @@
+// journal.c — write-ahead metadata journal with group commit
+#define _GNU_SOURCE
+#include "journal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "crc32.h"
+
+typedef struct {
+    uint32_t* v;
+    size_t n, cap;
+} list_t;
+
+static int push(list_t* l, uint32_t x) {
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 64;
+        uint32_t* v = realloc(l->v, cap * sizeof(uint32_t));
+        if (v == NULL) return -1;
+        l->v = v;
+        l->cap = cap;
+    }
+    l->v[l->n++] = x;
+    return 0;
+}
+
+static int cmp_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int read_block(int fd, uint64_t block, void* buf) {
+    return pread(fd, buf, BS, (off_t)(block * BS)) == (ssize_t)BS ? 0 : -1;
+}
+
+static int write_all(int fd, const void* buf, uint64_t n, uint64_t off) {
+    const uint8_t* p = buf;
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, (off_t)off);
+        if (w <= 0) return -1;
+        p += w;
+        off += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static uint64_t log_block(const journal_t* j, uint32_t pos) { return j->start + 1 + pos; }
+
+static int geometry(journal_t* j, const image_t* img) {
+    const superblock_t* sb = img->sb;
+    if (!(sb->flags & SB_FL_JOURNAL)) return -1;
+    const superblock_ext_t* ext = SB_EXT(sb);
+    if (ext->journal_blocks < JOURNAL_MIN_BLOCKS || ext->journal_start + ext->journal_blocks > img->nblocks) return -1;
+    j->start = ext->journal_start;
+    j->area = (uint32_t)(ext->journal_blocks - 1);
+    return 0;
+}
+
+// Make every checkpoint durable, then point the header at tail. The header
+// write is linked behind the fdatasync; with sync, a second one follows it.
+static int checkpoint(journal_t* j, uint32_t tail, int sync) {
+    if (bcache_flush(&j->cache) != 0) return -1;
+    memset(j->scratch, 0, BS);
+    journal_header_t* h = (journal_header_t*)j->scratch;
+    h->h.magic = JOURNAL_MAGIC;
+    h->h.type = JOURNAL_HEADER;
+    h->h.seq = j->seq;
+    h->tail = tail;
+    int rc = ioq_sync(&j->io, IOQ_DRAIN | IOQ_LINK);
+    if (rc == 0) rc = ioq_write(&j->io, j->scratch, BS, j->start * BS, sync ? IOQ_LINK : 0);
+    if (rc == 0 && sync) rc = ioq_sync(&j->io, 0);
+    if (ioq_wait(&j->io) != 0 || rc != 0) return -1;
+    j->syncs += 1 + (sync != 0);
+    return 0;
+}
+
+// Block numbers a descriptor may name: inside the image, outside the journal
+static int home_ok(const journal_t* j, uint32_t home) {
+    return home < j->img->nblocks && (home < j->start || home > log_block(j, j->area - 1));
+}
+
+// Length in blocks (commit block included) of the transaction seq at log
+// block pos, or 0 if it is not there or not completely committed.
+// Uses both scratch blocks.
+static uint32_t txn_length(journal_t* j, uint32_t pos, uint64_t seq) {
+    int fd = j->img->fd;
+    uint8_t* buf = j->scratch + BS;
+    uint32_t crc = 0;
+    for (uint32_t p = pos; p < j->area;) {
+        if (read_block(fd, log_block(j, p), buf) != 0) return 0;
+        const journal_rec_t* r = (const journal_rec_t*)buf;
+        if (r->magic != JOURNAL_MAGIC || r->seq != seq) return 0;
+        if (r->type == JOURNAL_COMMIT) {
+            const journal_commit_t* c = (const journal_commit_t*)buf;
+            if (p == pos || c->records != p - pos || c->crc != crc) return 0;
+            return p - pos + 1;
+        }
+        const journal_desc_t* d = (const journal_desc_t*)buf;
+        if (r->type != JOURNAL_DESC || d->count == 0 || d->count > JOURNAL_TAGS || d->count >= j->area - p) return 0;
+        for (uint32_t i = 0; i < d->count; i++) if (!home_ok(j, d->home[i])) return 0;
+        crc = crc32_update(crc, buf, BS);
+        uint32_t count = d->count;
+        for (uint32_t i = 1; i <= count; i++) {
+            if (read_block(fd, log_block(j, p + i), j->scratch) != 0) return 0;
+            crc = crc32_update(crc, j->scratch, BS);
+        }
+        p += 1 + count;
+    }
+    return 0;
+}
+
+// Copy the block images of a checked transaction to their home locations
+static int txn_apply(journal_t* j, uint32_t pos, uint32_t len) {
+    int fd = j->img->fd;
+    const journal_desc_t* d = (const journal_desc_t*)(j->scratch + BS);
+    for (uint32_t p = pos; p < pos + len - 1; p += 1 + d->count) {
+        if (read_block(fd, log_block(j, p), j->scratch + BS) != 0) return -1;
+        for (uint32_t i = 0; i < d->count; i++) {
+            if (read_block(fd, log_block(j, p + 1 + i), j->scratch) != 0) return -1;
+            // later transactions often rewrite the same blocks: only the last image is written
+            if (bcache_write(&j->cache, d->home[i], j->scratch) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+static int read_header(journal_t* j, journal_header_t* h) {
+    if (read_block(j->img->fd, j->start, j->scratch) != 0) return -1;
+    memcpy(h, j->scratch, sizeof(*h));
+    if (h->h.magic != JOURNAL_MAGIC || h->h.type != JOURNAL_HEADER || h->tail > j->area) return -1;
+    return 0;
+}
+
+int journal_format(image_t* img, uint64_t start, uint64_t blocks) {
+    journal_header_t* h = (journal_header_t*)image_block(img, start);
+    if (h == NULL || blocks < JOURNAL_MIN_BLOCKS || image_blocks(img, start, blocks) == NULL) return -1;
+    memset(h, 0, BS);
+    h->h.magic = JOURNAL_MAGIC;
+    h->h.type = JOURNAL_HEADER;
+    h->h.seq = 1;
+    h->tail = 0;
+    return 0;
+}
+
+int journal_open(journal_t* j, image_t* img, size_t cache_blocks) {
+    memset(j, 0, sizeof(*j));
+    j->img = img;
+    journal_header_t h;
+    if (geometry(j, img) != 0 || (j->scratch = malloc(2 * BS)) == NULL) return -1;
+    ioq_init(&j->io, img->fd, 0);
+    if (bcache_init(&j->cache, img->fd, cache_blocks) != 0) goto fail;
+    j->cache.io = &j->io;
+    if (read_header(j, &h) != 0) goto fail;
+
+    uint32_t pos = h.tail;
+    j->seq = h.h.seq;
+    int replayed = 0;
+    for (uint32_t len; pos < j->area && (len = txn_length(j, pos, j->seq)) != 0; pos += len, j->seq++) {
+        if (txn_apply(j, pos, len) != 0) goto fail;
+        replayed++;
+    }
+    if (replayed > 0) {
+        // the replayed blocks are durable before the header forgets them; the log starts over
+        if (checkpoint(j, 0, 1) != 0) goto fail;
+        pos = 0;
+        // pages read through the mapping before the replay are read again
+        madvise(img->base, img->size, MADV_DONTNEED);
+        if (image_check_layout(img) != 0) goto fail;
+    }
+    j->tail = j->head = pos;
+    return replayed;
+
+fail:
+    ioq_free(&j->io);
+    bcache_free(&j->cache);
+    free(j->scratch);
+    j->scratch = NULL;
+    return -1;
+}
+
+uint64_t journal_capacity(const journal_t* j) {
+    // n images need ceil(n / JOURNAL_TAGS) descriptors and one commit block
+    uint64_t records = j->area - 1;
+    return records - (records + JOURNAL_TAGS) / (JOURNAL_TAGS + 1);
+}
+
+int journal_watch(journal_t* j, uint64_t first, uint64_t count) {
+    if (first > j->img->nblocks || count > j->img->nblocks - first) return -1;
+    for (uint64_t b = first; b < first + count; b++) {
+        if (j->watch_count == j->watch_cap) {
+            size_t cap = j->watch_cap ? j->watch_cap * 2 : 64;
+            uint32_t* w = realloc(j->watch, cap * sizeof(uint32_t));
+            if (w == NULL) return -1;
+            j->watch = w;
+            j->watch_cap = cap;
+        }
+        j->watch[j->watch_count++] = (uint32_t)b;
+    }
+    return 0;
+}
+
+// Runs of data-region bits set since the last commit, as (start, len) pairs in bit order
+static int add_fresh(list_t* fresh, uint32_t bit) {
+    if (fresh->n > 0 && fresh->v[fresh->n - 2] + fresh->v[fresh->n - 1] == bit) {
+        fresh->v[fresh->n - 1]++;
+        return 0;
+    }
+    return push(fresh, bit) || push(fresh, 1) ? -1 : 0;
+}
+
+static int is_fresh(const list_t* fresh, const superblock_t* sb, uint32_t block) {
+    if (block < sb->data_region_start) return 0;
+    uint64_t bit = block - sb->data_region_start;
+    size_t lo = 0, hi = fresh->n / 2;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (bit < fresh->v[2 * mid]) hi = mid;
+        else if (bit >= (uint64_t)fresh->v[2 * mid] + fresh->v[2 * mid + 1]) lo = mid + 1;
+        else return 1;
+    }
+    return 0;
+}
+
+// Compare one bitmap region with the file. Changed bitmap blocks become candidates,
+// and so do the inode table blocks of inodes whose bit changed (inode bitmap), or the
+// newly set bits are collected as fresh runs (data bitmap).
+static int diff_bitmap(journal_t* j, uint64_t first, uint64_t count, uint64_t nbits, int inodes, list_t* cand, list_t* fresh) {
+    for (uint64_t b = 0; b < count; b++) {
+        const uint8_t* now = image_block(j->img, first + b);
+        const uint8_t* old = now ? bcache_read(&j->cache, first + b) : NULL;
+        if (old == NULL) return -1;
+        if (memcmp(now, old, BS) == 0) continue;
+        if (push(cand, (uint32_t)(first + b)) != 0) return -1;
+        for (uint64_t i = 0; i < BS; i++) {
+            uint8_t changed = inodes ? now[i] ^ old[i] : now[i] & ~old[i];
+            for (int k = 0; changed != 0 && k < 8; k++) {
+                if (!(changed >> k & 1)) continue;
+                uint64_t bit = (b * BS + i) * 8 + k;
+                if (bit >= nbits) break;
+                int rc = inodes ? push(cand, (uint32_t)image_inode_block(j->img, bit + 1))
+                                : add_fresh(fresh, (uint32_t)bit);
+                if (rc != 0) return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int journal_write_data(journal_t* j, uint64_t first, uint64_t count) {
+    const uint8_t* run = image_blocks(j->img, first, count);
+    if (run == NULL || count > UINT32_MAX || write_all(j->img->fd, run, count * BS, first * BS) != 0) return -1;
+    return journal_data_written(j, first, count);
+}
+
+int journal_data_written(journal_t* j, uint64_t first, uint64_t count) {
+    if (image_blocks(j->img, first, count) == NULL || count > UINT32_MAX) return -1;
+    bcache_forget(&j->cache, first, count);
+    if (j->written_count + 2 > j->written_cap) {
+        size_t cap = j->written_cap ? j->written_cap * 2 : 64;
+        uint32_t* w = realloc(j->written, cap * sizeof(uint32_t));
+        if (w == NULL) return -1;
+        j->written = w;
+        j->written_cap = cap;
+    }
+    j->written[j->written_count++] = (uint32_t)first;
+    j->written[j->written_count++] = (uint32_t)count;
+    image_advise(j->img, first, count, IMAGE_ADV_DONTNEED);
+    return 0;
+}
+
+void journal_forget_data(journal_t* j) {
+    j->written_count = 0;
+}
+
+int journal_commit(journal_t* j) {
+    image_t* img = j->img;
+    const superblock_t* sb = img->sb;
+    list_t cand = {0}, fresh = {0}, logged = {0};
+    uint8_t* descs_buf = NULL;
+    struct iovec* iov = NULL;
+    int rc = -1;
+
+    // 1. what may have changed: block 0, the bitmaps (and through them the touched
+    //    inode table blocks and the newly allocated data blocks), watched blocks
+    if (push(&cand, 0) != 0) goto out;
+    for (size_t i = 0; i < j->watch_count; i++) if (push(&cand, j->watch[i]) != 0) goto out;
+    if (diff_bitmap(j, sb->inode_bitmap_start, sb->inode_bitmap_blocks, sb->inode_count, 1, &cand, &fresh) != 0) goto out;
+    if (diff_bitmap(j, sb->data_bitmap_start, sb->data_bitmap_blocks, sb->data_region_blocks, 0, &cand, &fresh) != 0) goto out;
+
+    // 2. of those, the blocks that really differ from the file, minus fresh ones
+    qsort(cand.v, cand.n, sizeof(uint32_t), cmp_u32);
+    for (size_t i = 0; i < cand.n; i++) {
+        if (i > 0 && cand.v[i] == cand.v[i - 1]) continue;
+        if (is_fresh(&fresh, sb, cand.v[i])) continue;
+        const uint8_t* now = image_block(img, cand.v[i]);
+        const uint8_t* old = now ? bcache_read(&j->cache, cand.v[i]) : NULL;
+        if (old == NULL) goto out;
+        if (memcmp(now, old, BS) != 0 && push(&logged, cand.v[i]) != 0) goto out;
+    }
+    if (logged.n == 0 && fresh.n == 0) {
+        rc = 0;
+        goto out;
+    }
+    uint32_t descs = (uint32_t)((logged.n + JOURNAL_TAGS - 1) / JOURNAL_TAGS);
+    uint64_t records = logged.n + descs + 1;
+    if (logged.n > journal_capacity(j)) goto out;
+
+    // 3. fresh blocks go straight home: nothing committed refers to them
+    //    (minus the runs journal_write_data() put there already). Queued only:
+    //    they are written together with the log records of step 5
+    uint64_t in_place = 0;
+    qsort(j->written, j->written_count / 2, 2 * sizeof(uint32_t), cmp_u32);
+    for (size_t r = 0, w = 0; r < fresh.n; r += 2) {
+        uint64_t first = sb->data_region_start + fresh.v[r], end = first + fresh.v[r + 1];
+        in_place += fresh.v[r + 1];
+        while (first < end) {
+            while (w < j->written_count && (uint64_t)j->written[w] + j->written[w + 1] <= first) w += 2;
+            uint64_t stop = end;
+            if (w < j->written_count && j->written[w] <= first) {
+                first = (uint64_t)j->written[w] + j->written[w + 1]; // already home
+                continue;
+            }
+            if (w < j->written_count && j->written[w] < stop) stop = j->written[w];
+            const uint8_t* run = image_blocks(img, first, stop - first);
+            if (run == NULL || ioq_write(&j->io, run, (stop - first) * BS, first * BS, 0) != 0) goto out;
+            bcache_forget(&j->cache, first, stop - first);
+            first = stop;
+        }
+    }
+
+    // 4. no room before the end of the log: make every checkpoint durable and start over at 0
+    //    (the flush waits for the writes queued in step 3 too)
+    if (j->head + records > j->area) {
+        if (checkpoint(j, 0, 1) != 0) goto out;
+        j->tail = j->head = 0;
+    }
+
+    // 5. each descriptor + its images as one request, then the commit block. Every
+    //    descriptor has its own buffer: they are all in flight at once.
+    uint32_t pos = j->head, crc = 0;
+    descs_buf = calloc(descs ? descs : 1, BS);
+    iov = malloc((records - 1 ? records - 1 : 1) * sizeof(struct iovec));
+    if (descs_buf == NULL || iov == NULL) goto out;
+    struct iovec* v = iov;
+    for (size_t i = 0, n = 0; i < logged.n; n++) {
+        journal_desc_t* d = (journal_desc_t*)(descs_buf + n * BS);
+        d->h.magic = JOURNAL_MAGIC;
+        d->h.type = JOURNAL_DESC;
+        d->h.seq = j->seq;
+        d->count = (uint32_t)(logged.n - i < JOURNAL_TAGS ? logged.n - i : JOURNAL_TAGS);
+        v[0].iov_base = d;
+        v[0].iov_len = BS;
+        for (uint32_t k = 0; k < d->count; k++) {
+            d->home[k] = logged.v[i + k];
+            v[1 + k].iov_base = image_block(img, logged.v[i + k]);
+            v[1 + k].iov_len = BS;
+        }
+        for (uint32_t k = 0; k <= d->count; k++) crc = crc32_update(crc, v[k].iov_base, BS);
+        if (ioq_writev(&j->io, v, (int)d->count + 1, log_block(j, pos) * BS, 0) != 0) goto out;
+        pos += 1 + d->count;
+        i += d->count;
+        v += 1 + d->count;
+    }
+    memset(j->scratch, 0, BS);
+    journal_commit_t* c = (journal_commit_t*)j->scratch;
+    c->h.magic = JOURNAL_MAGIC;
+    c->h.type = JOURNAL_COMMIT;
+    c->h.seq = j->seq;
+    c->records = pos - j->head;
+    c->crc = crc;
+    if (ioq_write(&j->io, c, BS, log_block(j, pos) * BS, 0) != 0) goto out;
+
+    // 6. the one flush of the transaction: in-place data and log records together,
+    //    drained behind all of them. A torn write cannot pass for a commit, the crc
+    //    covers every record.
+    int queued = ioq_sync(&j->io, IOQ_DRAIN);
+    if (ioq_wait(&j->io) != 0 || queued != 0) goto out;
+    j->syncs++;
+
+#ifdef MINIVSFS_TEST_HOOKS
+    // crash tests only (built with -DMINIVSFS_TEST_HOOKS): stop right after
+    // the commit point, as a crash would
+    const char* stop = getenv("MINIVSFS_JOURNAL_STOP");
+    if (stop != NULL && strcmp(stop, "commit") == 0) _exit(1);
+#endif
+
+    // 7. checkpoint into the cache: the blocks reach home when it is flushed (log restart,
+    //    eviction, journal_close()), so a block every commit of a batch changes (block 0,
+    //    the bitmaps, the root inode) is written once, and adjacent blocks in one pwritev()
+    for (size_t i = 0; i < logged.n; i++) {
+        if (bcache_write(&j->cache, logged.v[i], image_block(img, logged.v[i])) != 0) goto out;
+    }
+    j->head = pos + 1;
+    j->seq++;
+    j->commits++;
+    j->logged += logged.n;
+    j->in_place += in_place;
+
+    // the file holds the fresh blocks now: drop their private copies so memory does
+    // not grow with the data of the batch (changed metadata stays in the mapping)
+    for (size_t r = 0; r < fresh.n; r += 2) {
+        image_advise(img, sb->data_region_start + fresh.v[r], fresh.v[r + 1], IMAGE_ADV_DONTNEED);
+    }
+    j->watch_count = 0;
+    j->written_count = 0;
+    rc = 0;
+
+out:
+    // nothing may still be writing from the buffers below (after an error)
+    if (rc != 0) ioq_wait(&j->io);
+    free(descs_buf);
+    free(iov);
+    free(cand.v);
+    free(fresh.v);
+    free(logged.v);
+    return rc;
+}
+
+int journal_close(journal_t* j) {
+    int rc = 0;
+    if (j->scratch != NULL && j->head != j->tail) {
+        // checkpoints durable first; the header write itself needs no flush,
+        // an old header only replays transactions that are already home
+        if (checkpoint(j, j->head, 0) != 0) rc = -1;
+        j->tail = j->head;
+    }
+    ioq_free(&j->io);
+    bcache_free(&j->cache);
+    free(j->scratch);
+    free(j->watch);
+    free(j->written);
+    j->scratch = NULL;
+    j->watch = NULL;
+    j->written = NULL;
+    return rc;
+}
+
+int64_t journal_pending(const image_t* img) {
+    journal_t j;
+    memset(&j, 0, sizeof(j));
+    j.img = (image_t*)img;
+    journal_header_t h;
+    if (geometry(&j, img) != 0 || (j.scratch = malloc(2 * BS)) == NULL) return -1;
+    int64_t n = -1;
+    if (read_header(&j, &h) == 0) {
+        n = 0;
+        uint64_t seq = h.h.seq;
+        for (uint32_t pos = h.tail, len; pos < j.area && (len = txn_length(&j, pos, seq)) != 0; pos += len, seq++) n++;
+    }
+    free(j.scratch);
+    return n;
+}
@@ -0,0 +1,140 @@
+// journal.h — write-ahead metadata journal (mkfs_adder)
+//
+// An image made with a journal (SB_FL_JOURNAL) has journal_blocks blocks
+// between the inode table and the data region: one header block, then the
+// log. mkfs_adder maps such an image MAP_PRIVATE (IMAGE_PRIVATE), so its
+// stores stay in memory until journal_commit() turns everything changed
+// since the last commit into one transaction:
+//
+//   1. blocks that were free at the last commit (new file data, new pointer,
+//      directory and index blocks) are written in place: nothing on disk
+//      points at them yet;
+//   2. every other changed block (superblock, bitmaps, inode table blocks,
+//      watched directory blocks) is appended to the log as descriptor blocks
+//      listing the home block numbers, the block images, and a commit block
+//      with a crc over all of them;
+//   3. one fdatasync() makes both durable: this is the commit point. Steps
+//      1 and 2 are queued together on an ioq (io_uring where there is one)
+//      and the fdatasync drains them, so they are in flight at once;
+//   4. the logged blocks are copied to their home locations (checkpoint),
+//      through a write-back block cache (bcache.h) that also serves the
+//      committed copies the next commit compares against.
+//
+// Transactions are appended one after another. When the next one does not
+// fit before the end of the log, the checkpoints are flushed and synced, the header is
+// moved to the start of the log (linked behind that fdatasync) and it is
+// reused from there. journal_open()
+// replays every committed transaction found from the header's tail, so a
+// crash at any point leaves either the old or the new metadata, never a mix.
+//
+// A block changed in memory but neither free at the last commit, nor in the
+// bitmaps, nor the inode of a bit that changed, must be journal_watch()ed,
+// otherwise its change is lost. A block freed since the last commit must not
+// be allocated again before the next one: it would count as in use at both
+// commits and be overwritten in place while the old metadata still uses it.
+#ifndef MINIVSFS_JOURNAL_H
+#define MINIVSFS_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bcache.h"
+#include "image.h"
+#include "ioq.h"
+#include "minivsfs.h"
+
+#define JOURNAL_MAGIC 0x4C4A564Du   // "MVJL"
+#define JOURNAL_MIN_BLOCKS 16       // header + a transaction of one add (about 7 blocks) with room to spare
+
+enum { JOURNAL_HEADER = 1, JOURNAL_DESC = 2, JOURNAL_COMMIT = 3 };
+
+#pragma pack(push,1)
+typedef struct {
+    uint32_t magic;
+    uint32_t type;    // JOURNAL_HEADER / JOURNAL_DESC / JOURNAL_COMMIT
+    uint64_t seq;     // transaction; in the header: the first one still to replay
+} journal_rec_t;
+
+typedef struct {
+    journal_rec_t h;
+    uint32_t tail;    // log block (0 = just after the header) where replay starts
+    uint32_t reserved;
+} journal_header_t;
+
+#define JOURNAL_TAGS ((BS - sizeof(journal_rec_t) - 8) / 4)
+typedef struct {
+    journal_rec_t h;
+    uint32_t count;   // block images following this descriptor
+    uint32_t reserved;
+    uint32_t home[JOURNAL_TAGS];
+} journal_desc_t;
+
+typedef struct {
+    journal_rec_t h;
+    uint32_t records; // descriptor and image blocks of the transaction, before this block
+    uint32_t crc;     // crc32 over those blocks, in log order
+} journal_commit_t;
+#pragma pack(pop)
+_Static_assert(sizeof(journal_desc_t) == BS, "descriptor block size mismatch");
+
+typedef struct {
+    image_t* img;
+    uint64_t start;       // header block
+    uint32_t area;        // log blocks after the header
+    uint32_t tail;        // first transaction whose checkpoint may not be durable
+    uint32_t head;        // where the next transaction goes
+    uint64_t seq;         // of the next transaction
+    uint32_t* watch;      // blocks to compare at the next commit
+    size_t watch_count, watch_cap;
+    uint32_t* written;    // (start, len) runs of fresh blocks already home (journal_write_data)
+    size_t written_count, written_cap;
+    uint8_t* scratch;     // two blocks: read back from the file, descriptor/header
+    bcache_t cache;       // committed copies of home blocks, pending checkpoints
+    ioq_t io;             // every write of a commit or checkpoint goes through it
+
+    // totals, for reports
+    uint64_t commits, logged, in_place, syncs;
+} journal_t;
+
+// Lay out an empty journal of `blocks` blocks at `start` in a writable image
+// (mkfs_builder). The caller records it in the superblock.
+int journal_format(image_t* img, uint64_t start, uint64_t blocks);
+
+// Attach to the journal of img (opened IMAGE_PRIVATE) and replay every
+// committed transaction. cache_blocks sizes the block cache (0 = default).
+// Returns how many were replayed, or -1.
+int journal_open(journal_t* j, image_t* img, size_t cache_blocks);
+
+// Most blocks one transaction can log.
+uint64_t journal_capacity(const journal_t* j);
+
+// Compare [first, first+count) with the file at the next commit.
+int journal_watch(journal_t* j, uint64_t first, uint64_t count);
+
+// Write [first, first+count) home now: data blocks allocated since the last
+// commit whose contents are final (an add streaming a file of unknown length).
+// Their private copies are dropped, so a long add does not keep all of its data
+// in memory, and the next commit does not write them again. 0 or -1.
+int journal_write_data(journal_t* j, uint64_t first, uint64_t count);
+
+// Same, for blocks the caller already wrote to the file itself, around the
+// mapping (writer.h): they are recorded as home and any private copies of
+// them are dropped, so the mapping shows what was written. 0 or -1.
+int journal_data_written(journal_t* j, uint64_t first, uint64_t count);
+
+// Forget every journal_write_data() since the last commit: one of those blocks
+// was freed again (a failed add) and may be reused. The commit writes them all.
+void journal_forget_data(journal_t* j);
+
+// Commit everything changed since the last commit (see above). On -1
+// nothing the old metadata refers to has been touched.
+int journal_commit(journal_t* j);
+
+// Make the checkpoints durable, advance the header and release j.
+int journal_close(journal_t* j);
+
+// Committed transactions in img's journal that journal_open() would replay
+// (read only, for Validator). -1 if the journal header is damaged.
+int64_t journal_pending(const image_t* img);
+
+#endif
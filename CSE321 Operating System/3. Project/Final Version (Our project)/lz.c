@@ -0,0 +1,164 @@
+// lz.c — LZ77 block compression and bounds-checked decompression (LZ4 block format)
+#include "lz.h"
+
+#include <string.h>
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5   // the last bytes of a block are always literals
+#define MF_LIMIT 12       // and no match starts this close to the end
+#define MAX_OFFSET 65535
+#define HASH_BITS 13      // 8192 entries, 32 KiB on the stack
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Bytes that match at a and b (b before a), stopping at limit; 8 at a time
+static size_t match_len(const uint8_t* a, const uint8_t* b, const uint8_t* limit) {
+    const uint8_t* start = a;
+    while (a + 8 <= limit) {
+        uint64_t x = read64(a) ^ read64(b);
+        if (x != 0) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            return (size_t)(a - start) + (size_t)(__builtin_clzll(x) >> 3);
+#else
+            return (size_t)(a - start) + (size_t)(__builtin_ctzll(x) >> 3);
+#endif
+        }
+        a += 8;
+        b += 8;
+    }
+    while (a < limit && *a == *b) {
+        a++;
+        b++;
+    }
+    return (size_t)(a - start);
+}
+
+// The length bytes after a nibble of 15
+static uint8_t* put_length(uint8_t* op, size_t len) {
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// One sequence: nlit literals, then a match of mlen bytes at off back (mlen 0:
+// the last sequence). Returns the new end of the output, or NULL if it does not fit.
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* oend, const uint8_t* lit, size_t nlit, size_t off, size_t mlen) {
+    size_t need = 1 + nlit / 255 + 1 + nlit + (mlen ? 2 + mlen / 255 + 1 : 0);
+    if (need > (size_t)(oend - op)) return NULL;
+    uint8_t* token = op++;
+    *token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15) op = put_length(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen == 0) return op;
+    *op++ = (uint8_t)(off & 0xFF);
+    *op++ = (uint8_t)(off >> 8);
+    mlen -= MIN_MATCH;
+    *token |= (uint8_t)(mlen < 15 ? mlen : 15);
+    if (mlen >= 15) op = put_length(op, mlen - 15);
+    return op;
+}
+
+size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t lz_compress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap) {
+    if (n >= UINT32_MAX) return 0;   // positions are kept in 32 bits
+    uint32_t table[1u << HASH_BITS]; // position + 1 of the last 4 bytes with that hash, 0 = none
+    memset(table, 0, sizeof(table));
+    const uint8_t *ip = src, *anchor = src, *end = src + n;
+    const uint8_t* mflimit = n > MF_LIMIT ? end - MF_LIMIT : src;
+    const uint8_t* mlimit = n > LAST_LITERALS ? end - LAST_LITERALS : src;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    while (ip < mflimit) {
+        uint32_t seq = read32(ip);
+        uint32_t h = hash4(seq);
+        const uint8_t* ref = table[h] ? src + table[h] - 1 : NULL;
+        table[h] = (uint32_t)(ip - src) + 1;
+        if (ref == NULL || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+            // the longer nothing has matched, the bigger the steps
+            ip += 1 + ((size_t)(ip - anchor) >> 6);
+            continue;
+        }
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        size_t len = MIN_MATCH + match_len(ip + MIN_MATCH, ref + MIN_MATCH, mlimit);
+        op = put_sequence(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), len);
+        if (op == NULL) return 0;
+        ip += len;
+        anchor = ip;
+        // a position inside the match, so a repeat of it is found right away
+        if (ip < mflimit) table[hash4(read32(ip - 2))] = (uint32_t)(ip - 2 - src) + 1;
+    }
+    op = put_sequence(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+// Adds the length bytes after a nibble of 15 to *len
+static int get_length(const uint8_t** ip, const uint8_t* iend, size_t* len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int64_t lz_decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap) {
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && get_length(&ip, iend, &lit) != 0) return -1;
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) return -1;
+        // short runs are copied 16 bytes at a time where both buffers have the room:
+        // the bytes past the end are overwritten by what follows
+        if (lit <= 16 && iend - ip >= 16 && oend - op >= 16) memcpy(op, ip, 16);
+        else memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) break; // the last sequence: literals only
+
+        if (iend - ip < 2) return -1;
+        size_t off = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && get_length(&ip, iend, &len) != 0) return -1;
+        len += MIN_MATCH;
+        if (off == 0 || off > (size_t)(op - dst) || len > (size_t)(oend - op)) return -1;
+
+        const uint8_t* m = op - off;
+        uint8_t* mend = op + len;
+        if (off >= 16 && (size_t)(oend - op) >= len + 16) {
+            // 16 at a time never reads what the same step writes
+            for (; op < mend; op += 16, m += 16) memcpy(op, m, 16);
+        } else if (off >= 8 && (size_t)(oend - op) >= len + 8) {
+            for (; op < mend; op += 8, m += 8) memcpy(op, m, 8);
+        } else {
+            // a short offset repeats a pattern: byte by byte
+            while (op < mend) *op++ = *m++;
+        }
+        op = mend;
+    }
+    return (int64_t)(op - dst);
+}
@@ -0,0 +1,31 @@
+// lz.h — small LZ77 block codec (LZ4 block format) for compressed files (compress.h)
+//
+// A block is a sequence of (literals, match) pairs: a token byte with the
+// literal count in its high nibble and the match length - 4 in its low one
+// (15 = more length bytes follow, each adding up to 255), the literals, a
+// 2-byte little-endian offset back into the output (1..65535) and the extra
+// match length bytes. The last sequence has literals only.
+// Compression is greedy with one hash table of 4-byte prefixes, and skips
+// ahead faster through data that does not match, so incompressible input
+// costs little. Decompression checks every length and offset: a damaged
+// block fails instead of writing out of bounds.
+#ifndef MINIVSFS_LZ_H
+#define MINIVSFS_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest compressed size of n bytes (incompressible input)
+size_t lz_bound(size_t n);
+
+// Compress src[0..n) into dst (cap bytes). Returns the compressed size, or 0
+// if it does not fit in cap.
+size_t lz_compress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap);
+
+// Decompress the n bytes of src into dst (cap bytes). Returns the size of
+// the output, or -1 if src is damaged or the output exceeds cap. Short runs
+// are copied 16 bytes at a time, so the bytes of dst after the output (up to
+// cap) may be overwritten too.
+int64_t lz_decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap);
+
+#endif
@@ -0,0 +1,149 @@
+// minivsfs.h — MiniVSFS on-disk format shared by mkfs_builder, mkfs_adder,
+// mkfs_reader and Validator
+#ifndef MINIVSFS_H
+#define MINIVSFS_H
+
+#include <stdint.h>
+
+#define BS 4096u               // block size
+#define INODE_SIZE 128u
+#define ROOT_INO 1u
+#define DIRECT_MAX 12
+#define MINIVSFS_MAGIC 0x4D565346u
+
+#define PTRS_PER_BLOCK (BS / sizeof(uint32_t))      // block pointers in one indirect block
+#define DIRENTS_PER_BLOCK (BS / sizeof(dirent64_t)) // directory entries in one block
+
+#pragma pack(push, 1)
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t total_blocks;
+    uint64_t inode_count;
+    uint64_t inode_bitmap_start;
+    uint64_t inode_bitmap_blocks;
+    uint64_t data_bitmap_start;
+    uint64_t data_bitmap_blocks;
+    uint64_t inode_table_start;
+    uint64_t inode_table_blocks;
+    uint64_t data_region_start;
+    uint64_t data_region_blocks;
+    uint64_t root_inode;
+    uint64_t mtime_epoch;
+    uint32_t flags;
+
+    // THIS FIELD SHOULD STAY AT THE END
+    // ALL OTHER FIELDS SHOULD BE ABOVE THIS
+    uint32_t checksum;            // crc32(superblock[0..4091])
+} superblock_t;
+#pragma pack(pop)
+_Static_assert(sizeof(superblock_t) == 116, "superblock must fit in one block");
+
+// superblock_t.flags
+#define SB_FL_JOURNAL 0x1u   // the image has a metadata journal (journal.h), described in superblock_ext_t
+#define SB_FL_DEDUP 0x2u     // the image has a dedup table of shared data blocks (dedup.h), in superblock_ext_t
+#define SB_FL_GROUPS 0x4u    // block groups: the inode table is split into one slice per group (group_desc_t)
+
+// Fields stored in block 0 after superblock_t, at SB_EXT_OFFSET. The superblock
+// crc covers the whole block, so they are checksummed too; images made before
+// they existed have zeros here and the matching flags clear.
+#define SB_EXT_OFFSET 128u
+#pragma pack(push, 1)
+typedef struct {
+    uint64_t journal_start;   // journal header block; the log follows it
+    uint64_t journal_blocks;  // header included
+    uint64_t dedup_start;     // first block of the dedup table, in the data region
+    uint64_t dedup_blocks;
+    uint64_t groups_start;    // group descriptor table: the first blocks of group 0
+    uint32_t groups_blocks;
+    uint32_t groups_crc;      // crc32 of the group_count descriptors
+    uint64_t group_count;
+    uint64_t inodes_per_group;
+} superblock_ext_t;
+#pragma pack(pop)
+#define SB_EXT(sb) ((superblock_ext_t *)((uint8_t *)(sb) + SB_EXT_OFFSET))
+
+// Block groups (SB_FL_GROUPS, mkfs_builder --groups). The data region is cut
+// into groups of GROUP_BLOCKS blocks, the blocks one data bitmap block tracks,
+// and the inode table into slices of inodes_per_group inodes, one at the start
+// of each group's blocks: inode i lives in group (i - 1) / inodes_per_group,
+// next to the data mkfs_adder gives it. The superblock's inode table is empty
+// (inode_table_blocks 0); the slices and the descriptor table are data blocks
+// marked used in the data bitmap, as files never reference them. A last group
+// too short for a slice has no inodes, only data.
+#define GROUP_BLOCKS 32768u
+#define INODES_PER_BLOCK (BS / INODE_SIZE)
+#pragma pack(push, 1)
+typedef struct {
+    uint64_t first_block;     // first block of the group, in the data region
+    uint64_t inode_table;     // first block of its inode slice, 0 for a group without inodes
+    uint32_t blocks;          // blocks in the group, descriptor table and inode slice included
+    uint32_t first_inode;     // its inodes: first_inode .. first_inode + inodes_per_group - 1 (0: none)
+    uint32_t block_bitmap;    // the data bitmap block of its blocks
+    uint32_t inode_bitmap;    // the inode bitmap block of its first inode
+} group_desc_t;
+#pragma pack(pop)
+_Static_assert(sizeof(group_desc_t) == 32, "group descriptor size mismatch");
+
+#pragma pack(push,1)
+typedef struct {
+    uint16_t mode;
+    uint16_t links;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size_bytes;
+    uint64_t atime;
+    uint64_t mtime;
+    uint64_t ctime;
+    uint32_t direct[12];   // absolute block numbers, 0 = unused
+    uint32_t indirect1;    // block of PTRS_PER_BLOCK pointers for file blocks 12..1035 (was reserved_0)
+    uint32_t indirect2;    // block of pointers to indirect blocks, for the rest (was reserved_1)
+    uint32_t flags;        // INODE_FL_* (was reserved_2)
+    uint32_t proj_id;
+    uint32_t uid16_gid16;
+    uint64_t xattr_ptr;
+
+    // THIS FIELD SHOULD STAY AT THE END
+    // ALL OTHER FIELDS SHOULD BE ABOVE THIS
+    uint64_t inode_crc;   // low 4 bytes store crc32 of bytes [0..119]; high 4 bytes 0
+} inode_t;
+#pragma pack(pop)
+_Static_assert(sizeof(inode_t)==INODE_SIZE, "inode size mismatch");
+
+// inode_t.flags
+#define INODE_FL_EXTENTS 0x1u  // direct[] holds EXTENT_MAX extents instead of block pointers
+#define INODE_FL_DIR_INDEX 0x2u // directory: indirect2 is the first block of its hash index (dir_index.h)
+#define INODE_FL_SPARSE 0x4u    // file with holes: a data pointer of 0, or an extent with start 0,
+                                // stands for blocks of zeros that have no data block (sparse.h)
+#define INODE_FL_COMPRESSED 0x8u // file data in clusters of COMPRESS_CLUSTER_BLOCKS blocks, each
+                                 // stored raw or LZ-compressed (compress.h)
+#define COMPRESS_CLUSTER_BLOCKS 8 // 32 KiB of file data per cluster
+#define INODE_FL_INLINE 0x10u    // file of at most INLINE_MAX bytes kept in the inode itself, no data block
+#define INLINE_MAX 64            // bytes: direct[], indirect1 and indirect2 (56), then xattr_ptr (8)
+
+// Extent-mapped inode: direct[12] is read as 6 (start, length) pairs.
+// File blocks are the extents' blocks in order; an unused extent has length 0,
+// and one with start 0 is a hole of length blocks (INODE_FL_SPARSE).
+// indirect1/indirect2 stay 0.
+#pragma pack(push,1)
+typedef struct {
+    uint32_t start;   // absolute block number of the first block
+    uint32_t len;     // blocks in the run
+} extent_t;
+#pragma pack(pop)
+#define EXTENT_MAX (int)(sizeof(((inode_t *)0)->direct) / sizeof(extent_t))
+
+#pragma pack(push,1)
+typedef struct {
+    uint32_t inode_no;
+    uint8_t type;
+    char name[58];
+
+    // THIS FIELD SHOULD STAY AT THE END
+    uint8_t  checksum; // XOR of bytes 0..62
+} dirent64_t;
+#pragma pack(pop)
+_Static_assert(sizeof(dirent64_t)==64, "dirent size mismatch");
+
+#endif
@@ -1,4 +1,6 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread mkfs_adder.c volume.c sparse.c writer.c crc32.c bitmap.c dcache.c dir_index.c image.c inode_map.c compress.c lz.c dedup.c sha256.c journal.c bcache.c ioq.c -o mkfs_adder
 #define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE // copy_file_range
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -8,365 +10,220 @@
 #include <getopt.h>
 #include <errno.h>
 #include <inttypes.h>
-
-
-#define BS 4096u
-#define INODE_SIZE 128u
-#define ROOT_INO 1u
-#define DIRECT_MAX 12
-#pragma pack(push, 1)
-
-typedef struct {
-    uint32_t magic;
-    uint32_t version;
-    uint32_t block_size;
-    uint64_t total_blocks;
-    uint64_t inode_count;
-    uint64_t inode_bitmap_start;
-    uint64_t inode_bitmap_blocks;
-    uint64_t data_bitmap_start;
-    uint64_t data_bitmap_blocks;
-    uint64_t inode_table_start;
-    uint64_t inode_table_blocks;
-    uint64_t data_region_start;
-    uint64_t data_region_blocks;
-    uint64_t root_inode;
-    uint64_t mtime_epoch;
-    uint32_t flags;
-    
-    // THIS FIELD SHOULD STAY AT THE END
-    // ALL OTHER FIELDS SHOULD BE ABOVE THIS
-    uint32_t checksum;            // crc32(superblock[0..4091])
-} superblock_t;
-#pragma pack(pop)
-_Static_assert(sizeof(superblock_t) == 116, "superblock must fit in one block");
-
-#pragma pack(push,1)
-typedef struct {
-    uint16_t mode;
-    uint16_t links;
-    uint32_t uid;
-    uint32_t gid;
-    uint64_t size_bytes;
-    uint64_t atime;
-    uint64_t mtime;
-    uint64_t ctime;
-    uint32_t direct[12]; //direct blocks
-    uint32_t reserved_0;
-    uint32_t reserved_1;
-    uint32_t reserved_2;
-    uint32_t proj_id;
-    uint32_t uid16_gid16;
-    uint64_t xattr_ptr;
-    
-    // THIS FIELD SHOULD STAY AT THE END
-    // ALL OTHER FIELDS SHOULD BE ABOVE THIS
-    uint64_t inode_crc;   // low 4 bytes store crc32 of bytes [0..119]; high 4 bytes 0
-} inode_t;
-#pragma pack(pop)
-_Static_assert(sizeof(inode_t)==INODE_SIZE, "inode size mismatch");
-
-#pragma pack(push,1)
-typedef struct {
-    uint32_t inode_no;
-    uint8_t type;
-    char name[58];
-    
-    // THIS FIELD SHOULD STAY AT THE END
-    uint8_t  checksum; // XOR of bytes 0..62
-} dirent64_t;
-#pragma pack(pop)
-_Static_assert(sizeof(dirent64_t)==64, "dirent size mismatch");
-
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h> // FICLONE
+#endif
+
+#include "crc32.h"
+#include "dcache.h"
+#include "minivsfs.h"
+#include "sha256.h"
+#include "sparse.h"
+#include "volume.h"
+
+// on-disk structures (superblock_t, inode_t, dirent64_t) live in minivsfs.h
 
 // ==========================DO NOT CHANGE THIS PORTION=========================
 // These functions are there for your help. You should refer to the specifications to see how you can use them.
 // ====================================CRC32====================================
-uint32_t CRC32_TAB[256];
-void crc32_init(void){
-    for (uint32_t i=0;i<256;i++){
-        uint32_t c=i;
-        for(int j=0;j<8;j++) c = (c&1)?(0xEDB88320u^(c>>1)):(c>>1);
-        CRC32_TAB[i]=c;
-    }
-}
-uint32_t crc32(const void* data, size_t n){
-    const uint8_t* p=(const uint8_t*)data; uint32_t c=0xFFFFFFFFu;
-    for(size_t i=0;i<n;i++) c = CRC32_TAB[(c^p[i])&0xFF] ^ (c>>8);
-    return c ^ 0xFFFFFFFFu;
-}
+// crc32_init() and crc32() live in crc32.c, shared by all MiniVSFS tools
 // ====================================CRC32====================================
 
-// WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
-static uint32_t superblock_crc_finalize(superblock_t *sb) {
-    sb->checksum = 0;
-    uint32_t s = crc32((void *) sb, BS - 4);
-    sb->checksum = s;
-    return s;
-}
+// superblock_crc_finalize(), inode_crc_finalize() and dirent_checksum_finalize()
+// live in volume.c, with the code that adds files (volume.h)
 
-// WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
-void inode_crc_finalize(inode_t* ino){
-    uint8_t tmp[INODE_SIZE]; memcpy(tmp, ino, INODE_SIZE);
-    // zero crc area before computing
-    memset(&tmp[120], 0, 8);
-    uint32_t c = crc32(tmp, 120);
-    ino->inode_crc = (uint64_t)c; // low 4 bytes carry the crc
-}
 
-// WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
-void dirent_checksum_finalize(dirent64_t* de) {
-    const uint8_t* p = (const uint8_t*)de;
-    uint8_t x = 0;
-    for (int i = 0; i < 63; i++) x ^= p[i];   // covers ino(4) + type(1) + name(58)
-    de->checksum = x;
+// ==========================DUPLICATE NAME SET=================================
+// Paths of the files in this batch (normalized, see normalize_path), so a path
+// given twice is caught before anything is added. Open addressing (linear
+// probing) over a power-of-two table of pointers to the job paths.
+typedef struct {
+    const char **slots; //slots[i] == NULL means empty
+    size_t cap;
+    size_t count;
+} name_set_t;
+
+static int name_set_init(name_set_t *set, size_t expected) {
+    set->cap = 64;
+    while (set->cap < expected * 2) set->cap <<= 1; //keep load factor <= 1/2
+    set->count = 0;
+    set->slots = calloc(set->cap, sizeof(*set->slots));
+    return set->slots == NULL ? -1 : 0;
 }
 
-
-// Function to read superblock from image
-// fp: pointer to input_fp(output_fp)
-int read_superblock(FILE *fp, superblock_t *sb) {
-    //SEEK_SET: read from beginning of sb
-    if (fseek(fp, 0, SEEK_SET) != 0) {
-        return -1; //go back to main when nothing to read (file empty)
-    }
-    
-    
-    //fread(sb, sizeof(superblock_t), 1, fp):
-        //sb: pointer to address of sb struct where the read data will be stored
-        //sizeof(superblock_t): size of each elem to read (size of one sb struct = 116 bytes). reading 116 bytes
-        //1: number of superblocks. we have 1 sb
-        //fp: file pointer to read from (input_fp)
-    size_t num_of_superblock_read = fread(sb, sizeof(superblock_t), 1, fp);
-    //on success fread() returns the third parameter
-    //on success fread() returns 1 (it has read 1 superblock), 
-    //else it enters loop and go back to main()
-    if (num_of_superblock_read != 1) {
-        return -1;
-    }
-
-    
-    //Verify magic number to verify img file sb
-    if (sb->magic != 0x4D565346) {
-        printf("Error in matching sb.magic\n");
-        return -1;
+// FNV-1a over the whole path (dir_hash() stops at a dirent name's length)
+static uint64_t path_hash(const char *path) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *path != '\0'; path++) {
+        h ^= (uint8_t)*path;
+        h *= 1099511628211ULL;
     }
-    
-    return 0;
+    return h;
 }
 
-//reading a specific inode from img file
-int read_inode(FILE *fp, superblock_t *sb, uint64_t inode_no, inode_t *root_inode) {
-    if (inode_no < 1 || inode_no > sb->inode_count) {
-        return -1;
-    }
-    
-    // Calculate inode position (inodes are 1-indexed)
-    uint64_t inode_table_start_address = sb->inode_table_start * BS;
-    uint64_t inode_address = inode_table_start_address + (inode_no - 1) * INODE_SIZE;
-    
-    if (fseek(fp, inode_address, SEEK_SET) != 0) {
-        return -1;
-    }
-    
-    //fread(root_inode, INODE_SIZE, 1, fp):
-        //root_inode: pointer to address of root_inode where the read data will be stored
-        //INODE_SIZE: size of each elem to read (size of 1 INODE). reading 128 bytes
-        //1: number of INODE. 
-        //fp: file pointer to read from (input_fp)
-    if (fread(root_inode, INODE_SIZE, 1, fp) != 1) {
-        return -1;
+// returns 1 if added, 0 if the path was already there
+static int name_set_add(name_set_t *set, const char *name) {
+    size_t i = path_hash(name) & (set->cap - 1);
+    while (set->slots[i] != NULL) {
+        if (strcmp(set->slots[i], name) == 0) return 0;
+        i = (i + 1) & (set->cap - 1);
     }
-    
-    return 0;
+    set->slots[i] = name;
+    set->count++;
+    return 1;
 }
 
-//writing a specific inode to img file
-int write_inode(FILE *fp, superblock_t *sb, int free_inode_no, inode_t *new_inode) {
-    if (free_inode_no < 1 || free_inode_no > sb->inode_count) {
-        return -1;
-    }
-    
-    //Calculating inode position (inodes are 1-indexed)
-    uint64_t inode_table_start_address = sb->inode_table_start * BS;
-    uint64_t inode_address = inode_table_start_address + (free_inode_no - 1) * INODE_SIZE;
-    
-    //SEEK_SET: move cursor to beginning. offset=inode_address
-    if (fseek(fp, inode_address, SEEK_SET) != 0) {
-        return -1;
-    }
-    
-    //fwrite(new_inode, INODE_SIZE, 1, fp) - 
-       //new_inode: the element we want to write in fp
-       //INODE_SIZE: writes INODE_SIZE (in bytes) at once
-       //1: no. of elements to write (1 inode for this)
-       //fp: tells fwrite where to write (input_fp for this)    
-    if (fwrite(new_inode, INODE_SIZE, 1, fp) != 1) {
-        return -1;
-    }
-    
-    return 0;
-}
+// ==========================DUPLICATE NAME SET=================================
 
-// Function to read bitmap
-int read_bitmap(FILE *fp, uint64_t bitmap_start, uint8_t *bitmap) {
-    //SEEK_SET offset=bitmap_start * BS (moving cursor to start of inode/data bmap) 
-    if (fseek(fp, bitmap_start * BS, SEEK_SET) != 0) {
-        return -1;
-    }
-    
 
-    //fread(bitmap, BS, 1, fp) - 
-       //bitmap: memory allocated(1 BS) in this location. all data read will be stored in this array
-       //BS: reads 1 BS (in bytes) at once
-       //1: no. of elements to read (1 block for this)
-       //fp: tells fread where to read from (input_fp for this)    
-    size_t num_of_bitmap_read = fread(bitmap, BS, 1, fp);
-    //on success fread() returns the third parameter
-    //on success fread() returns 1 (it has read 1 superblock), 
-    //else it enters loop and go back to main()
-    if (num_of_bitmap_read != 1) {
-        return -1;
-    }
-    
+// One file to add: its path on the host is also its path in the image (below
+// the root, directories created as needed), except for "-" (stdin), named by
+// --stdin-name
+typedef struct {
+    char *path;
+    char *name;     // path in the image, normalized
+    FILE *fp;       // stdin, or NULL until the file is opened for its add
+    long size;      // -1: a pipe, FIFO or stdin, read to EOF (VOLUME_STREAM)
+} add_job_t;
+
+// Appends path to the job list (grows it as needed)
+static int push_job(add_job_t **jobs, size_t *count, size_t *cap, const char *path) {
+    if (*count == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 16;
+        add_job_t *grown = realloc(*jobs, new_cap * sizeof(add_job_t));
+        if (grown == NULL) return -1;
+        *jobs = grown;
+        *cap = new_cap;
+    }
+    add_job_t *job = &(*jobs)[*count];
+    job->path = malloc(strlen(path) + 1);
+    if (job->path == NULL) return -1;
+    strcpy(job->path, path);
+    job->name = NULL;
+    job->fp = NULL;
+    job->size = 0;
+    (*count)++;
     return 0;
 }
 
-// Function to write bitmap
-int write_bitmap(FILE *fp, uint64_t bitmap_start, uint8_t *bitmap) {
-    //SEEK_SET: move cursor to beginning of file. offset = bitmap_start * BS (beginning of ibmap)
-    if (fseek(fp, bitmap_start * BS, SEEK_SET) != 0) {
+// Manifest: one file path per line, blank lines and lines starting with '#' are skipped
+static int read_manifest(const char *manifest, add_job_t **jobs, size_t *count, size_t *cap) {
+    FILE *mf = fopen(manifest, "r");
+    if (mf == NULL) {
+        printf("Error opening manifest %s\n", manifest);
         return -1;
     }
-    
-    //fwrite(bitmap, BS, 1, fp) - 
-       //bitmap: the element we want to write
-       //BS: writes BS (in bytes) at once
-       //1: no. of elements to write (1 block for this)
-       //fp: tells fwrite where to write (input_fp for this)    
-    size_t num_of_bitmap_write = fwrite(bitmap, BS, 1, fp);
-    //on success fwrite() returns the third parameter
-    //on success fwrite() returns 1 (it has written 1 ibmap/dbmap), 
-    //else it enters loop and go back to main()
-    if (num_of_bitmap_write != 1) {
-        return -1;
+    char line[4096];
+    while (fgets(line, sizeof(line), mf) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (push_job(jobs, count, cap, line) != 0) {
+            printf("Error in allocating memory for the file list\n");
+            fclose(mf);
+            return -1;
+        }
     }
-    
+    fclose(mf);
     return 0;
 }
 
-
-//Function to find first free bit in bitmap
-int find_free_bit(uint8_t *bitmap) { //bitmap has one BS mem allocation
-    for (int i = 0; i < BS; i++) {
-        if (bitmap[i] != 1) { //bitmap[i]!=1 means that indexed inode/datablock is free
-            //printf("Free inode/datablock is found: %d no inode/datablock", i+1); //i+1 (bc 1 indexed)
-            return i;
-        }
-    }
-    return -1; // No free bits found
+// The image path of a host path, as volume_add() will walk it: components
+// joined by single slashes, without a leading slash or "." components.
+// NULL if a component is too long, is "..", or there is none
+static char *normalize_path(const char *path) {
+    char *out = malloc(strlen(path) + 1), name[DCACHE_NAME_MAX + 1];
+    size_t len = 0;
+    int r;
+    while (out != NULL && (r = path_next(&path, name)) == 1 && strcmp(name, "..") != 0) {
+        if (len > 0) out[len++] = '/';
+        strcpy(out + len, name);
+        len += strlen(name);
+    }
+    if (out == NULL || r != 0 || len == 0) {
+        free(out);
+        return NULL;
+    }
+    out[len] = '\0';
+    return out;
 }
 
+// Makes output a copy of input, cheapest method first:
+//   1. FICLONE: output shares input's extents (btrfs, xfs), no data is copied at all
+//   2. copy_file_range: the kernel copies (or reflinks) without passing data through user space
+//   3. pread/pwrite with a 1 MiB buffer; all-zero chunks are skipped so the copy stays sparse
+// Returns 0 on success, -1 on failure
+#define COPY_CHUNK (1u << 20)
 
-// Function to add a directory entry
-// add_directory_entry(input_fp, &sb, &root_inode, free_inode + 1, 1, file)
-//5th parameter= directory_entry.type = 1 (as its a file)
+static int is_zero(const uint8_t *buf, size_t n) {
+    return n == 0 || (buf[0] == 0 && memcmp(buf, buf + 1, n - 1) == 0);
+}
 
-int add_directory_entry(FILE *fp, superblock_t *sb, inode_t *root_dir_inode, int new_inode_no, uint8_t type,  char *name) {
-    // If we get here, we need to allocate a new data block for the directory
-    // Read data bitmap
-    uint8_t *data_bitmap = malloc(BS);
-    if (data_bitmap == NULL) {
+static int copy_image(const char *input, const char *output) {
+    int in = open(input, O_RDONLY);
+    if (in < 0) return -1;
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
         return -1;
     }
-    
-    if (read_bitmap(fp, sb->data_bitmap_start, data_bitmap) != 0) {
-        free(data_bitmap);
+    //O_TRUNC : truncate the file (make it empty) if it already exists
+    int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        close(in);
         return -1;
     }
-    
-    // Find free data block
-    int free_data_block = find_free_bit(data_bitmap);
-    if (free_data_block == -1) {
-        free(data_bitmap);
-        printf("Error: No free data blocks available\n");
-        return -1;
-    }
-    
-    // Allocate the data block
-    //set_bitmap_bit(data_bitmap, free_data_block);
-    data_bitmap[free_data_block] = 1;
-    if (write_bitmap(fp, sb->data_bitmap_start, data_bitmap) != 0) {
-        free(data_bitmap);
-        return -1;
-    }
-    
-    free(data_bitmap); 
-    
-    // Find a free direct pointer in the ROOT directory inode
-    // TO point to the datablock having the file.txt directory entry
-    int free_direct = -1;
-    for (int i = 0; i < DIRECT_MAX; i++) {
-        if (root_dir_inode->direct[i] == 0) {
-            free_direct = i;
+
+    off_t size = st.st_size;
+    off_t copied = 0;
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0) copied = size;
+#endif
+#ifdef __linux__
+    // stops early with EXDEV/ENOSYS/EINVAL where unsupported; the fallback continues from `copied`
+    while (copied < size) {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, size - copied, 0);
+        if (n <= 0) break;
+        copied += n;
+    }
+#endif
+
+    uint8_t *buffer = NULL;
+    if (copied < size) {
+        buffer = malloc(COPY_CHUNK);
+        if (buffer == NULL) copied = -1;
+    }
+    while (copied >= 0 && copied < size) {
+        ssize_t n = pread(in, buffer, COPY_CHUNK, copied);
+        if (n <= 0) {
+            copied = -1;
             break;
         }
+        if (!is_zero(buffer, n) && pwrite(out, buffer, n, copied) != n) {
+            copied = -1;
+            break;
+        }
+        copied += n;
     }
-    
-    if (free_direct == -1) {
-        printf("Error: Directory has no free direct pointers\n");
-        return -1;
-    }
-    
-    // Setting the direct pointer to the new data block
-    // free_data_block : holds the file.txt directory entry
-    root_dir_inode->direct[free_direct] = free_data_block;
-    
-    // Initialize the new data block with zeros
-    uint8_t *empty_block = malloc(BS);
-    if (empty_block == NULL) {
-        return -1;
-    }
-    memset(empty_block, 0, sb->block_size);
-    
-    // block_address where the empty block will be placed
-    uint64_t block_address = sb->data_region_start * BS + free_data_block * BS;
-    
-    if (fseek(fp, block_address, SEEK_SET) != 0) {
-        free(empty_block);
-        return -1;
-    }
-    //Writing empty data block to fp
-    if (fwrite(empty_block, BS, 1, fp) != 1) {
-        free(empty_block);
-        return -1;
-    }
-    
-    free(empty_block);
-    
-    // Now add the directory entry to the new empty block
-    dirent64_t new_entry;
-    memset(&new_entry, 0, sizeof(new_entry));
-    new_entry.inode_no = new_inode_no;
-    new_entry.type = type;
-    strncpy(new_entry.name, name, sizeof(new_entry.name));
-    dirent_checksum_finalize(&new_entry);
-    
-    if (fseek(fp, block_address, SEEK_SET) != 0) {
-        return -1;
-    }
-    
-    //writing the new entry in new datablock
-    if (fwrite(&new_entry, sizeof(new_entry), 1, fp) != 1) {
-        return -1;
-    }
-    
-    // Update directory inode size and modification time
-    root_dir_inode->size_bytes += sizeof(dirent64_t);
-    root_dir_inode->mtime = time(NULL);
-    root_dir_inode->atime = time(NULL);
-    
-    return 0;
+    free(buffer);
+
+    // sets the final length (skipped zero chunks at the end become a hole)
+    int rc = (copied == size && ftruncate(out, size) == 0) ? 0 : -1;
+    close(in);
+    if (close(out) != 0) rc = -1;
+    return rc;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s --input <img> (--output <img> | --in-place) --file <file> [--file <file> ...] [--manifest <list>] [--mkdir <dir> ...] [--no-extents] [--cache-blocks <n>] [--stdin-name <name>] [--writer map|sync|pipelined] [--no-holes] [--no-inline] [--compress] [--dedup]\n", prog);
 }
 
 int main(int argc, char *argv[]) {
@@ -374,412 +231,285 @@ int main(int argc, char *argv[]) {
     
     char *input = NULL;
     char *output = NULL;
-    char *file = NULL;
-    
-    input = argv[2];
-    output = argv[4];
-    file = argv[6];
-
-    if (*input == NULL || *output == NULL || *file == NULL) {
-        printf("Usage: %s --input <file> --output <file> --file <file>\n", argv[0]);
-        exit(1);
-    }
-    // Opening to get the size of the file that we want to add into the filesystem
-    //rb: "read binary"
-    // r: Open file for reading
-    // b: Open in binary mode
-    //fopen returns a pointer to the FILE obj(file_fp)
-    FILE *file_fp = fopen(file, "rb"); 
-    if (file_fp == NULL) {
-        printf("Error opening file we want to add\n");
-        exit(1);
-    }
-    
-    // Get file size
-    //SEEK_END moves cursor to end of file to get the total file size
-    if (fseek(file_fp, 0, SEEK_END) != 0) {
-        printf("Error in seeking: moving the cursor to the end of the file we want to add\n");
-        fclose(file_fp);
-        exit(1);
+    int in_place = 0;         //--in-place: modify --input directly instead of writing --output
+    int use_extents = 1;      //--no-extents: always use direct/indirect block maps
+    size_t cache_blocks = 0;  //--cache-blocks: journal block cache size (0 = BCACHE_DEFAULT_BLOCKS)
+    const char *stdin_name = "stdin"; //--stdin-name: name of the file read from stdin (--file -)
+    writer_mode_t writer_mode = WRITER_PIPELINED; //--writer: how big files are copied (writer.h)
+    int holes = 1;            //--no-holes: store all-zero blocks like any other (sparse.h)
+    int compress = 0;         //--compress: store the files in compressed clusters (compress.h)
+    int inline_data = 1;      //--no-inline: give files of at most INLINE_MAX bytes a data block too
+    int dedup = 0;            //--dedup: share blocks already in the image instead of writing them (dedup.h)
+    add_job_t *jobs = NULL;   //every --file and every manifest line, in order
+    size_t job_count = 0, job_cap = 0;
+    add_job_t *dirs = NULL;   //every --mkdir (only path and name used), made before the files
+    size_t dir_count = 0, dir_cap = 0;
+
+    // ./mkfs_adder --input in.img --output out.img --file a.txt [--file b.txt ...] [--manifest list.txt]
+    // ./mkfs_adder --input in.img --in-place --file a.txt
+    // ./mkfs_adder --input in.img --in-place --mkdir logs/2024 --file logs/2024/app.log
+    // producer | ./mkfs_adder --input in.img --in-place --file - --stdin-name data.tar
+    static const struct option long_options[] = {
+        {"input", required_argument, NULL, 'i'},
+        {"output", required_argument, NULL, 'o'},
+        {"file", required_argument, NULL, 'f'},
+        {"manifest", required_argument, NULL, 'm'},
+        {"in-place", no_argument, NULL, 'p'},
+        {"no-extents", no_argument, NULL, 'E'},
+        {"cache-blocks", required_argument, NULL, 'c'},
+        {"stdin-name", required_argument, NULL, 'n'},
+        {"writer", required_argument, NULL, 'w'},
+        {"no-holes", no_argument, NULL, 'Z'},
+        {"compress", no_argument, NULL, 'C'},
+        {"dedup", no_argument, NULL, 'D'},
+        {"no-inline", no_argument, NULL, 'I'},
+        {"mkdir", required_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:o:f:m:pEc:n:w:ZCDId:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'i': input = optarg; break;
+        case 'o': output = optarg; break;
+        case 'f':
+            if (push_job(&jobs, &job_count, &job_cap, optarg) != 0) {
+                printf("Error in allocating memory for the file list\n");
+                exit(1);
+            }
+            break;
+        case 'm':
+            if (read_manifest(optarg, &jobs, &job_count, &job_cap) != 0) exit(1);
+            break;
+        case 'd':
+            if (push_job(&dirs, &dir_count, &dir_cap, optarg) != 0) {
+                printf("Error in allocating memory for the directory list\n");
+                exit(1);
+            }
+            break;
+        case 'p': in_place = 1; break;
+        case 'E': use_extents = 0; break;
+        case 'c': cache_blocks = strtoull(optarg, NULL, 10); break;
+        case 'n': stdin_name = optarg; break;
+        case 'Z': holes = 0; break;
+        case 'C': compress = 1; break;
+        case 'D': dedup = 1; break;
+        case 'I': inline_data = 0; break;
+        case 'w':
+            if (strcmp(optarg, "map") == 0) writer_mode = WRITER_MAP;
+            else if (strcmp(optarg, "sync") == 0) writer_mode = WRITER_SYNC;
+            else if (strcmp(optarg, "pipelined") == 0) writer_mode = WRITER_PIPELINED;
+            else {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
     }
 
-    //as cursor is at the end of the file now,
-    //the current file position (ftell) equals the file size in bytes.
-    //ftell() returns "long" type
-    long file_size = ftell(file_fp);
-    if (file_size == -1) {
-        printf("Error getting file size\n");
-        fclose(file_fp);
+    // exactly one of --output / --in-place
+    if (input == NULL || (output == NULL) == !in_place || job_count + dir_count == 0) {
+        usage(argv[0]);
         exit(1);
     }
-    
-    //SEEK_SET moves the cursor back to the start of the file 
-    //to read the contents from the beginning
-    if (fseek(file_fp, 0, SEEK_SET) != 0) {
-        printf("Error in seeking: moving the cursor to the start of the file we want to add\n");
-        fclose(file_fp);
-        exit(1);
-    }
-    
-    // Opening input image
-    //r+: read and write on EXISTING file
-    //b: in binary 
-    FILE *input_fp = fopen(input, "r+b");
-    if (input_fp == NULL) {
-        printf("Error in opening: read and write on existing input .img file in binary mode\n");
-        fclose(file_fp);
-        exit(1);
-    }
-    
-    // Copying input image to output
-    //w+: read and write after CREATING file
-    //b: in binary
-    FILE *output_fp = fopen(output, "w+b");
-    if (output_fp == NULL) {
-        printf("Error in opening: read and write on creating new .img file in binary mode\n");
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    //Copying the entire input .img file to output .img file
-    //in builder, pwrite: write at a given offset (as we are creating .img file), writes specific elements at specific locations
-    //in addder, fwrite: sequential writing (as we are copying data), writes where the fp currently
-    uint8_t buffer[BS]; //an array of one block size. each idx is 1 byte
-    size_t bytes_read; //fread returns size_t type
-    
-    //fread(buffer, 1, bytes_read, input_fp):
-        //buffer: pointer to mem where the read bytes will be stored
-        //1: size of each element to read (in bytes). reading 1 byte at a time
-        //BS: number of total bytes to read
-        //input_fp: file pointer to read from
 
-    //fread(buffer, 1, BS, input_fp): reading 1 block, storing it to buffer
-    //fwrite(buffer, 1, bytes_read, output_fp): writing that one block(buffer) into new .img file 
-    //loop stops when no more blocks remain- fread return 0
-    while ((bytes_read = fread(buffer, 1, BS, input_fp)) > 0) {
-        if (fwrite(buffer, 1, bytes_read, output_fp) != bytes_read) {
-            printf("Error in writing to output .img file\n");
-            fclose(file_fp);
-            fclose(input_fp);
-            fclose(output_fp);
+    // Checking every file we want to add and getting its size with stat(),
+    // so a bad path stops the run before the image is touched; each file is
+    // opened only for its own add, so a batch holds one descriptor at a time
+    // Pipes, FIFOs and stdin have no size: they are read to EOF while blocks are
+    // allocated (VOLUME_STREAM), never staged in memory or in a temporary file
+    int stdin_used = 0;
+    for (size_t j = 0; j < job_count; j++) {
+        if (strcmp(jobs[j].path, "-") == 0) {
+            if (stdin_used++) {
+                printf("Error: stdin (--file -) can be added only once\n");
+                exit(1);
+            }
+            jobs[j].fp = stdin;
+            jobs[j].name = normalize_path(stdin_name);
+            jobs[j].size = -1;
+            if (jobs[j].name == NULL) {
+                printf("Error: '%s' is not a valid path in the image\n", stdin_name);
+                exit(1);
+            }
+            continue;
+        }
+        jobs[j].name = normalize_path(jobs[j].path);
+        if (jobs[j].name == NULL) {
+            printf("Error: '%s' is not a valid path in the image (components of at most %zu bytes, no '..')\n",
+                   jobs[j].path, DCACHE_NAME_MAX);
+            exit(1);
+        }
+        //stat() and access() never open the file (nor wait for a FIFO's writer)
+        struct stat st;
+        if (stat(jobs[j].path, &st) != 0 || access(jobs[j].path, R_OK) != 0) {
+            printf("Error opening file we want to add: %s\n", jobs[j].path);
             exit(1);
         }
+        if (S_ISDIR(st.st_mode)) {
+            printf("Error: '%s' is a directory (use --mkdir)\n", jobs[j].path);
+            exit(1);
+        }
+        jobs[j].fp = NULL;
+        jobs[j].size = S_ISREG(st.st_mode) ? (long)st.st_size : -1;
     }
     
-    // Now we'll work with the output image
-    fclose(input_fp);
-    input_fp = output_fp;/// ekhanee eshe copoied 
-    
-    
-    //Reading and verifying superblock
-    superblock_t sb;
-    if (read_superblock(input_fp, &sb) != 0) {
-        printf("Error reading superblock\n");
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
+    const char *target = in_place ? input : output;
+    if (!in_place) {
+        //Copying the input .img file to output .img file, ONCE for the whole batch
+        //(reflink or in-kernel copy when the filesystem allows it)
+        if (copy_image(input, output) != 0) {
+            printf("Error in copying input .img file to output .img file\n");
+            exit(1);
+        }
     }
+    
+    // Opening the image we work on (the output copy, or the input itself with --in-place):
+    // mapped once, every structure is used in place; an image with a journal first
+    // replays what an interrupted run committed
+    volume_t vol;
+    int replayed = volume_open(&vol, target, cache_blocks);
+    if (replayed < 0) exit(1);
+    if (replayed > 0) printf("Replayed %d journal transaction(s)\n", replayed);
+    vol.writer.mode = writer_mode;
+    vol.holes = holes;
+    vol.compress = compress;
+    vol.dedup = dedup;
+    vol.inline_data = inline_data;
 
     //===EXISTING FILE CHECKER ===========================================================
-//bla bla
-
-//c c 
-
-
-    // Reading root inode (inode #1)
-    inode_t checking_root_inode;
-    if (read_inode(output_fp, &sb, ROOT_INO, &checking_root_inode) != 0) {
-        printf("Error: could not read root inode\n");
-        fclose(output_fp);
-        return 1;
+    // names already in the root directory: one lookup each in its hashed index
+    // (a plain scan of the dirent blocks on images that do not have one yet);
+    // names repeated inside this batch: the in-memory name set
+    name_set_t names;
+    if (name_set_init(&names, job_count) != 0) {
+        printf("Error in allocating memory for the name set\n");
+        volume_close(&vol);
+        exit(1);
     }
 
-    // buffer to hold one block
-    // each index 1 byte
-    // total 4096 bytes of raw binary data
-    uint8_t block_buf[BS];
-
-    // Check each direct block of root directory
-    for (int i = 0; i < DIRECT_MAX; i++) {
-        if (checking_root_inode.direct[i] == 0) continue; // empty slot
-
-        // Seek to that block and read
-        // checking the occupied blocks
-        fseek(output_fp, (sb.data_region_start + checking_root_inode.direct[i]) * BS, SEEK_SET);
-
-        //block_buf: storing the data thats being read
-        //       1 : reading 1 byte at a time
-        //      BS : no. of elements being read = 4096 
-        //output_fp: reading from this img file
-        fread(block_buf, 1, BS, output_fp);
-
-        // reading root directory entries
-        // casting raw data(4096 bytes of raw binary data) 
-        // as an array of dirent64_t structures (directory entries)
-        // where each index is an object of direct64_t struct
-        dirent64_t *entries = (dirent64_t *)block_buf;
-        int entries_per_block = BS / sizeof(dirent64_t);
-
-        for (int j = 0; j < entries_per_block; j++) {
-            if (entries[j].inode_no == 0) continue; // unused entry
-            
-            // checking the used entries
-            //if given file name already exists in the inputted img file system
-            if (strcmp(entries[j].name, file) == 0) {
-                printf("Error: '%s' already exists in filesystem\n", file);
-                fclose(output_fp);
-                exit(1); // ends the code here
-            }
+    for (size_t j = 0; j < job_count; j++) {
+        //if given path already exists in the inputted img file system (or earlier in this batch);
+        //the lookups share the dentry cache, so a common prefix is read once
+        if (volume_lookup(&vol, jobs[j].name, NULL) >= 0 || !name_set_add(&names, jobs[j].name)) {
+            printf("Error: '%s' already exists in filesystem\n", jobs[j].name);
+            volume_close(&vol);
+            exit(1); // ends the code here
         }
     }
+    free(names.slots);
     //=====================================================================================
-    
-    //Reading inode bitmap
-    uint8_t *inode_bitmap = malloc(1*BS);
-    if (inode_bitmap == NULL) {
-        printf("Error in allocating memory for inode bitmap\n");
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    if (read_bitmap(input_fp, sb.inode_bitmap_start, inode_bitmap) != 0) {
-        printf("Error reading inode bitmap\n");
-        free(inode_bitmap); //bc malloc was used
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    //Finding free inode from inode bitmap 
-    int free_inode = find_free_bit(inode_bitmap);
-    if (free_inode == -1) {
-        printf("Error: No free inodes available\n");
-        free(inode_bitmap);
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    inode_bitmap[free_inode] = 1; //allocate it in malloc (not in img file)
-    
-    
-    //writing the update inode bmap into the .img file
-    if (write_bitmap(input_fp, sb.inode_bitmap_start, inode_bitmap) != 0) {
-        printf("Error in writing inode bitmap in img file\n");
-        free(inode_bitmap); //from malloc
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    free(inode_bitmap); //freeing inode bmap from mem allocation as it's work is done in .img file
-    
-    //Reading data bitmap
-    uint8_t *data_bitmap = malloc(1*BS);
-    if (data_bitmap == NULL) {
-        printf("Error in allocating one block for data bitmap in memory");
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    if (read_bitmap(input_fp, sb.data_bitmap_start, data_bitmap) != 0) {
-        printf("Error in reading data bitmap from img file\n");
-        free(data_bitmap);
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    } 
-
-
-    //calculating how many blocks the file needs
 
-    //ceiling. e.g. if blocks needed=1.2, I would still need 2 blocks to store the file
-    int blocks_needed = (file_size + BS - 1) / BS;  
-    if (blocks_needed > DIRECT_MAX) {
-        printf("Error: File is too large to be accommodated with %d direct blocks\n", DIRECT_MAX);
-        free(data_bitmap);
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    // Allocating data blocks
-    uint32_t free_data_blocks_list[DIRECT_MAX] = {0};
-    
-    for (int i = 0; i < blocks_needed; i++) {
-        int free_data_block = find_free_bit(data_bitmap);
-        if (free_data_block == -1) {
-            printf("Error: No free data blocks available\n");
-            free(data_bitmap);
-            fclose(file_fp);
-            fclose(input_fp);
-            exit(1);
+    // Adding the files one after another, all in one transaction (group commit).
+    // On the first failure we stop, but still commit so the files already added stay
+    double start = now_sec();
+    size_t added = 0;
+    int made = 1;
+    for (size_t d = 0; d < dir_count && made; d++) {
+        made = volume_mkdir(&vol, dirs[d].path) >= 0;
+        if (made) printf("Directory '%s' ready\n", dirs[d].path);
+    }
+    for (size_t j = 0; made && j < job_count; j++) {
+        //rb: "read binary"
+        //fopen returns a pointer to the FILE obj (opening a FIFO waits for its writer)
+        if (jobs[j].fp == NULL && (jobs[j].fp = fopen(jobs[j].path, "rb")) == NULL) {
+            printf("Error opening file we want to add: %s\n", jobs[j].path);
+            break;
         }
-        
-        //updating data bmap to allocate it for the file's data blocks
-        data_bitmap[free_data_block] = 1; //allocate it in malloc (not in img file)
-    
-        free_data_blocks_list[i] = free_data_block;
-    }
-    
-    //Writing updated data bitmap in img file
-    if (write_bitmap(input_fp, sb.data_bitmap_start, data_bitmap) != 0) {
-        printf("Error writing data bitmap\n");
-        free(data_bitmap);
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    free(data_bitmap);
-    
-    //Create the new inode
-    inode_t new_inode;
-    memset(&new_inode, 0, sizeof(new_inode));
-    new_inode.mode = 0x8000; //Regular file
-    new_inode.links = 1;     //Only one link (from root directory) bc file placed in root dir
-    new_inode.size_bytes = file_size; //the size of the file (in bytes) that this inode is pointing to
-    new_inode.atime = time(NULL);
-    new_inode.mtime = time(NULL);
-    new_inode.ctime = time(NULL);
-    new_inode.proj_id = 8; //group ID
-    
-    //Setting direct pointers to the free data blocks (where the file is to be placed later)
-    for (int i = 0; i < blocks_needed; i++) {
-        new_inode.direct[i] = free_data_blocks_list[i]; 
-    }
-    
-    inode_crc_finalize(&new_inode);
-    
-    //Writing new inode
-    //free_inode coming from find_free_bit(), we used earlier
-    //free_inode no. = free_inode+1 (bc 1-indexing)
-    if (write_inode(input_fp, &sb, free_inode + 1, &new_inode) != 0) {
-        printf("Error in writing new inode to img file\n");
-        fclose(file_fp);
-        fclose(input_fp);
+        uint64_t size = jobs[j].size < 0 ? VOLUME_STREAM : (uint64_t)jobs[j].size;
+        int64_t inode_no = volume_add(&vol, jobs[j].name, jobs[j].fp, size, use_extents);
+        if (jobs[j].fp != stdin) fclose(jobs[j].fp);
+        jobs[j].fp = NULL;
+        if (inode_no < 0) break;
+        printf("File '%s' added successfully to inode %" PRId64 "\n", jobs[j].name, inode_no);
+        added++;
+    }
+    
+    // root inode crc (new entries, increament of root_inode.links) and superblock
+    // modification time, once; then one journal commit or one msync for the batch
+    int rc = volume_commit(&vol);
+    uint64_t groups = (vol.img.sb->flags & SB_FL_GROUPS) ? SB_EXT(vol.img.sb)->group_count : 0;
+    dcache_t dc = vol.dc;   // counters only: volume_close() frees the table
+    if (volume_close(&vol) != 0 || rc != 0) {
+        printf("Error in writing output .img file\n");
         exit(1);
     }
-    
-    //Writing file data to data blocks ======================================================================================
-    for (int i = 0; i < blocks_needed; i++) {
-        //starting address of data region = sb.data_region_start * BS
-        //offset of free data block = free_data_blocks_list[i] * BS
-        uint64_t block_address = sb.data_region_start * BS + free_data_blocks_list[i] * BS;
-        
-        if (fseek(input_fp, block_address, SEEK_SET) != 0) {
-            printf("Error in seeking to data block\n");
-            fclose(file_fp);
-            fclose(input_fp);
-            exit(1);
+    double elapsed = now_sec() - start;
+    for (size_t j = 0; j < job_count; j++) {
+        free(jobs[j].path);
+        free(jobs[j].name);
+    }
+    free(jobs);
+    for (size_t d = 0; d < dir_count; d++) free(dirs[d].path);
+    free(dirs);
+
+    if (vol.inline_files > 0) {
+        printf("Inline: %" PRIu64 " file(s) of at most %d bytes stored in their inode, no data block\n",
+               vol.inline_files, INLINE_MAX);
+    }
+    if (vol.dirs_made > 0 || dc.hits > 0) {
+        printf("Directories: %" PRIu64 " created, dentry cache %" PRIu64 " hit(s), %" PRIu64 " miss(es)\n",
+               vol.dirs_made, dc.hits, dc.misses);
+    }
+    if (groups > 0) {
+        printf("Block groups: %" PRIu64 ", each file's data kept in its inode's group (%" PRIu64 " file(s) did not fit)\n",
+               groups, vol.group_spills);
+    }
+    if (vol.hole_blocks > 0) {
+        printf("Holes: %" PRIu64 " all-zero block(s) (%.1f MiB) stored without a data block (zero test: %s)\n",
+               vol.hole_blocks, vol.hole_blocks * (double)BS / 1048576.0, sparse_kernel());
+    }
+    const compress_stats_t *zs = &vol.zstats;
+    if (zs->files > 0) {
+        uint64_t stored = zs->blocks_out * BS;
+        printf("Compression: %" PRIu64 " file(s), %.1f MiB in %.1f MiB (ratio %.2f), %" PRIu64 " of %" PRIu64 " cluster(s) raw, %" PRIu64 " zero, %.0f MB/s\n",
+               zs->files, zs->bytes_in / 1048576.0, stored / 1048576.0, stored ? (double)zs->bytes_in / stored : 0.0,
+               zs->raw_clusters, zs->clusters, zs->zero_clusters, zs->seconds > 0 ? zs->bytes_packed / 1e6 / zs->seconds : 0.0);
+    }
+    const dedup_t *dd = &vol.dd;
+    if (dd->blocks > 0) {
+        // ratio: file blocks per block written (none written: every block was shared)
+        char ratio[32] = "all shared";
+        if (dd->blocks > dd->shared) snprintf(ratio, sizeof(ratio), "ratio %.2f", (double)dd->blocks / (dd->blocks - dd->shared));
+        printf("Dedup: %" PRIu64 " of %" PRIu64 " data block(s) shared (%s), %" PRIu64 " hash collision(s), hashing %.0f MB/s (%s)\n",
+               dd->shared, dd->blocks, ratio, dd->collisions,
+               dd->seconds > 0 ? dd->blocks * (double)BS / 1e6 / dd->seconds : 0.0, sha256_kernel());
+        printf("Dedup index: %" PRIu64 " block(s), %.2f MiB in memory (%.1f bytes per block)\n",
+               dd->count, dedup_memory(dd) / 1048576.0, dd->count ? (double)dedup_memory(dd) / dd->count : 0.0);
+    }
+    if (job_count > 1) {
+        printf("Added %zu of %zu files in %.3f s (%.1f files/s)\n",
+               added, job_count, elapsed, elapsed > 0 ? added / elapsed : 0.0);
+        const writer_stats_t *ws = &vol.writer.stats;
+        if (ws->files > 0) {
+            printf("Writer: %" PRIu64 " file(s), %.1f MiB in %" PRIu64 " chunk(s), %" PRIu64 " write(s)\n",
+                   ws->files, ws->bytes / 1048576.0, ws->chunks, ws->writes);
         }
-        
-        // how many bytes to read from file.txt while writing each data block
-        // if file size exceeded, then we'll face error while trying to read the file.txt
-        size_t bytes_to_read;
-        if (i == blocks_needed - 1) {
-            // This is the last block, retriving the remaining bytes to read from file.txt
-            bytes_to_read = file_size % BS;
-
-            if (bytes_to_read == 0) {
-                // File size is exactly divisible by block size
-                bytes_to_read = BS;
-            }
-        } 
-        else {
-            // Not the last block, always read full block
-            bytes_to_read = BS;
+        // the writer's queue and the journal's
+        ioq_stats_t io = vol.writer.io.stats;
+        if (vol.journal) {
+            const ioq_stats_t *js = &vol.jnl.io.stats;
+            io.requests += js->requests;
+            io.enters += js->enters;
+            if (js->max_inflight > io.max_inflight) io.max_inflight = js->max_inflight;
         }
-
-        //file_data
-        uint8_t *file_data = malloc(bytes_to_read);
-        if (file_data == NULL) {
-            printf("Error in allocating memory for file (file to add) data\n");
-            fclose(file_fp);
-            fclose(input_fp);
-            exit(1);
+        if (io.uring) {
+            printf("I/O: io_uring, %" PRIu64 " request(s) in %" PRIu64 " io_uring_enter call(s), up to %" PRIu64 " in flight\n",
+                   io.requests, io.enters, io.max_inflight);
+        } else {
+            printf("I/O: pwritev, %" PRIu64 " request(s)\n", io.requests);
         }
-        
-
-
-        if (fread(file_data, 1, bytes_to_read, file_fp) != bytes_to_read) {
-            printf("Error in reading file data\n");
-            free(file_data);
-            fclose(file_fp);
-            fclose(input_fp);
-            exit(1);
-        }
-        
-        //writing the data block (the bytes we just read above) in img file
-        if (fwrite(file_data, 1, bytes_to_read, input_fp) != bytes_to_read) {
-            printf("Error in writing file data\n");
-            free(file_data);
-            fclose(file_fp);
-            fclose(input_fp);
-            exit(1);
+        if (vol.journal) {
+            const journal_t *jnl = &vol.jnl;
+            printf("Journal: %" PRIu64 " commit(s), %" PRIu64 " metadata blocks logged, %" PRIu64 " data blocks written in place, %" PRIu64 " flush(es)\n",
+                   jnl->commits, jnl->logged, jnl->in_place, jnl->syncs);
+            const bcache_stats_t *cs = &jnl->cache.stats;
+            printf("Block cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " of %" PRIu64 " writes saved, %" PRIu64 " blocks in %" PRIu64 " write(s)\n",
+                   cs->hits, cs->misses, cs->writes_saved, cs->writes, cs->blocks_written, cs->write_calls);
         }
-        
-        free(file_data);
-    } //=============================================================================================================
-    
-    // Read root inode
-    inode_t root_inode;
-    if (read_inode(input_fp, &sb, ROOT_INO, &root_inode) != 0) {
-        printf("Error in reading root inode\n");
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    // Adding directory entry for the new file
-    if (add_directory_entry(input_fp, &sb, &root_inode, free_inode + 1, 1, file) != 0) {
-        printf("Error in adding directory entry of the new file to add\n");
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    //As new file adds a link to the root directory
-    //Updating root inode link count 
-    root_inode.links++;
-    
-    // Write updated (increament of root_inode.links) root inode
-    inode_crc_finalize(&root_inode);
-    if (write_inode(input_fp, &sb, ROOT_INO, &root_inode) != 0) {
-        printf("Error in writing root inode in the img file\n");
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    // Updating superblock modification time
-    sb.mtime_epoch = time(NULL);
-    superblock_crc_finalize(&sb);
-    
-    // Writing updated superblock
-    if (fseek(input_fp, 0, SEEK_SET) != 0) {
-        printf("Error in seeking to superblock to update the modification time\n");
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
-    }
-    
-    if (fwrite(&sb, BS, 1, input_fp) != 1) {
-        printf("Error in writing the update of modification time in superblock\n");
-        fclose(file_fp);
-        fclose(input_fp);
-        exit(1);
     }
     
-    // Cleaning up by closing the opened files
-    fclose(file_fp);
-    fclose(input_fp);
-    
-    printf("File '%s' added successfully to inode %d\n", file, free_inode + 1);
-    
-    return 0;
+    return made && added == job_count ? 0 : 1;
 }
-
-
@@ -1,4 +1,4 @@
-// Build: gcc -O2 -std=c17 -Wall -Wextra mkfs_minivsfs.c -o mkfs_builder
+// Build: gcc -O2 -std=c17 -Wall -Wextra mkfs_builder.c crc32.c bitmap.c image.c journal.c bcache.c ioq.c -o mkfs_builder
 #define _FILE_OFFSET_BITS 64
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,100 +12,36 @@
 #include <fcntl.h>
 #include <getopt.h>
 
-#define BS 4096u               // block size
-#define INODE_SIZE 128u
-#define ROOT_INO 1u
-
-uint64_t g_random_seed = 0; // This should be replaced by seed value from the CLI.
-
-// below contains some basic structures you need for your project
-// you are free to create more structures as you require
-
-#pragma pack(push, 1)
-typedef struct {
-    uint32_t magic;
-    uint32_t version;
-    uint32_t block_size;
-    uint64_t total_blocks;
-    uint64_t inode_count;
-    uint64_t inode_bitmap_start;
-    uint64_t inode_bitmap_blocks;
-    uint64_t data_bitmap_start;
-    uint64_t data_bitmap_blocks;
-    uint64_t inode_table_start;
-    uint64_t inode_table_blocks;
-    uint64_t data_region_start;
-    uint64_t data_region_blocks;
-    uint64_t root_inode;
-    uint64_t mtime_epoch;
-    uint32_t flags;
-    
-    // THIS FIELD SHOULD STAY AT THE END
-    // ALL OTHER FIELDS SHOULD BE ABOVE THIS
-    uint32_t checksum;            // crc32(superblock[0..4091])
-} superblock_t;
-#pragma pack(pop)
-_Static_assert(sizeof(superblock_t) == 116, "superblock must fit in one block");
-
-#pragma pack(push,1)
-typedef struct {
-    uint16_t mode;
-    uint16_t links;
-    uint32_t uid;
-    uint32_t gid;
-    uint64_t size_bytes;
-    uint64_t atime;
-    uint64_t mtime;
-    uint64_t ctime;
-    uint32_t direct_blocks[12];
-    uint32_t reserved_0;
-    uint32_t reserved_1;
-    uint32_t reserved_2;
-    uint32_t proj_id;
-    uint32_t uid16_gid16;
-    uint64_t xattr_ptr;
-    
-    // THIS FIELD SHOULD STAY AT THE END
-    // ALL OTHER FIELDS SHOULD BE ABOVE THIS
-    uint64_t inode_crc;   // low 4 bytes store crc32 of bytes [0..119]; high 4 bytes 0
-} inode_t;
-#pragma pack(pop)
-_Static_assert(sizeof(inode_t)==INODE_SIZE, "inode size mismatch");
-
-#pragma pack(push,1)
-typedef struct {
-    uint32_t inode_no;
-    uint8_t type;
-    char name[58];
-    
-    uint8_t  checksum; // XOR of bytes 0..62
-} dirent64_t;
-#pragma pack(pop)
-_Static_assert(sizeof(dirent64_t)==64, "dirent size mismatch");
+#include "bitmap.h"
+#include "crc32.h"
+#include "image.h"
+#include "journal.h"
+#include "minivsfs.h"
+
+uint64_t g_random_seed = 0; // --seed: 0 = none
+
+// Timestamp of the new file system: the clock, or with --seed the seed itself,
+// so the same arguments and seed give a byte-identical image (bench_suite
+// compares runs of a seeded workload)
+static uint64_t format_time(void) {
+    return g_random_seed ? g_random_seed : (uint64_t)time(NULL);
+}
+
+// on-disk structures (superblock_t, inode_t, dirent64_t) live in minivsfs.h
 
 
 // ==========================DO NOT CHANGE THIS PORTION=========================
 // These functions are there for your help. You should refer to the specifications to see how you can use them.
 // ====================================CRC32====================================
-uint32_t CRC32_TAB[256];
-void crc32_init(void){
-    for (uint32_t i=0;i<256;i++){
-        uint32_t c=i;
-        for(int j=0;j<8;j++) c = (c&1)?(0xEDB88320u^(c>>1)):(c>>1);
-        CRC32_TAB[i]=c;
-    }
-}
-uint32_t crc32(const void* data, size_t n){
-    const uint8_t* p=(const uint8_t*)data; uint32_t c=0xFFFFFFFFu;
-    for(size_t i=0;i<n;i++) c = CRC32_TAB[(c^p[i])&0xFF] ^ (c>>8);
-    return c ^ 0xFFFFFFFFu;
-}
+// crc32_init() and crc32() live in crc32.c, shared by all MiniVSFS tools
 // ====================================CRC32====================================
 
 // WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
+// sb is block 0 of the image: the crc covers the whole block (the struct, the
+// superblock_ext_t fields after it and the zero padding), as Validator checks it
 static uint32_t superblock_crc_finalize(superblock_t *sb) {
     sb->checksum = 0;
-    uint32_t s = crc32((void *) sb, BS - 4);
+    uint32_t s = crc32((const uint8_t *)sb, BS - 4);
     sb->checksum = s;
     return s;
 }
@@ -132,11 +68,12 @@ void dirent_checksum_finalize(dirent64_t* de) {
 //when new data received if it doesnt match with previous checksum value, then there's error
 
 
-void create_file_system(const char* image_name, uint64_t size_kib, uint64_t inodes);
-void write_superblock(int fd, superblock_t* sb);
-void write_bitmaps(int fd, superblock_t* sb);
-void write_inode_table(int fd, superblock_t* sb);
-void create_root_directory(int fd, superblock_t* sb);
+void create_file_system(const char* image_name, uint64_t size_kib, uint64_t inodes, int64_t journal_blocks, int groups);
+void write_superblock(image_t* img, superblock_t* sb, const superblock_ext_t* ext);
+void write_group_table(image_t* img, superblock_t* sb, superblock_ext_t* ext);
+void write_bitmaps(image_t* img, superblock_t* sb);
+void write_inode_table(image_t* img, superblock_t* sb);
+void create_root_directory(image_t* img, superblock_t* sb);
 
 int main(int argc, char *argv[]) {
     crc32_init();
@@ -145,18 +82,42 @@ int main(int argc, char *argv[]) {
     char *image_name = NULL;
     uint64_t size_kib = 0;
     uint64_t inode_count = 0;
+    int64_t journal_blocks = -1; // -1: default size (see create_file_system), 0: no journal
+    int groups = 0;              // --groups: block group layout (minivsfs.h)
     
 
     // CLI parser 
     // ./mkfs_builder --image myfs.img --size-kib 180 --inodes 128
-    image_name = argv[2];
-    size_kib = strtoull(argv[4], NULL, 10);
-    inode_count = strtoull(argv[6], NULL, 10);
+    static const struct option long_options[] = {
+        {"image", required_argument, NULL, 'i'},
+        {"size-kib", required_argument, NULL, 's'},
+        {"inodes", required_argument, NULL, 'n'},
+        {"journal-blocks", required_argument, NULL, 'j'},
+        {"groups", no_argument, NULL, 'g'},
+        {"seed", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:s:n:j:gr:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'i': image_name = optarg; break;
+        case 's': size_kib = strtoull(optarg, NULL, 10); break;
+        case 'n': inode_count = strtoull(optarg, NULL, 10); break;
+        case 'j': journal_blocks = strtoll(optarg, NULL, 10); break;
+        case 'g': groups = 1; break;
+        case 'r': g_random_seed = strtoull(optarg, NULL, 10); break;
+        default:
+            printf("Usage: %s --image <img> --size-kib <kib> --inodes <count> [--journal-blocks <n>] [--groups] [--seed <n>]\n", argv[0]);
+            return 1;
+        }
+    }
 
 
     
     // Validating arguments
-    if (!image_name || size_kib < 180 || size_kib > 4096 || inode_count < 128 || inode_count > 512) {
+    // block numbers are 32 bit on disk (inode pointers), so the image can have at most UINT32_MAX blocks,
+    // and inode numbers are 32 bit in directory entries
+    if (!image_name || size_kib < 180 || size_kib / 4 > UINT32_MAX || inode_count < 128 || inode_count > UINT32_MAX) {
         printf("Invalid CLI arguments.\n");
         return 1;
     }
@@ -166,15 +127,21 @@ int main(int argc, char *argv[]) {
         printf("Invalid size-kib: must be a multiple of 4\n");
         return 1;
     }
+
+    // a journal needs room for a header and one transaction of one block
+    if (journal_blocks != -1 && journal_blocks != 0 && (journal_blocks < JOURNAL_MIN_BLOCKS || journal_blocks > UINT32_MAX)) {
+        printf("Invalid journal-blocks: 0 (no journal) or %d to %u\n", JOURNAL_MIN_BLOCKS, UINT32_MAX);
+        return 1;
+    }
     
     // Creating the file system
-    create_file_system(image_name, size_kib, inode_count);
+    create_file_system(image_name, size_kib, inode_count, journal_blocks, groups);
     
     return 0;
 }
 
 
-void create_file_system(const char* image_name, uint64_t size_kib, uint64_t inode_count) {
+void create_file_system(const char* image_name, uint64_t size_kib, uint64_t inode_count, int64_t journal_blocks, int groups) {
     
     // superblock initialization
     superblock_t sb;
@@ -184,162 +151,220 @@ void create_file_system(const char* image_name, uint64_t size_kib, uint64_t inod
     sb.total_blocks = (size_kib * 1024) / BS;
     sb.inode_count = inode_count;  //from CLI
 
+    // Layout for any size: every region gets as many blocks as it needs
+    // one bitmap block tracks BS*8 = 32768 objects
+    const uint64_t bits_per_block = (uint64_t)BS * 8;
+
     sb.inode_bitmap_start = 1;  // block after superblock
-    sb.inode_bitmap_blocks = 1;  // 1 inode bitmap block
+    sb.inode_bitmap_blocks = (inode_count + bits_per_block - 1) / bits_per_block; //celling value needed
+    sb.inode_table_blocks = ((inode_count * INODE_SIZE) + BS - 1) / BS ; //celling value needed
 
-    sb.data_bitmap_start = 2; //block after inode bmap
-    sb.data_bitmap_blocks = 1;  //1 block for data bmap
+    // Metadata journal (journal.c), between the inode table and the data region.
+    // Default: 1/64 of the image, at most 8192 blocks (32 MiB); images of up to
+    // 4 MiB (1024 blocks) get none, so the small images of the spec keep their layout
+    if (journal_blocks < 0) {
+        journal_blocks = sb.total_blocks <= 1024 ? 0 : sb.total_blocks / 64;
+        if (journal_blocks > 8192) journal_blocks = 8192;
+    }
 
-    sb.inode_table_start = 3;
-    sb.inode_table_blocks = ((inode_count * INODE_SIZE) + BS - 1) / BS ; //celling value needed
+    // Block groups: no inode table here, a slice of it at the start of every group
+    // of GROUP_BLOCKS data blocks. The inodes are spread evenly, in whole inode
+    // blocks, so the count is rounded up; that can take one more inode bitmap
+    // block, which moves the groups: the layout is settled in a few rounds
+    uint64_t group_count = 0, ipg = 0, inode_groups = 0;
+    for (int round = 0; groups && round < 4; round++) {
+        sb.inode_table_blocks = 0;
+        uint64_t fixed = 1 + sb.inode_bitmap_blocks + journal_blocks;
+        if (fixed >= sb.total_blocks) break;
+        uint64_t data_blocks = sb.total_blocks - fixed - (sb.total_blocks - fixed + bits_per_block - 1) / bits_per_block;
+        group_count = (data_blocks + GROUP_BLOCKS - 1) / GROUP_BLOCKS;
+        uint64_t desc_blocks = (group_count * sizeof(group_desc_t) + BS - 1) / BS;
+        // a last group too short for a slice and a block of data holds data only
+        inode_groups = group_count;
+        for (int k = 0; k < 2 && inode_groups > 1; k++) {
+            ipg = (inode_count + inode_groups - 1) / inode_groups;
+            ipg = (ipg + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK * INODES_PER_BLOCK;
+            if (data_blocks - (group_count - 1) * GROUP_BLOCKS > ipg / INODES_PER_BLOCK) break;
+            inode_groups = group_count - 1;
+        }
+        ipg = (inode_count + inode_groups - 1) / inode_groups;
+        ipg = (ipg + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK * INODES_PER_BLOCK;
+        uint64_t group0 = data_blocks < GROUP_BLOCKS ? data_blocks : GROUP_BLOCKS;
+        if (desc_blocks + ipg / INODES_PER_BLOCK + 1 > group0 || ipg * inode_groups > UINT32_MAX) {
+            printf("Invalid CLI arguments: %" PRIu64 " inodes do not fit in %" PRIu64 " KiB with block groups\n",
+                   inode_count, size_kib);
+            exit(1);
+        }
+        uint64_t ibm_blocks = (ipg * inode_groups + bits_per_block - 1) / bits_per_block;
+        if (ibm_blocks == sb.inode_bitmap_blocks) {
+            inode_count = sb.inode_count = ipg * inode_groups;
+            break;
+        }
+        sb.inode_bitmap_blocks = ibm_blocks;
+    }
+
+    // the data bitmap covers whatever is left after the other regions; sized for all of it
+    // (it can be one block bigger than strictly needed, since it takes space from the data region itself)
+    uint64_t fixed_blocks = 1 + sb.inode_bitmap_blocks + sb.inode_table_blocks + journal_blocks;
+    if (fixed_blocks >= sb.total_blocks || (groups && sb.inode_count != ipg * inode_groups)) {
+        printf("Invalid CLI arguments: %" PRIu64 " inodes do not fit in %" PRIu64 " KiB\n", inode_count, size_kib);
+        exit(1);
+    }
+    sb.data_bitmap_start = sb.inode_bitmap_start + sb.inode_bitmap_blocks; //block after inode bmap
+    sb.data_bitmap_blocks = (sb.total_blocks - fixed_blocks + bits_per_block - 1) / bits_per_block;
+
+    sb.inode_table_start = sb.data_bitmap_start + sb.data_bitmap_blocks;
     
+    superblock_ext_t ext = {0};
+    ext.journal_start = sb.inode_table_start + sb.inode_table_blocks;
+    ext.journal_blocks = journal_blocks;
+
     // Calculating data region
-    sb.data_region_start = 3 + sb.inode_table_blocks;
+    sb.data_region_start = ext.journal_start + ext.journal_blocks;
+    if (sb.data_region_start >= sb.total_blocks) {
+        printf("Invalid CLI arguments: no room left for the data region\n");
+        exit(1);
+    }
     sb.data_region_blocks = sb.total_blocks - sb.data_region_start;
+    if (groups) {
+        // the descriptor table opens group 0
+        ext.groups_start = sb.data_region_start;
+        ext.groups_blocks = (uint32_t)((group_count * sizeof(group_desc_t) + BS - 1) / BS);
+        ext.group_count = group_count;
+        ext.inodes_per_group = ipg;
+    }
     
     sb.root_inode = ROOT_INO; //root_inode index = ROOT_INO -1 (1 indexed)
-    sb.mtime_epoch = time(NULL);
-    sb.flags = 0;
+    sb.mtime_epoch = format_time();
+    sb.flags = (journal_blocks ? SB_FL_JOURNAL : 0) | (groups ? SB_FL_GROUPS : 0);
     
     // Creating the image file
-    //O_WRONLY : open for writing only.
-    // O_CREAT : create the file if it doesn't exist
-    // O_TRUNC : truncate the file (make it empty) if it already exists
-    int fd = open(image_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
+    // image_create: O_CREAT|O_TRUNC, then ftruncate to the full size (a hole, every block reads as zero)
+    // and mmap it, so below we only store the few metadata bytes that are not zero
+    image_t img;
+    if (image_create(&img, image_name, sb.total_blocks * BS) != 0) {
         printf("Error in creating img file\n");
         exit(1);
     }
     
+    // Empty journal: just its header block, the log itself reads as zero
+    if (journal_blocks && journal_format(&img, ext.journal_start, ext.journal_blocks) != 0) {
+        printf("Error in writing the journal\n");
+        exit(1);
+    }
+
+    // Group descriptors first: their crc is in the superblock
+    if (groups) write_group_table(&img, &sb, &ext);
+
     // Compute superblock checksum (Write superblock)
-    write_superblock(fd, &sb);
+    write_superblock(&img, &sb, &ext);
     
     // Write bitmaps
-    write_bitmaps(fd, &sb);
+    write_bitmaps(&img, &sb);
     
     //INODE INITIALIZATION (Write inode table)
-    write_inode_table(fd, &sb);
+    write_inode_table(&img, &sb);
     
     // THEN CREATE YOUR FILE SYSTEM WITH A ROOT DIRECTORY
     // ROOT DIRECTORY INITIALIZATION in data block 0
-    create_root_directory(fd, &sb);
+    create_root_directory(&img, &sb);
     
-    // Filling remaining space with zeros
-    // If the file is smaller than file_size, it is extended (zero-filled)
-    off_t file_size = sb.total_blocks * BS;
-    if (ftruncate(fd, file_size) < 0) {
-        printf("Error in setting file size\n");
-        close(fd);
+    // msync: push the dirty pages to the file before we report success
+    if (image_flush(&img) != 0 || image_close(&img) != 0) {
+        printf("Error in writing img file\n");
         exit(1);
     }
-    
-    close(fd);
 
     // unsigned integer's formate identifier: %" PRIu64
     printf("File system created successfully: %s\n", image_name);
     printf("Total blocks: %" PRIu64 "\n", sb.total_blocks);
     printf("Inodes: %" PRIu64 "\n", sb.inode_count);
     printf("Data region blocks: %" PRIu64 "\n", sb.data_region_blocks);
+    if (journal_blocks) printf("Journal blocks: %" PRId64 "\n", journal_blocks);
+    if (groups) printf("Block groups: %" PRIu64 " of up to %u blocks, %" PRIu64 " inodes each in %" PRIu64 " of them\n",
+                       group_count, GROUP_BLOCKS, ipg, inode_groups);
 }
 
-void write_superblock(int fd, superblock_t* sb) {
-    // Calculating checksum
-    superblock_crc_finalize(sb);
-    
-    // Writing superblock to block 0
-    // fd: where to write
-    // sb: points to the data we are going to write
-    // sizeof(superblock_t): number of bytes to write
-    // 0 : where in the file to start writing (0 = beginning of the file)
-
-    // pwrite is lseek + write in one atomic call
-    if (pwrite(fd, sb, sizeof(superblock_t), 0) != sizeof(superblock_t)) { //for raw byte access
-        printf("Error writing superblock\n");
-        exit(1);
-    }
+// The root directory's block: data block 0, or with block groups the first one
+// of group 0 after the descriptor table and the inode slice
+static uint64_t root_dir_block(const image_t* img, const superblock_t* sb) {
+    if (!(sb->flags & SB_FL_GROUPS)) return sb->data_region_start;
+    const superblock_ext_t *ext = SB_EXT(img->sb);
+    return image_groups(img)[0].inode_table + ext->inodes_per_group / INODES_PER_BLOCK;
 }
 
-void write_bitmaps(int fd, superblock_t* sb) {
-    // allocating 1 block for inode_bitmap
-    //inode_bitmap[0].....inode_bitmap[4095]
-    uint8_t *inode_bitmap = malloc(1*BS);
-    if (!inode_bitmap) {
-        printf("Error allocating memory for inode bitmap\n");
-        exit(1);
-    }
-    
-    // inode_bitmap[0] = 1 ; 1st inode  (Root inode) booked
-    inode_bitmap[0] = 1; 
-    
-    // Write inode bitmap in .img file
-    // off_t : (4th parameter of pwrite) Calculates the byte offset in the file where the inode bitmap block starts
-    // sb->inode_bitmap_start * BS = getting the size (KB) from where writing the inode_bitmap will start 
-    // ssize_t: holds the return value (a byte count) by the sysmtem call(pwrite())
-    off_t inode_bitmap_offset = sb->inode_bitmap_start * BS;
-    ssize_t num_of_bytes_written_ibmap = pwrite(fd, inode_bitmap, BS, inode_bitmap_offset);
-    if ( num_of_bytes_written_ibmap != BS) {
-        printf("Error writing inode bitmap\n");
-        free(inode_bitmap);
-        exit(1);
-    }
-    free(inode_bitmap);
+void write_superblock(image_t* img, superblock_t* sb, const superblock_ext_t* ext) {
+    // Writing superblock to block 0
+    // image_block(img, 0): the mapped block 0, the rest of it stays zero
+    superblock_t *block0 = (superblock_t *)image_block(img, 0);
+    memcpy(block0, sb, sizeof(superblock_t));
+    if (ext != NULL) *SB_EXT(block0) = *ext;
     
+    // Calculating checksum, over block 0 as it is now
+    sb->checksum = superblock_crc_finalize(block0);
+}
 
-    //allocating 1 block for data_bitmap
-    //data_bitmap[0].....data_bitmap[4095]
-    uint8_t *data_bitmap = malloc(1*BS);
-    if (!data_bitmap) {
-        printf("Error allocating memory for data bitmap\n");
-        exit(1);
-    }
-    
-    //data_bitmap[0] = 1 ; 1st data block  (Root directory data) booked
-    data_bitmap[0] = 1; 
-    
-    // Write data bitmap in .img file
-    // off_t : Calculates the byte offset in the file where the data bitmap block starts
-    // sb->data_bitmap_start * BS = getting the size (KB) from where writing the data_bitmap will start
-    // ssize_t: holds the return value (a byte count) by the sysmtem call(pwrite())
-    off_t data_bitmap_offset = sb->data_bitmap_start * BS;
-    ssize_t num_of_bytes_written_dbmap = pwrite(fd, data_bitmap, BS, data_bitmap_offset);
-    if (num_of_bytes_written_dbmap != BS) {
-        printf("Error writing data bitmap\n");
-        free(data_bitmap);
-        exit(1);
+void write_group_table(image_t* img, superblock_t* sb, superblock_ext_t* ext) {
+    // One descriptor per group, in the first blocks of group 0 (still zero here)
+    group_desc_t *gd = (group_desc_t *)image_blocks(img, ext->groups_start, ext->groups_blocks);
+    uint64_t inode_groups = sb->inode_count / ext->inodes_per_group;
+    for (uint64_t g = 0; g < ext->group_count; g++) {
+        uint64_t left = sb->data_region_blocks - g * GROUP_BLOCKS;
+        gd[g].first_block = sb->data_region_start + g * GROUP_BLOCKS;
+        gd[g].blocks = (uint32_t)(left < GROUP_BLOCKS ? left : GROUP_BLOCKS);
+        gd[g].block_bitmap = (uint32_t)(sb->data_bitmap_start + g);
+        if (g < inode_groups) {
+            gd[g].first_inode = (uint32_t)(g * ext->inodes_per_group + 1);
+            gd[g].inode_table = gd[g].first_block + (g == 0 ? ext->groups_blocks : 0);
+            gd[g].inode_bitmap = (uint32_t)(sb->inode_bitmap_start + g * ext->inodes_per_group / ((uint64_t)BS * 8));
+        }
     }
-    
-    free(data_bitmap);
+    ext->groups_crc = crc32(gd, ext->group_count * sizeof(group_desc_t));
 }
 
-void write_inode_table(int fd, superblock_t* sb) {
-    // Allocating for inode table
-    uint8_t *inode_table = malloc(sb->inode_table_blocks*BS);
-    if (!inode_table) {
-        printf("Error allocating memory for inode table\n");
-        free(inode_table)
-        exit(1);
+void write_bitmaps(image_t* img, superblock_t* sb) {
+    // The bitmaps are used in place in the mapped image (no malloc, no copy)
+    // and start all zero (free), so only the booked bits are set
+    
+    // bit 0 = 1st inode (Root inode) booked
+    bitmap_t ibm;
+    bitmap_init(&ibm, image_inode_bitmap(img), sb->inode_count);
+    bitmap_set(&ibm, ROOT_INO - 1);
+    
+    // bit 0 = 1st data block (Root directory data) booked
+    bitmap_t dbm;
+    bitmap_init(&dbm, image_data_bitmap(img), sb->data_region_blocks);
+    if (sb->flags & SB_FL_GROUPS) {
+        // the descriptor table and every inode slice, then the root directory after them
+        const superblock_ext_t *ext = SB_EXT(img->sb);   // sb is the caller's copy, without the extension
+        const group_desc_t *gd = image_groups(img);
+        bitmap_set_range(&dbm, 0, ext->groups_blocks);
+        for (uint64_t g = 0; g < ext->group_count; g++) {
+            if (gd[g].inode_table == 0) continue;
+            bitmap_set_range(&dbm, gd[g].inode_table - sb->data_region_start, ext->inodes_per_group / INODES_PER_BLOCK);
+        }
     }
-    
+    bitmap_set(&dbm, root_dir_block(img, sb) - sb->data_region_start);
+}
+
+void write_inode_table(image_t* img, superblock_t* sb) {
     // ROOT INODE initialization
-    // Root inode (#1)  = 1st inode = inode_table[0]
-    // root inode index = root inode number = ROOT_INO - 1
-    // offset =  inode number * size of inode 
-    // Byte address or location of the inode number = start address of the inode table + offset
-    // inode_table + (ROOT_INO - 1) * INODE_SIZE return uint8_t type
-    //type casting it to inode_t structure
-    inode_t *root_inode = (inode_t *)(inode_table + (ROOT_INO - 1) * INODE_SIZE);
+    // Root inode (#1)  = 1st inode of the table
+    // image_inode() gives the mapped inode: start address of the inode table + (inode number - 1) * INODE_SIZE
+    // every other inode stays zero (unused)
+    inode_t *root_inode = image_inode(img, ROOT_INO);
     root_inode->mode = 0x4000; // Directory
     root_inode->links = 2;     // . and ..
     root_inode->uid = 0;
     root_inode->gid = 0;
     root_inode->size_bytes = 2 * sizeof(dirent64_t); // . and .. 2 diectory entries
-    root_inode->atime = time(NULL);
-    root_inode->mtime = time(NULL);
-    root_inode->ctime = time(NULL);
-    root_inode->direct_blocks[0] = 0; // (points to data block 0) First data block of root 
-    root_inode->reserved_0 = 0;
-    root_inode->reserved_1 = 0;
-    root_inode->reserved_2 = 0;
+    root_inode->atime = format_time();
+    root_inode->mtime = format_time();
+    root_inode->ctime = format_time();
+    root_inode->direct[0] = root_dir_block(img, sb); // absolute block number of the first data block of root
+    root_inode->indirect1 = 0;
+    root_inode->indirect2 = 0;
+    root_inode->flags = 0;
     root_inode->proj_id = 8; // Your group ID
     root_inode->uid16_gid16 = 0;
     root_inode->xattr_ptr = 0;
@@ -347,29 +372,12 @@ void write_inode_table(int fd, superblock_t* sb) {
     
     // Calculating root inode checksum
     inode_crc_finalize(root_inode);
-    
-    // Write inode table in .img file
-    // sb->inode_table_start * BS  : retriving the size from where writing the inode table will start
-    // sb->inode_table_blocks * BS : total size of inode table
-
-    // size_t : represent the size of objects in bytes
-    // it tells pwrite() how many bytes we want to write
-    off_t inode_table_offset = sb->inode_table_start * BS;
-    size_t inode_table_size = sb->inode_table_blocks * BS;
-    ssize_t num_of_bytes_written_itable = pwrite(fd, inode_table, inode_table_size, inode_table_offset);
-    if (num_of_bytes_written_itable != inode_table_size) {
-        printf("Error writing inode table\n");
-        free(inode_table);
-        exit(1);
-    }
-    
-    free(inode_table);
 }
 
-void create_root_directory(int fd, superblock_t* sb) {
+void create_root_directory(image_t* img, superblock_t* sb) {
     // ROOT directory initialization
-    // Creating directory entries for root
-    dirent64_t root_entries[2] = {0};
+    // Creating directory entries for root, directly in the mapped data block 0
+    dirent64_t *root_entries = image_dirents(img, root_dir_block(img, sb));
     
     // N.B : Strncpy is used instead of strcpy because 
     // name field has a fixed size (58 bytes), and      
@@ -389,17 +397,4 @@ void create_root_directory(int fd, superblock_t* sb) {
     root_entries[1].type = 2; // Directory
     strncpy(root_entries[1].name, "..", sizeof(root_entries[1].name));
     dirent_checksum_finalize(&root_entries[1]);
-    
-
-
-    // Writing root directory entries to first data block in .img file
-    // sb->data_region_start * BS : retriving the size (location or byte address) from where writing the data block will start
-    off_t data_block_offset = sb->data_region_start * BS;
-    ssize_t num_of_bytes_written_root_entries = pwrite(fd, root_entries, sizeof(root_entries), data_block_offset);
-    if (num_of_bytes_written_root_entries != sizeof(root_entries)) {
-        printf("Error writing root directory entries\n");
-        exit(1);
-    }
 }
-
-
@@ -0,0 +1,379 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra mkfs_client.c ipc.c -o mkfs_client
+// Usage: ./mkfs_client --socket <path> --input <img> --in-place --file <file> [--file <file> ...] [--manifest <list>] [--no-extents] [--no-holes] [--no-inline] [--compress] [--dedup] [--stdin-name <name>]
+//        ./mkfs_client --socket <path> --input <img> [--read <name> [--to <file>]] [--list] [--list-dir <dir>] [--stat] [--validate] [--stats]
+// Thin client of mkfs_server: the add options are mkfs_adder's, so a script
+// can switch between the two by adding --socket. The server changes the image
+// it serves in place, so --output is not supported.
+//
+// Requests are pipelined: up to WINDOW of them are in flight before the first
+// response is read, so the server sees them together and commits the adds of
+// one round at once. Each file is opened here as its request enters the window
+// (so at most WINDOW are open) and its descriptor is passed to the server,
+// which reads it directly: the data is never copied through the socket.
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ipc.h"
+
+#define WINDOW 64   // requests in flight
+
+// One request to send, with the descriptor that goes with it (-1 for none;
+// an add opens name when it is sent, -2 if that failed)
+typedef struct {
+    uint32_t op;
+    const char *name;
+    int fd;
+} request_t;
+
+static int push_request(request_t **reqs, size_t *count, size_t *cap, uint32_t op, const char *name, int fd) {
+    if (*count == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 16;
+        request_t *grown = realloc(*reqs, new_cap * sizeof(request_t));
+        if (grown == NULL) return -1;
+        *reqs = grown;
+        *cap = new_cap;
+    }
+    (*reqs)[*count] = (request_t){ op, name, fd };
+    (*count)++;
+    return 0;
+}
+
+// Manifest: one file path per line, blank lines and lines starting with '#' are skipped
+static int read_manifest(const char *manifest, char ***paths, size_t *count, size_t *cap) {
+    FILE *mf = fopen(manifest, "r");
+    if (mf == NULL) {
+        printf("Error opening manifest %s\n", manifest);
+        return -1;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), mf) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (*count == *cap) {
+            size_t new_cap = *cap ? *cap * 2 : 16;
+            char **grown = realloc(*paths, new_cap * sizeof(char *));
+            if (grown == NULL) break;
+            *paths = grown;
+            *cap = new_cap;
+        }
+        if (((*paths)[*count] = strdup(line)) == NULL) break;
+        (*count)++;
+    }
+    int rc = feof(mf) ? 0 : -1;
+    if (rc != 0) printf("Error in allocating memory for the file list\n");
+    fclose(mf);
+    return rc;
+}
+
+// stdin as a descriptor the server can add: stdin itself when it is a regular
+// file, otherwise (pipe, terminal) a copy of it to EOF in an unlinked file
+// under $TMPDIR, so the server never waits on our writer. -1 on error.
+static int spool_stdin(void) {
+    struct stat st;
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode)) return STDIN_FILENO;
+    const char *dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/mkfs_client.XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0) return -1;
+    unlink(path);
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 || write(fd, buf, (size_t)n) != n) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int send_request(int sock, uint64_t id, uint32_t op, const char *name, uint32_t flags, int fd) {
+    ipc_request_t req;
+    size_t len = name ? strlen(name) : 0;
+    if (len > IPC_NAME_MAX) return -1;
+    req.magic = IPC_MAGIC;
+    req.op = op;
+    req.id = id;
+    req.flags = flags;
+    req.name_len = (uint32_t)len;
+    memcpy(req.name, name ? name : "", len);
+    return ipc_send(sock, &req, IPC_REQUEST_HEADER + len, fd);
+}
+
+static int recv_response(int sock, ipc_response_t *resp) {
+    int fd;
+    ssize_t len = ipc_recv(sock, resp, sizeof(*resp), &fd, 0);
+    if (fd >= 0) close(fd);
+    // the server sends at most IPC_TEXT_MAX - 1 bytes of text, leaving room for the terminator
+    if (len < (ssize_t)IPC_RESPONSE_HEADER || resp->magic != IPC_MAGIC || resp->text_len != len - IPC_RESPONSE_HEADER ||
+        resp->text_len >= IPC_TEXT_MAX) return -1;
+    resp->text[resp->text_len] = '\0';
+    return 0;
+}
+
+static int connect_to(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        sock = -1;
+    }
+    return sock;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s --socket <path> --input <img> --in-place --file <file> [--file <file> ...] [--manifest <list>] [--no-extents] [--no-holes] [--no-inline] [--compress] [--dedup] [--stdin-name <name>]\n"
+           "       %s --socket <path> --input <img> [--read <name> [--to <file>]] [--list] [--list-dir <dir>] [--stat] [--validate] [--stats]\n", prog, prog);
+}
+
+int main(int argc, char *argv[]) {
+    char *sock_path = NULL;
+    char *input = NULL;
+    int in_place = 0;
+    uint32_t add_flags = 0;
+    char **paths = NULL;      //every --file and every manifest line, in order
+    size_t path_count = 0, path_cap = 0;
+    char *read_name = NULL;   //--read: file to copy out of the image
+    char *read_to = NULL;     //--to: where (default stdout)
+    char *stdin_name = "stdin"; //--stdin-name: name of the file read from stdin (--file -)
+    int list = 0, stat = 0, validate = 0, stats = 0;
+    char *list_dir = NULL;    //--list-dir: directory to list instead of the root
+
+    static const struct option long_options[] = {
+        {"socket", required_argument, NULL, 's'},
+        {"input", required_argument, NULL, 'i'},
+        {"output", required_argument, NULL, 'o'},
+        {"file", required_argument, NULL, 'f'},
+        {"manifest", required_argument, NULL, 'm'},
+        {"in-place", no_argument, NULL, 'p'},
+        {"no-extents", no_argument, NULL, 'E'},
+        {"no-holes", no_argument, NULL, 'Z'},
+        {"compress", no_argument, NULL, 'C'},
+        {"dedup", no_argument, NULL, 'D'},
+        {"no-inline", no_argument, NULL, 'I'},
+        {"read", required_argument, NULL, 'r'},
+        {"to", required_argument, NULL, 'T'},
+        {"list", no_argument, NULL, 'l'},
+        {"list-dir", required_argument, NULL, 'd'},
+        {"stat", no_argument, NULL, 'S'},
+        {"validate", no_argument, NULL, 'V'},
+        {"stats", no_argument, NULL, 'L'},
+        {"stdin-name", required_argument, NULL, 'n'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:i:o:f:m:pEZCDIr:T:ld:SVLn:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's': sock_path = optarg; break;
+        case 'i': input = optarg; break;
+        case 'o':
+            printf("Error: --output is not supported, the server changes its image in place (use --in-place)\n");
+            exit(1);
+        case 'f':
+            if (path_count == path_cap) {
+                path_cap = path_cap ? path_cap * 2 : 16;
+                if ((paths = realloc(paths, path_cap * sizeof(char *))) == NULL) {
+                    printf("Error in allocating memory for the file list\n");
+                    exit(1);
+                }
+            }
+            paths[path_count++] = optarg;
+            break;
+        case 'm':
+            if (read_manifest(optarg, &paths, &path_count, &path_cap) != 0) exit(1);
+            break;
+        case 'p': in_place = 1; break;
+        case 'E': add_flags |= IPC_NO_EXTENTS; break;
+        case 'Z': add_flags |= IPC_NO_HOLES; break;
+        case 'C': add_flags |= IPC_COMPRESS; break;
+        case 'D': add_flags |= IPC_DEDUP; break;
+        case 'I': add_flags |= IPC_NO_INLINE; break;
+        case 'r': read_name = optarg; break;
+        case 'T': read_to = optarg; break;
+        case 'l': list = 1; break;
+        case 'd': list_dir = optarg; list = 1; break;
+        case 'S': stat = 1; break;
+        case 'V': validate = 1; break;
+        case 'L': stats = 1; break;
+        case 'n': stdin_name = optarg; break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    // adds need --in-place, as with mkfs_adder; something must be asked for
+    if (sock_path == NULL || input == NULL || (path_count > 0) != in_place ||
+        (path_count == 0 && !read_name && !list && !stat && !validate && !stats)) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    // stdin (--file -) is spooled to a file below (spool_stdin)
+    for (size_t j = 0; j < path_count; j++) {
+        if (strcmp(paths[j], "-") == 0) paths[j] = stdin_name;
+    }
+
+    // a name given twice is an error before anything is sent (names already in
+    // the image are the server's to check)
+    if (path_count > 1) {
+        char **sorted = malloc(path_count * sizeof(char *));
+        if (sorted == NULL) {
+            printf("Error in allocating memory for the file list\n");
+            exit(1);
+        }
+        memcpy(sorted, paths, path_count * sizeof(char *));
+        qsort(sorted, path_count, sizeof(char *), cmp_str);
+        for (size_t j = 1; j < path_count; j++) {
+            if (strcmp(sorted[j - 1], sorted[j]) == 0) {
+                printf("Error: '%s' already exists in filesystem\n", sorted[j]);
+                exit(1);
+            }
+        }
+        free(sorted);
+    }
+
+    // every file is checked first, so a bad path stops the run before anything
+    // is added; it is only opened when its request is sent
+    request_t *reqs = NULL;
+    size_t req_count = 0, req_cap = 0;
+    for (size_t j = 0; j < path_count; j++) {
+        int fd = paths[j] == stdin_name ? spool_stdin() : -1;
+        if (paths[j] == stdin_name && fd < 0) {
+            printf("Error reading stdin into a temporary file\n");
+            exit(1);
+        }
+        if (fd < 0 && access(paths[j], R_OK) != 0) {
+            printf("Error opening file we want to add: %s\n", paths[j]);
+            exit(1);
+        }
+        if (push_request(&reqs, &req_count, &req_cap, IPC_ADD, paths[j], fd) != 0) {
+            printf("Error in allocating memory for the request list\n");
+            exit(1);
+        }
+    }
+    int rc = 0;
+    if (read_name) {
+        int fd = read_to ? open(read_to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : STDOUT_FILENO;
+        if (fd < 0) {
+            printf("Error opening output file %s\n", read_to);
+            exit(1);
+        }
+        rc |= push_request(&reqs, &req_count, &req_cap, IPC_READ, read_name, fd);
+    }
+    if (list) rc |= push_request(&reqs, &req_count, &req_cap, IPC_LIST, list_dir, STDOUT_FILENO);
+    if (stat) rc |= push_request(&reqs, &req_count, &req_cap, IPC_STAT, NULL, -1);
+    if (validate) rc |= push_request(&reqs, &req_count, &req_cap, IPC_VALIDATE, NULL, -1);
+    if (stats) rc |= push_request(&reqs, &req_count, &req_cap, IPC_STATS, NULL, -1);
+    if (rc != 0) {
+        printf("Error in allocating memory for the request list\n");
+        exit(1);
+    }
+
+    int sock = connect_to(sock_path);
+    if (sock < 0) {
+        printf("Error connecting to mkfs_server at %s\n", sock_path);
+        exit(1);
+    }
+    ipc_response_t *resp = malloc(sizeof(ipc_response_t));
+    if (resp == NULL) {
+        printf("Error in allocating memory for the response\n");
+        exit(1);
+    }
+    // the server must be serving the image the command names (paths are
+    // resolved here: the server's working directory is not ours)
+    char image[PATH_MAX];
+    if (realpath(input, image) == NULL) {
+        printf("Error opening %s\n", input);
+        exit(1);
+    }
+    if (send_request(sock, 0, IPC_HELLO, image, 0, -1) != 0 || recv_response(sock, resp) != 0) {
+        printf("Error talking to mkfs_server at %s\n", sock_path);
+        exit(1);
+    }
+    if (resp->status != 0) {
+        printf("%s\n", resp->text);
+        exit(1);
+    }
+
+    // the server may write to our stdout (read, list): nothing of ours may be left in the buffer
+    fflush(stdout);
+    double start = now_sec();
+    size_t sent = 0, done = 0, added = 0, failed = 0;
+    while (done < req_count) {
+        // fill the window; the descriptor is the server's once sent, so ours is closed
+        while (sent < req_count && sent - done < WINDOW) {
+            request_t *r = &reqs[sent];
+            // a file that went away since the check is still sent (without a
+            // descriptor, the server refuses it) to keep the responses in order
+            if (r->op == IPC_ADD && r->fd == -1 && (r->fd = open(r->name, O_RDONLY | O_CLOEXEC)) < 0) r->fd = -2;
+            if (send_request(sock, sent + 1, r->op, r->name, r->op == IPC_ADD ? add_flags : 0, r->fd < 0 ? -1 : r->fd) != 0) {
+                printf("Error sending %s request for %s\n", ipc_op_name(r->op), r->name ? r->name : "the image");
+                exit(1);
+            }
+            if (r->fd > STDOUT_FILENO) close(r->fd);
+            sent++;
+        }
+        // responses come back in request order
+        if (recv_response(sock, resp) != 0 || resp->id != done + 1) {
+            printf("Error: lost the connection to mkfs_server\n");
+            exit(1);
+        }
+        const request_t *r = &reqs[done++];
+        if (resp->status != 0) failed++;
+        switch (r->op) {
+        case IPC_ADD:
+            if (r->fd == -2) printf("Error opening file we want to add: %s\n", r->name);
+            else printf("%s\n", resp->text);
+            if (resp->status == 0) added++;
+            break;
+        case IPC_READ:
+        case IPC_LIST:
+            if (resp->status != 0) fprintf(stderr, "%s\n", resp->text);
+            break;
+        default:
+            printf("%s%s", resp->text, resp->text_len && resp->text[resp->text_len - 1] == '\n' ? "" : "\n");
+            break;
+        }
+        fflush(stdout);
+    }
+    double elapsed = now_sec() - start;
+    close(sock);
+
+    if (path_count > 1) {
+        printf("Added %zu of %zu files in %.3f s (%.1f files/s)\n",
+               added, path_count, elapsed, elapsed > 0 ? added / elapsed : 0.0);
+    }
+    free(resp);
+    free(reqs);
+    return failed == 0 ? 0 : 1;
+}
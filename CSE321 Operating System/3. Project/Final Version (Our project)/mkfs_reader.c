@@ -0,0 +1,131 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra mkfs_reader.c bitmap.c dcache.c dir_index.c image.c inode_map.c compress.c lz.c -o mkfs_reader
+// Usage: ./mkfs_reader --input myfs.img --file path [--output out] [--stats]
+// Copies the file at path (e.g. logs/2024/app.log) of a MiniVSFS image to --output
+// (or stdout); a directory is listed instead, one "name<TAB>type<TAB>inode<TAB>size"
+// line per entry.
+// Errors go to stderr so they never end up in the copied data, and so does the
+// --stats line (read speed, blocks stored, and the ratio of a compressed file).
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "dcache.h"
+#include "image.h"
+#include "inode_map.h"
+#include "minivsfs.h"
+
+int main(int argc, char *argv[]) {
+    char *input = NULL;
+    char *file = NULL;
+    char *output = NULL;
+    int stats = 0;
+
+    static const struct option long_options[] = {
+        {"input", required_argument, NULL, 'i'},
+        {"file", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {"stats", no_argument, NULL, 's'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:f:o:s", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'i': input = optarg; break;
+        case 'f': file = optarg; break;
+        case 'o': output = optarg; break;
+        case 's': stats = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s --input <img> --file <path> [--output <file>] [--stats]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (input == NULL || file == NULL) {
+        fprintf(stderr, "Usage: %s --input <img> --file <path> [--output <file>] [--stats]\n", argv[0]);
+        return 1;
+    }
+
+    image_t img;
+    if (image_open(&img, input, 0) != 0) {
+        fprintf(stderr, "Error opening image %s\n", input);
+        return 1;
+    }
+    if (image_check_layout(&img) != 0) {
+        fprintf(stderr, "Error: %s is not a MiniVSFS image\n", input);
+        image_close(&img);
+        return 1;
+    }
+
+    // one lookup per component: each directory's hashed index when it has one,
+    // else a scan of its dirent blocks (one path, so no dentry cache)
+    uint8_t type = 0;
+    int64_t found = path_resolve(NULL, &img, file, &type);
+    uint32_t inode_no = found > 0 ? (uint32_t)found : 0;
+    if (inode_no == 0) {
+        fprintf(stderr, "Error: '%s' not found\n", file);
+        image_close(&img);
+        return 1;
+    }
+    const inode_t *ino = image_inode(&img, inode_no);
+    if (ino == NULL) {
+        fprintf(stderr, "Error reading inode %" PRIu32 "\n", inode_no);
+        image_close(&img);
+        return 1;
+    }
+
+    FILE *out = output ? fopen(output, "wb") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Error opening output %s\n", output);
+        image_close(&img);
+        return 1;
+    }
+
+    if (type == 2) {
+        // a directory: its entries, "." and ".." included
+        int rc = 0;
+        for (int i = 0; i < DIRECT_MAX; i++) {
+            const dirent64_t *de = ino->direct[i] ? image_dirents(&img, ino->direct[i]) : NULL;
+            for (size_t j = 0; de != NULL && j < DIRENTS_PER_BLOCK; j++) {
+                if (de[j].inode_no == 0) continue;
+                const inode_t *e = image_inode(&img, de[j].inode_no);
+                if (fprintf(out, "%.*s\t%s\t%" PRIu32 "\t%" PRIu64 "\n", (int)sizeof(de[j].name), de[j].name,
+                            de[j].type == 2 ? "dir" : "file", de[j].inode_no, e ? e->size_bytes : 0) < 0) rc = -1;
+            }
+        }
+        if (out != stdout && fclose(out) != 0) rc = -1;
+        image_close(&img);
+        return rc == 0 ? 0 : 1;
+    }
+
+    // data is written straight out of the mapping, one run (one fwrite) per extent
+    // or per group of adjacent blocks
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = map_copy_out(&img, ino, out);
+    if (rc != 0) fprintf(stderr, "Error copying data of '%s'\n", file);
+
+    if (out != stdout && fclose(out) != 0) rc = -1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (rc == 0 && stats) {
+        // data blocks really stored: holes and the unused blocks of compressed clusters are 0,
+        // an inline file has none
+        uint64_t n = map_inode_blocks(ino), stored = 0;
+        uint32_t *blocks = malloc((n ? n : 1) * sizeof(uint32_t));
+        if (blocks != NULL && map_read(&img, ino, n, blocks, NULL) >= 0) {
+            for (uint64_t i = 0; i < n; i++) stored += blocks[i] != 0;
+        }
+        free(blocks);
+        double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        fprintf(stderr, "'%s': %" PRIu64 " bytes in %.3f s (%.0f MB/s)%s, %" PRIu64 " of %" PRIu64 " blocks stored (ratio %.2f)\n",
+                file, ino->size_bytes, sec, sec > 0 ? ino->size_bytes / 1e6 / sec : 0.0,
+                (ino->flags & INODE_FL_COMPRESSED) ? " decompressed" : (ino->flags & INODE_FL_INLINE) ? " inline" : "", stored, n,
+                stored ? (double)ino->size_bytes / ((double)stored * BS) : 0.0);
+    }
+    image_close(&img);
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,503 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread mkfs_server.c ipc.c volume.c sparse.c writer.c crc32.c bitmap.c dcache.c dir_index.c fsck.c image.c inode_map.c compress.c lz.c dedup.c sha256.c journal.c bcache.c ioq.c -o mkfs_server
+// Usage: ./mkfs_server --image <img> --socket <path> [--cache-blocks <n>] [--threads <n>]
+// Keeps one MiniVSFS image open and serves add/read/list/stat/validate requests
+// from mkfs_client over a Unix domain socket (protocol in ipc.h) until SIGINT or
+// SIGTERM. Nothing else may write the image while the server runs.
+//
+// The image is opened once (volume.h): the mapping, bitmaps, root inode and its
+// hashed index, the journal and its block cache stay warm across requests, so an
+// add costs its data copy plus a share of one commit instead of a process start,
+// an image open and a journal replay.
+//
+// One thread, one poll() loop. Each round takes every request already waiting
+// on every client (up to BATCH_MAX), runs them in arrival order, commits the
+// adds among them once (group commit: one journal transaction, or one msync),
+// and only then sends the responses, so a successful add is durable when the
+// client hears about it.
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "bitmap.h"
+#include "crc32.h"
+#include "dir_index.h"
+#include "fsck.h"
+#include "inode_map.h"
+#include "ipc.h"
+#include "minivsfs.h"
+#include "volume.h"
+
+#define MAX_CLIENTS 64
+#define BATCH_MAX 256        // requests run per round, over all clients
+#define CLIENT_BATCH_MAX 64  // from one client per round, so no client starves the others
+#define LAT_WINDOW 65536     // latency samples kept per request type (the most recent ones)
+#define NAME_LEN sizeof(((dirent64_t *)0)->name)
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// ==========================LATENCY============================================
+// Per request type: time from receiving a request to sending its response
+// (waiting in the batch and the group commit included)
+typedef struct {
+    uint64_t *ns;      // ring of the last LAT_WINDOW samples
+    uint64_t count;    // samples ever recorded
+    uint64_t max;
+} latency_t;
+
+static void latency_add(latency_t *l, uint64_t ns) {
+    if (l->ns == NULL && (l->ns = malloc(LAT_WINDOW * sizeof(uint64_t))) == NULL) return;
+    l->ns[l->count % LAT_WINDOW] = ns;
+    l->count++;
+    if (ns > l->max) l->max = ns;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Appends one "op count p50 p90 p99 max" line per request type seen, in µs
+static size_t latency_report(latency_t *lat, char *out, size_t cap) {
+    size_t len = snprintf(out, cap, "%-9s %10s %10s %10s %10s %10s\n", "request", "count", "p50 us", "p90 us", "p99 us", "max us");
+    uint64_t *sorted = malloc(LAT_WINDOW * sizeof(uint64_t));
+    for (uint32_t op = 1; op < IPC_OP_COUNT && sorted != NULL && len < cap; op++) {
+        const latency_t *l = &lat[op];
+        if (l->count == 0 || l->ns == NULL) continue;
+        size_t n = l->count < LAT_WINDOW ? l->count : LAT_WINDOW;
+        memcpy(sorted, l->ns, n * sizeof(uint64_t));
+        qsort(sorted, n, sizeof(uint64_t), cmp_u64);
+        len += snprintf(out + len, cap - len, "%-9s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f\n",
+                        ipc_op_name(op), l->count, sorted[(n - 1) * 50 / 100] / 1e3,
+                        sorted[(n - 1) * 90 / 100] / 1e3, sorted[(n - 1) * 99 / 100] / 1e3, l->max / 1e3);
+    }
+    free(sorted);
+    return len < cap ? len : cap - 1;
+}
+// ==========================LATENCY============================================
+
+
+typedef struct {
+    volume_t vol;
+    char image[PATH_MAX];     // realpath of the image, checked by IPC_HELLO
+    int threads;              // for validate
+    uint64_t rounds, requests;
+    latency_t lat[IPC_OP_COUNT];
+} server_t;
+
+// One request of the current round
+typedef struct {
+    int client;               // index into the pollfd array
+    int fd;                   // descriptor passed with the request, or -1
+    uint64_t received;        // now_ns() at recv
+    ipc_request_t req;
+    ipc_response_t resp;
+} job_t;
+
+static void reply(job_t *jb, int status, uint64_t value, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(jb->resp.text, IPC_TEXT_MAX, fmt, ap);
+    va_end(ap);
+    jb->resp.status = status;
+    jb->resp.value = value;
+    jb->resp.text_len = n < 0 ? 0 : n < IPC_TEXT_MAX ? (uint32_t)n : IPC_TEXT_MAX - 1;
+}
+
+static void do_add(server_t *s, job_t *jb, const char *name) {
+    volume_t *v = &s->vol;
+    struct stat st;
+    if (v->failed) {
+        reply(jb, -1, 0, "Error: the image is read-only after a failed commit");
+        return;
+    }
+    // a path: its directories are created by volume_add() as needed
+    if (volume_lookup(v, name, NULL) >= 0) {
+        reply(jb, -1, 0, "Error: '%s' already exists in filesystem", name);
+        return;
+    }
+    // only a regular file: a pipe or FIFO would be read to EOF inside the
+    // round, holding every other client until its writer closes (mkfs_client
+    // spools its stdin to a file; mkfs_adder reads pipes itself)
+    if (fstat(jb->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        reply(jb, -1, 0, "Error: '%s' is not a regular file (use mkfs_adder for a pipe or FIFO)", name);
+        return;
+    }
+    FILE *fp = fdopen(jb->fd, "rb");
+    if (fp == NULL) {
+        reply(jb, -1, 0, "Error opening file we want to add: %s", name);
+        return;
+    }
+    jb->fd = -1; // fclose() closes it
+    // the file shares its offset with the client's: start from the beginning
+    int use_extents = !(jb->req.flags & IPC_NO_EXTENTS);
+    v->holes = !(jb->req.flags & IPC_NO_HOLES);
+    v->compress = (jb->req.flags & IPC_COMPRESS) != 0;
+    v->dedup = (jb->req.flags & IPC_DEDUP) != 0;
+    v->inline_data = !(jb->req.flags & IPC_NO_INLINE);
+    int64_t inode_no = fseeko(fp, 0, SEEK_SET) == 0 ? volume_add(v, name, fp, (uint64_t)st.st_size, use_extents) : -1;
+    fclose(fp);
+    if (inode_no < 0) reply(jb, -1, 0, "Error in adding '%s' (see the server log)", name);
+    else reply(jb, 0, (uint64_t)inode_no, "File '%s' added successfully to inode %" PRId64, name, inode_no);
+}
+
+static void do_read(server_t *s, job_t *jb, const char *name) {
+    const image_t *img = &s->vol.img;
+    uint8_t type = 0;
+    int64_t inode_no = volume_lookup(&s->vol, name, &type);
+    const inode_t *ino = inode_no > 0 && type == 1 ? image_inode(img, (uint64_t)inode_no) : NULL;
+    if (ino == NULL || (ino->mode & 0xF000) != 0x8000) {
+        reply(jb, -1, 0, "Error: '%s' not found in filesystem", name);
+        return;
+    }
+    FILE *out = fdopen(jb->fd, "wb");
+    if (out == NULL) {
+        reply(jb, -1, 0, "Error opening the output");
+        return;
+    }
+    jb->fd = -1;
+    int rc = map_copy_out(img, ino, out);
+    if (fclose(out) != 0) rc = -1;
+    if (rc != 0) reply(jb, -1, 0, "Error copying data of '%s'", name);
+    else reply(jb, 0, ino->size_bytes, "%" PRIu64 " bytes", ino->size_bytes);
+}
+
+// "name<TAB>inode<TAB>size" for every entry of directory name (the root when empty)
+static void do_list(server_t *s, job_t *jb, const char *name) {
+    const image_t *img = &s->vol.img;
+    uint8_t type = 0;
+    int64_t dir_no = volume_lookup(&s->vol, name, &type);
+    const inode_t *dir = dir_no > 0 && type == 2 ? image_inode(img, (uint64_t)dir_no) : NULL;
+    if (dir == NULL) {
+        reply(jb, -1, 0, "Error: directory '%s' not found in filesystem", name);
+        return;
+    }
+    FILE *out = fdopen(jb->fd, "w");
+    if (out == NULL) {
+        reply(jb, -1, 0, "Error opening the output");
+        return;
+    }
+    jb->fd = -1;
+    uint64_t entries = 0;
+    for (int i = 0; i < DIRECT_MAX; i++) {
+        const dirent64_t *block = dir->direct[i] ? image_dirents(img, dir->direct[i]) : NULL;
+        for (size_t j = 0; block != NULL && j < DIRENTS_PER_BLOCK; j++) {
+            if (block[j].inode_no == 0) continue;
+            const inode_t *ino = image_inode(img, block[j].inode_no);
+            fprintf(out, "%.*s\t%" PRIu32 "\t%" PRIu64 "\n", (int)NAME_LEN, block[j].name,
+                    block[j].inode_no, ino ? ino->size_bytes : 0);
+            entries++;
+        }
+    }
+    if (fclose(out) != 0) reply(jb, -1, entries, "Error writing the list");
+    else reply(jb, 0, entries, "%" PRIu64 " entries", entries);
+}
+
+static void do_stat(server_t *s, job_t *jb) {
+    const volume_t *v = &s->vol;
+    const superblock_t *sb = v->img.sb;
+    uint64_t free_inodes = bitmap_count_free(&v->ibm), free_blocks = bitmap_count_free(&v->dbm);
+    char text[IPC_TEXT_MAX];
+    size_t len = snprintf(text, sizeof(text),
+                          "Image: %s\n"
+                          "Blocks: %" PRIu64 " total, data region %" PRIu64 "..%" PRIu64 "\n"
+                          "Inodes: %" PRIu64 " used, %" PRIu64 " free\n"
+                          "Data blocks: %" PRIu64 " used, %" PRIu64 " free\n"
+                          "Root directory: %" PRIu64 " entries%s\n",
+                          s->image, sb->total_blocks, sb->data_region_start, sb->data_region_start + sb->data_region_blocks - 1,
+                          v->ibm.nbits - free_inodes, free_inodes, v->dbm.nbits - free_blocks, free_blocks,
+                          (uint64_t)(v->root->links > 2 ? v->root->links - 2 : 0),
+                          (v->root->flags & INODE_FL_DIR_INDEX) ? ", indexed" : "");
+    if (v->journal) {
+        const journal_t *jnl = v->journal;
+        const bcache_stats_t *cs = &jnl->cache.stats;
+        len += snprintf(text + len, sizeof(text) - len,
+                        "Journal: %" PRIu64 " blocks, %" PRIu64 " commit(s), %" PRIu64 " metadata blocks logged, %" PRIu64 " data blocks written in place, %" PRIu64 " flush(es)\n"
+                        "Block cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " of %" PRIu64 " writes saved, %" PRIu64 " blocks in %" PRIu64 " write(s)\n",
+                        SB_EXT(sb)->journal_blocks, jnl->commits, jnl->logged, jnl->in_place, jnl->syncs,
+                        cs->hits, cs->misses, cs->writes_saved, cs->writes, cs->blocks_written, cs->write_calls);
+    } else {
+        len += snprintf(text + len, sizeof(text) - len, "Journal: none\n");
+    }
+    if (v->dd.blocks > 0) {
+        const dedup_t *dd = &v->dd;
+        len += snprintf(text + len, sizeof(text) - len,
+                        "Dedup: %" PRIu64 " of %" PRIu64 " data blocks shared, index of %" PRIu64 " blocks in %.2f MiB\n",
+                        dd->shared, dd->blocks, dd->count, dedup_memory(dd) / 1048576.0);
+    }
+    reply(jb, 0, 0, "%s", text);
+}
+
+static void do_validate(server_t *s, job_t *jb) {
+    // adds of this round before the check must be finalized (checksums) first
+    if (volume_commit(&s->vol) != 0) {
+        reply(jb, -1, 0, "Error in writing the image");
+        return;
+    }
+    fsck_report_t r;
+    int64_t problems = fsck_run(&s->vol.img, s->threads, &r);
+    if (problems < 0) {
+        reply(jb, -1, 0, "Error: the full check could not run");
+        return;
+    }
+    reply(jb, problems == 0 ? 0 : -1, (uint64_t)problems,
+          "%s: %" PRId64 " problem(s); %" PRIu64 " inodes used, %" PRIu64 " files, %" PRIu64 " dirs, %" PRIu64 " blocks referenced",
+          problems == 0 ? "OK" : "FAIL", problems, r.inodes_used, r.files, r.dirs, r.blocks_claimed);
+}
+
+static void do_stats(server_t *s, job_t *jb) {
+    char text[IPC_TEXT_MAX];
+    size_t len = snprintf(text, sizeof(text), "%" PRIu64 " requests in %" PRIu64 " round(s), %.1f per round\n",
+                          s->requests, s->rounds, s->rounds ? (double)s->requests / s->rounds : 0.0);
+    len += latency_report(s->lat, text + len, sizeof(text) - len);
+    reply(jb, 0, s->requests, "%s", text);
+}
+
+static void run(server_t *s, job_t *jb) {
+    ipc_request_t *req = &jb->req;
+    char name[IPC_NAME_MAX + 1];
+    memcpy(name, req->name, req->name_len);
+    name[req->name_len] = '\0';
+
+    int needs_fd = req->op == IPC_ADD || req->op == IPC_READ || req->op == IPC_LIST;
+    if (needs_fd && jb->fd < 0) {
+        reply(jb, -1, 0, "Error: %s request without a file descriptor", ipc_op_name(req->op));
+        return;
+    }
+    switch (req->op) {
+    case IPC_HELLO: {
+        char path[PATH_MAX];
+        if (realpath(name, path) == NULL || strcmp(path, s->image) != 0) reply(jb, -1, 0, "Error: this server serves %s, not %s", s->image, name);
+        else reply(jb, 0, 0, "%s", s->image);
+        break;
+    }
+    case IPC_ADD: do_add(s, jb, name); break;
+    case IPC_READ: do_read(s, jb, name); break;
+    case IPC_LIST: do_list(s, jb, name); break;
+    case IPC_STAT: do_stat(s, jb); break;
+    case IPC_VALIDATE: do_validate(s, jb); break;
+    case IPC_STATS: do_stats(s, jb); break;
+    default: reply(jb, -1, 0, "Error: unknown request %" PRIu32, req->op); break;
+    }
+}
+
+// Takes up to `room` requests already waiting on client `c` into jobs[] and
+// returns how many. *hup is set if the client hung up or broke the protocol
+// after them: the ones taken still run (and their descriptors are closed),
+// only their responses have nowhere to go.
+static int receive(struct pollfd *pfd, int c, job_t *jobs, int room, int *hup) {
+    int n = 0;
+    while (n < room) {
+        job_t *jb = &jobs[n];
+        ssize_t len = ipc_recv(pfd[c].fd, &jb->req, sizeof(jb->req), &jb->fd, MSG_DONTWAIT);
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (len < (ssize_t)IPC_REQUEST_HEADER || jb->req.magic != IPC_MAGIC ||
+            jb->req.name_len != len - IPC_REQUEST_HEADER) {
+            if (len > 0) fprintf(stderr, "mkfs_server: bad request from client %d, dropping it\n", c);
+            if (len >= 0 && jb->fd >= 0) close(jb->fd);
+            *hup = 1;
+            break;
+        }
+        jb->client = c;
+        jb->received = now_ns();
+        memset(&jb->resp, 0, IPC_RESPONSE_HEADER);
+        jb->resp.magic = IPC_MAGIC;
+        jb->resp.op = jb->req.op;
+        jb->resp.id = jb->req.id;
+        n++;
+    }
+    return n;
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    unlink(path); // a socket left by a server that did not shut down
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, MAX_CLIENTS) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s --image <img> --socket <path> [--cache-blocks <n>] [--threads <n>]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    crc32_init();
+
+    char *image = NULL;
+    char *sock_path = NULL;
+    size_t cache_blocks = 0;  //--cache-blocks: journal block cache size (0 = BCACHE_DEFAULT_BLOCKS)
+    int threads = 0;          //--threads: validate workers (0 = one per online CPU)
+
+    static const struct option long_options[] = {
+        {"image", required_argument, NULL, 'i'},
+        {"socket", required_argument, NULL, 's'},
+        {"cache-blocks", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:s:c:t:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'i': image = optarg; break;
+        case 's': sock_path = optarg; break;
+        case 'c': cache_blocks = strtoull(optarg, NULL, 10); break;
+        case 't': threads = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (image == NULL || sock_path == NULL) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    static server_t s;
+    s.threads = threads;
+    if (realpath(image, s.image) == NULL) {
+        printf("Error opening %s\n", image);
+        exit(1);
+    }
+    int replayed = volume_open(&s.vol, s.image, cache_blocks);
+    if (replayed < 0) exit(1);
+    if (replayed > 0) printf("Replayed %d journal transaction(s)\n", replayed);
+
+    int lsock = listen_on(sock_path);
+    if (lsock < 0) {
+        printf("Error listening on %s\n", sock_path);
+        volume_close(&s.vol);
+        exit(1);
+    }
+
+    // no SA_RESTART: the signal interrupts poll() and the loop ends
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    job_t *jobs = malloc(BATCH_MAX * sizeof(job_t));
+    if (jobs == NULL) {
+        printf("Error in allocating memory for the request batch\n");
+        exit(1);
+    }
+    // pfd[0] is the listening socket, pfd[1..nfds) the clients
+    struct pollfd pfd[1 + MAX_CLIENTS];
+    int hung_up[1 + MAX_CLIENTS];
+    nfds_t nfds = 1;
+    pfd[0].fd = lsock;
+    pfd[0].events = POLLIN;
+    printf("Serving %s on %s\n", s.image, sock_path);
+    fflush(stdout);
+
+    while (!stop) {
+        if (poll(pfd, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            printf("Error in poll: %s\n", strerror(errno));
+            break;
+        }
+
+        // one round: what every client has sent so far, in turn
+        int n = 0;
+        for (nfds_t c = 1; c < nfds; c++) {
+            hung_up[c] = 0;
+            if (!(pfd[c].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            int room = BATCH_MAX - n < CLIENT_BATCH_MAX ? BATCH_MAX - n : CLIENT_BATCH_MAX;
+            n += receive(pfd, (int)c, jobs + n, room, &hung_up[c]);
+        }
+        for (int i = 0; i < n; i++) run(&s, &jobs[i]);
+
+        // group commit, before any add is acknowledged
+        if (s.vol.dirty && volume_commit(&s.vol) != 0) {
+            for (int i = 0; i < n; i++) {
+                if (jobs[i].req.op == IPC_ADD && jobs[i].resp.status == 0) reply(&jobs[i], -1, 0, "Error in writing the image");
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            job_t *jb = &jobs[i];
+            if (jb->fd >= 0) close(jb->fd);
+            latency_add(&s.lat[jb->req.op < IPC_OP_COUNT ? jb->req.op : 0], now_ns() - jb->received);
+            if (!hung_up[jb->client] && ipc_send(pfd[jb->client].fd, &jb->resp, IPC_RESPONSE_HEADER + jb->resp.text_len, -1) != 0) {
+                hung_up[jb->client] = 1;
+            }
+        }
+        if (n > 0) {
+            s.rounds++;
+            s.requests += n;
+        }
+
+        // drop clients that left, keeping pfd[] packed
+        nfds_t kept = 1;
+        for (nfds_t c = 1; c < nfds; c++) {
+            if (hung_up[c]) close(pfd[c].fd);
+            else pfd[kept++] = pfd[c];
+        }
+        nfds = kept;
+
+        if (pfd[0].revents & POLLIN) {
+            int cs = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+            if (cs >= 0 && nfds == 1 + MAX_CLIENTS) {
+                close(cs); // full: the client sees the connection closed
+            } else if (cs >= 0) {
+                pfd[nfds].fd = cs;
+                pfd[nfds].events = POLLIN;
+                pfd[nfds].revents = 0;
+                nfds++;
+            }
+        }
+    }
+
+    for (nfds_t c = 1; c < nfds; c++) close(pfd[c].fd);
+    close(lsock);
+    unlink(sock_path);
+    free(jobs);
+
+    int rc = volume_commit(&s.vol);
+    if (volume_close(&s.vol) != 0 || rc != 0) {
+        printf("Error in writing the image\n");
+        exit(1);
+    }
+
+    char report[IPC_TEXT_MAX];
+    latency_report(s.lat, report, sizeof(report));
+    printf("Served %" PRIu64 " requests in %" PRIu64 " round(s)\n%s", s.requests, s.rounds, report);
+    for (int op = 0; op < IPC_OP_COUNT; op++) free(s.lat[op].ns);
+    return 0;
+}
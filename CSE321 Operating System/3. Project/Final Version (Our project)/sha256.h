@@ -0,0 +1,19 @@
+// sha256.h — SHA-256 of data blocks for deduplication (dedup.h)
+//
+// The x86 SHA extensions (SHA-NI) do the compression rounds where the CPU
+// has them, picked at run time like the zero test of sparse.c; a portable
+// version runs everywhere else.
+#ifndef MINIVSFS_SHA256_H
+#define MINIVSFS_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BYTES 32
+
+void sha256(const void* data, size_t len, uint8_t out[SHA256_BYTES]);
+
+// Name of the implementation in use ("sha-ni" or "portable"), for reports
+const char* sha256_kernel(void);
+
+#endif
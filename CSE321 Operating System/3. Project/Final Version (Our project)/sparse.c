@@ -0,0 +1,164 @@
+// sparse.c — zero-block detection and SEEK_HOLE scanning of source files
+#define _GNU_SOURCE
+#include "sparse.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPARSE_X86 1
+#endif
+
+#include "minivsfs.h"
+
+#define SCAN_CHUNK (1u << 20)   // bytes per pread while scanning
+
+// Every kernel ORs the bytes together and tests once at the end: no branch
+// per vector. The vector ones leave the tail (n not a multiple of 64/128) to this one.
+static int zero_word(const uint8_t* p, size_t n) {
+    uint64_t acc = 0;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        uint64_t a, b, c, d;
+        memcpy(&a, p + i, 8);
+        memcpy(&b, p + i + 8, 8);
+        memcpy(&c, p + i + 16, 8);
+        memcpy(&d, p + i + 24, 8);
+        acc |= a | b | c | d;
+    }
+    for (; i < n; i++) acc |= p[i];
+    return acc == 0;
+}
+
+#ifdef SPARSE_X86
+__attribute__((target("sse2")))
+static int zero_sse2(const uint8_t* p, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(p + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(p + i + 48));
+        acc = _mm_or_si128(acc, _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF) return 0;
+    return zero_word(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int zero_avx2(const uint8_t* p, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 128 <= n; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(p + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(p + i + 96));
+        acc = _mm256_or_si256(acc, _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)));
+    }
+    if (!_mm256_testz_si256(acc, acc)) return 0;
+    return zero_word(p + i, n - i);
+}
+#endif
+
+typedef int (*zero_fn)(const uint8_t*, size_t);
+static zero_fn zero_kernel;
+static const char* zero_name;
+
+static void pick_kernel(void) {
+    zero_kernel = zero_word;
+    zero_name = "word";
+#ifdef SPARSE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        zero_kernel = zero_avx2;
+        zero_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        zero_kernel = zero_sse2;
+        zero_name = "sse2";
+    }
+#endif
+}
+
+int sparse_is_zero(const void* p, size_t n) {
+    if (zero_kernel == NULL) pick_kernel();
+    return zero_kernel(p, n);
+}
+
+const char* sparse_kernel(void) {
+    if (zero_kernel == NULL) pick_kernel();
+    return zero_name;
+}
+
+static void set_bit(uint8_t* b, uint64_t i) {
+    b[i >> 3] |= (uint8_t)(1u << (i & 7));
+}
+
+// Reads the blocks [first, end) of the range and marks the all-zero ones
+static int64_t scan_data(int fd, uint64_t off, uint64_t size, uint64_t first, uint64_t end, uint8_t* buf, uint8_t* holes) {
+    int64_t found = 0;
+    while (first < end) {
+        uint64_t blocks = end - first < SCAN_CHUNK / BS ? end - first : SCAN_CHUNK / BS;
+        uint64_t want = blocks * BS;
+        if (want > size - first * BS) want = size - first * BS;
+        uint64_t got = 0;
+        while (got < want) {
+            ssize_t n = pread(fd, buf + got, want - got, (off_t)(off + first * BS + got));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            got += (uint64_t)n;
+        }
+        for (uint64_t k = 0; k < blocks; k++) {
+            uint64_t len = want - k * BS < BS ? want - k * BS : BS;   // the last block may be short
+            if (sparse_is_zero(buf + k * BS, len)) {
+                set_bit(holes, first + k);
+                found++;
+            }
+        }
+        first += blocks;
+    }
+    return found;
+}
+
+int64_t sparse_scan(int fd, uint64_t off, uint64_t size, uint8_t* holes) {
+    uint64_t n = (size + BS - 1) / BS;
+    if (n == 0) return 0;
+    uint8_t* buf = malloc(size < SCAN_CHUNK ? (size_t)n * BS : SCAN_CHUNK);
+    if (buf == NULL) return -1;
+
+    off_t saved = lseek(fd, 0, SEEK_CUR);   // SEEK_DATA/SEEK_HOLE move it
+    int64_t found = 0;
+    uint64_t pos = 0;   // bytes of the range looked at so far, a multiple of BS
+    while (pos < size && found >= 0) {
+        // next data at or after pos: everything before it is a hole of the source.
+        // Without SEEK_DATA support (or a failure) the rest is simply all read
+        uint64_t data = pos, hole = size;
+        off_t d = lseek(fd, (off_t)(off + pos), SEEK_DATA);
+        if (d < 0 && errno == ENXIO) {
+            data = size;
+        } else if (d >= 0) {
+            data = (uint64_t)d - off;
+            off_t h = lseek(fd, d, SEEK_HOLE);
+            if (h >= 0 && (uint64_t)h - off < size) hole = (uint64_t)h - off;
+        }
+        if (data > size) data = size;
+        // blocks wholly inside the source's hole
+        uint64_t first = pos / BS, hole_end = data >= size ? n : data / BS;
+        for (uint64_t b = first; b < hole_end; b++) set_bit(holes, b);
+        found += (int64_t)(hole_end > first ? hole_end - first : 0);
+        if (data >= size) break;
+        // blocks touching [data, hole) are read and tested
+        uint64_t end = (hole + BS - 1) / BS;
+        if (end > n) end = n;
+        int64_t z = scan_data(fd, off, size, hole_end, end, buf, holes);
+        found = z < 0 ? -1 : found + z;
+        pos = end * BS;
+    }
+    free(buf);
+    if (saved >= 0 && lseek(fd, saved, SEEK_SET) != saved) found = -1;
+    return found;
+}
@@ -0,0 +1,29 @@
+// sparse.h — finding the holes of a file before it is added (volume.c)
+//
+// A file block whose BS bytes are all zero is stored as a hole: no data
+// block, a 0 block pointer or an extent with start 0 (INODE_FL_SPARSE, see
+// minivsfs.h), and it reads back as zeros. Holes are found two ways:
+//   - SEEK_DATA/SEEK_HOLE on the source: blocks inside a hole of a sparse
+//     source are holes without being read at all;
+//   - a zero test on every block that is read, with the widest vector unit
+//     the CPU has (AVX2, SSE2, or 64-bit words elsewhere).
+#ifndef MINIVSFS_SPARSE_H
+#define MINIVSFS_SPARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 1 if the n bytes at p are all zero
+int sparse_is_zero(const void* p, size_t n);
+
+// Name of the zero test in use ("avx2", "sse2" or "word"), for reports
+const char* sparse_kernel(void);
+
+// Mark the holes among the file blocks of [off, off + size) of fd: bit i of
+// holes (cleared by the caller, map_file_blocks(size) bits) is set when
+// block i is a hole. Data is read with pread(); the file offset is left
+// where it was.
+// Returns the number of holes, or -1 on a read error.
+int64_t sparse_scan(int fd, uint64_t off, uint64_t size, uint8_t* holes);
+
+#endif
@@ -0,0 +1,1448 @@
+// volume.c — adding files to an image: allocation, directory entry, group commit
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L // fseeko, ftello
+#include "volume.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "compress.h"
+#include "crc32.h"
+#include "dcache.h"
+#include "dedup.h"
+#include "dir_index.h"
+#include "inode_map.h"
+#include "sparse.h"
+
+// Most blocks one add (or mkdir) makes the journal log beyond volume_t.txn_base:
+// its inode table block, its directory's dirent block, index block and inode
+// table block (new data, pointer and directory blocks are written in place, not logged)
+#define ADD_LOGGED_BLOCKS 4
+
+// WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
+// sb is block 0 of the image: the crc covers the whole block (the struct, the
+// superblock_ext_t fields after it and the zero padding), as Validator checks it
+static uint32_t superblock_crc_finalize(superblock_t *sb) {
+    sb->checksum = 0;
+    uint32_t s = crc32((const uint8_t *)sb, BS - 4);
+    sb->checksum = s;
+    return s;
+}
+
+// WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
+static void inode_crc_finalize(inode_t* ino){
+    uint8_t tmp[INODE_SIZE]; memcpy(tmp, ino, INODE_SIZE);
+    // zero crc area before computing
+    memset(&tmp[120], 0, 8);
+    uint32_t c = crc32(tmp, 120);
+    ino->inode_crc = (uint64_t)c; // low 4 bytes carry the crc
+}
+
+// WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
+static void dirent_checksum_finalize(dirent64_t* de) {
+    const uint8_t* p = (const uint8_t*)de;
+    uint8_t x = 0;
+    for (int i = 0; i < 63; i++) x ^= p[i];   // covers ino(4) + type(1) + name(58)
+    de->checksum = x;
+}
+
+
+// Function to add a directory entry
+// add_directory_entry(&img, &dbm, dir_inode, inode_no, 1, name), into any directory (v->parent)
+//5th parameter= directory_entry.type: 1 for a file, 2 for a directory (make_dir)
+//the entry goes into the first free slot (inode_no == 0) of the directory's existing blocks,
+//so each block fills up to DIRENTS_PER_BLOCK entries and freed slots are reused;
+//only when every block is full a new directory block comes from the data bitmap
+static int insert_directory_entry(image_t *img, bitmap_t *dbm, inode_t *dir_inode, uint32_t new_inode_no, uint8_t type, const char *name) {
+    uint64_t dir_block_no = 0;
+    dirent64_t *entries = NULL;
+    size_t slot = 0;
+    int free_direct = -1;
+
+    // Looking for a free slot in the blocks the directory already has
+    for (int i = 0; i < DIRECT_MAX && entries == NULL; i++) {
+        if (dir_inode->direct[i] == 0) {
+            // first unused direct pointer, in case every block is full
+            if (free_direct == -1) free_direct = i;
+            continue;
+        }
+        dirent64_t *block = image_dirents(img, dir_inode->direct[i]);
+        if (block == NULL) continue;
+        for (size_t j = 0; j < DIRENTS_PER_BLOCK; j++) {
+            if (block[j].inode_no == 0) {
+                dir_block_no = dir_inode->direct[i];
+                entries = block;
+                slot = j;
+                break;
+            }
+        }
+    }
+
+    if (entries == NULL) {
+        // Find a free direct pointer in the directory inode
+        // TO point to the datablock having the file.txt directory entry
+        if (free_direct == -1) {
+            printf("Error: Directory has no free direct pointers\n");
+            return -1;
+        }
+    
+        // If we get here, we need to allocate a new data block for the directory
+        // (bit index relative to the data region)
+        int64_t free_data_block = bitmap_alloc(dbm);
+        if (free_data_block == -1) {
+            printf("Error: No free data blocks available\n");
+            return -1;
+        }
+    
+        // Setting the direct pointer to the new data block (absolute block number)
+        // free_data_block : holds the file.txt directory entry and the next 63 ones
+        dir_block_no = img->sb->data_region_start + free_data_block;
+        entries = image_dirents(img, dir_block_no);
+        if (entries == NULL) {
+            bitmap_clear(dbm, free_data_block);
+            return -1;
+        }
+        dir_inode->direct[free_direct] = dir_block_no;
+    
+        // Initialize the new data block with zeros (in the mapped image)
+        memset(entries, 0, BS);
+        slot = 0;
+    }
+    
+    // Now add the directory entry to the free slot
+    dirent64_t *new_entry = &entries[slot];
+    memset(new_entry, 0, sizeof(*new_entry));
+    new_entry->inode_no = new_inode_no;
+    new_entry->type = type;
+    memcpy(new_entry->name, name, strnlen(name, sizeof(new_entry->name)));   // not terminated at full length
+    dirent_checksum_finalize(new_entry);
+    
+    // File the new entry in the directory's hash index.
+    // If the index cannot grow it is dropped, the directory stays valid without it
+    dir_index_insert(img, dbm, dir_inode, name, dir_block_no, slot);
+    
+    // Update directory inode size and modification time
+    dir_inode->size_bytes += sizeof(dirent64_t);
+    dir_inode->mtime = time(NULL);
+    dir_inode->atime = time(NULL);
+    
+    return 0;
+}
+
+// The directory's blocks belong to no one file: with block groups they are
+// allocated outside the window of the file being added
+static int add_directory_entry(image_t *img, bitmap_t *dbm, inode_t *dir_inode, uint32_t new_inode_no, uint8_t type, const char *name) {
+    uint64_t lo = dbm->lo, hi = dbm->hi;
+    bitmap_window(dbm, 0, dbm->nbits);
+    int rc = insert_directory_entry(img, dbm, dir_inode, new_inode_no, type, name);
+    bitmap_window(dbm, lo, hi);
+    return rc;
+}
+
+
+// Copies the next bytes of fp into the count adjacent blocks starting at first:
+// one fread for the whole run, straight into the mapping. *left is the number of
+// file bytes still to copy; whatever the run holds past the end of the file is zeroed.
+static int copy_run(image_t *img, FILE *fp, uint64_t first, uint64_t count, uint64_t *left) {
+    uint8_t *run = image_blocks(img, first, count);
+    if (run == NULL) {
+        printf("Error: data block outside the image\n");
+        return -1;
+    }
+    uint64_t bytes = count * BS;
+    if (bytes > *left) bytes = *left;
+    if (fread(run, 1, bytes, fp) != bytes) {
+        printf("Error in reading file data\n");
+        return -1;
+    }
+    memset(run + bytes, 0, count * BS - bytes);
+    *left -= bytes;
+    return 0;
+}
+
+// Copies size bytes of fp into runs (absolute blocks holding exactly the file):
+// a big file through the writer, around the mapping (writer.h), a small one with
+// copy_run() into the mapping
+static int copy_data(volume_t *v, FILE *fp, uint64_t size, const extent_t *runs, size_t nruns) {
+    if (v->writer.mode == WRITER_MAP || size < WRITER_MIN_BYTES) {
+        uint64_t left = size;
+        for (size_t r = 0; r < nruns; r++) {
+            if (copy_run(&v->img, fp, runs[r].start, runs[r].len, &left) != 0) return -1;
+        }
+        return 0;
+    }
+    for (size_t r = 0; r < nruns; r++) {
+        if (image_blocks(&v->img, runs[r].start, runs[r].len) == NULL) {
+            printf("Error: data block outside the image\n");
+            return -1;
+        }
+    }
+    if (writer_copy(&v->writer, fp, size, runs, nruns) != 0) {
+        printf("Error in copying file data\n");
+        return -1;
+    }
+    // under the journal: home already, and the private mapping must not hide it
+    for (size_t r = 0; v->journal && r < nruns; r++) {
+        if (journal_data_written(v->journal, runs[r].start, runs[r].len) != 0) return -1;
+    }
+    return 0;
+}
+
+static int is_hole(const uint8_t *holes, uint64_t i) {
+    return holes != NULL && (holes[i >> 3] >> (i & 7) & 1);
+}
+
+// File blocks of fp (size bytes from its current offset) that are all zeros, as a
+// bitmap (sparse.h), with their number in *count. NULL when there are none, when
+// fp is not a regular file or holes are turned off: everything is stored then.
+static uint8_t *find_holes(volume_t *v, FILE *fp, uint64_t size, uint64_t *count) {
+    *count = 0;
+    uint64_t n = map_file_blocks(size);
+    off_t base = ftello(fp);
+    struct stat st;
+    if (!v->holes || n == 0 || base < 0 || fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+    uint8_t *holes = calloc((n + 7) / 8, 1);
+    if (holes == NULL) return NULL;
+    // a read error here shows up again, and is reported, when the data is copied
+    int64_t found = sparse_scan(fileno(fp), (uint64_t)base, size, holes);
+    if (found <= 0) {
+        free(holes);
+        return NULL;
+    }
+    *count = (uint64_t)found;
+    return holes;
+}
+
+// The file's extents: its holes as extents with start 0, and its data laid out over
+// the pc allocated runs (bits p_start/p_len) in order. Returns the count, or -1 if
+// that takes more than EXTENT_MAX extents.
+static int layout_extents(const superblock_t *sb, const uint8_t *holes, uint64_t n,
+                          const uint64_t *p_start, const uint64_t *p_len, extent_t *ext) {
+    int count = 0, pe = 0;
+    uint64_t po = 0;
+    for (uint64_t i = 0; i < n;) {
+        int hole = is_hole(holes, i);
+        uint64_t e = i + 1;
+        while (e < n && is_hole(holes, e) == hole) e++;
+        for (uint64_t left = e - i; left > 0;) {
+            if (count == EXTENT_MAX) return -1;
+            uint64_t take = left;
+            if (hole) {
+                ext[count].start = 0;
+            } else {
+                if (take > p_len[pe] - po) take = p_len[pe] - po;
+                ext[count].start = (uint32_t)(sb->data_region_start + p_start[pe] + po);
+                po += take;
+                if (po == p_len[pe]) {
+                    pe++;
+                    po = 0;
+                }
+            }
+            ext[count].len = (uint32_t)take;
+            count++;
+            left -= take;
+        }
+        i = e;
+    }
+    return count;
+}
+
+// Copies the file's data blocks (phys[i] != 0) from fp, which is at file block 0,
+// each run of data blocks between two holes with one copy_data(); holes are skipped
+// with a seek. runs has room for n entries.
+static int copy_blocks(volume_t *v, FILE *fp, uint64_t size, const uint32_t *phys, uint64_t n, extent_t *runs) {
+    off_t base = ftello(fp);
+    uint64_t at = 0;   // file block fp is at
+    for (uint64_t i = 0; i < n;) {
+        if (phys[i] == 0) {
+            i++;
+            continue;
+        }
+        //blocks that happen to be adjacent are still copied as one run
+        size_t nruns = 0;
+        uint64_t e = i;
+        for (; e < n && phys[e] != 0; e++) {
+            if (nruns > 0 && runs[nruns - 1].start + runs[nruns - 1].len == phys[e]) {
+                runs[nruns - 1].len++;
+            } else {
+                runs[nruns].start = phys[e];
+                runs[nruns].len = 1;
+                nruns++;
+            }
+        }
+        if (at != i && (base < 0 || fseeko(fp, base + (off_t)(i * BS), SEEK_SET) != 0)) {
+            printf("Error in reading file data\n");
+            return -1;
+        }
+        uint64_t bytes = (e - i) * BS < size - i * BS ? (e - i) * BS : size - i * BS;
+        if (copy_data(v, fp, bytes, runs, nruns) != 0) return -1;
+        at = i = e;
+    }
+    return 0;
+}
+
+// What place_blocks() took from the data bitmap, so a failed add can give it back
+typedef struct {
+    uint64_t ext_start[EXTENT_MAX], ext_len[EXTENT_MAX];
+    int ext_count;          // -1: block-mapped, the bits are in bits[]
+    uint64_t *bits, nbits;
+} placement_t;
+
+// Gives back the bits of a placement (failed add) and frees it
+static void release_blocks(bitmap_t *dbm, placement_t *pl) {
+    if (pl->ext_count >= 0) {
+        for (int e = 0; e < pl->ext_count; e++) bitmap_clear_range(dbm, pl->ext_start[e], pl->ext_len[e]);
+    } else {
+        for (uint64_t i = 0; i < pl->nbits; i++) bitmap_clear(dbm, pl->bits[i]);
+    }
+    free(pl->bits);
+    pl->bits = NULL;
+}
+
+// Allocates data blocks for the n file blocks that are not set in holes
+// (hole_count of them) and maps them in ino, with holes as 0 entries: with
+// use_extents first as at most EXTENT_MAX contiguous runs (extent-mapped inode);
+// when the free space is too fragmented for that, or without use_extents, as
+// the usual direct/indirect block map. phys[i] gets the data block of file
+// block i (0 = hole). Returns 0 (free pl->bits once the add is done), or -1
+// with nothing allocated.
+static int place_blocks(volume_t *v, inode_t *ino, const uint8_t *holes, uint64_t hole_count, uint64_t n,
+                        int use_extents, uint32_t *phys, placement_t *pl) {
+    image_t *img = &v->img;
+    bitmap_t *dbm = &v->dbm;
+    superblock_t *sb = img->sb;
+    uint64_t data_needed = n - hole_count;
+    memset(pl, 0, sizeof(*pl));
+
+    //pointer blocks (indirect1, indirect2 and its leaves) needed beyond the 12 direct pointers
+    uint64_t meta_needed = map_meta_blocks(n);
+    if (meta_needed == UINT64_MAX) {
+        printf("Error: File is too large, the limit is %" PRIu64 " blocks\n", (uint64_t)MAP_MAX_BLOCKS);
+        return -1;
+    }
+
+    //===EXTENTS: best-fit runs of adjacent free blocks, with the holes between them =====================
+    pl->ext_count = -1;
+    if (use_extents && data_needed > 0) {
+        pl->ext_count = bitmap_alloc_extents(dbm, data_needed, pl->ext_start, pl->ext_len, EXTENT_MAX);
+    } else if (use_extents && n > 0) {
+        pl->ext_count = 0; // nothing but holes
+    }
+    if (pl->ext_count >= 0) {
+        extent_t ext[EXTENT_MAX];
+        int count = layout_extents(sb, holes, n, pl->ext_start, pl->ext_len, ext);
+        if (count < 0) {
+            // too many holes to describe with extents: a block map it is
+            release_blocks(dbm, pl);
+            pl->ext_count = -1;
+        } else if (map_write_extents(ino, ext, count) != 0) {
+            release_blocks(dbm, pl);
+            return -1;
+        } else {
+            uint64_t i = 0;
+            for (int e = 0; e < count; e++) {
+                for (uint32_t k = 0; k < ext[e].len; k++) phys[i++] = ext[e].start ? ext[e].start + k : 0;
+            }
+            return 0;
+        }
+    } //==================================================================================================
+
+    //===BLOCK MAP: direct + indirect pointers ===
+
+    // Allocating pointer blocks and data blocks in one call
+    // first meta_needed bits become pointer blocks, so each indirect block sits just before the data it maps
+    uint64_t total_needed = meta_needed + data_needed;
+    pl->bits = malloc((total_needed ? total_needed : 1) * sizeof(uint64_t));
+    uint32_t *meta_blocks_list = malloc((meta_needed ? meta_needed : 1) * sizeof(uint32_t));
+    if (pl->bits == NULL || meta_blocks_list == NULL) {
+        printf("Error in allocating memory for the block list\n");
+        free(meta_blocks_list);
+        free(pl->bits);
+        pl->bits = NULL;
+        return -1;
+    }
+    if (bitmap_alloc_n(dbm, total_needed, pl->bits) != 0) {
+        printf("Error: No free data blocks available\n");
+        free(meta_blocks_list);
+        free(pl->bits);
+        pl->bits = NULL;
+        return -1;
+    }
+    pl->nbits = total_needed;
+
+    // bitmap bits are relative to the data region, inode pointers are absolute block numbers
+    for (uint64_t i = 0; i < meta_needed; i++) meta_blocks_list[i] = sb->data_region_start + pl->bits[i];
+    for (uint64_t i = 0, d = meta_needed; i < n; i++) {
+        phys[i] = is_hole(holes, i) ? 0 : sb->data_region_start + pl->bits[d++];
+    }
+    if (hole_count > 0) ino->flags |= INODE_FL_SPARSE;
+
+    //Setting direct/indirect pointers to the free data blocks (where the file is to be placed later)
+    //and filling the indirect pointer blocks in the mapped image
+    int rc = map_write(img, ino, phys, n, meta_blocks_list);
+    free(meta_blocks_list);
+    if (rc != 0) {
+        printf("Error in writing indirect blocks to img file\n");
+        release_blocks(dbm, pl);
+        return -1;
+    }
+    return 0;
+}
+
+// A new regular file inode, its map still empty
+static void new_file_inode(inode_t *ino, uint64_t size) {
+    memset(ino, 0, sizeof(*ino));
+    ino->mode = 0x8000; //Regular file
+    ino->links = 1;     // one link: the entry in its parent directory (v->parent)
+    ino->size_bytes = size; //the size of the file (in bytes) that this inode is pointing to
+    ino->atime = time(NULL);
+    ino->mtime = time(NULL);
+    ino->ctime = time(NULL);
+    ino->proj_id = 8; //group ID
+}
+
+// Adds one file to the mapped image, in directory v->parent. Bitmaps and directory
+// inode are changed in place; volume_commit() finalizes the directory inodes and
+// superblock once for the whole batch.
+// The blocks are placed by place_blocks(); all-zero blocks get no data block at
+// all, they become holes (INODE_FL_SPARSE).
+// Returns the new inode number, or -1 (bitmap bits taken for this file are given back).
+static int64_t add_file(volume_t *v, const char *name, FILE *fp, uint64_t size, int use_extents) {
+    image_t *img = &v->img;
+    bitmap_t *ibm = &v->ibm, *dbm = &v->dbm;
+    inode_t *dir_inode = v->parent;
+
+    //Finding and allocating a free inode from inode bitmap
+    //bit i is inode number i+1
+    int64_t free_inode = bitmap_alloc(ibm);
+    if (free_inode == -1) {
+        printf("Error: No free inodes available\n");
+        return -1;
+    }
+
+    //calculating how many blocks the file needs
+
+    //ceiling. e.g. if blocks needed=1.2, I would still need 2 blocks to store the file
+    uint64_t blocks_needed = map_file_blocks(size);
+    
+    //Create the new inode (built on the stack, stored into the inode table once it is complete)
+    inode_t new_inode;
+    new_file_inode(&new_inode, size);
+
+    //Holes: the all-zero blocks of the file, which need no data block
+    uint64_t hole_count = 0;
+    uint8_t *holes = find_holes(v, fp, size, &hole_count);
+
+    //phys[i]: the data block of file block i (0 = hole); runs: what copy_blocks() copies at once
+    uint32_t *phys = malloc((blocks_needed ? blocks_needed : 1) * sizeof(uint32_t));
+    extent_t *runs = malloc((blocks_needed ? blocks_needed : 1) * sizeof(extent_t));
+    placement_t pl;
+    if (phys == NULL || runs == NULL) {
+        printf("Error in allocating memory for the block list\n");
+        goto fail_early;
+    }
+    if (place_blocks(v, &new_inode, holes, hole_count, blocks_needed, use_extents, phys, &pl) != 0) goto fail_early;
+
+    //Writing file data to data blocks ==========================================================================
+    if (copy_blocks(v, fp, size, phys, blocks_needed, runs) != 0) goto fail;
+
+    // Adding directory entry for the new file
+    if (add_directory_entry(img, dbm, dir_inode, free_inode + 1, 1, name) != 0) {
+        printf("Error in adding directory entry of the new file to add\n");
+        goto fail;
+    }
+
+    //Writing new inode into the mapped inode table
+    //free_inode no. = free_inode+1 (bc 1-indexing)
+    inode_crc_finalize(&new_inode);
+    *image_inode(img, free_inode + 1) = new_inode;
+
+    //As new file adds a link to its directory
+    //Updating the directory's link count (its crc is finalized once, by commit_batch)
+    dir_inode->links++;
+
+    v->hole_blocks += hole_count;
+    free(holes);
+    free(phys);
+    free(runs);
+    free(pl.bits);
+    return free_inode + 1;
+
+fail:
+    // give the bits back so the bitmaps only describe files that were really added
+    release_blocks(dbm, &pl);
+fail_early:
+    bitmap_clear(ibm, free_inode);
+    free(holes);
+    free(phys);
+    free(runs);
+    return -1;
+}
+
+// A file of 1..INLINE_MAX bytes goes into its inode (INODE_FL_INLINE): no data
+// block, no data bitmap bit, and reading it back costs the inode alone
+static int64_t add_inline(volume_t *v, const char *name, FILE *fp, uint64_t size) {
+    uint8_t data[INLINE_MAX];
+    if (fread(data, 1, size, fp) != size) {
+        printf("Error in reading file data\n");
+        return -1;
+    }
+    int64_t free_inode = bitmap_alloc(&v->ibm);
+    if (free_inode == -1) {
+        printf("Error: No free inodes available\n");
+        return -1;
+    }
+    inode_t ino;
+    new_file_inode(&ino, size);
+    if (map_write_inline(&ino, data, size) != 0 ||
+        add_directory_entry(&v->img, &v->dbm, v->parent, free_inode + 1, 1, name) != 0) {
+        printf("Error in adding directory entry of the new file to add\n");
+        bitmap_clear(&v->ibm, free_inode);
+        return -1;
+    }
+    inode_crc_finalize(&ino);
+    *image_inode(&v->img, free_inode + 1) = ino;
+    v->parent->links++;
+    v->inline_files++;
+    return free_inode + 1;
+}
+
+// ==========================COMPRESSED FILES===================================
+// With v->compress a file is read one cluster at a time and packed
+// (compress_cluster()) into memory, so its size, and the blocks it needs, are
+// known before anything is allocated: the packed clusters take
+// O(compressed size) of memory. The blocks a compressed cluster does not use
+// are holes of the map (compress.h), and so are whole clusters of zeros;
+// place_blocks() then lays the file out like any other. Works for streams
+// too (size VOLUME_STREAM: read to EOF).
+static int64_t add_compressed(volume_t *v, const char *name, FILE *fp, uint64_t size, int use_extents) {
+    image_t *img = &v->img;
+    int64_t free_inode = bitmap_alloc(&v->ibm);
+    if (free_inode == -1) {
+        printf("Error: No free inodes available\n");
+        return -1;
+    }
+
+    uint8_t *raw = malloc(COMPRESS_CLUSTER_BYTES);
+    uint8_t *packed = NULL, *holes = NULL;
+    uint32_t *phys = NULL;
+    uint64_t packed_cap = 0, stored = 0;   // packed holds the stored blocks, in file order
+    uint64_t n = 0, holes_cap = 0, hole_count = 0, total = 0;
+    compress_stats_t zs = {0};
+    placement_t pl;
+    if (raw == NULL) goto nomem;
+
+    // the whole file, cluster by cluster
+    for (;;) {
+        size_t want = COMPRESS_CLUSTER_BYTES;
+        if (size != VOLUME_STREAM && size - total < want) want = (size_t)(size - total);
+        size_t got = want ? fread(raw, 1, want, fp) : 0;
+        if (ferror(fp) || (size != VOLUME_STREAM && got < want)) {
+            printf("Error in reading file data\n");
+            goto fail_early;
+        }
+        if (got == 0) break;
+        uint64_t nblocks = (got + BS - 1) / BS;
+        if (n + nblocks > MAP_MAX_BLOCKS) {
+            printf("Error: File is too large, the limit is %" PRIu64 " blocks\n", (uint64_t)MAP_MAX_BLOCKS);
+            goto fail_early;
+        }
+        if (packed_cap < (stored + nblocks) * BS) {
+            packed_cap = packed_cap ? packed_cap * 2 : 16 * COMPRESS_CLUSTER_BYTES;
+            uint8_t *p = realloc(packed, packed_cap);
+            if (p == NULL) goto nomem;
+            packed = p;
+        }
+        if (holes_cap < (n + nblocks + 7) / 8) {
+            uint64_t cap = holes_cap ? holes_cap * 2 : 64;
+            uint8_t *h = realloc(holes, cap);
+            if (h == NULL) goto nomem;
+            memset(h + holes_cap, 0, cap - holes_cap);
+            holes = h;
+            holes_cap = cap;
+        }
+        uint32_t k = 0;   // blocks stored: 0 for a cluster of zeros
+        if (v->holes && sparse_is_zero(raw, got)) {
+            zs.clusters++;
+            zs.zero_clusters++;
+            zs.bytes_in += got;
+        } else {
+            k = compress_cluster(raw, got, packed + stored * BS, &zs);
+        }
+        for (uint64_t b = k; b < nblocks; b++) holes[(n + b) >> 3] |= (uint8_t)(1u << ((n + b) & 7));
+        hole_count += nblocks - k;
+        stored += k;
+        n += nblocks;
+        total += got;
+        if (got < COMPRESS_CLUSTER_BYTES) break;
+    }
+
+    inode_t ino;
+    new_file_inode(&ino, total);
+    phys = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (phys == NULL) goto nomem;
+    if (place_blocks(v, &ino, holes, hole_count, n, use_extents, phys, &pl) != 0) goto fail_early;
+    ino.flags |= INODE_FL_COMPRESSED;
+
+    // the stored blocks, in file order, into the mapping (written home by the commit)
+    for (uint64_t i = 0, j = 0; i < n; i++) {
+        if (phys[i] == 0) continue;
+        uint8_t *dst = image_block(img, phys[i]);
+        if (dst == NULL) {
+            printf("Error: data block outside the image\n");
+            goto fail;
+        }
+        memcpy(dst, packed + j++ * BS, BS);
+    }
+    if (add_directory_entry(img, &v->dbm, v->parent, free_inode + 1, 1, name) != 0) {
+        printf("Error in adding directory entry of the new file to add\n");
+        goto fail;
+    }
+    inode_crc_finalize(&ino);
+    *image_inode(img, free_inode + 1) = ino;
+    v->parent->links++;
+
+    zs.files = 1;
+    v->zstats.files += zs.files;
+    v->zstats.clusters += zs.clusters;
+    v->zstats.raw_clusters += zs.raw_clusters;
+    v->zstats.zero_clusters += zs.zero_clusters;
+    v->zstats.bytes_in += zs.bytes_in;
+    v->zstats.bytes_packed += zs.bytes_packed;
+    v->zstats.blocks_out += zs.blocks_out;
+    v->zstats.seconds += zs.seconds;
+    free(raw);
+    free(packed);
+    free(holes);
+    free(phys);
+    free(pl.bits);
+    return free_inode + 1;
+
+nomem:
+    printf("Error in allocating memory for the compressed file\n");
+    goto fail_early;
+fail:
+    release_blocks(&v->dbm, &pl);
+fail_early:
+    bitmap_clear(&v->ibm, free_inode);
+    free(raw);
+    free(packed);
+    free(holes);
+    free(phys);
+    return -1;
+}
+// ==========================COMPRESSED FILES===================================
+
+// ==========================DEDUPLICATED FILES=================================
+// With v->dedup the file is read DEDUP_CHUNK blocks at a time and every block
+// is hashed and looked up in the image's dedup index (dedup.h): one already
+// stored is shared (one more reference), a new one gets a block of its own at
+// once, is copied into the mapping and goes into the index, so a block that
+// repeats within the file is shared too. All-zero blocks become holes as
+// usual. Once every block is known the map is built: extents when the blocks
+// fall into at most EXTENT_MAX runs, holes included, a block map otherwise,
+// its pointer blocks allocated last. Each chunk's new blocks are sent home
+// like a stream's (journal_write_data(), or dropped from the shared mapping),
+// and streams (size VOLUME_STREAM) work the same way.
+#define DEDUP_CHUNK 256   // blocks per fread, 1 MiB
+
+// What happened to each file block, so a failed add can undo it
+enum { DD_HOLE, DD_NEW, DD_SHARED, DD_UNINDEXED };
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sends home (or drops) the runs of newly stored blocks among phys[first, first+count)
+static int dedup_flush(volume_t *v, const uint32_t *phys, const uint8_t *kind, uint64_t first, uint64_t count) {
+    for (uint64_t k = first, e; k < first + count; k = e) {
+        for (e = k + 1; e < first + count && kind[e] == kind[k] && phys[e] == phys[e - 1] + 1;) e++;
+        if (kind[k] != DD_NEW && kind[k] != DD_UNINDEXED) continue;
+        if (v->journal == NULL) image_advise(&v->img, phys[k], e - k, IMAGE_ADV_DONTNEED);
+        else if (journal_write_data(v->journal, phys[k], e - k) != 0) return -1;
+    }
+    return 0;
+}
+
+static int64_t add_dedup(volume_t *v, const char *name, FILE *fp, uint64_t size, int use_extents) {
+    image_t *img = &v->img;
+    uint64_t drs = img->sb->data_region_start;
+    if (!v->dd.loaded && dedup_load(&v->dd, img) != 0) {
+        printf("Error: the dedup table of the image is damaged\n");
+        return -1;
+    }
+    int64_t free_inode = bitmap_alloc(&v->ibm);
+    if (free_inode == -1) {
+        printf("Error: No free inodes available\n");
+        return -1;
+    }
+
+    uint8_t *buf = malloc((size_t)DEDUP_CHUNK * BS);
+    uint32_t *phys = NULL;
+    uint8_t *kind = NULL, (*hash)[DEDUP_HASH_BYTES] = NULL;
+    uint64_t n = 0, cap = 0, total = 0, hole_count = 0, meta_count = 0;
+    uint64_t *meta_bits = NULL;
+    uint32_t *meta = NULL;
+    dedup_t *dd = &v->dd;
+    uint64_t blocks0 = dd->blocks, shared0 = dd->shared, collisions0 = dd->collisions;
+    if (buf == NULL) goto nomem;
+
+    for (int eof = 0; !eof;) {
+        size_t want = (size_t)DEDUP_CHUNK * BS;
+        if (size != VOLUME_STREAM && size - total < want) want = (size_t)(size - total);
+        size_t got = want ? fread(buf, 1, want, fp) : 0;
+        if (ferror(fp) || (size != VOLUME_STREAM && got < want)) {
+            printf("Error in reading file data\n");
+            goto fail;
+        }
+        eof = got < (size_t)DEDUP_CHUNK * BS;
+        if (got == 0) break;
+        uint64_t nblocks = (got + BS - 1) / BS;
+        memset(buf + got, 0, nblocks * BS - got);
+        if (n + nblocks > MAP_MAX_BLOCKS) {
+            printf("Error: File is too large, the limit is %" PRIu64 " blocks\n", (uint64_t)MAP_MAX_BLOCKS);
+            goto fail;
+        }
+        if (cap < n + nblocks) {
+            uint64_t c = cap ? cap * 2 : 4 * DEDUP_CHUNK;
+            while (c < n + nblocks) c *= 2;
+            uint32_t *p = realloc(phys, c * sizeof(*phys));
+            if (p != NULL) phys = p;
+            uint8_t *k = realloc(kind, c);
+            if (k != NULL) kind = k;
+            uint8_t (*h)[DEDUP_HASH_BYTES] = realloc(hash, c * DEDUP_HASH_BYTES);
+            if (h != NULL) hash = h;
+            if (p == NULL || k == NULL || h == NULL) goto nomem;
+            cap = c;
+        }
+
+        for (uint64_t k = 0; k < nblocks; k++) {
+            const uint8_t *blk = buf + k * BS;
+            uint64_t i = n + k;
+            if (v->holes && sparse_is_zero(blk, BS)) {
+                phys[i] = 0;
+                kind[i] = DD_HOLE;
+                hole_count++;
+                continue;
+            }
+            double t0 = now_sec();
+            dedup_hash(blk, hash[i]);
+            dd->seconds += now_sec() - t0;
+            dd->blocks++;
+            dedup_entry_t *e = dedup_find(dd, hash[i]);
+            const uint8_t *old = e ? image_block(img, e->block) : NULL;
+            if (old != NULL && memcmp(old, blk, BS) == 0) {
+                e->refs++;
+                dd->dirty = 1;
+                dd->shared++;
+                phys[i] = e->block;
+                kind[i] = DD_SHARED;
+                continue;
+            }
+            if (e != NULL) dd->collisions++;
+            int64_t bit = bitmap_alloc(&v->dbm);
+            uint8_t *dst = bit < 0 ? NULL : image_block(img, drs + (uint64_t)bit);
+            if (dst == NULL) {
+                if (bit >= 0) bitmap_clear(&v->dbm, (uint64_t)bit);
+                printf("Error: No free data blocks available\n");
+                n += k;
+                goto fail;
+            }
+            memcpy(dst, blk, BS);
+            phys[i] = (uint32_t)(drs + (uint64_t)bit);
+            // a colliding hash keeps its entry: this block is stored but not indexed
+            kind[i] = e ? DD_UNINDEXED : DD_NEW;
+            if (e == NULL && dedup_insert(dd, hash[i], phys[i]) == NULL) {
+                kind[i] = DD_UNINDEXED;
+                n += k + 1;
+                goto nomem;
+            }
+        }
+        if (dedup_flush(v, phys, kind, n, nblocks) != 0) {
+            printf("Error in writing file data\n");
+            n += nblocks;
+            goto fail;
+        }
+        n += nblocks;
+        total += got;
+    }
+
+    inode_t ino;
+    new_file_inode(&ino, total);
+    if (hole_count > 0) ino.flags |= INODE_FL_SPARSE;
+
+    // extents: a run continues while the blocks are adjacent (or both holes)
+    extent_t ext[EXTENT_MAX];
+    int count = 0;
+    for (uint64_t i = 0; use_extents && count <= EXTENT_MAX && i < n; i++) {
+        extent_t *last = count > 0 ? &ext[count - 1] : NULL;
+        if (last != NULL && last->len < UINT32_MAX &&
+            (phys[i] == 0 ? last->start == 0 : last->start != 0 && phys[i] == last->start + last->len)) {
+            last->len++;
+        } else if (count++ < EXTENT_MAX) {
+            ext[count - 1].start = phys[i];
+            ext[count - 1].len = 1;
+        }
+    }
+    if (use_extents && n > 0 && count <= EXTENT_MAX) {
+        if (map_write_extents(&ino, ext, count) != 0) goto fail;
+    } else {
+        uint64_t m = map_meta_blocks(n);
+        meta_bits = malloc((m ? m : 1) * sizeof(uint64_t));
+        meta = malloc((m ? m : 1) * sizeof(uint32_t));
+        if (meta_bits == NULL || meta == NULL) goto nomem;
+        if (bitmap_alloc_n(&v->dbm, m, meta_bits) != 0) {
+            printf("Error: No free data blocks available\n");
+            goto fail;
+        }
+        meta_count = m;
+        for (uint64_t k = 0; k < meta_count; k++) meta[k] = drs + meta_bits[k];
+        if (map_write(img, &ino, phys, n, meta) != 0) {
+            printf("Error in writing indirect blocks to img file\n");
+            goto fail;
+        }
+    }
+    if (add_directory_entry(img, &v->dbm, v->parent, free_inode + 1, 1, name) != 0) {
+        printf("Error in adding directory entry of the new file to add\n");
+        goto fail;
+    }
+    inode_crc_finalize(&ino);
+    *image_inode(img, free_inode + 1) = ino;
+    v->parent->links++;
+    v->hole_blocks += hole_count;
+    free(buf);
+    free(phys);
+    free(kind);
+    free(hash);
+    free(meta_bits);
+    free(meta);
+    return free_inode + 1;
+
+nomem:
+    printf("Error in allocating memory for the deduplicated file\n");
+fail:
+    // the first n file blocks were placed: give back what they took
+    for (uint64_t i = 0; i < n; i++) {
+        if (kind[i] == DD_NEW || kind[i] == DD_SHARED) dedup_unref(dd, hash[i]);
+        if (kind[i] == DD_NEW || kind[i] == DD_UNINDEXED) bitmap_clear(&v->dbm, phys[i] - drs);
+    }
+    for (uint64_t k = 0; k < meta_count; k++) bitmap_clear(&v->dbm, meta_bits[k]);
+    dd->blocks = blocks0;
+    dd->shared = shared0;
+    dd->collisions = collisions0;
+    bitmap_clear(&v->ibm, free_inode);
+    free(buf);
+    free(phys);
+    free(kind);
+    free(hash);
+    free(meta_bits);
+    free(meta);
+    return -1;
+}
+// ==========================DEDUPLICATED FILES=================================
+
+// ==========================STREAMED FILES=====================================
+// A file of unknown length (pipe, FIFO, stdin) is read STREAM_CHUNK blocks at a
+// time, straight into blocks allocated just before the read. Extents are grown in
+// place while the blocks after the last one are free, and a new extent starts on
+// the longest free run; when the EXTENT_MAX extents are used up the file switches
+// to a block map, which grows one pointer block at a time. Each chunk is sent
+// home as soon as it is full (journal_write_data(), or dropped from the shared
+// mapping), so memory use does not depend on the length of the file.
+// All-zero blocks of a chunk give their blocks back at once and become holes
+// (hole extents, 0 pointers). They were read into the mapping all the same: the
+// private mapping of a journaled image never writes them, the shared one does.
+#define STREAM_CHUNK 256   // blocks per fread, 1 MiB
+
+typedef struct {
+    image_t *img;
+    bitmap_t *dbm;
+    inode_t ino;             // built here, stored into the inode table at the end
+    uint64_t blocks;         // file blocks so far
+    extent_t ext[EXTENT_MAX];
+    int ext_count;           // -1 once the file is block-mapped
+} stream_t;
+
+// Appends data block `block` to a block-mapped stream, with the pointer blocks it needs
+static int stream_append(stream_t *st, uint32_t block) {
+    uint64_t bits[2];
+    uint32_t meta[2];
+    int m = map_append_meta(st->blocks);
+    if (bitmap_alloc_n(st->dbm, m, bits) != 0) {
+        printf("Error: No free data blocks available\n");
+        return -1;
+    }
+    for (int k = 0; k < m; k++) meta[k] = st->img->sb->data_region_start + bits[k];
+    if (map_append(st->img, &st->ino, st->blocks, block, meta) != 0) {
+        for (int k = 0; k < m; k++) bitmap_clear(st->dbm, bits[k]);
+        printf("Error in writing indirect blocks to img file\n");
+        return -1;
+    }
+    st->blocks++;
+    return 0;
+}
+
+// Gives back every block the stream took (data and pointer blocks)
+static void stream_release(stream_t *st) {
+    uint64_t drs = st->img->sb->data_region_start;
+    if (st->ext_count >= 0) {
+        for (int e = 0; e < st->ext_count; e++) {
+            if (st->ext[e].start != 0) bitmap_clear_range(st->dbm, st->ext[e].start - drs, st->ext[e].len);
+        }
+        return;
+    }
+    for (uint64_t i = 0; i < st->blocks; i++) {
+        uint32_t b = map_block(st->img, &st->ino, i);
+        if (b >= drs) bitmap_clear(st->dbm, b - drs);
+    }
+    if (st->blocks > DIRECT_MAX + PTRS_PER_BLOCK) {
+        uint64_t leaves = (st->blocks - DIRECT_MAX - PTRS_PER_BLOCK + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
+        const uint32_t *top = (const uint32_t *)image_block(st->img, st->ino.indirect2);
+        for (uint64_t k = 0; top != NULL && k < leaves; k++) if (top[k] >= drs) bitmap_clear(st->dbm, top[k] - drs);
+        bitmap_clear(st->dbm, st->ino.indirect2 - drs);
+    }
+    if (st->blocks > DIRECT_MAX) bitmap_clear(st->dbm, st->ino.indirect1 - drs);
+}
+
+// Out of extents: the blocks read so far become the start of a block map
+static int stream_to_block_map(stream_t *st) {
+    extent_t ext[EXTENT_MAX];
+    int count = st->ext_count;
+    memcpy(ext, st->ext, sizeof(ext));
+    uint64_t n = st->blocks;
+    st->blocks = 0;
+    st->ext_count = -1;
+    for (int e = 0; e < count; e++) {
+        for (uint32_t k = 0; k < ext[e].len; k++) {
+            if (stream_append(st, ext[e].start ? ext[e].start + k : 0) == 0) continue;
+            // give back the pointer blocks taken so far (and, harmlessly early, some
+            // data blocks), then put the extents back so the caller releases the rest
+            stream_release(st);
+            st->blocks = n;
+            st->ext_count = count;
+            memset(st->ino.direct, 0, sizeof(st->ino.direct));
+            st->ino.indirect1 = st->ino.indirect2 = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Appends len blocks from first (0: a hole) to the stream, merged into the last
+// extent where they continue it; out of extents, the stream becomes block-mapped
+static int stream_append_run(stream_t *st, uint64_t first, uint64_t len) {
+    if (st->ext_count >= 0) {
+        extent_t *last = st->ext_count > 0 ? &st->ext[st->ext_count - 1] : NULL;
+        if (last != NULL && (first == 0 ? last->start == 0 : last->start != 0 && (uint64_t)last->start + last->len == first)
+            && len <= UINT32_MAX - last->len) {
+            last->len += len;
+            st->blocks += len;
+            return 0;
+        }
+        if (st->ext_count < EXTENT_MAX) {
+            st->ext[st->ext_count].start = (uint32_t)first;
+            st->ext[st->ext_count].len = (uint32_t)len;
+            st->ext_count++;
+            st->blocks += len;
+            return 0;
+        }
+        if (stream_to_block_map(st) != 0) return -1;
+    }
+    for (uint64_t k = 0; k < len; k++) {
+        if (stream_append(st, first ? (uint32_t)(first + k) : 0) != 0) return -1;
+    }
+    return 0;
+}
+
+// Picks and allocates the blocks the next chunk is read into: *first, *count (absolute)
+static int stream_next_run(stream_t *st, uint64_t *first, uint64_t *count) {
+    uint64_t drs = st->img->sb->data_region_start, bit = 0, len = 0, s;
+    uint64_t room = MAP_MAX_BLOCKS - st->blocks;
+    if (st->ext_count > 0 && st->ext[st->ext_count - 1].start != 0) {
+        // grow the last extent in place
+        const extent_t *last = &st->ext[st->ext_count - 1];
+        uint64_t end = (uint64_t)last->start + last->len - drs;
+        if (end < st->dbm->nbits && !bitmap_test(st->dbm, end) && bitmap_next_run(st->dbm, end, &s, &len)) bit = end;
+        if (len > UINT32_MAX - last->len) len = UINT32_MAX - last->len;
+    }
+    if (len == 0 && st->ext_count >= 0 && st->ext_count < EXTENT_MAX) len = bitmap_largest_run(st->dbm, &bit);
+    if (len == 0 && st->ext_count == EXTENT_MAX && stream_to_block_map(st) != 0) return -1;
+    if (len == 0 && st->ext_count < 0) {
+        // block map: the next free run from where the last allocation stopped
+        if (bitmap_next_run(st->dbm, st->dbm->hint, &bit, &len) == 0 && bitmap_next_run(st->dbm, 0, &bit, &len) == 0) len = 0;
+    }
+    if (len == 0 && (st->dbm->lo != 0 || st->dbm->hi != st->dbm->nbits)) {
+        // the file's group is full: the rest of it goes wherever there is room
+        bitmap_window(st->dbm, 0, st->dbm->nbits);
+        return stream_next_run(st, first, count);
+    }
+    if (len == 0) {
+        printf("Error: No free data blocks available\n");
+        return -1;
+    }
+    if (len > STREAM_CHUNK) len = STREAM_CHUNK;
+    if (len > room) len = room;
+    bitmap_set_range(st->dbm, bit, len);
+    st->dbm->hint = bit + len;
+    *first = drs + bit;
+    *count = len;
+    return 0;
+}
+
+// Adds the rest of fp, read to EOF, as a new file: add_file() for a file whose
+// length is not known until it has been read.
+static int64_t add_stream(volume_t *v, const char *name, FILE *fp, int use_extents) {
+    image_t *img = &v->img;
+    int64_t free_inode = bitmap_alloc(&v->ibm);
+    if (free_inode == -1) {
+        printf("Error: No free inodes available\n");
+        return -1;
+    }
+
+    stream_t st;
+    memset(&st, 0, sizeof(st));
+    st.img = img;
+    st.dbm = &v->dbm;
+    st.ext_count = use_extents ? 0 : -1;
+    st.ino.mode = 0x8000; //Regular file
+    st.ino.links = 1;
+    st.ino.proj_id = 8;
+
+    uint64_t size = 0, hole_count = 0;
+    int failed = 0, eof = 0;
+    uint8_t zero[STREAM_CHUNK];   // which blocks of the chunk are all zeros
+    while (!failed && !eof) {
+        uint64_t first, count;
+        if (st.blocks == MAP_MAX_BLOCKS) {
+            // the map is full: fine only if the file ends here
+            if (fgetc(fp) != EOF) {
+                printf("Error: File is too large, the limit is %" PRIu64 " blocks\n", (uint64_t)MAP_MAX_BLOCKS);
+                failed = 1;
+            }
+            break;
+        }
+        if (stream_next_run(&st, &first, &count) != 0) {
+            failed = 1;
+            break;
+        }
+        uint8_t *run = image_blocks(img, first, count);
+        size_t got = run ? fread(run, 1, count * BS, fp) : 0;
+        uint64_t used = (got + BS - 1) / BS;
+        if (run == NULL || ferror(fp)) {
+            printf("Error in reading file data\n");
+            failed = 1;
+            used = 0;
+        } else if (got < count * BS) {
+            eof = 1;
+            if (used > 0) memset(run + got, 0, used * BS - got);
+        }
+        // the blocks the chunk did not need go back at once
+        bitmap_clear_range(&v->dbm, first - img->sb->data_region_start + used, count - used);
+        if (used == 0) continue;
+
+        // the chunk's pieces: runs of data blocks and, with v->holes, the runs of
+        // all-zero blocks between them, whose blocks go back at once
+        uint64_t drs = img->sb->data_region_start;
+        for (uint64_t k = 0; k < used; k++) zero[k] = v->holes && sparse_is_zero(run + k * BS, BS);
+        for (uint64_t k = 0, e; !failed && k < used; k = e) {
+            for (e = k + 1; e < used && zero[e] == zero[k];) e++;
+            if (zero[k]) {
+                bitmap_clear_range(&v->dbm, first - drs + k, e - k);
+                hole_count += e - k;
+            }
+            if (stream_append_run(&st, zero[k] ? 0 : first + k, e - k) != 0) {
+                bitmap_clear_range(&v->dbm, first - drs + k, used - k);
+                failed = 1;
+            } else if (!zero[k] && v->journal && journal_write_data(v->journal, first + k, e - k) != 0) {
+                // the piece is final: send it home now instead of holding it until the commit
+                printf("Error in writing file data\n");
+                failed = 1;
+            }
+        }
+        size += got;
+        if (failed) break;
+        if (v->journal == NULL) image_advise(img, first, used, IMAGE_ADV_DONTNEED);
+    }
+
+    if (!failed && v->inline_data && size > 0 && size <= INLINE_MAX) {
+        // a tiny stream after all: its bytes go into the inode and its block back.
+        // That block may have been sent home already: the commit writes them all again
+        uint8_t data[INLINE_MAX] = {0};
+        uint32_t b = st.ext_count >= 0 ? st.ext[0].start : map_block(img, &st.ino, 0);
+        const uint8_t *p = b ? image_block(img, b) : NULL;   // 0: a hole, all zeros
+        if (p != NULL) memcpy(data, p, size);
+        stream_release(&st);
+        if (v->journal) journal_forget_data(v->journal);
+        memset(st.ino.direct, 0, sizeof(st.ino.direct));
+        st.ino.indirect1 = st.ino.indirect2 = 0;
+        st.ext_count = 0;
+        hole_count = 0;
+        map_write_inline(&st.ino, data, size);
+        v->inline_files++;
+    }
+    if (!failed && st.ext_count < 0 && hole_count > 0) st.ino.flags |= INODE_FL_SPARSE;
+    if (!failed && st.ext_count > 0 && map_write_extents(&st.ino, st.ext, st.ext_count) != 0) failed = 1;
+    if (!failed && add_directory_entry(img, &v->dbm, v->parent, free_inode + 1, 1, name) != 0) {
+        printf("Error in adding directory entry of the new file to add\n");
+        failed = 1;
+    }
+    if (failed) {
+        stream_release(&st);
+        bitmap_clear(&v->ibm, free_inode);
+        return -1;
+    }
+
+    st.ino.size_bytes = size;
+    st.ino.atime = st.ino.mtime = st.ino.ctime = time(NULL);
+    inode_crc_finalize(&st.ino);
+    *image_inode(img, free_inode + 1) = st.ino;
+    v->parent->links++;
+    v->hole_blocks += hole_count;
+    return free_inode + 1;
+}
+// ==========================STREAMED FILES=====================================
+
+// A directory that got entries since the last commit: its inode crc is
+// finalized, and its inode, dirent blocks and index blocks are changed in
+// place, so the journal is told to look at them
+static int finish_dir(image_t *img, journal_t *journal, uint32_t dir_ino) {
+    inode_t *dir = image_inode(img, dir_ino);
+    if (dir == NULL) return -1;
+    inode_crc_finalize(dir);
+    if (journal == NULL) return 0;
+
+    int rc = journal_watch(journal, image_inode_block(img, dir_ino), 1);
+    for (int i = 0; rc == 0 && i < DIRECT_MAX; i++) {
+        if (dir->direct[i] != 0) rc = journal_watch(journal, dir->direct[i], 1);
+    }
+    if (rc == 0 && (dir->flags & INODE_FL_DIR_INDEX)) {
+        dir_index_block_t *idx = (dir_index_block_t *)image_block(img, dir->indirect2);
+        rc = idx == NULL ? -1 : journal_watch(journal, dir->indirect2, idx->nblocks);
+    }
+    return rc;
+}
+
+// Finishes the metadata of everything added so far: the root and every other
+// changed directory (finish_dir), superblock mtime and crc. With a journal this
+// is also the commit, one transaction and one flush for all of it.
+static int commit_batch(volume_t *v) {
+    image_t *img = &v->img;
+    superblock_t *sb = img->sb;
+    int rc = finish_dir(img, v->journal, ROOT_INO);
+    for (int i = 0; rc == 0 && i < v->ndirs; i++) rc = finish_dir(img, v->journal, v->dirs[i]);
+    v->ndirs = 0;
+    sb->mtime_epoch = time(NULL);
+    superblock_crc_finalize(sb);
+    if (v->journal == NULL) return rc;
+    return rc == 0 ? journal_commit(v->journal) : -1;
+}
+
+
+int volume_open(volume_t *v, const char *path, size_t cache_blocks) {
+    memset(v, 0, sizeof(*v));
+
+    // mapped private first: an image with a journal stays that way,
+    // so nothing reaches the file before journal_commit() has logged it
+    if (image_open(&v->img, path, IMAGE_PRIVATE) != 0) {
+        printf("Error in opening and mapping %s\n", path);
+        return -1;
+    }
+    if (image_check_layout(&v->img) != 0) {
+        printf("Error: %s is not a valid MiniVSFS image\n", path);
+        image_close(&v->img);
+        return -1;
+    }
+
+    int replayed = 0;
+    if (v->img.sb->flags & SB_FL_JOURNAL) {
+        // finish whatever an interrupted run committed but did not write home
+        replayed = journal_open(&v->jnl, &v->img, cache_blocks);
+        if (replayed < 0) {
+            printf("Error: the journal of %s is damaged\n", path);
+            image_close(&v->img);
+            return -1;
+        }
+        v->journal = &v->jnl;
+    } else {
+        // no journal: shared mapping, written back with one msync per commit
+        image_close(&v->img);
+        if (image_open(&v->img, path, IMAGE_WRITE) != 0 || image_check_layout(&v->img) != 0) {
+            printf("Error in opening and mapping %s\n", path);
+            return -1;
+        }
+    }
+
+    superblock_t *sb = v->img.sb;
+    v->root = image_inode(&v->img, ROOT_INO);
+    if (v->root == NULL) {
+        printf("Error: could not read root inode\n");
+        volume_close(v);
+        return -1;
+    }
+    bitmap_init(&v->ibm, image_inode_bitmap(&v->img), sb->inode_count);
+    bitmap_init(&v->dbm, image_data_bitmap(&v->img), sb->data_region_blocks);
+    // free-space summaries for the allocations to come; without memory for
+    // them the bitmaps are simply searched word by word
+    bitmap_summarize(&v->ibm);
+    bitmap_summarize(&v->dbm);
+
+    // Most blocks a transaction logs: block 0, the root inode block and every
+    // bitmap block, plus ADD_LOGGED_BLOCKS per file
+    v->txn_base = 2 + sb->inode_bitmap_blocks + sb->data_bitmap_blocks;
+    v->pending = v->txn_base;
+    writer_init(&v->writer, v->img.fd, WRITER_PIPELINED);
+    v->holes = 1;
+    v->inline_data = 1;
+    return replayed;
+}
+
+// Block groups: windows both bitmaps to the group the next file goes to.
+// First fit from the group of the last add, among the groups with a free
+// inode and enough free blocks for the file and its pointer blocks; a stream,
+// whose size is unknown, takes the group with the most free blocks. When no
+// group has room for the data, only the inode is kept to a group (a spill).
+static void enter_group(volume_t *v, uint64_t size) {
+    const superblock_t *sb = v->img.sb;
+    const superblock_ext_t *ext = SB_EXT(sb);
+    const group_desc_t *gd = image_groups(&v->img);
+    uint64_t ipg = ext->inodes_per_group, need = 0;
+    if (size != VOLUME_STREAM && !(v->inline_data && size > 0 && size <= INLINE_MAX)) {
+        uint64_t n = map_file_blocks(size), m = map_meta_blocks(n);
+        need = m == UINT64_MAX ? UINT64_MAX : n + m;
+    }
+    uint64_t best = UINT64_MAX, best_free = 0;
+    for (uint64_t k = 0; k < ext->group_count; k++) {
+        uint64_t g = (v->group + k) % ext->group_count;
+        if (gd[g].first_inode == 0 || bitmap_count_free_in(&v->ibm, g * ipg, (g + 1) * ipg) == 0) continue;
+        uint64_t lo = gd[g].first_block - sb->data_region_start;
+        uint64_t free_blocks = bitmap_count_free_in(&v->dbm, lo, lo + gd[g].blocks);
+        if (best == UINT64_MAX || free_blocks > best_free) {
+            best = g;
+            best_free = free_blocks;
+        }
+        if (size != VOLUME_STREAM && free_blocks >= need) {
+            best = g;
+            best_free = free_blocks;
+            break;
+        }
+    }
+    if (best == UINT64_MAX) return;   // no free inode anywhere: the add reports it
+    v->group = best;
+    bitmap_window(&v->ibm, best * ipg, (best + 1) * ipg);
+    if (size != VOLUME_STREAM && best_free < need) {
+        v->group_spills++;
+        return;
+    }
+    uint64_t lo = gd[best].first_block - sb->data_region_start;
+    bitmap_window(&v->dbm, lo, lo + gd[best].blocks);
+}
+
+// Commits early when the next add or mkdir might not fit in the open transaction:
+// the journal could not log it, or the list of changed directories is full
+static int make_room(volume_t *v) {
+    if (v->ndirs == VOLUME_MAX_DIRS) return volume_commit(v);
+    if (v->journal && v->pending > v->txn_base && v->pending + ADD_LOGGED_BLOCKS > journal_capacity(v->journal)) {
+        return volume_commit(v);
+    }
+    return 0;
+}
+
+// Directory dir_ino got a new entry: the commit finishes it (the root always is)
+static void touch_dir(volume_t *v, uint32_t dir_ino) {
+    if (dir_ino == ROOT_INO) return;
+    for (int i = 0; i < v->ndirs; i++) {
+        if (v->dirs[i] == dir_ino) return;
+    }
+    v->dirs[v->ndirs++] = dir_ino;
+}
+
+// After an entry went into dir: a directory other than the root gets a hash
+// index once it needs a second dirent block. If its index moved and freed the
+// old blocks, they must not be handed out again before that is committed (new
+// data is written in place, over the old index): commit now. A failed commit
+// shows in the next volume_commit()
+static void after_entry(volume_t *v, inode_t *dir, uint32_t index_start) {
+    if (!(dir->flags & INODE_FL_DIR_INDEX) && dir->direct[1] != 0) dir_index_build(&v->img, &v->dbm, dir, 1);
+    if (v->journal && index_start != 0 && dir->indirect2 != index_start) volume_commit(v);
+}
+
+// Creates directory `name` in directory parent_ino: one inode and one dirent
+// block holding "." and "..", in the same group on an image with block groups.
+// The new inode number, or -1 (message printed, nothing allocated)
+static int64_t make_dir(volume_t *v, uint32_t parent_ino, const char *name) {
+    image_t *img = &v->img;
+    if (make_room(v) != 0) return -1;
+    inode_t *parent = image_inode(img, parent_ino);
+    uint32_t index_start = parent->indirect2;
+    if (img->sb->flags & SB_FL_GROUPS) enter_group(v, BS);
+    int64_t free_inode = bitmap_alloc(&v->ibm);
+    int64_t bit = free_inode < 0 ? -1 : bitmap_alloc(&v->dbm);
+    bitmap_window(&v->ibm, 0, v->ibm.nbits);
+    bitmap_window(&v->dbm, 0, v->dbm.nbits);
+    dirent64_t *de = bit < 0 ? NULL : image_dirents(img, img->sb->data_region_start + (uint64_t)bit);
+    if (de == NULL) {
+        printf("Error: No free %s available for directory '%s'\n", free_inode < 0 ? "inodes" : "data blocks", name);
+        if (bit >= 0) bitmap_clear(&v->dbm, (uint64_t)bit);
+        if (free_inode >= 0) bitmap_clear(&v->ibm, (uint64_t)free_inode);
+        return -1;
+    }
+    uint32_t ino_no = (uint32_t)free_inode + 1;
+
+    // "." and "..", as mkfs_builder writes them for the root
+    memset(de, 0, BS);
+    de[0].inode_no = ino_no;
+    de[0].type = 2;
+    strncpy(de[0].name, ".", sizeof(de[0].name));
+    dirent_checksum_finalize(&de[0]);
+    de[1].inode_no = parent_ino;
+    de[1].type = 2;
+    strncpy(de[1].name, "..", sizeof(de[1].name));
+    dirent_checksum_finalize(&de[1]);
+
+    if (add_directory_entry(img, &v->dbm, parent, ino_no, 2, name) != 0) {
+        printf("Error in adding directory entry of the new directory '%s'\n", name);
+        bitmap_clear(&v->dbm, (uint64_t)bit);
+        bitmap_clear(&v->ibm, (uint64_t)free_inode);
+        return -1;
+    }
+    inode_t ino;
+    memset(&ino, 0, sizeof(ino));
+    ino.mode = 0x4000;   // Directory
+    ino.links = 2;       // . and ..
+    ino.size_bytes = 2 * sizeof(dirent64_t);
+    ino.atime = ino.mtime = ino.ctime = time(NULL);
+    ino.direct[0] = (uint32_t)(img->sb->data_region_start + (uint64_t)bit);
+    inode_crc_finalize(&ino);
+    *image_inode(img, ino_no) = ino;
+
+    parent->links++;
+    touch_dir(v, parent_ino);
+    dcache_add(&v->dc, parent_ino, name, ino_no, 2);
+    v->dirs_made++;
+    v->pending += ADD_LOGGED_BLOCKS;
+    v->dirty = 1;
+    after_entry(v, parent, index_start);
+    return ino_no;
+}
+
+// Walks the directories of path, creating the missing ones (make_dir), and
+// leaves its last component in leaf. The directory it goes in, or -1
+// (message printed)
+static int64_t walk_parent(volume_t *v, const char *path, char *leaf) {
+    char next[DCACHE_NAME_MAX + 1];
+    const char *p = path;
+    int64_t dir = ROOT_INO;
+    int r = path_next(&p, leaf);
+    while (r == 1 && (r = path_next(&p, next)) == 1) {
+        uint8_t type = 0;
+        int64_t child = dcache_lookup(&v->dc, &v->img, (uint32_t)dir, leaf, &type);
+        if (child < 0) child = make_dir(v, (uint32_t)dir, leaf);
+        else if (type != 2) {
+            printf("Error: '%s' in '%s' is not a directory\n", leaf, path);
+            return -1;
+        }
+        if (child < 0) return -1;
+        dir = child;
+        strcpy(leaf, next);
+    }
+    if (r < 0 || leaf[0] == '\0' || strcmp(leaf, "..") == 0) {
+        printf("Error: '%s' is not a valid path (components of at most %zu bytes)\n", path, DCACHE_NAME_MAX);
+        return -1;
+    }
+    return dir;
+}
+
+int64_t volume_add(volume_t *v, const char *path, FILE *fp, uint64_t size, int use_extents) {
+    if (v->failed) return -1;
+
+    // images made before the index existed get one with their first add (one scan
+    // of the dirent blocks); without space for it the root directory simply stays linear
+    if (!v->indexed) {
+        if (!(v->root->flags & INODE_FL_DIR_INDEX)) dir_index_build(&v->img, &v->dbm, v->root, 1);
+        v->indexed = 1;
+        v->dirty = 1;
+    }
+
+    char name[DCACHE_NAME_MAX + 1];
+    int64_t dir_ino = walk_parent(v, path, name);
+    if (dir_ino < 0) return -1;
+    if (dcache_lookup(&v->dc, &v->img, (uint32_t)dir_ino, name, NULL) >= 0) {
+        printf("Error: '%s' already exists in filesystem\n", path);
+        return -1;
+    }
+
+    // group commit: adds share one transaction, unless the journal cannot hold it all
+    if (make_room(v) != 0) return -1;
+
+    v->parent = image_inode(&v->img, (uint32_t)dir_ino);
+    uint32_t index_start = v->parent->indirect2;
+    int tiny = v->inline_data && size > 0 && size <= INLINE_MAX;   // never VOLUME_STREAM
+    if (v->img.sb->flags & SB_FL_GROUPS) enter_group(v, size);
+    int64_t inode_no = tiny ? add_inline(v, name, fp, size)
+                     : v->compress ? add_compressed(v, name, fp, size, use_extents)
+                     : v->dedup ? add_dedup(v, name, fp, size, use_extents)
+                     : size == VOLUME_STREAM ? add_stream(v, name, fp, use_extents)
+                                             : add_file(v, name, fp, size, use_extents);
+    bitmap_window(&v->ibm, 0, v->ibm.nbits);
+    bitmap_window(&v->dbm, 0, v->dbm.nbits);
+    if (inode_no < 0) {
+        // blocks already sent home may be handed out again: the commit must write them
+        if (v->journal) journal_forget_data(v->journal);
+        return -1;
+    }
+    touch_dir(v, (uint32_t)dir_ino);
+    dcache_add(&v->dc, (uint32_t)dir_ino, name, (uint32_t)inode_no, 1);
+    v->pending += ADD_LOGGED_BLOCKS;
+    v->dirty = 1;
+    after_entry(v, v->parent, index_start);
+    return inode_no;
+}
+
+int64_t volume_mkdir(volume_t *v, const char *path) {
+    if (v->failed) return -1;
+    char name[DCACHE_NAME_MAX + 1];
+    int64_t dir_ino = walk_parent(v, path, name);
+    if (dir_ino < 0) return -1;
+    uint8_t type = 0;
+    int64_t ino = dcache_lookup(&v->dc, &v->img, (uint32_t)dir_ino, name, &type);
+    if (ino >= 0 && type != 2) {
+        printf("Error: '%s' already exists in filesystem and is not a directory\n", path);
+        return -1;
+    }
+    return ino >= 0 ? ino : make_dir(v, (uint32_t)dir_ino, name);
+}
+
+int64_t volume_lookup(volume_t *v, const char *path, uint8_t *type) {
+    return path_resolve(&v->dc, &v->img, path, type);
+}
+
+int volume_commit(volume_t *v) {
+    if (v->failed) return -1;
+    if (!v->dirty) return 0;
+    // a changed dedup table goes to new blocks, in place like file data
+    int rc = v->dd.dirty ? dedup_store(&v->dd, &v->img, &v->dbm) : 0;
+    if (rc == 0) rc = commit_batch(v);
+    // msync: every dirty block of the batch goes to the file in one call
+    if (rc == 0 && v->journal == NULL) rc = image_flush(&v->img);
+    v->pending = v->txn_base;
+    v->dirty = 0;
+    if (rc != 0) v->failed = 1;
+    return rc;
+}
+
+int volume_close(volume_t *v) {
+    // with a journal everything is already in the file: make the checkpoint durable
+    int rc = v->journal ? journal_close(v->journal) : 0;
+    writer_free(&v->writer);
+    dedup_free(&v->dd);
+    dcache_free(&v->dc);
+    bitmap_release(&v->ibm);
+    bitmap_release(&v->dbm);
+    if (image_close(&v->img) != 0) rc = -1;
+    return rc;
+}
@@ -0,0 +1,109 @@
+// volume.h — an image open for adding files (mkfs_adder, mkfs_server)
+//
+// A volume is the mapped image together with what every add needs: the two
+// bitmaps used in place, the root directory inode, a dentry cache (dcache.h)
+// and the journal when the image has one. volume_add() puts a file at a path
+// below the root, creating the directories on the way that do not exist yet;
+// volume_mkdir() creates a directory the same way. volume_commit() stores the
+// dedup table if dedup adds changed it, finalizes the checksums of the
+// directory inodes that got entries and of the superblock, and makes
+// everything added since the last commit durable in one step: a journal
+// transaction (journal.h) or, on an image without a journal, one msync.
+//
+// A new directory has one dirent block; it gets a hash index (dir_index.h)
+// when it needs a second one, so small directories cost one block.
+//
+// Adds between two commits form one transaction (group commit). With a journal,
+// volume_add() commits early on its own when the transaction would outgrow the
+// journal, when a directory index moved and freed its old blocks, or when
+// VOLUME_MAX_DIRS directories besides the root got entries.
+//
+// On an image with block groups (SB_FL_GROUPS) each add first picks a group
+// and windows both bitmaps to it (bitmap_window), so the file's inode and
+// its data blocks come from the same group; directories' own blocks
+// may still come from anywhere.
+#ifndef MINIVSFS_VOLUME_H
+#define MINIVSFS_VOLUME_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bitmap.h"
+#include "compress.h"
+#include "dcache.h"
+#include "dedup.h"
+#include "image.h"
+#include "journal.h"
+#include "minivsfs.h"
+#include "writer.h"
+
+#define VOLUME_MAX_DIRS 64
+
+typedef struct {
+    image_t img;
+    bitmap_t ibm, dbm;
+    inode_t *root;          // root directory inode, in the mapping
+    inode_t *parent;        // directory of the add in progress, in the mapping
+    dcache_t dc;            // (directory, name) -> inode of the lookups and adds so far
+    uint32_t dirs[VOLUME_MAX_DIRS]; // directories other than the root changed since the last commit
+    int ndirs;
+    uint64_t dirs_made;     // directories created so far
+    journal_t jnl;
+    journal_t *journal;     // &jnl, or NULL for an image without a journal
+    writer_t writer;        // file data of big files (WRITER_PIPELINED unless changed)
+    uint64_t txn_base;      // blocks every transaction may log (see volume_add)
+    uint64_t pending;       // blocks the open transaction may log
+    int holes;              // store all-zero blocks as holes (default on)
+    int inline_data;        // keep files of at most INLINE_MAX bytes in their inode (default on)
+    uint64_t inline_files;  // files added inline so far
+    uint64_t hole_blocks;   // holes in the files added so far
+    int compress;           // add files compressed (compress.h, default off)
+    compress_stats_t zstats; // of the files added compressed so far
+    int dedup;              // share blocks already in the image (dedup.h, default off)
+    dedup_t dd;             // the image's dedup index, loaded by the first dedup add
+    uint64_t group;         // block groups: where the last add went, the next one looks first
+    uint64_t group_spills;  // files whose data did not fit in their inode's group
+    int indexed;            // the root index was checked for (first add)
+    int dirty;              // changed since the last commit
+    int failed;             // a commit failed: no more adds
+} volume_t;
+
+// Open the image at path for adding files. An image with a journal is mapped
+// IMAGE_PRIVATE and its committed transactions are replayed (cache_blocks
+// sizes the journal's block cache, 0 = default); one without is mapped
+// IMAGE_WRITE. The first add gives the root directory a hashed index if it
+// has none.
+// Returns the number of transactions replayed, or -1 (message printed).
+int volume_open(volume_t *v, const char *path, size_t cache_blocks);
+
+// volume_add() size of a file whose length is only known at EOF (pipe, FIFO,
+// stdin): blocks are allocated as the data arrives, the inode is finished at EOF
+#define VOLUME_STREAM UINT64_MAX
+
+// Add size bytes read from fp (or all of it, size VOLUME_STREAM) as `path`
+// (dcache.h); the directories of path that do not exist yet are created, and
+// one that is a file fails the add. With use_extents the file is mapped by
+// extents when the free space allows it. With v->inline_data a file of at most
+// INLINE_MAX bytes is kept in its inode. With v->holes its all-zero blocks take no data blocks;
+// with v->compress it is stored in compressed clusters; otherwise with v->dedup
+// its blocks already stored in the image are shared instead of written again.
+// Returns the new inode number, or -1 (message printed, nothing allocated but
+// the directories created on the way, which stay).
+// The file is durable after the next volume_commit().
+int64_t volume_add(volume_t *v, const char *path, FILE *fp, uint64_t size, int use_extents);
+
+// Create directory path and the missing ones above it (mkdir -p). Its inode
+// number (also when it already existed), or -1 (message printed).
+int64_t volume_mkdir(volume_t *v, const char *path);
+
+// Inode number of path, its dirent type (1 file, 2 directory) in *type
+// (may be NULL), or -1. Through the volume's dentry cache.
+int64_t volume_lookup(volume_t *v, const char *path, uint8_t *type);
+
+// Finalize and make durable everything added since the last commit. 0 or -1.
+int volume_commit(volume_t *v);
+
+// Release the volume (call volume_commit() first). 0 or -1.
+int volume_close(volume_t *v);
+
+#endif
@@ -0,0 +1,169 @@
+// writer.c — chunked, double-buffered file data copy with queued writes
+#define _GNU_SOURCE
+#include "writer.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+static const uint8_t zero_block[BS];
+
+// Where the next byte of the file goes: run index and block within the run
+typedef struct {
+    const extent_t *runs;
+    size_t nruns, run;
+    uint64_t block;
+} cursor_t;
+
+void writer_init(writer_t *w, int fd, writer_mode_t mode) {
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->mode = mode;
+    ioq_init(&w->io, fd, 0);
+}
+
+void writer_free(writer_t *w) {
+    ioq_free(&w->io);
+    free(w->buf[0]);
+    free(w->buf[1]);
+    free(w->iov);
+    w->buf[0] = w->buf[1] = NULL;
+    w->iov = NULL;
+}
+
+// Writes len bytes of buf (a whole chunk, or the last bytes of the file) at the
+// cursor: one request per run, all queued, then one wait
+static int write_chunk(writer_t *w, cursor_t *c, const uint8_t *buf, size_t len) {
+    size_t pos = 0;
+    int rc = 0;
+    for (struct iovec *iov = w->iov; pos < len && rc == 0; iov += 2) {
+        if (c->run >= c->nruns) {
+            rc = -1;
+            break;
+        }
+        const extent_t *r = &c->runs[c->run];
+        uint64_t blocks = r->len - c->block;
+        uint64_t fit = (len - pos + BS - 1) / BS;
+        if (blocks > fit) blocks = fit;
+        size_t bytes = blocks * BS < len - pos ? blocks * BS : len - pos;
+
+        iov[0] = (struct iovec){ (void *)(buf + pos), bytes };
+        iov[1] = (struct iovec){ (void *)zero_block, blocks * BS - bytes };
+        rc = ioq_writev(&w->io, iov, iov[1].iov_len ? 2 : 1, ((uint64_t)r->start + c->block) * BS, 0);
+        w->stats.writes++;
+        pos += bytes;
+        c->block += blocks;
+        if (c->block == r->len) {
+            c->run++;
+            c->block = 0;
+        }
+    }
+    if (ioq_wait(&w->io) != 0) rc = -1;
+    if (rc == 0) w->stats.chunks++;
+    return rc;
+}
+
+// ---- WRITER_PIPELINED: the reader thread fills buf[k] while buf[k^1] is written ----
+typedef struct {
+    writer_t *w;
+    FILE *src;
+    uint64_t size;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    size_t len[2];
+    int full[2];
+    int error;     // the reader failed
+    int stop;      // the writer failed: stop reading
+} pipeline_t;
+
+static void *reader_main(void *arg) {
+    pipeline_t *p = arg;
+    uint64_t left = p->size;
+    for (int k = 0; left > 0; k ^= 1) {
+        pthread_mutex_lock(&p->mu);
+        while (p->full[k] && !p->stop) pthread_cond_wait(&p->cv, &p->mu);
+        int stop = p->stop;
+        pthread_mutex_unlock(&p->mu);
+        if (stop) break;
+
+        size_t want = left < WRITER_CHUNK ? (size_t)left : WRITER_CHUNK;
+        size_t got = fread(p->w->buf[k], 1, want, p->src);
+        pthread_mutex_lock(&p->mu);
+        p->len[k] = got;
+        p->full[k] = 1;
+        if (got != want) p->error = 1;
+        pthread_cond_broadcast(&p->cv);
+        pthread_mutex_unlock(&p->mu);
+        if (got != want) break;
+        left -= want;
+    }
+    return NULL;
+}
+
+static int copy_pipelined(writer_t *w, FILE *src, uint64_t size, cursor_t *c) {
+    pipeline_t p;
+    memset(&p, 0, sizeof(p));
+    p.w = w;
+    p.src = src;
+    p.size = size;
+    pthread_mutex_init(&p.mu, NULL);
+    pthread_cond_init(&p.cv, NULL);
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, reader_main, &p) != 0) {
+        pthread_mutex_destroy(&p.mu);
+        pthread_cond_destroy(&p.cv);
+        return -1;
+    }
+
+    int rc = 0;
+    uint64_t left = size;
+    for (int k = 0; left > 0 && rc == 0; k ^= 1) {
+        pthread_mutex_lock(&p.mu);
+        while (!p.full[k] && !p.error) pthread_cond_wait(&p.cv, &p.mu);
+        // an error is only final once the chunk it belongs to is reached
+        size_t len = p.full[k] ? p.len[k] : 0;
+        pthread_mutex_unlock(&p.mu);
+
+        size_t want = left < WRITER_CHUNK ? (size_t)left : WRITER_CHUNK;
+        if (len != want || write_chunk(w, c, w->buf[k], len) != 0) rc = -1;
+        else left -= want;
+
+        pthread_mutex_lock(&p.mu);
+        p.full[k] = 0;
+        if (rc != 0) p.stop = 1;
+        pthread_cond_broadcast(&p.cv);
+        pthread_mutex_unlock(&p.mu);
+    }
+    pthread_join(reader, NULL);
+    pthread_mutex_destroy(&p.mu);
+    pthread_cond_destroy(&p.cv);
+    return rc;
+}
+
+int writer_copy(writer_t *w, FILE *src, uint64_t size, const extent_t *runs, size_t nruns) {
+    int pipelined = w->mode == WRITER_PIPELINED && size > WRITER_CHUNK;
+    for (int k = 0; k < 1 + pipelined; k++) {
+        if (w->buf[k] == NULL && posix_memalign((void **)&w->buf[k], BS, WRITER_CHUNK) != 0) {
+            w->buf[k] = NULL;
+            return -1;
+        }
+    }
+    if (w->iov == NULL && (w->iov = malloc(2 * (WRITER_CHUNK / BS) * sizeof(struct iovec))) == NULL) return -1;
+    cursor_t c = { runs, nruns, 0, 0 };
+    int rc = 0;
+    if (pipelined) {
+        rc = copy_pipelined(w, src, size, &c);
+    } else {
+        for (uint64_t left = size; left > 0 && rc == 0;) {
+            size_t want = left < WRITER_CHUNK ? (size_t)left : WRITER_CHUNK;
+            if (fread(w->buf[0], 1, want, src) != want || write_chunk(w, &c, w->buf[0], want) != 0) rc = -1;
+            left -= want;
+        }
+    }
+    if (rc == 0) {
+        w->stats.files++;
+        w->stats.bytes += size;
+    }
+    return rc;
+}
@@ -0,0 +1,58 @@
+// writer.h — pipelined copy of file data into image blocks (volume.c)
+//
+// A file can be added through the mapping: one fread() straight into each
+// run of mapped blocks. For a big file that costs a page fault per 4 KiB
+// block and, under the journal, a private copy of every page that is written
+// to the file again at commit. The writer bypasses the mapping instead. The
+// source is read WRITER_CHUNK bytes at a time into one of two reusable
+// page-aligned buffers, and each run of adjacent destination blocks in a chunk
+// is one write request: the data, plus the zero padding of the file's last
+// block as a second iovec. The requests of a chunk go through a queue (ioq.h)
+// and are in flight together. In WRITER_PIPELINED mode a reader thread fills
+// one buffer while the other one is being written.
+//
+// A shared mapping sees the new data at once (it is the page cache). A
+// private one does too, except for pages it already copied: the caller drops
+// those (journal_data_written()).
+#ifndef MINIVSFS_WRITER_H
+#define MINIVSFS_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ioq.h"
+#include "minivsfs.h"
+
+#define WRITER_CHUNK (1u << 20)          // bytes per read, a multiple of BS
+#define WRITER_MIN_BYTES (64u << 10)     // smaller files go through the mapping
+
+typedef enum {
+    WRITER_MAP,        // no writer: fread into the mapping
+    WRITER_SYNC,       // read a chunk, write it, read the next
+    WRITER_PIPELINED,  // the next chunk is read while this one is written
+} writer_mode_t;
+
+typedef struct {
+    uint64_t files, bytes;
+    uint64_t chunks;
+    uint64_t writes;         // requests: one per run of blocks in a chunk
+} writer_stats_t;
+
+typedef struct {
+    int fd;                  // the image file
+    writer_mode_t mode;
+    uint8_t *buf[2];         // WRITER_CHUNK each, allocated on first use
+    struct iovec *iov;       // two per block of a chunk: the requests of one chunk
+    ioq_t io;
+    writer_stats_t stats;
+} writer_t;
+
+void writer_init(writer_t *w, int fd, writer_mode_t mode);
+void writer_free(writer_t *w);
+
+// Copy the next size bytes of src to runs[0..nruns), which hold exactly
+// ceil(size / BS) blocks (absolute block numbers); the last block is padded
+// with zeros. Returns 0, or -1 on a read or write error.
+int writer_copy(writer_t *w, FILE *src, uint64_t size, const extent_t *runs, size_t nruns);
+
+#endif